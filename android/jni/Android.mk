@@ -8,14 +8,19 @@ LOCAL_SRC_FILES := \
 ../../src/ESCalendar.cpp \
 ../../src/ESCalendar_simpleTZ.cpp \
 ../../src/ESCalendar_android.cpp \
+../../src/ESEventLog.cpp \
 ../../src/ESLeapSecond.cpp \
+../../src/ESMetrics.cpp \
+../../src/ESNTPClockDiscipline.cpp \
 ../../src/ESNTPDriver.cpp \
 ../../src/ESNTPDriver_android.cpp \
 ../../src/ESNTPHostNames.cpp \
+../../src/ESNTPLoopbackSimulator.cpp \
 ../../src/ESPoolHostSurvey.cpp \
 ../../src/ESSystemTimeBase_dualBase.cpp \
 ../../src/ESSystemTimeBase_android.cpp \
 ../../src/ESTime.cpp \
+../../src/ESTimeSharedPublisher.cpp \
 ../../src/ESTimeEnvironment.cpp \
 ../../src/ESTimer.cpp \
 ../../src/ESTimeSourceDriver.cpp \
@@ -10,11 +10,87 @@
 #include "ESCalendar.hpp"
 #include "ESCalendarPvt.hpp"
 #include "ESUtil.hpp"
+#include "ESMetrics.hpp"
+
+#include <vector>
 
 #include <math.h>
 #include <assert.h>
 
-// Return calendar components from an ESTimeInterval (UTC)
+// *****************************************************************************************
+// Integer civil-date kernel.  Days are counted from the ESTime epoch (2001-01-01); years are signed (1 BCE == 0).
+// Both calendars use March-based years so the leap day falls at the end (after H. Hinnant, "chrono-Compatible
+// Low-Level Date Algorithms").
+// *****************************************************************************************
+
+#define ES_JDN_OF_ESTIME_EPOCH     2451911L  /* Julian Day Number of 2001-01-01 */
+#define ES_JDN_OF_GREGORIAN_MARCH0 1721120L  /* JDN of 0000-03-01 in the proleptic Gregorian calendar */
+#define ES_JDN_OF_JULIAN_MARCH0    1721118L  /* JDN of 0000-03-01 in the Julian calendar */
+#define ES_SWITCHOVER_DAY (-152750L)         /* kECJulianGregorianSwitchoverTimeInterval / 86400:  1582-10-15 */
+
+static inline long
+floorDiv(long a,
+         long b) {
+    return (a >= 0 ? a : a - (b - 1)) / b;
+}
+
+static long
+dayNumberFromGregorian(int signedYear,
+                       int month,
+                       int day) {
+    long y = signedYear - (month <= 2);
+    long era = floorDiv(y, 400);
+    long yearOfEra = y - era * 400;                                     // [0, 399]
+    long dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;  // [0, 365], from March 1
+    long dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra + ES_JDN_OF_GREGORIAN_MARCH0 - ES_JDN_OF_ESTIME_EPOCH;
+}
+
+static long
+dayNumberFromJulian(int signedYear,
+                    int month,
+                    int day) {
+    long y = signedYear - (month <= 2);
+    long era = floorDiv(y, 4);
+    long yearOfEra = y - era * 4;                                       // [0, 3]; the leap day ends yearOfEra 3
+    long dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    return era * 1461 + yearOfEra * 365 + dayOfYear + ES_JDN_OF_JULIAN_MARCH0 - ES_JDN_OF_ESTIME_EPOCH;
+}
+
+static void
+gregorianFromDayNumber(long dayNumber,
+                       int  *signedYear,
+                       int  *month,
+                       int  *day) {
+    long z = dayNumber + ES_JDN_OF_ESTIME_EPOCH - ES_JDN_OF_GREGORIAN_MARCH0;
+    long era = floorDiv(z, 146097);
+    long dayOfEra = z - era * 146097;                                   // [0, 146096]
+    long yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    long dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    long mp = (5 * dayOfYear + 2) / 153;
+    *day = (int)(dayOfYear - (153 * mp + 2) / 5 + 1);
+    *month = (int)(mp < 10 ? mp + 3 : mp - 9);
+    *signedYear = (int)(yearOfEra + era * 400 + (*month <= 2));
+}
+
+static void
+julianFromDayNumber(long dayNumber,
+                    int  *signedYear,
+                    int  *month,
+                    int  *day) {
+    long z = dayNumber + ES_JDN_OF_ESTIME_EPOCH - ES_JDN_OF_JULIAN_MARCH0;
+    long era = floorDiv(z, 1461);
+    long dayOfEra = z - era * 1461;                                     // [0, 1460]
+    long yearOfEra = (dayOfEra - dayOfEra / 1460) / 365;
+    long dayOfYear = dayOfEra - 365 * yearOfEra;
+    long mp = (5 * dayOfYear + 2) / 153;
+    *day = (int)(dayOfYear - (153 * mp + 2) / 5 + 1);
+    *month = (int)(mp < 10 ? mp + 3 : mp - 9);
+    *signedYear = (int)(yearOfEra + era * 4 + (*month <= 2));
+}
+
+// Return calendar components from an ESTimeInterval (UTC).  The day number and the seconds within the day are split
+// exactly, so there's no rounding at day boundaries and the fraction of a second is carried through unchanged.
 void
 ESCalendar_UTCComponentsFromTimeInterval(ESTimeInterval timeInterval,
                                          int            *era,
@@ -24,33 +100,20 @@ ESCalendar_UTCComponentsFromTimeInterval(ESTimeInterval timeInterval,
 					 int            *hour,
 					 int            *minute,
 					 double         *seconds) {
-    double xRemainder;
-    int signedYear;
-    double x0;
-    if (timeInterval < kECJulianGregorianSwitchoverTimeInterval) {
-        double x1F = 730793 + timeInterval/(24 * 3600);
-        double x1 = floor(x1F);  // Algorithm only works on even day boundaries?  At least that's true of Gregorian
-        xRemainder = x1F - x1;
-        signedYear = floor((4 * x1 + 3) / kECDaysInJulianCycle);
-        x0 = x1 - floor(kECDaysInJulianCycle * signedYear / 4.0);
-    } else {
-        double x2F = 730791 + timeInterval/(24 * 3600);
-
-        double x2 = floor(x2F);  // Algorithm only works on even day boundaries; else has trouble at end of year, e.g., 12/31/1997 23:59:59 and back several hours
-        xRemainder = x2F - x2;
-
-        int century = floor(4 * x2 + 3) / kECDaysInGregorianCycle;
-        double x1 = x2 - floor(kECDaysInGregorianCycle * century / 4.0);
-        int yearWithinCentury = floor((100 * x1 + 99) / kECDaysInNonLeapCentury);
-        signedYear = (100 * century) + yearWithinCentury;
-        x0 = x1 - floor(kECDaysInNonLeapCentury * yearWithinCentury / 100.0);
+    long dayNumber = (long)floor(timeInterval / 86400);
+    double secondsInDay = timeInterval - dayNumber * 86400.0;
+    if (secondsInDay >= 86400) {  // timeInterval / 86400 rounded up to an integer
+        dayNumber++;
+        secondsInDay -= 86400;
+    } else if (secondsInDay < 0) {
+        dayNumber--;
+        secondsInDay += 86400;
     }
-    int monthI = floor((5 * x0 + 461) / 153);
-    if (monthI > 12) {
-        *month = monthI - 12;
-        signedYear++;
+    int signedYear;
+    if (dayNumber < ES_SWITCHOVER_DAY) {
+        julianFromDayNumber(dayNumber, &signedYear, month, day);
     } else {
-        *month = monthI;
+        gregorianFromDayNumber(dayNumber, &signedYear, month, day);
     }
     if (signedYear <= 0) {
         *era = 0;
@@ -59,15 +122,10 @@ ESCalendar_UTCComponentsFromTimeInterval(ESTimeInterval timeInterval,
         *era = 1;
         *year = signedYear;
     }
-    double dayF = x0 - floor((153 * monthI - 457) / 5.0) + 1;
-    *day = round(dayF);
-    double hoursF = xRemainder * 24;
-    int hoursI = floor(hoursF);
-    *hour = hoursI;
-    double minutesF = (hoursF - hoursI) * 60;
-    int minutesI = floor(minutesF);
-    *minute = minutesI;
-    *seconds = (minutesF - minutesI) * 60;
+    int wholeSeconds = (int)secondsInDay;
+    *hour = wholeSeconds / 3600;
+    *minute = (wholeSeconds / 60) % 60;
+    *seconds = secondsInDay - (*hour * 3600 + *minute * 60);
 }
 
 void
@@ -76,6 +134,15 @@ ESCalendar_UTCDateComponentsFromTimeInterval(ESTimeInterval   timeInterval,
     ESCalendar_UTCComponentsFromTimeInterval(timeInterval, &cs->era, &cs->year, &cs->month, &cs->day, &cs->hour, &cs->minute, &cs->seconds);
 }
 
+void
+ESCalendar_UTCDateComponentsFromTimeIntervals(const ESTimeInterval *timeIntervals,
+                                              ESDateComponents     *cs,
+                                              size_t               count) {
+    for (size_t i = 0; i < count; i++) {
+        ESCalendar_UTCComponentsFromTimeInterval(timeIntervals[i], &cs[i].era, &cs[i].year, &cs[i].month, &cs[i].day, &cs[i].hour, &cs[i].minute, &cs[i].seconds);
+    }
+}
+
 // Return an ESTimeInterval from calendar components (UTC)
 ESTimeInterval
 ESCalendar_timeIntervalFromUTCComponents(int    era,
@@ -86,30 +153,17 @@ ESCalendar_timeIntervalFromUTCComponents(int    era,
 					 int    minute,
 					 double seconds) {
     int signedYear = era == 0 ? 1 - year : year;
-    int monthI;
-    if (month < 3) {
-        monthI = month + 12;
-        signedYear--;
-    } else {
-        monthI = month;
-    }
-    double J;
+    long dayNumber;
     if (era == 0 ||
         year < 1582 ||
         (year == 1582 &&
          (month < 10 ||
           (month == 10 && day < 15)))) {  // Could be < 5 instead; 5-14 inclusive are really undefined in this convention
-        J = 1721116.5 + floor(1461 * signedYear / 4.0);
+        dayNumber = dayNumberFromJulian(signedYear, month, day);
     } else {
-        // Gregorian
-        double c = floor(signedYear/100.0);
-        double x = signedYear - 100 * c;
-        J = 1721118.5 + floor(146097 * c / 4.0) + floor(36525 * x / 100);
+        dayNumber = dayNumberFromGregorian(signedYear, month, day);
     }
-    J += floor((153 * monthI - 457) / 5.0) + day;
-    ESTimeInterval returnTimeInterval = (J - kECJulianDayOf1990Epoch)*24*3600 + kEC1990Epoch + hour * 3600 + minute * 60 + seconds;
-    //printf("timeIntervalFromUTC %d-%04d-%02d-%02d-%02d:%02d returning %.2f\n", era, year, month, day, hour, minute, returnTimeInterval);
-    return returnTimeInterval;
+    return dayNumber * 86400.0 + (hour * 3600 + minute * 60) + seconds;
 }
 
 // Return an ESTimeInterval from calendar components (UTC)
@@ -603,6 +657,417 @@ ESCalendar_nextDSTChangeAfterTimeIntervalTheSlowWay(ESTimeZone     *estz,
     return 0;
 }
 
+// *****************************************************************************************
+// ESTimeZoneTransitionIndex
+// *****************************************************************************************
+
+#define ES_TZ_INDEX_WINDOW_SECONDS (ES_TZ_INDEX_WINDOW_DAYS * 86400.0)
+#define ES_TZ_INDEX_HIT_BATCH       256  /* Each thread adds its hits to tz.index.hits this many at a time */
+
+static ESMetricCounter tzIndexHits("tz.index.hits");                    // Answered from an already-built window (up to ES_TZ_INDEX_HIT_BATCH - 1 per thread not yet counted)
+static ESMetricCounter tzIndexWindowsBuilt("tz.index.windows_built");   // Misses:  a window had to be probed
+static ESMetricCounter tzIndexProbes("tz.index.probes");                // Backend calls made building windows
+static ESMetricCounter tzIndexBypasses("tz.index.bypasses");            // Outside the range covered; sent to the backend
+
+struct ESTimeZoneTransition {
+    ESTimeInterval          at;      // The first second of the new state
+    ESTimeInterval          offset;
+    bool                    isDST;
+};
+
+// The state at the start of window k, and the transitions in (start, start + ES_TZ_INDEX_WINDOW_SECONDS]:  one exactly
+// at a window's start belongs to the window before, so that nextChangeAfter() finds it there.
+struct ESTimeZoneTransitionWindow {
+    ESTimeInterval          startOffset;
+    bool                    startIsDST;
+    std::vector<ESTimeZoneTransition> transitions;
+};
+
+ESTimeZoneTransitionIndex::ESTimeZoneTransitionIndex(ESTimeZoneProbeFunction          probe,
+                                                     void                             *zone,
+                                                     ESTimeZoneNextTransitionFunction nextTransition)
+:   _probe(probe),
+    _nextTransition(nextTransition),
+    _zone(zone)
+{
+    for (int i = 0; i < ES_TZ_INDEX_NUM_WINDOWS; i++) {
+        _windows[i] = NULL;
+    }
+}
+
+ESTimeZoneTransitionIndex::~ESTimeZoneTransitionIndex() {
+    for (int i = 0; i < ES_TZ_INDEX_NUM_WINDOWS; i++) {
+        delete _windows[i];
+    }
+}
+
+// Follow the backend's own list of transitions across the window, keeping those that change the offset or DST.  Returns
+// false, leaving the window as it found it, if the result doesn't agree with a probe at the window's end (a backend
+// whose list skips some kinds of change, say), so the caller can probe instead.
+bool
+ESTimeZoneTransitionIndex::walkBackendTransitions(ESTimeZoneTransitionWindow *window,
+                                                  ESTimeInterval             start,
+                                                  int                        *numProbes) {
+    ESTimeInterval end = start + ES_TZ_INDEX_WINDOW_SECONDS;
+    ESTimeInterval lastOffset = window->startOffset;
+    bool lastIsDST = window->startIsDST;
+    ESTimeInterval t = start;
+    while (true) {
+        ESTimeInterval next = (*_nextTransition)(_zone, t);
+        (*numProbes)++;
+        if (next <= t || next > end) {  // None (0), or it's in a later window
+            break;
+        }
+        ESTimeInterval offset;
+        bool isDST;
+        (*_probe)(_zone, next, &offset, &isDST);
+        (*numProbes)++;
+        if (offset != lastOffset || isDST != lastIsDST) {
+            ESTimeZoneTransition transition;
+            transition.at = next;
+            transition.offset = offset;
+            transition.isDST = isDST;
+            window->transitions.push_back(transition);
+            lastOffset = offset;
+            lastIsDST = isDST;
+        }
+        t = next;
+    }
+    ESTimeInterval endOffset;
+    bool endIsDST;
+    (*_probe)(_zone, end, &endOffset, &endIsDST);
+    (*numProbes)++;
+    if (endOffset != lastOffset || endIsDST != lastIsDST) {
+        window->transitions.clear();
+        return false;
+    }
+    return true;
+}
+
+// Probe the backend once a day across the window and bisect each change to the second.  Two changes within the same
+// day that cancel out are missed.
+void
+ESTimeZoneTransitionIndex::probeForTransitions(ESTimeZoneTransitionWindow *window,
+                                               ESTimeInterval             start,
+                                               int                        *numProbes) {
+    ESTimeInterval lastOffset = window->startOffset;
+    bool lastIsDST = window->startIsDST;
+    ESTimeInterval lastTime = start;
+    for (int day = 1; day <= ES_TZ_INDEX_WINDOW_DAYS; day++) {
+        ESTimeInterval probeTime = start + day * 86400.0;
+        ESTimeInterval offset;
+        bool isDST;
+        (*_probe)(_zone, probeTime, &offset, &isDST);
+        (*numProbes)++;
+        if (offset == lastOffset && isDST == lastIsDST) {
+            lastTime = probeTime;
+            continue;
+        }
+        // Bisect to the second:  lo is known to be in the old state, hi in the new
+        ESTimeInterval lo = lastTime;
+        ESTimeInterval hi = probeTime;
+        ESTimeInterval hiOffset = offset;
+        bool hiIsDST = isDST;
+        while (hi - lo > 1) {
+            ESTimeInterval mid = floor((lo + hi) / 2);
+            ESTimeInterval midOffset;
+            bool midIsDST;
+            (*_probe)(_zone, mid, &midOffset, &midIsDST);
+            (*numProbes)++;
+            if (midOffset == lastOffset && midIsDST == lastIsDST) {
+                lo = mid;
+            } else {
+                hi = mid;
+                hiOffset = midOffset;
+                hiIsDST = midIsDST;
+            }
+        }
+        ESTimeZoneTransition transition;
+        transition.at = hi;
+        transition.offset = hiOffset;
+        transition.isDST = hiIsDST;
+        window->transitions.push_back(transition);
+        lastOffset = hiOffset;
+        lastIsDST = hiIsDST;
+        lastTime = hi;
+        if (hiOffset != offset || hiIsDST != isDST) {
+            day--;  // Another change before probeTime; look again from the one we just found
+        } else {
+            lastTime = probeTime;
+        }
+    }
+}
+
+ESTimeZoneTransitionWindow *
+ESTimeZoneTransitionIndex::buildWindow(int windowIndex) {
+    ESTimeZoneTransitionWindow *window = new ESTimeZoneTransitionWindow;
+    ESTimeInterval start = (windowIndex + ES_TZ_INDEX_FIRST_WINDOW) * ES_TZ_INDEX_WINDOW_SECONDS;
+    (*_probe)(_zone, start, &window->startOffset, &window->startIsDST);
+    int numProbes = 1;
+    if (!_nextTransition || !walkBackendTransitions(window, start, &numProbes)) {
+        probeForTransitions(window, start, &numProbes);
+    }
+    tzIndexProbes.add(numProbes);
+    return window;
+}
+
+const ESTimeZoneTransitionWindow *
+ESTimeZoneTransitionIndex::windowAtIndex(int windowIndex) {
+    if (windowIndex < 0 || windowIndex >= ES_TZ_INDEX_NUM_WINDOWS) {
+        return NULL;
+    }
+    ESTimeZoneTransitionWindow *window = __atomic_load_n(&_windows[windowIndex], __ATOMIC_ACQUIRE);
+    if (window) {
+        // Hits are every offset query, from every thread, so a shared atomic add here would cost more than the lookup
+        static __thread unsigned int unflushedHits = 0;
+        if (++unflushedHits == ES_TZ_INDEX_HIT_BATCH) {
+            tzIndexHits.add(ES_TZ_INDEX_HIT_BATCH);
+            unflushedHits = 0;
+        }
+        return window;
+    }
+    window = buildWindow(windowIndex);
+    tzIndexWindowsBuilt.add();
+    ESTimeZoneTransitionWindow *expected = NULL;
+    if (!__atomic_compare_exchange_n(&_windows[windowIndex], &expected, window, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        delete window;  // Another thread built the same one first
+        return expected;
+    }
+    return window;
+}
+
+void
+ESTimeZoneTransitionIndex::lookup(ESTimeInterval utc,
+                                  ESTimeInterval *offset,
+                                  bool           *isDST) {
+    double windowNumber = floor(utc / ES_TZ_INDEX_WINDOW_SECONDS) - ES_TZ_INDEX_FIRST_WINDOW;
+    const ESTimeZoneTransitionWindow *window =
+        (windowNumber >= 0 && windowNumber < ES_TZ_INDEX_NUM_WINDOWS) ? windowAtIndex((int)windowNumber) : NULL;
+    if (!window) {
+        tzIndexBypasses.add();
+        (*_probe)(_zone, utc, offset, isDST);
+        return;
+    }
+    *offset = window->startOffset;
+    *isDST = window->startIsDST;
+    size_t numTransitions = window->transitions.size();
+    for (size_t i = 0; i < numTransitions && window->transitions[i].at <= utc; i++) {
+        *offset = window->transitions[i].offset;
+        *isDST = window->transitions[i].isDST;
+    }
+}
+
+ESTimeInterval
+ESTimeZoneTransitionIndex::offsetForTime(ESTimeInterval utc) {
+    ESTimeInterval offset;
+    bool isDST;
+    lookup(utc, &offset, &isDST);
+    return offset;
+}
+
+bool
+ESTimeZoneTransitionIndex::isDSTAtTime(ESTimeInterval utc) {
+    ESTimeInterval offset;
+    bool isDST;
+    lookup(utc, &offset, &isDST);
+    return isDST;
+}
+
+ESTimeInterval
+ESTimeZoneTransitionIndex::nextTransitionAfter(ESTimeInterval utc,
+                                               bool           dstOnly) {
+    double windowNumber = floor(utc / ES_TZ_INDEX_WINDOW_SECONDS) - ES_TZ_INDEX_FIRST_WINDOW;
+    if (!(windowNumber >= 0 && windowNumber < ES_TZ_INDEX_NUM_WINDOWS)) {
+        tzIndexBypasses.add();
+        return 0;  // We could probe the backend the slow way here, but nobody asks about DST in 1850 or 2250
+    }
+    for (int w = (int)windowNumber; w <= (int)windowNumber + ES_TZ_INDEX_LOOKAHEAD_WINDOWS; w++) {
+        const ESTimeZoneTransitionWindow *window = windowAtIndex(w);
+        if (!window) {
+            break;
+        }
+        bool wasDST = window->startIsDST;
+        size_t numTransitions = window->transitions.size();
+        for (size_t i = 0; i < numTransitions; i++) {
+            const ESTimeZoneTransition &transition = window->transitions[i];
+            if (transition.at > utc && (!dstOnly || transition.isDST != wasDST)) {
+                return transition.at;
+            }
+            wasDST = transition.isDST;
+        }
+    }
+    return 0;
+}
+
+ESTimeInterval
+ESTimeZoneTransitionIndex::nextChangeAfter(ESTimeInterval utc) {
+    return nextTransitionAfter(utc, false/*dstOnly*/);
+}
+
+ESTimeInterval
+ESTimeZoneTransitionIndex::nextDSTChangeAfter(ESTimeInterval utc) {
+    return nextTransitionAfter(utc, true/*dstOnly*/);
+}
+
+#ifdef ESCALENDAR_KERNEL_TEST  // Defined (or not) in ESCalendarPvt.hpp
+// The floating-point conversions the integer kernel replaced, kept to check it against
+
+static void
+legacyUTCComponentsFromTimeInterval(ESTimeInterval timeInterval,
+                                    int            *era,
+                                    int            *year,
+                                    int            *month,
+                                    int            *day,
+                                    int            *hour,
+                                    int            *minute,
+                                    double         *seconds) {
+    double xRemainder;
+    int signedYear;
+    double x0;
+    if (timeInterval < kECJulianGregorianSwitchoverTimeInterval) {
+        double x1F = 730793 + timeInterval/(24 * 3600);
+        double x1 = floor(x1F);  // Algorithm only works on even day boundaries?  At least that's true of Gregorian
+        xRemainder = x1F - x1;
+        signedYear = floor((4 * x1 + 3) / kECDaysInJulianCycle);
+        x0 = x1 - floor(kECDaysInJulianCycle * signedYear / 4.0);
+    } else {
+        double x2F = 730791 + timeInterval/(24 * 3600);
+
+        double x2 = floor(x2F);  // Algorithm only works on even day boundaries; else has trouble at end of year, e.g., 12/31/1997 23:59:59 and back several hours
+        xRemainder = x2F - x2;
+
+        int century = floor(4 * x2 + 3) / kECDaysInGregorianCycle;
+        double x1 = x2 - floor(kECDaysInGregorianCycle * century / 4.0);
+        int yearWithinCentury = floor((100 * x1 + 99) / kECDaysInNonLeapCentury);
+        signedYear = (100 * century) + yearWithinCentury;
+        x0 = x1 - floor(kECDaysInNonLeapCentury * yearWithinCentury / 100.0);
+    }
+    int monthI = floor((5 * x0 + 461) / 153);
+    if (monthI > 12) {
+        *month = monthI - 12;
+        signedYear++;
+    } else {
+        *month = monthI;
+    }
+    if (signedYear <= 0) {
+        *era = 0;
+        *year = 1 - signedYear;
+    } else {
+        *era = 1;
+        *year = signedYear;
+    }
+    double dayF = x0 - floor((153 * monthI - 457) / 5.0) + 1;
+    *day = round(dayF);
+    double hoursF = xRemainder * 24;
+    int hoursI = floor(hoursF);
+    *hour = hoursI;
+    double minutesF = (hoursF - hoursI) * 60;
+    int minutesI = floor(minutesF);
+    *minute = minutesI;
+    *seconds = (minutesF - minutesI) * 60;
+}
+
+static ESTimeInterval
+legacyTimeIntervalFromUTCComponents(int    era,
+                                    int    year,
+                                    int    month,
+                                    int    day,
+                                    int    hour,
+                                    int    minute,
+                                    double seconds) {
+    int signedYear = era == 0 ? 1 - year : year;
+    int monthI;
+    if (month < 3) {
+        monthI = month + 12;
+        signedYear--;
+    } else {
+        monthI = month;
+    }
+    double J;
+    if (era == 0 ||
+        year < 1582 ||
+        (year == 1582 &&
+         (month < 10 ||
+          (month == 10 && day < 15)))) {  // Could be < 5 instead; 5-14 inclusive are really undefined in this convention
+        J = 1721116.5 + floor(1461 * signedYear / 4.0);
+    } else {
+        // Gregorian
+        double c = floor(signedYear/100.0);
+        double x = signedYear - 100 * c;
+        J = 1721118.5 + floor(146097 * c / 4.0) + floor(36525 * x / 100);
+    }
+    J += floor((153 * monthI - 457) / 5.0) + day;
+    ESTimeInterval returnTimeInterval = (J - kECJulianDayOf1990Epoch)*24*3600 + kEC1990Epoch + hour * 3600 + minute * 60 + seconds;
+    return returnTimeInterval;
+}
+
+// Every day from ESMinimumSupportedAstroDate to ESMaximumSupportedAstroDate, at a time away from midnight (where the
+// old code is known to go wrong) against the old code, and at and just before midnight for the kernel's own round trip
+void
+ESTestCalendarKernel() {
+    long firstDay = (long)floor(ESMinimumSupportedAstroDate / 86400);
+    long lastDay = (long)floor(ESMaximumSupportedAstroDate / 86400);
+    long numMismatches = 0;
+    long numRoundTripFailures = 0;
+    long numLegacyBoundaryDisagreements = 0;
+    ESDateComponents cs;
+    ESDateComponents legacy;
+    for (long d = firstDay; d <= lastDay; d++) {
+        ESTimeInterval t = d * 86400.0 + 45296.25;  // 12:34:56.25
+        ESCalendar_UTCDateComponentsFromTimeInterval(t, &cs);
+        legacyUTCComponentsFromTimeInterval(t, &legacy.era, &legacy.year, &legacy.month, &legacy.day, &legacy.hour, &legacy.minute, &legacy.seconds);
+        if (cs.era != legacy.era || cs.year != legacy.year || cs.month != legacy.month || cs.day != legacy.day ||
+            cs.hour != legacy.hour || cs.minute != legacy.minute || fabs(cs.seconds - legacy.seconds) > 1e-3 ||
+            fabs(ESCalendar_timeIntervalFromUTCDateComponents(&cs) -
+                 legacyTimeIntervalFromUTCComponents(cs.era, cs.year, cs.month, cs.day, cs.hour, cs.minute, cs.seconds)) > 1e-3) {
+            if (numMismatches++ < 10) {
+                printf("KERNEL MISMATCH at %.2f: %d-%04d-%02d-%02d %02d:%02d:%06.3f vs %d-%04d-%02d-%02d %02d:%02d:%06.3f\n", t,
+                       cs.era, cs.year, cs.month, cs.day, cs.hour, cs.minute, cs.seconds,
+                       legacy.era, legacy.year, legacy.month, legacy.day, legacy.hour, legacy.minute, legacy.seconds);
+            }
+        }
+        ESTimeInterval boundaries[2] = { d * 86400.0, d * 86400.0 - 0.001 };
+        for (int i = 0; i < 2; i++) {
+            ESCalendar_UTCDateComponentsFromTimeInterval(boundaries[i], &cs);
+            if (fabs(ESCalendar_timeIntervalFromUTCDateComponents(&cs) - boundaries[i]) > 1e-5 || cs.hour > 23 || cs.minute > 59 || cs.seconds >= 60) {
+                numRoundTripFailures++;
+            }
+            legacyUTCComponentsFromTimeInterval(boundaries[i], &legacy.era, &legacy.year, &legacy.month, &legacy.day, &legacy.hour, &legacy.minute, &legacy.seconds);
+            if (cs.day != legacy.day || cs.hour != legacy.hour || cs.minute != legacy.minute) {
+                numLegacyBoundaryDisagreements++;
+            }
+        }
+    }
+    printf("KERNEL TEST: %ld days, %ld mismatches with the old code, %ld round-trip failures, %ld disagreements at midnight (old code's)\n",
+           lastDay - firstDay + 1, numMismatches, numRoundTripFailures, numLegacyBoundaryDisagreements);
+    ESAssert(numMismatches == 0 && numRoundTripFailures == 0);
+
+    // Throughput, components from times
+    const size_t numTimes = 1 << 20;
+    std::vector<ESTimeInterval> times(numTimes);
+    std::vector<ESDateComponents> components(numTimes);
+    for (size_t i = 0; i < numTimes; i++) {
+        times[i] = ESMinimumSupportedAstroDate + (ESMaximumSupportedAstroDate - ESMinimumSupportedAstroDate) * i / numTimes;
+    }
+    int sum = 0;
+    ESTimeInterval t0 = ESTime::currentContinuousTime();
+    for (size_t i = 0; i < numTimes; i++) {
+        legacyUTCComponentsFromTimeInterval(times[i], &legacy.era, &legacy.year, &legacy.month, &legacy.day, &legacy.hour, &legacy.minute, &legacy.seconds);
+        sum += legacy.day;
+    }
+    ESTimeInterval t1 = ESTime::currentContinuousTime();
+    for (size_t i = 0; i < numTimes; i++) {
+        ESCalendar_UTCDateComponentsFromTimeInterval(times[i], &cs);
+        sum += cs.day;
+    }
+    ESTimeInterval t2 = ESTime::currentContinuousTime();
+    ESCalendar_UTCDateComponentsFromTimeIntervals(&times[0], &components[0], numTimes);
+    ESTimeInterval t3 = ESTime::currentContinuousTime();
+    printf("KERNEL BENCHMARK: old %.1f ns, new %.1f ns, bulk %.1f ns per conversion (%d)\n",
+           (t1 - t0) * 1e9 / numTimes, (t2 - t1) * 1e9 / numTimes, (t3 - t2) * 1e9 / numTimes, sum + components[numTimes - 1].day);
+}
+#endif  // ESCALENDAR_KERNEL_TEST
+
 #if 0
 static void testHybridConversion() {
     ESTimeInterval timeInterval = ESCalendar_timeIntervalFromUTCComponents(0, 3999, 1, 1, 12, 0, 0);
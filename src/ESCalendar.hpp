@@ -104,6 +104,12 @@ extern void
 ESCalendar_UTCDateComponentsFromTimeInterval(ESTimeInterval   timeInterval,
 					     ESDateComponents *dateComponents);
 
+// The same for each of count times
+extern void
+ESCalendar_UTCDateComponentsFromTimeIntervals(const ESTimeInterval *timeIntervals,
+                                              ESDateComponents     *dateComponents,
+                                              size_t               count);
+
 // Return an ESTimeInterval from calendar components (UTC)
 extern ESTimeInterval
 ESCalendar_timeIntervalFromUTCDateComponents(ESDateComponents *dateComponents);
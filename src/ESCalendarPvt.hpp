@@ -17,6 +17,62 @@
 
 #define kECJulianGregorianSwitchoverTimeInterval (-13197600000.0)
 
+#define ES_TZ_INDEX_WINDOW_DAYS       366  /* Transitions are discovered this many days at a time */
+#define ES_TZ_INDEX_FIRST_WINDOW     -120  /* The windows (counted from the ESTime epoch) the index covers:  1881 ... */
+#define ES_TZ_INDEX_NUM_WINDOWS       320  /* ... through 2200; times outside go straight to the backend */
+#define ES_TZ_INDEX_LOOKAHEAD_WINDOWS   2  /* How many windows past the current one nextChangeAfter() looks */
+
+// Returns the backend's answer for one instant; zone is the backend's own pointer
+typedef void (*ESTimeZoneProbeFunction)(void           *zone,
+                                        ESTimeInterval utc,
+                                        ESTimeInterval *offset,
+                                        bool           *isDST);
+
+// Returns the first transition the backend's own data has after utc (of offset, DST or anything else it records, like
+// an abbreviation), or 0 if it knows of none
+typedef ESTimeInterval (*ESTimeZoneNextTransitionFunction)(void           *zone,
+                                                           ESTimeInterval utc);
+
+struct ESTimeZoneTransitionWindow;
+
+/*! A per-zone cache of transitions that works the same for every backend:  the first query in a window of
+ *  ES_TZ_INDEX_WINDOW_DAYS walks the backend's transitions across it (or, for a backend that can't list them, probes
+ *  it once a day and bisects each change to the second), and publishes the result, which is never modified
+ *  afterwards.  Every later offset, DST or next-change query in that window is answered from it without calling the
+ *  backend.  Lock-free; safe to use from any thread if the backend functions are. */
+class ESTimeZoneTransitionIndex {
+  public:
+                            ESTimeZoneTransitionIndex(ESTimeZoneProbeFunction          probe,
+                                                      void                             *zone,
+                                                      ESTimeZoneNextTransitionFunction nextTransition = NULL);  // NULL to find transitions by probing
+                            ~ESTimeZoneTransitionIndex();
+
+    ESTimeInterval          offsetForTime(ESTimeInterval utc);
+    bool                    isDSTAtTime(ESTimeInterval utc);
+    ESTimeInterval          nextChangeAfter(ESTimeInterval utc);  // Of offset or DST; 0 if none within ES_TZ_INDEX_LOOKAHEAD_WINDOWS
+    ESTimeInterval          nextDSTChangeAfter(ESTimeInterval utc);  // Into or out of DST only; 0 if none within ES_TZ_INDEX_LOOKAHEAD_WINDOWS
+
+  private:
+    void                    lookup(ESTimeInterval utc,
+                                   ESTimeInterval *offset,
+                                   bool           *isDST);
+    ESTimeInterval          nextTransitionAfter(ESTimeInterval utc,
+                                                bool           dstOnly);
+    const ESTimeZoneTransitionWindow *windowAtIndex(int windowIndex);  // NULL if outside the range covered
+    ESTimeZoneTransitionWindow *buildWindow(int windowIndex);
+    bool                    walkBackendTransitions(ESTimeZoneTransitionWindow *window,
+                                                   ESTimeInterval             start,
+                                                   int                        *numProbes);
+    void                    probeForTransitions(ESTimeZoneTransitionWindow *window,
+                                                ESTimeInterval             start,
+                                                int                        *numProbes);
+
+    ESTimeZoneProbeFunction _probe;
+    ESTimeZoneNextTransitionFunction _nextTransition;
+    void                    *_zone;
+    ESTimeZoneTransitionWindow *_windows[ES_TZ_INDEX_NUM_WINDOWS];  // Published with compare-and-swap
+};
+
 extern void
 ESCalendar_gregorianToHybrid(int *era,
 			     int *year,
@@ -69,4 +125,11 @@ ESCalendar_timeIntervalFromUTCComponents(int    era,
 					 int    minute,
 					 double seconds);
 
+// Define this to check the integer civil-date kernel in ESCalendar.cpp against the floating-point code it replaced,
+// for every day in the supported range, and time both, at ESCalendar_init()
+#undef ESCALENDAR_KERNEL_TEST
+#ifdef ESCALENDAR_KERNEL_TEST
+extern void ESTestCalendarKernel();
+#endif
+
 #endif  // _ESCALENDARPVT_HPP_
@@ -34,9 +34,13 @@ struct ESTimeZone {
     NSTimeZone *nsTimeZone;
     NSCalendar *nsCalendar;
     NSCalendar *utcCalendar;
+    ESTimeZoneTransitionIndex *transitionIndex;
     int refCount;
 };
 
+static void probeTimeZone(void *zone, ESTimeInterval utc, ESTimeInterval *offset, bool *isDST);
+static ESTimeInterval nextTransitionOfTimeZone(void *zone, ESTimeInterval utc);
+
 // Allocate and init ("new") a time zone
 ESTimeZone *
 ESCalendar_initTimeZoneFromOlsonID(const char *olsonID) {
@@ -53,6 +57,7 @@ ESCalendar_initTimeZoneFromOlsonID(const char *olsonID) {
     tz->utcCalendar = [[NSCalendar alloc] initWithCalendarIdentifier:NSCalendarIdentifierGregorian];
     assert(tz->utcCalendar);
     [tz->utcCalendar setTimeZone:[NSTimeZone timeZoneForSecondsFromGMT:0]];
+    tz->transitionIndex = new ESTimeZoneTransitionIndex(probeTimeZone, tz, nextTransitionOfTimeZone);
     tz->refCount = 1;
     return tz;
 }
@@ -67,6 +72,7 @@ ESCalendar_freeTimeZone(ESTimeZone *tz) {
     tz->nsCalendar = nil;
     [tz->utcCalendar release];
     tz->utcCalendar = nil;
+    delete tz->transitionIndex;
     free(tz);
 }
 
@@ -152,13 +158,10 @@ ESCalendar_init() {
 
 extern void printADateWithTimeZone(NSTimeInterval dt, ESTimeZone *estz);
 
-// Number of seconds ahead of UTC at the given time in the given time zone
-double
-ESCalendar_tzOffsetForTimeInterval(ESTimeZone     *estz,
-				   NSTimeInterval dt) {
-    if (!estz) {
-	return 0;  // Bogus but reproduces prior behavior
-    }
+// What NSCalendar says, for the transition index
+static double
+rawTZOffsetForTimeInterval(ESTimeZone     *estz,
+                           NSTimeInterval dt) {
     NSCalendar *ltCalendar = estz->nsCalendar;
     NSCalendar *utcCalendar = estz->utcCalendar;
 
@@ -192,6 +195,26 @@ ESCalendar_tzOffsetForTimeInterval(ESTimeZone     *estz,
     return offset;
 }
 
+static void
+probeTimeZone(void           *zone,
+              ESTimeInterval utc,
+              ESTimeInterval *offset,
+              bool           *isDST) {
+    ESTimeZone *estz = (ESTimeZone *)zone;
+    *offset = rawTZOffsetForTimeInterval(estz, utc);
+    *isDST = [estz->nsTimeZone isDaylightSavingTimeForDate:[NSDate dateWithTimeIntervalSinceReferenceDate:utc]] ? true : false;
+}
+
+// Number of seconds ahead of UTC at the given time in the given time zone
+double
+ESCalendar_tzOffsetForTimeInterval(ESTimeZone     *estz,
+				   NSTimeInterval dt) {
+    if (!estz) {
+	return 0;  // Bogus but reproduces prior behavior
+    }
+    return estz->transitionIndex->offsetForTime(dt);
+}
+
 // Return calendar components in the given time zone from an NSTimeInterval
 void
 ESCalendar_localComponentsFromTimeInterval(NSTimeInterval timeInterval,
@@ -326,9 +349,11 @@ ESCalendar_localDateComponentsFromDeltaTimeInterval(ESTimeZone     *estz,
     cs->seconds = (int)nscs.second;
 }
 
-NSTimeInterval
-ESCalendar_nextDSTChangeAfterTimeInterval(ESTimeZone     *estz,
-					  NSTimeInterval fromDateInterval) {
+// What NSTimeZone says, both for the transition index (which checks each window's result against a probe at its end,
+// in case this skips transitions that aren't DST changes) and for times the index doesn't cover
+static NSTimeInterval
+rawNextDSTChangeAfterTimeInterval(ESTimeZone     *estz,
+                                  NSTimeInterval fromDateInterval) {
     NSDate *fromDate = [NSDate dateWithTimeIntervalSinceReferenceDate:fromDateInterval];
     NSDate *transitionDate = [estz->nsTimeZone nextDaylightSavingTimeTransitionAfterDate:fromDate];
     NSTimeInterval transitionDateInterval = [transitionDate timeIntervalSinceReferenceDate];
@@ -350,10 +375,26 @@ ESCalendar_nextDSTChangeAfterTimeInterval(ESTimeZone     *estz,
     return transitionDateInterval;
 }
 
+static ESTimeInterval
+nextTransitionOfTimeZone(void           *zone,
+                         ESTimeInterval utc) {
+    return rawNextDSTChangeAfterTimeInterval((ESTimeZone *)zone, utc);
+}
+
+NSTimeInterval
+ESCalendar_nextDSTChangeAfterTimeInterval(ESTimeZone     *estz,
+					  NSTimeInterval fromDateInterval) {
+    NSTimeInterval indexed = estz->transitionIndex->nextDSTChangeAfter(fromDateInterval);
+    if (indexed) {
+        return indexed;
+    }
+    return rawNextDSTChangeAfterTimeInterval(estz, fromDateInterval);  // Nothing in the next couple of years
+}
+
 bool
 ESCalendar_isDSTAtTimeInterval(ESTimeZone     *estz,
 			       NSTimeInterval timeInterval) {
-    return [estz->nsTimeZone isDaylightSavingTimeForDate:[NSDate dateWithTimeIntervalSinceReferenceDate:timeInterval]] ? true : false;
+    return estz->transitionIndex->isDSTAtTime(timeInterval);
 }
 
 extern ESTimeZone *
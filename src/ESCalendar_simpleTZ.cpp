@@ -9,47 +9,103 @@
 #include "ESCalendarPvt.hpp"
 #include "ESCalendar_simpleTZPvt.hpp"
 #include "ESErrorReporter.hpp"
+#include "ESLock.hpp"
 
 #include "assert.h"
 #include <cstdlib>
+#include <map>
+#include <vector>
 
+// One per Olson ID, shared by everyone who asks for that ID (see internedTimeZones).  Everything reachable from here
+// is either immutable once built or, like the transition index, published lock-free, so a zone may be used from any
+// thread.
 struct ESTimeZone {
+    std::string              olsonID;  // The intern key, which may differ from impl->name()
     ESTimeZoneImplementation *impl;
-    int                      refCount;
+    ESTimeZoneTransitionIndex *transitionIndex;  // Answers offset and DST queries without calling impl, mostly
+    int                      refCount;  // Atomic; goes to zero only under internLock
 };
 
-static ESTimeZone *localTimeZone;
+static std::map<std::string, ESTimeZone *> internedTimeZones;  // Protected by internLock
+static ESLock internLock;
+
+static ESTimeZone *localTimeZone;  // Swapped atomically by ESCalendar_localTimeZoneChanged(); holds one reference
+static std::vector<ESTimeZone *> *retiredLocalTimeZones;  // Protected by internLock; each holds one reference, never released (see ESCalendar_localTimeZoneChanged())
 static bool assertOnRelease = false;
 
 void ESCalendar_assertOnRelease() {
     assertOnRelease = true;
 }
 
-// Allocate and init ("new") a time zone
-ESTimeZone *
-ESCalendar_initTimeZoneFromOlsonID(const char *olsonID) {
-    
-    ESTimeZone *tz = (ESTimeZone *)malloc(sizeof(ESTimeZone));
+static void
+probeImplementation(void           *impl,
+                    ESTimeInterval utc,
+                    ESTimeInterval *offset,
+                    bool           *isDST) {
+    ESTimeZoneImplementation *implementation = (ESTimeZoneImplementation *)impl;
+    *offset = implementation->offsetFromUTCForTime(utc);
+    *isDST = implementation->isDSTAtTime(utc);
+}
+
+#if ES_ANDROID
+#define ES_IMPLEMENTATION_NEXT_TRANSITION NULL  /* java.util.TimeZone can't list its transitions; the index probes */
+#else
+// The TZif backend's nextDSTChangeAfterTime() is a lookup in its transition table (or its POSIX rule), and reports
+// every transition there, so the index can walk them instead of probing
+static ESTimeInterval
+nextTransitionOfImplementation(void           *impl,
+                               ESTimeInterval utc) {
+    return ((ESTimeZoneImplementation *)impl)->nextDSTChangeAfterTime(utc, NULL);
+}
+#define ES_IMPLEMENTATION_NEXT_TRANSITION nextTransitionOfImplementation
+#endif
+
+// A new zone, with one reference, not yet interned
+static ESTimeZone *
+ESCalendar_newTimeZone(const char *olsonID) {
+    ESTimeZone *tz = new ESTimeZone;
+    tz->olsonID = olsonID;
     tz->impl = new ESTimeZoneImplementation(olsonID);
+    tz->transitionIndex = new ESTimeZoneTransitionIndex(probeImplementation, tz->impl, ES_IMPLEMENTATION_NEXT_TRANSITION);
     tz->refCount = 1;
+    return tz;
+}
+
+// Return the shared time zone for this ID, retained, making it if nobody has it now.  Environments (and so watch faces)
+// asking for the same zone share one implementation and one warm transition index.
+ESTimeZone *
+ESCalendar_initTimeZoneFromOlsonID(const char *olsonID) {
+    internLock.lock();
+    std::map<std::string, ESTimeZone *>::iterator it = internedTimeZones.find(olsonID);
+    if (it != internedTimeZones.end()) {
+        ESTimeZone *tz = it->second;
+        __atomic_add_fetch(&tz->refCount, 1, __ATOMIC_RELAXED);  // Can't be zero:  that happens only under the lock, which removes it
+        internLock.unlock();
+        return tz;
+    }
+    // Construct under the lock so that two threads asking for a new zone don't both build it
+    ESTimeZone *tz = ESCalendar_newTimeZone(olsonID);
+    internedTimeZones[tz->olsonID] = tz;
+    internLock.unlock();
     // ESErrorReporter::logInfo("ESCalendar_initTimeZoneFromOlsonID", "%s => 0x%016llx", olsonID, (unsigned long long)tz);
     return tz;
 }
 
-// Clean up and Free the time zone
+// Clean up and Free the time zone; the caller has removed it from internedTimeZones
 static void
 ESCalendar_freeTimeZone(ESTimeZone *tz) {
     // ESErrorReporter::logInfo("ESCalendar_freeTimeZone", "0x%016llx => DELETE %s", (unsigned long long)tz, tz->impl->name().c_str());
     ESAssert(tz->refCount == 0);
+    delete tz->transitionIndex;
     delete tz->impl;
-    free(tz);
+    delete tz;
 }
 
 extern ESTimeZone *
 ESCalendar_retainTimeZone(ESTimeZone *estz) {
     // ESErrorReporter::logInfo("ESCalendar_retainTimeZone", "0x%016llx => RETAIN, refCount %d", (unsigned long long)estz, estz->refCount);
-    ESAssert(estz->refCount > 0);
-    ++estz->refCount;
+    int previousCount = __atomic_fetch_add(&estz->refCount, 1, __ATOMIC_RELAXED);
+    ESAssert(previousCount > 0);
     return estz;
 }
 
@@ -59,11 +115,29 @@ ESCalendar_releaseTimeZone(ESTimeZone *estz) {
     if (assertOnRelease) {
         ESAssert(false);
     }
-    ESAssert(estz->refCount > 0);
-    if (estz) {
-	if (--estz->refCount == 0) {
-	    ESCalendar_freeTimeZone(estz);
-	}
+    if (!estz) {
+        return;
+    }
+    // Not the last reference:  just decrement
+    int count = __atomic_load_n(&estz->refCount, __ATOMIC_RELAXED);
+    while (count > 1) {
+        if (__atomic_compare_exchange_n(&estz->refCount, &count, count - 1, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+    }
+    // Maybe the last:  decrement under the lock, so nobody can find it in the table between our zero and its removal
+    internLock.lock();
+    count = __atomic_sub_fetch(&estz->refCount, 1, __ATOMIC_ACQ_REL);
+    ESAssert(count >= 0);
+    if (count == 0) {
+        std::map<std::string, ESTimeZone *>::iterator it = internedTimeZones.find(estz->olsonID);
+        if (it != internedTimeZones.end() && it->second == estz) {  // Else it was evicted by ESCalendar_localTimeZoneChanged()
+            internedTimeZones.erase(it);
+        }
+    }
+    internLock.unlock();
+    if (count == 0) {
+        ESCalendar_freeTimeZone(estz);
     }
 }
 
@@ -74,7 +148,13 @@ ESCalendar_timeZoneName(ESTimeZone *estz) {
 
 void
 ESCalendar_init() {
-    localTimeZone = ESCalendar_initTimeZoneFromOlsonID(ESTimeZoneImplementation::olsonNameOfLocalTimeZone().c_str());
+    __atomic_store_n(&localTimeZone, ESCalendar_initTimeZoneFromOlsonID(ESTimeZoneImplementation::olsonNameOfLocalTimeZone().c_str()), __ATOMIC_RELEASE);
+#ifdef ESCALENDAR_KERNEL_TEST  // Defined (or not) in ESCalendarPvt.hpp
+    ESTestCalendarKernel();
+#endif
+#ifdef ES_TZIF_BENCHMARK  // Defined (or not) in ESCalendar_simpleTZPvt.hpp
+    ESTZifBenchmark();
+#endif
 }
 
 double
@@ -84,7 +164,7 @@ ESCalendar_tzOffsetForTimeInterval(ESTimeZone     *estz,
 	return 0;  // Bogus but reproduces prior behavior
     }
     // ESErrorReporter::logInfo("ESCalendar_tzOffsetForTimeInterval", "0x%016llx", (unsigned long long)estz);
-    return estz->impl->offsetFromUTCForTime(dt);
+    return estz->transitionIndex->offsetForTime(dt);
 }
 
 // Return calendar components in the given time zone from an ESTimeInterval
@@ -98,7 +178,7 @@ ESCalendar_localComponentsFromTimeInterval(ESTimeInterval timeInterval,
                                            int            *hour,
                                            int            *minute,
                                            double         *seconds) {
-    ESCalendar_UTCComponentsFromTimeInterval(timeInterval + timeZone->impl->offsetFromUTCForTime(timeInterval),
+    ESCalendar_UTCComponentsFromTimeInterval(timeInterval + timeZone->transitionIndex->offsetForTime(timeInterval),
                                              era, year, month, day, hour, minute, seconds);
 }
 
@@ -112,9 +192,9 @@ ESCalendar_timeIntervalFromLocalComponents(ESTimeZone *timeZone,
                                            int         minute,
                                            double      seconds) {
     ESTimeInterval localT = ESCalendar_timeIntervalFromUTCComponents(era, year, month, day, hour, minute, seconds);
-    ESTimeInterval offsetAtLocalT = timeZone->impl->offsetFromUTCForTime(localT);
+    ESTimeInterval offsetAtLocalT = timeZone->transitionIndex->offsetForTime(localT);
     ESTimeInterval tryUTC = localT - offsetAtLocalT;
-    ESTimeInterval offsetAtTryUTC = timeZone->impl->offsetFromUTCForTime(tryUTC);
+    ESTimeInterval offsetAtTryUTC = timeZone->transitionIndex->offsetForTime(tryUTC);
     if (offsetAtTryUTC == offsetAtLocalT) {
         return tryUTC;
     }
@@ -153,29 +233,56 @@ ESCalendar_localDateComponentsFromDeltaTimeInterval(ESTimeZone     *estz,
 ESTimeInterval
 ESCalendar_nextDSTChangeAfterTimeInterval(ESTimeZone     *estz,
 					  ESTimeInterval fromDateInterval) {
-    return estz->impl->nextDSTChangeAfterTime(fromDateInterval, estz);
+    ESTimeInterval indexed = estz->transitionIndex->nextDSTChangeAfter(fromDateInterval);
+    if (indexed) {
+        return indexed;
+    }
+    // Nothing in the next couple of years; ask the backend, which also reports changes of offset alone, so skip those
+    bool wasDST = estz->impl->isDSTAtTime(fromDateInterval);
+    ESTimeInterval change = fromDateInterval;
+    while ((change = estz->impl->nextDSTChangeAfterTime(change, estz)) != 0) {
+        if (estz->impl->isDSTAtTime(change) != wasDST) {
+            return change;
+        }
+    }
+    return 0;
 }
 
 bool
 ESCalendar_isDSTAtTimeInterval(ESTimeZone     *estz,
 			       ESTimeInterval timeInterval) {
-    return estz->impl->isDSTAtTime(timeInterval);
+    return estz->transitionIndex->isDSTAtTime(timeInterval);
 }
 
 extern ESTimeZone *
 ESCalendar_localTimeZone() {
-    assert(localTimeZone);
-    return localTimeZone;
+    ESTimeZone *tz = __atomic_load_n(&localTimeZone, __ATOMIC_ACQUIRE);
+    assert(tz);
+    return tz;
 }
 
 extern void
 ESCalendar_localTimeZoneChanged() {
-    assert(localTimeZone);
-    ESCalendar_releaseTimeZone(localTimeZone);
     std::string newTZName = ESTimeZoneImplementation::olsonNameOfLocalTimeZone();
     ESErrorReporter::logInfo("ESCalendar_localTimeZoneChanged", "setting localTimeZone to '%s'",
                              newTZName.c_str());
-    localTimeZone = ESCalendar_initTimeZoneFromOlsonID(newTZName.c_str());
+    // A fresh zone rather than the interned one, which may have been built from the zoneinfo file (or /etc/localtime)
+    // before it changed.  It replaces the interned one, so later lookups of the name get it too; holders of the
+    // evicted one keep using it until they release it.
+    ESTimeZone *newTZ = ESCalendar_newTimeZone(newTZName.c_str());
+    internLock.lock();
+    internedTimeZones[newTZ->olsonID] = newTZ;
+    // Swap only once it's built, so that a reader on another thread always finds a valid zone.
+    // ESCalendar_localTimeZone() doesn't retain what it returns, and there's no telling when a thread that fetched the
+    // old zone is done with it, so the old zone keeps its one reference for good:  one zone per change of local zone.
+    ESTimeZone *oldTZ = __atomic_exchange_n(&localTimeZone, newTZ, __ATOMIC_ACQ_REL);
+    if (oldTZ) {
+        if (!retiredLocalTimeZones) {
+            retiredLocalTimeZones = new std::vector<ESTimeZone *>;
+        }
+        retiredLocalTimeZones->push_back(oldTZ);
+    }
+    internLock.unlock();
 }
 
 std::string
@@ -14,6 +14,10 @@
 
 #include "string"
 
+#if !ES_ANDROID
+struct ESTZifZone;  // ESCalendar_tzif.cpp
+#endif
+
 /*! "Abstract" class, not truly abstract but implemented differently
  *  on different platforms, representing the ability to return the
  *  offset from UTC for a given UTC. */
@@ -30,7 +34,16 @@ class ESTimeZoneImplementation {
   private:
 #if ES_ANDROID
     jobject                 _javaTZ;
+#else
+    ESTZifZone              *_zone;
 #endif
 };
 
+// Define this to time, at ESCalendar_init(), the TZif backend's nextDSTChangeAfterTime() and offset lookups against
+// ESCalendar_nextDSTChangeAfterTimeIntervalTheSlowWay() for a few zones, and to check that they agree
+#undef ES_TZIF_BENCHMARK
+#ifdef ES_TZIF_BENCHMARK
+extern void ESTZifBenchmark();
+#endif
+
 #endif  // _ESCALENDAR_SIMPLETZPVT_HPP_
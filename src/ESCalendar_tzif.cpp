@@ -0,0 +1,706 @@
+//
+//  ESCalendar_tzif.cpp
+//
+//  Copyright Emerald Sequoia LLC 2011. All rights reserved.
+//
+
+// ESTimeZoneImplementation for platforms with an IANA zoneinfo database on disk (Linux et al).  Each zone's TZif
+// file (RFC 8536, versions 1-3) is read once into a sorted transition array, extended with the file's POSIX TZ footer
+// rule through ES_TZIF_RULE_HORIZON_YEAR; after that the rule is evaluated directly.  An offset lookup is then a
+// binary search, and the next DST change is the next array entry.
+
+#include "ESCalendar.hpp"
+#include "ESCalendarPvt.hpp"
+#include "ESCalendar_simpleTZPvt.hpp"
+#include "ESErrorReporter.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ES_TZIF_DEFAULT_DIR        "/usr/share/zoneinfo"  /* Overridden by $TZDIR */
+#define ES_TZIF_RULE_HORIZON_YEAR  2100                   /* The footer rule is precomputed into the array through this year */
+#define ES_TZIF_UNIX_EPOCH_DAYS    11323                  /* Days from 1970-01-01 to the ESTime epoch, 2001-01-01 */
+
+struct ESTZifType {
+    ESTimeInterval          offset;  // Seconds east of UTC
+    bool                    isDST;
+    std::string             abbrev;
+};
+
+// A POSIX TZ rule, as in the footer of a v2+ TZif file:  "std offset [dst [offset] [,start[/time],end[/time]]]"
+struct ESTZifRuleDate {
+    char                    kind;    // 'M' (month, week, weekday), 'J' (1-based day of year, no Feb 29), or 'n' (0-based day of year)
+    int                     month;
+    int                     week;    // 1-5; 5 means the last
+    int                     weekday; // 0 == Sunday
+    int                     day;
+    ESTimeInterval          time;    // Local time of day (may be negative or past 24h in v3)
+};
+
+struct ESTZifRule {
+    int                     stdType; // Index into ESTZifZone::types
+    int                     dstType; // -1 if there's no DST
+    ESTZifRuleDate          start;
+    ESTZifRuleDate          end;
+};
+
+/*! Everything about one zone, immutable once built */
+struct ESTZifZone {
+    std::string             name;
+    std::vector<ESTZifType> types;
+    std::vector<ESTimeInterval> transitionTimes;  // Sorted; each is a change of offset, DST or abbreviation
+    std::vector<unsigned char> transitionTypes;   // The type in effect from transitionTimes[i] on
+    int                     initialType;          // Before the first transition
+    bool                    haveRule;
+    ESTZifRule              rule;
+    ESTimeInterval          ruleHorizon;          // Past this, transitions come from the rule rather than the array
+
+    int                     typeAtTime(ESTimeInterval utc) const;
+    ESTimeInterval          nextTransitionAfter(ESTimeInterval utc) const;  // Of offset or DST (not abbreviation alone); 0 if none
+    bool                    changesOffsetOrDST(size_t transitionIndex) const;
+    void                    ruleTransitionsForYear(int            year,
+                                                   ESTimeInterval *times,
+                                                   int            *types) const;  // Two, in order; only when the rule has DST
+    int                     findOrAddType(ESTimeInterval    offset,
+                                          bool              isDST,
+                                          const std::string &abbrev);
+};
+
+// *****************************************************************************************
+// Civil-date arithmetic (proleptic Gregorian), in days since 1970-01-01
+// *****************************************************************************************
+
+static long
+daysFromCivil(int year,
+              int month,
+              int day) {
+    year -= month <= 2;
+    long era = (year >= 0 ? year : year - 399) / 400;
+    unsigned int yearOfEra = (unsigned int)(year - era * 400);
+    unsigned int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    unsigned int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + (long)dayOfEra - 719468;
+}
+
+static int
+yearFromDays(long days) {
+    days += 719468;
+    long era = (days >= 0 ? days : days - 146096) / 146097;
+    unsigned int dayOfEra = (unsigned int)(days - era * 146097);
+    unsigned int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    unsigned int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    unsigned int mp = (5 * dayOfYear + 2) / 153;
+    return (int)(yearOfEra + era * 400) + (mp >= 10);
+}
+
+static bool
+isLeapYear(int year) {
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+static long
+daysSinceUnixEpochForUTC(ESTimeInterval utc) {
+    return (long)floor(utc / 86400) + ES_TZIF_UNIX_EPOCH_DAYS;
+}
+
+// Days since 1970-01-01 of the given rule date in the given year
+static long
+daysForRuleDate(const ESTZifRuleDate &date,
+                int                  year) {
+    if (date.kind == 'J') {
+        return daysFromCivil(year, 1, 1) + date.day - 1 + (isLeapYear(year) && date.day >= 60);
+    } else if (date.kind == 'n') {
+        return daysFromCivil(year, 1, 1) + date.day;
+    }
+    static const int daysInMonth[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    long firstOfMonth = daysFromCivil(year, date.month, 1);
+    int weekdayOfFirst = (int)(((firstOfMonth + 4) % 7 + 7) % 7);  // 1970-01-01 was a Thursday
+    int day = 1 + (date.weekday - weekdayOfFirst + 7) % 7 + 7 * (date.week - 1);
+    int monthLength = daysInMonth[date.month - 1] + (date.month == 2 && isLeapYear(year));
+    while (day > monthLength) {
+        day -= 7;
+    }
+    return firstOfMonth + day - 1;
+}
+
+// *****************************************************************************************
+// POSIX TZ rule parsing
+// *****************************************************************************************
+
+static bool
+parseRuleName(const char  **p,
+              std::string *name) {
+    const char *s = *p;
+    if (*s == '<') {
+        const char *end = strchr(s, '>');
+        if (!end) {
+            return false;
+        }
+        *name = std::string(s + 1, end - s - 1);
+        *p = end + 1;
+        return true;
+    }
+    const char *start = s;
+    while ((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z')) {
+        s++;
+    }
+    if (s - start < 3) {
+        return false;
+    }
+    *name = std::string(start, s - start);
+    *p = s;
+    return true;
+}
+
+// [+-]hh[:mm[:ss]]
+static bool
+parseRuleTime(const char     **p,
+              ESTimeInterval *seconds) {
+    const char *s = *p;
+    int sign = 1;
+    if (*s == '+' || *s == '-') {
+        sign = *s == '-' ? -1 : 1;
+        s++;
+    }
+    if (*s < '0' || *s > '9') {
+        return false;
+    }
+    int parts[3] = { 0, 0, 0 };
+    for (int i = 0; i < 3; i++) {
+        if (*s < '0' || *s > '9') {
+            return false;
+        }
+        while (*s >= '0' && *s <= '9') {
+            parts[i] = parts[i] * 10 + (*s++ - '0');
+        }
+        if (*s != ':') {
+            break;
+        }
+        s++;
+    }
+    *seconds = sign * (parts[0] * 3600.0 + parts[1] * 60 + parts[2]);
+    *p = s;
+    return true;
+}
+
+static bool
+parseRuleDate(const char     **p,
+              ESTZifRuleDate *date) {
+    const char *s = *p;
+    char *end;
+    if (*s == 'M') {
+        date->kind = 'M';
+        date->month = (int)strtol(s + 1, &end, 10);
+        if (*end != '.') return false;
+        date->week = (int)strtol(end + 1, &end, 10);
+        if (*end != '.') return false;
+        date->weekday = (int)strtol(end + 1, &end, 10);
+        if (date->month < 1 || date->month > 12 || date->week < 1 || date->week > 5 || date->weekday < 0 || date->weekday > 6) {
+            return false;
+        }
+    } else {
+        date->kind = *s == 'J' ? 'J' : 'n';
+        if (*s == 'J') {
+            s++;
+        }
+        if (*s < '0' || *s > '9') {
+            return false;
+        }
+        date->day = (int)strtol(s, &end, 10);
+        if (date->day > 365 || (date->kind == 'J' && date->day < 1)) {
+            return false;
+        }
+    }
+    s = end;
+    date->time = 2 * 3600;
+    if (*s == '/') {
+        s++;
+        if (!parseRuleTime(&s, &date->time)) {
+            return false;
+        }
+    }
+    *p = s;
+    return true;
+}
+
+// Fills in rule (adding its types to the zone); returns false if the string isn't a valid rule
+static bool
+parseRule(const char *tzString,
+          ESTZifZone *zone,
+          ESTZifRule *rule) {
+    const char *p = tzString;
+    std::string stdName, dstName;
+    ESTimeInterval stdOffset, dstOffset;
+    if (!parseRuleName(&p, &stdName) || !parseRuleTime(&p, &stdOffset)) {
+        return false;
+    }
+    stdOffset = -stdOffset;  // POSIX offsets are west of UTC
+    rule->stdType = zone->findOrAddType(stdOffset, false, stdName);
+    rule->dstType = -1;
+    if (!*p) {
+        return true;
+    }
+    if (!parseRuleName(&p, &dstName)) {
+        return false;
+    }
+    dstOffset = stdOffset + 3600;
+    if (*p && *p != ',') {
+        if (!parseRuleTime(&p, &dstOffset)) {
+            return false;
+        }
+        dstOffset = -dstOffset;
+    }
+    if (*p == ',') {
+        p++;
+        if (!parseRuleDate(&p, &rule->start) || *p++ != ',' || !parseRuleDate(&p, &rule->end) || *p) {
+            return false;
+        }
+    } else if (!*p) {  // No dates:  POSIX leaves it to the implementation; use the current US rules, as glibc does
+        const char *usRule = "M3.2.0,M11.1.0";
+        parseRuleDate(&usRule, &rule->start);
+        usRule++;
+        parseRuleDate(&usRule, &rule->end);
+    } else {
+        return false;
+    }
+    rule->dstType = zone->findOrAddType(dstOffset, true, dstName);
+    return true;
+}
+
+// *****************************************************************************************
+// ESTZifZone
+// *****************************************************************************************
+
+int
+ESTZifZone::findOrAddType(ESTimeInterval    offset,
+                          bool              isDST,
+                          const std::string &abbrev) {
+    for (size_t i = 0; i < types.size(); i++) {
+        if (types[i].offset == offset && types[i].isDST == isDST && types[i].abbrev == abbrev) {
+            return (int)i;
+        }
+    }
+    ESTZifType type;
+    type.offset = offset;
+    type.isDST = isDST;
+    type.abbrev = abbrev;
+    types.push_back(type);
+    return (int)types.size() - 1;
+}
+
+void
+ESTZifZone::ruleTransitionsForYear(int            year,
+                                   ESTimeInterval *times,
+                                   int            *transitionToTypes) const {
+    ESAssert(haveRule && rule.dstType >= 0);
+    ESTimeInterval stdOffset = types[rule.stdType].offset;
+    ESTimeInterval dstOffset = types[rule.dstType].offset;
+    ESTimeInterval dstStart = (daysForRuleDate(rule.start, year) - ES_TZIF_UNIX_EPOCH_DAYS) * 86400.0 + rule.start.time - stdOffset;
+    ESTimeInterval dstEnd = (daysForRuleDate(rule.end, year) - ES_TZIF_UNIX_EPOCH_DAYS) * 86400.0 + rule.end.time - dstOffset;
+    if (dstStart <= dstEnd) {  // Northern hemisphere
+        times[0] = dstStart;
+        transitionToTypes[0] = rule.dstType;
+        times[1] = dstEnd;
+        transitionToTypes[1] = rule.stdType;
+    } else {
+        times[0] = dstEnd;
+        transitionToTypes[0] = rule.stdType;
+        times[1] = dstStart;
+        transitionToTypes[1] = rule.dstType;
+    }
+}
+
+int
+ESTZifZone::typeAtTime(ESTimeInterval utc) const {
+    if (utc >= ruleHorizon && haveRule) {  // Rare:  more than ES_TZIF_RULE_HORIZON_YEAR
+        if (rule.dstType < 0) {
+            return rule.stdType;
+        }
+        int year = yearFromDays(daysSinceUnixEpochForUTC(utc));
+        ESTimeInterval times[2];
+        int toTypes[2];
+        ruleTransitionsForYear(year, times, toTypes);
+        if (utc < times[0]) {
+            return toTypes[1];  // The last change of the year before (the rule is the same every year)
+        }
+        return utc < times[1] ? toTypes[0] : toTypes[1];
+    }
+    std::vector<ESTimeInterval>::const_iterator it = std::upper_bound(transitionTimes.begin(), transitionTimes.end(), utc);
+    if (it == transitionTimes.begin()) {
+        return initialType;
+    }
+    return transitionTypes[it - transitionTimes.begin() - 1];
+}
+
+bool
+ESTZifZone::changesOffsetOrDST(size_t transitionIndex) const {
+    const ESTZifType &from = types[transitionIndex == 0 ? initialType : transitionTypes[transitionIndex - 1]];
+    const ESTZifType &to = types[transitionTypes[transitionIndex]];
+    return from.offset != to.offset || from.isDST != to.isDST;
+}
+
+ESTimeInterval
+ESTZifZone::nextTransitionAfter(ESTimeInterval utc) const {
+    if (utc < ruleHorizon || !haveRule) {
+        std::vector<ESTimeInterval>::const_iterator it = std::upper_bound(transitionTimes.begin(), transitionTimes.end(), utc);
+        while (it != transitionTimes.end() && *it < ruleHorizon && !changesOffsetOrDST(it - transitionTimes.begin())) {
+            it++;  // Only the abbreviation changes (e.g., US war time, 1942-1945), which isn't a DST change
+        }
+        if (it != transitionTimes.end() && *it < ruleHorizon) {
+            return *it;
+        }
+        if (!haveRule) {
+            return 0;
+        }
+    }
+    if (rule.dstType < 0) {
+        return 0;
+    }
+    int year = yearFromDays(daysSinceUnixEpochForUTC(utc > ruleHorizon ? utc : ruleHorizon));
+    for (int y = year; y <= year + 1; y++) {
+        ESTimeInterval times[2];
+        int toTypes[2];
+        ruleTransitionsForYear(y, times, toTypes);
+        for (int i = 0; i < 2; i++) {
+            if (times[i] > utc && times[i] >= ruleHorizon) {
+                return times[i];
+            }
+        }
+    }
+    return 0;
+}
+
+// *****************************************************************************************
+// TZif file parsing
+// *****************************************************************************************
+
+static long long
+readBigEndian(const unsigned char *p,
+              int                 size) {
+    unsigned long long value = 0;
+    for (int i = 0; i < size; i++) {
+        value = (value << 8) | p[i];
+    }
+    if (size == 4) {
+        return (int32_t)value;
+    }
+    return (long long)value;
+}
+
+struct ESTZifHeader {
+    char                    version;
+    unsigned int            isutcnt, isstdcnt, leapcnt, timecnt, typecnt, charcnt;
+};
+
+static bool
+readHeader(const unsigned char *p,
+           size_t              remaining,
+           ESTZifHeader        *header) {
+    if (remaining < 44 || memcmp(p, "TZif", 4) != 0) {
+        return false;
+    }
+    header->version = p[4];
+    header->isutcnt = (unsigned int)readBigEndian(p + 20, 4);
+    header->isstdcnt = (unsigned int)readBigEndian(p + 24, 4);
+    header->leapcnt = (unsigned int)readBigEndian(p + 28, 4);
+    header->timecnt = (unsigned int)readBigEndian(p + 32, 4);
+    header->typecnt = (unsigned int)readBigEndian(p + 36, 4);
+    header->charcnt = (unsigned int)readBigEndian(p + 40, 4);
+    return header->typecnt > 0 && header->typecnt <= 256 && header->timecnt < 100000 && header->charcnt < 100000 &&
+        header->leapcnt < 100000 && header->isutcnt <= header->typecnt && header->isstdcnt <= header->typecnt;
+}
+
+static size_t
+dataBlockSize(const ESTZifHeader &header,
+              int                timeSize) {
+    return header.timecnt * (size_t)timeSize + header.timecnt + header.typecnt * 6 + header.charcnt +
+        header.leapcnt * (size_t)(timeSize + 4) + header.isstdcnt + header.isutcnt;
+}
+
+// Appends a transition unless it changes none of offset, DST and abbreviation.  Abbreviation-only transitions are kept
+// for abbrevName(), and skipped by nextTransitionAfter().
+static void
+addTransition(ESTZifZone     *zone,
+              ESTimeInterval at,
+              int            type) {
+    int previousType = zone->transitionTypes.empty() ? zone->initialType : zone->transitionTypes.back();
+    if (!zone->transitionTimes.empty() && at <= zone->transitionTimes.back()) {
+        return;
+    }
+    const ESTZifType &from = zone->types[previousType];
+    const ESTZifType &to = zone->types[type];
+    if (from.offset == to.offset && from.isDST == to.isDST && from.abbrev == to.abbrev) {
+        return;
+    }
+    zone->transitionTimes.push_back(at);
+    zone->transitionTypes.push_back((unsigned char)type);
+}
+
+static bool
+parseTZif(const unsigned char *data,
+          size_t              length,
+          ESTZifZone          *zone) {
+    ESTZifHeader header;
+    if (!readHeader(data, length, &header)) {
+        return false;
+    }
+    const unsigned char *p = data + 44;
+    int timeSize = 4;
+    if (header.version >= '2') {  // Skip the v1 block in favor of the 64-bit one that follows
+        size_t v1Size = dataBlockSize(header, 4);
+        if (length - 44 < v1Size || !readHeader(p + v1Size, length - 44 - v1Size, &header)) {
+            return false;
+        }
+        p += v1Size + 44;
+        timeSize = 8;
+    }
+    const unsigned char *end = data + length;
+    if ((size_t)(end - p) < dataBlockSize(header, timeSize)) {
+        return false;
+    }
+    const unsigned char *times = p;
+    const unsigned char *timeTypes = times + header.timecnt * timeSize;
+    const unsigned char *ttinfos = timeTypes + header.timecnt;
+    const char *chars = (const char *)(ttinfos + header.typecnt * 6);
+    std::vector<int> typeMap(header.typecnt);
+    for (unsigned int i = 0; i < header.typecnt; i++) {
+        const unsigned char *ttinfo = ttinfos + i * 6;
+        unsigned int abbrevIndex = ttinfo[5];
+        std::string abbrev;
+        if (abbrevIndex < header.charcnt) {
+            abbrev = std::string(chars + abbrevIndex, strnlen(chars + abbrevIndex, header.charcnt - abbrevIndex));
+        }
+        typeMap[i] = zone->findOrAddType((ESTimeInterval)readBigEndian(ttinfo, 4), ttinfo[4] != 0, abbrev);
+    }
+    zone->initialType = typeMap[0];
+    for (unsigned int i = 0; i < header.timecnt; i++) {
+        if (timeTypes[i] >= header.typecnt) {
+            return false;
+        }
+        addTransition(zone, readBigEndian(times + i * timeSize, timeSize) - ESTIME_EPOCH, typeMap[timeTypes[i]]);
+    }
+    p += dataBlockSize(header, timeSize);
+    zone->haveRule = false;
+    if (timeSize == 8 && p < end && *p == '\n') {  // Footer
+        const unsigned char *footerEnd = (const unsigned char *)memchr(p + 1, '\n', end - p - 1);
+        if (footerEnd && footerEnd > p + 1) {
+            std::string tzString((const char *)p + 1, footerEnd - p - 1);
+            zone->haveRule = parseRule(tzString.c_str(), zone, &zone->rule);
+            if (!zone->haveRule) {
+                ESErrorReporter::logError("ESTZif", "%s: can't parse footer rule '%s'", zone->name.c_str(), tzString.c_str());
+            }
+        }
+    }
+    return true;
+}
+
+// Precomputes the rule's transitions from the last explicit one through ES_TZIF_RULE_HORIZON_YEAR
+static void
+extendWithRule(ESTZifZone *zone) {
+    zone->ruleHorizon = (daysFromCivil(ES_TZIF_RULE_HORIZON_YEAR + 1, 1, 1) - ES_TZIF_UNIX_EPOCH_DAYS) * 86400.0;
+    if (!zone->haveRule) {
+        return;
+    }
+    ESTimeInterval lastExplicit = zone->transitionTimes.empty() ? -ESFarFarInTheFuture : zone->transitionTimes.back();
+    if (zone->rule.dstType < 0) {
+        addTransition(zone, zone->transitionTimes.empty() ? -ESFarFarInTheFuture : lastExplicit + 1, zone->rule.stdType);
+        return;
+    }
+    int firstYear = zone->transitionTimes.empty() ? 1970 : yearFromDays(daysSinceUnixEpochForUTC(lastExplicit));
+    for (int year = firstYear; year <= ES_TZIF_RULE_HORIZON_YEAR; year++) {
+        ESTimeInterval times[2];
+        int toTypes[2];
+        zone->ruleTransitionsForYear(year, times, toTypes);
+        for (int i = 0; i < 2; i++) {
+            if (times[i] > lastExplicit) {
+                addTransition(zone, times[i], toTypes[i]);
+            }
+        }
+    }
+}
+
+static std::string
+zoneinfoDirectory() {
+    const char *dir = getenv("TZDIR");
+    return dir && *dir ? dir : ES_TZIF_DEFAULT_DIR;
+}
+
+static bool
+loadZoneFile(const std::string &path,
+             ESTZifZone        *zone) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 44) {
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        ESErrorReporter::checkAndLogSystemError("ESTZif", errno, "mmap of zoneinfo file");
+        return false;
+    }
+    bool ok = parseTZif((const unsigned char *)data, st.st_size, zone);
+    munmap(data, st.st_size);
+    return ok;
+}
+
+static ESTZifZone *
+buildZone(const char *olsonID) {
+    ESTZifZone *zone = new ESTZifZone;
+    zone->name = olsonID;
+    const char *id = *olsonID == ':' ? olsonID + 1 : olsonID;
+    bool ok = false;
+    if (*id && !strstr(id, "..")) {
+        ok = loadZoneFile(*id == '/' ? std::string(id) : zoneinfoDirectory() + "/" + id, zone);
+    }
+    if (!ok) {  // Maybe it's a POSIX TZ string rather than a zone name
+        zone->types.clear();
+        zone->transitionTimes.clear();
+        zone->transitionTypes.clear();
+        zone->haveRule = parseRule(id, zone, &zone->rule);
+        if (zone->haveRule) {
+            zone->initialType = zone->rule.stdType;
+        } else {
+            ESErrorReporter::logError("ESTZif", "Unknown time zone '%s'; using UTC", olsonID);
+            zone->types.clear();
+            zone->initialType = zone->findOrAddType(0, false, "UTC");
+        }
+    }
+    extendWithRule(zone);
+    return zone;
+}
+
+// *****************************************************************************************
+// ESTimeZoneImplementation
+// *****************************************************************************************
+
+ESTimeZoneImplementation::ESTimeZoneImplementation(const char *olsonID)
+:   _zone(buildZone(olsonID))
+{
+}
+
+ESTimeZoneImplementation::~ESTimeZoneImplementation() {
+    delete _zone;
+    _zone = NULL;
+}
+
+// $TZ if set, else the zone /etc/localtime links to
+/*static*/ std::string
+ESTimeZoneImplementation::olsonNameOfLocalTimeZone() {
+    const char *tz = getenv("TZ");
+    if (tz && *tz) {
+        return *tz == ':' ? tz + 1 : tz;
+    }
+    char buf[PATH_MAX];
+    ssize_t len = readlink("/etc/localtime", buf, sizeof(buf) - 1);
+    if (len > 0) {
+        buf[len] = '\0';
+        const char *zoneinfo = strstr(buf, "zoneinfo/");
+        if (zoneinfo) {
+            return zoneinfo + strlen("zoneinfo/");
+        }
+        return buf;  // An absolute path, which the constructor accepts too
+    }
+    return "/etc/localtime";  // A copy rather than a link
+}
+
+std::string
+ESTimeZoneImplementation::name() {
+    return _zone->name;
+}
+
+ESTimeInterval
+ESTimeZoneImplementation::offsetFromUTCForTime(ESTimeInterval utc) {
+    return _zone->types[_zone->typeAtTime(utc)].offset;
+}
+
+ESTimeInterval
+ESTimeZoneImplementation::nextDSTChangeAfterTime(ESTimeInterval dt, ESTimeZone *) {
+    return _zone->nextTransitionAfter(dt);
+}
+
+std::string
+ESTimeZoneImplementation::abbrevName(ESTimeZone *) {
+    return _zone->types[_zone->typeAtTime(ESTime::currentTime())].abbrev;
+}
+
+bool
+ESTimeZoneImplementation::isDSTAtTime(ESTimeInterval dt) {
+    return _zone->types[_zone->typeAtTime(dt)].isDST;
+}
+
+ESTimeInterval
+ESCalendar_tzOffsetAfterNextDSTChange(ESTimeZone     *estz,
+                                      ESTimeInterval timeInterval) {
+    ESTimeInterval nextChange = ESCalendar_nextDSTChangeAfterTimeInterval(estz, timeInterval);
+    return ESCalendar_tzOffsetForTimeInterval(estz, nextChange ? nextChange : timeInterval);
+}
+
+std::string
+ESCalendar_version() {
+    FILE *fp = fopen((zoneinfoDirectory() + "/+VERSION").c_str(), "r");
+    char buf[32];
+    if (fp && fgets(buf, sizeof(buf), fp)) {
+        fclose(fp);
+        buf[strcspn(buf, "\r\n")] = '\0';
+        return buf;
+    }
+    if (fp) {
+        fclose(fp);
+    }
+    return "tzif";
+}
+
+#ifdef ES_TZIF_BENCHMARK
+void
+ESTZifBenchmark() {
+    const char *zoneNames[] = { "America/New_York", "Europe/London", "Australia/Sydney", "Asia/Kolkata" };
+    for (size_t z = 0; z < sizeof(zoneNames) / sizeof(zoneNames[0]); z++) {
+        ESTimeZone *estz = ESCalendar_initTimeZoneFromOlsonID(zoneNames[z]);
+        const int numProbes = 2000;
+        ESTimeInterval start = ESTime::currentTime() - 10 * 365 * 86400.0;
+        ESTimeInterval step = 20 * 365 * 86400.0 / numProbes;
+        int numMismatches = 0;
+        ESTimeInterval sum = 0;
+        ESTimeInterval t0 = ESTime::currentContinuousTime();
+        for (int i = 0; i < numProbes; i++) {
+            sum += ESCalendar_nextDSTChangeAfterTimeInterval(estz, start + i * step);
+        }
+        ESTimeInterval t1 = ESTime::currentContinuousTime();
+        for (int i = 0; i < numProbes; i++) {
+            sum += ESCalendar_nextDSTChangeAfterTimeIntervalTheSlowWay(estz, start + i * step);
+        }
+        ESTimeInterval t2 = ESTime::currentContinuousTime();
+        for (int i = 0; i < numProbes; i++) {  // Untimed
+            ESTimeInterval slow = ESCalendar_nextDSTChangeAfterTimeIntervalTheSlowWay(estz, start + i * step);
+            if (slow != 0 && slow != ESCalendar_nextDSTChangeAfterTimeInterval(estz, start + i * step)) {
+                numMismatches++;
+            }
+        }
+        ESTimeInterval t2a = ESTime::currentContinuousTime();
+        for (int i = 0; i < numProbes * 100; i++) {
+            sum += ESCalendar_tzOffsetForTimeInterval(estz, start + i * step / 100);
+        }
+        ESTimeInterval t3 = ESTime::currentContinuousTime();
+        printf("TZIF BENCHMARK %s:  next DST change %.0f ns (slow way %.0f ns, %d mismatches), offset %.0f ns (%g)\n",
+               zoneNames[z], (t1 - t0) * 1e9 / numProbes, (t2 - t1) * 1e9 / numProbes, numMismatches,
+               (t3 - t2a) * 1e9 / (numProbes * 100), sum);
+        ESCalendar_releaseTimeZone(estz);
+    }
+}
+#endif  // ES_TZIF_BENCHMARK
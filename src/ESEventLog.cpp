@@ -0,0 +1,261 @@
+//
+//  ESEventLog.cpp
+//
+//  Copyright Emerald Sequoia LLC 2011. All rights reserved.
+//
+
+#include "ESEventLog.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define ES_EVENT_LOG_VERSION 2  /* 2:  full IPv6 addresses */
+
+#ifndef ES_EVENT_LOG_DECODER  // The offline decoder needs only decode(), and none of ESTime
+
+/*static*/ ESEventRecord ESEventLog::_ring[ES_EVENT_LOG_SIZE];
+/*static*/ unsigned int  ESEventLog::_nextPosition = 0;
+
+// Sequence-lock writer, one per record:  a reader that sees the same nonzero sequence before and after copying the
+// record got all of it.  Writers in different threads get different slots from the increment; a writer lapped by
+// ES_EVENT_LOG_SIZE others in the middle of a record is not worth guarding against.
+/*static*/ void
+ESEventLog::recordGuts(ESEventType    type,
+                       int            arg,
+                       unsigned char  family,
+                       const void     *host,
+                       ESTimeInterval value,
+                       float          value2) {
+    unsigned int position = __sync_fetch_and_add(&_nextPosition, 1);
+    ESEventRecord *rec = &_ring[position & (ES_EVENT_LOG_SIZE - 1)];
+    __atomic_store_n(&rec->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rec->contTime = ESTime::currentContinuousTime();
+    rec->type = (unsigned char)type;
+    rec->arg = (unsigned char)(arg > 255 ? 255 : arg);
+    rec->family = family;
+    rec->pad = 0;
+    memset(rec->host, 0, sizeof(rec->host));
+    if (family == AF_INET) {
+        memcpy(rec->host, host, sizeof(struct in_addr));
+    } else if (family == AF_INET6) {
+        memcpy(rec->host, host, sizeof(struct in6_addr));
+    }
+    rec->value2 = value2;
+    rec->pad2 = 0;
+    rec->value = value;
+    __atomic_store_n(&rec->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+/*static*/ void
+ESEventLog::record(ESEventType    type,
+                   int            arg,
+                   ESTimeInterval value,
+                   float          value2) {
+    recordGuts(type, arg, 0, NULL, value, value2);
+}
+
+/*static*/ void
+ESEventLog::recordHost(ESEventType    type,
+                       const void     *sockaddr,
+                       int            arg,
+                       ESTimeInterval value,
+                       float          value2) {
+    unsigned char family = 0;
+    const void *host = NULL;
+    if (sockaddr) {
+        const struct sockaddr_storage *addr = (const struct sockaddr_storage *)sockaddr;
+        if (addr->ss_family == AF_INET) {
+            family = AF_INET;
+            host = &((const struct sockaddr_in *)addr)->sin_addr;
+        } else if (addr->ss_family == AF_INET6) {
+            family = AF_INET6;
+            host = &((const struct sockaddr_in6 *)addr)->sin6_addr;
+        }
+    }
+    recordGuts(type, arg, family, host, value, value2);
+}
+
+/*static*/ std::string
+ESEventLog::dump() {
+    unsigned int end = __atomic_load_n(&_nextPosition, __ATOMIC_ACQUIRE);
+    unsigned int start = end > ES_EVENT_LOG_SIZE ? end - ES_EVENT_LOG_SIZE : 0;
+    std::string result;
+    result.reserve(sizeof(ESEventLogDumpHeader) + (end - start) * sizeof(ESEventRecord));
+    ESEventLogDumpHeader header;
+    memcpy(header.magic, "ESEV", 4);
+    header.version = ES_EVENT_LOG_VERSION;
+    header.recordSize = sizeof(ESEventRecord);
+    header.numRecords = 0;  // Filled in below
+    result.append((const char *)&header, sizeof(header));
+    unsigned int numRecords = 0;
+    for (unsigned int position = start; position != end; position++) {
+        const ESEventRecord *rec = &_ring[position & (ES_EVENT_LOG_SIZE - 1)];
+        unsigned int sequence = __atomic_load_n(&rec->sequence, __ATOMIC_ACQUIRE);
+        ESEventRecord copy = *rec;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (sequence != position + 1 || __atomic_load_n(&rec->sequence, __ATOMIC_RELAXED) != sequence) {
+            continue;  // Being written, or already overwritten by a newer record
+        }
+        result.append((const char *)&copy, sizeof(copy));
+        numRecords++;
+    }
+    ((ESEventLogDumpHeader *)&result[0])->numRecords = numRecords;
+    return result;
+}
+
+/*static*/ bool
+ESEventLog::dumpToFile(const char *path) {
+    std::string bytes = dump();
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        return false;
+    }
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), fp) == bytes.size();
+    return fclose(fp) == 0 && ok;
+}
+
+#endif  // !ES_EVENT_LOG_DECODER
+
+static const char *eventTypeNames[ESEventNumTypes] = {
+    "none",
+    "sync start",
+    "sync stop",
+    "send",
+    "recv",
+    "bad packet",
+    "short timeout",
+    "long timeout",
+    "status",
+    "setContSkew",
+    "timer fire"
+};
+
+static const char *badPacketReasonNames[ESEventNumBadPacketReasons] = {
+    "length",
+    "version",
+    "mode",
+    "stratum",
+    "precision",
+    "root delay",
+    "root dispersion",
+    "timestamps",
+    "send failed"
+};
+
+static void
+appendHost(std::string         &line,
+           const ESEventRecord *rec) {
+    char buf[64];
+    if (rec->family != AF_INET && rec->family != AF_INET6) {
+        return;
+    }
+    if (!inet_ntop(rec->family, rec->host, buf, sizeof(buf))) {
+        snprintf(buf, sizeof(buf), "?");
+    }
+    line += " ";
+    line += buf;
+}
+
+/*static*/ std::string
+ESEventLog::decode(const void *dump,
+                   size_t     length) {
+    if (length < sizeof(ESEventLogDumpHeader)) {
+        return "not an event log dump (too short)\n";
+    }
+    ESEventLogDumpHeader header;
+    memcpy(&header, dump, sizeof(header));
+    if (memcmp(header.magic, "ESEV", 4) != 0 || header.recordSize != sizeof(ESEventRecord)) {
+        return "not an event log dump from this build (bad magic or record size, or written with the other byte order)\n";
+    }
+    if (header.version != ES_EVENT_LOG_VERSION) {
+        return "unsupported event log version\n";
+    }
+    size_t available = (length - sizeof(header)) / sizeof(ESEventRecord);
+    size_t numRecords = header.numRecords < available ? header.numRecords : available;
+    const char *bytes = (const char *)dump + sizeof(header);
+    std::string result;
+    ESTimeInterval firstTime = 0;
+    ESTimeInterval lastTime = 0;
+    char buf[160];
+    for (size_t i = 0; i < numRecords; i++) {
+        ESEventRecord rec;
+        memcpy(&rec, bytes + i * sizeof(ESEventRecord), sizeof(rec));
+        if (i == 0) {
+            firstTime = rec.contTime;
+            lastTime = rec.contTime;
+        }
+        const char *typeName = rec.type < ESEventNumTypes ? eventTypeNames[rec.type] : "?";
+        snprintf(buf, sizeof(buf), "%12.6f %+10.6f  %-13s", rec.contTime - firstTime, rec.contTime - lastTime, typeName);
+        std::string line = buf;
+        appendHost(line, &rec);
+        switch (rec.type) {
+          case ESEventSyncStart:
+            line += rec.value ? " (user requested)" : "";
+            break;
+          case ESEventSyncStop:
+            snprintf(buf, sizeof(buf), " after %.3f s, %.0f packets", rec.value, rec.value2);
+            line += buf;
+            break;
+          case ESEventRecv:
+            snprintf(buf, sizeof(buf), " stratum %d offset %.6f rtt %.6f", rec.arg, rec.value, rec.value2);
+            line += buf;
+            break;
+          case ESEventBadPacket:
+            line += " ";
+            line += rec.arg < ESEventNumBadPacketReasons ? badPacketReasonNames[rec.arg] : "?";
+            break;
+          case ESEventLongTimeout:
+            snprintf(buf, sizeof(buf), " %d send(s) expired", rec.arg);
+            line += buf;
+            break;
+          case ESEventStatusChange:
+            snprintf(buf, sizeof(buf), " -> %d", rec.arg);
+            line += buf;
+            break;
+          case ESEventSetContSkew:
+            snprintf(buf, sizeof(buf), " %.6f +- %.6f", rec.value, rec.value2);
+            line += buf;
+            break;
+          case ESEventTimerFire:
+            snprintf(buf, sizeof(buf), " %d timer(s), latency %.6f", rec.arg, rec.value);
+            line += buf;
+            break;
+          default:
+            break;
+        }
+        result += line;
+        result += "\n";
+        lastTime = rec.contTime;
+    }
+    return result;
+}
+
+#ifdef ES_EVENT_LOG_DECODER
+// Offline decoder:  c++ -DES_EVENT_LOG_DECODER -I<esutil>/src ESEventLog.cpp -o eseventlog; eseventlog dumpfile
+int
+main(int  argc,
+     char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <event log dump>\n", argv[0]);
+        return 1;
+    }
+    FILE *fp = fopen(argv[1], "rb");
+    if (!fp) {
+        perror(argv[1]);
+        return 1;
+    }
+    std::string bytes;
+    char buf[8192];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        bytes.append(buf, n);
+    }
+    fclose(fp);
+    fputs(ESEventLog::decode(bytes.data(), bytes.size()).c_str(), stdout);
+    return 0;
+}
+#endif  // ES_EVENT_LOG_DECODER
@@ -0,0 +1,98 @@
+//
+//  ESEventLog.hpp
+//
+//  Copyright Emerald Sequoia LLC 2011. All rights reserved.
+//
+
+#ifndef _ESEVENTLOG_HPP_
+#define _ESEVENTLOG_HPP_
+
+#include "ESTime.hpp"  // For ESTimeInterval
+
+#include <string>
+
+#define ES_EVENT_LOG_SIZE 4096  /* Records in the ring; must be a power of two (at 48 bytes each, 192K) */
+
+enum ESEventType {
+    ESEventNone,
+    ESEventSyncStart,           // value: 1 if user requested
+    ESEventSyncStop,            // value: seconds since the sync started, value2: packets sent
+    ESEventSend,                // host
+    ESEventRecv,                // host, arg: stratum, value: offset, value2: round-trip time
+    ESEventBadPacket,           // host, arg: ESEventBadPacketReason
+    ESEventShortTimeout,        // host
+    ESEventLongTimeout,         // host, arg: number of sends expired
+    ESEventStatusChange,        // arg: new ESTimeSourceStatus
+    ESEventSetContSkew,         // value: new contSkew, value2: error
+    ESEventTimerFire,           // arg: number of timers lapsed (up to 255), value: latency of the earliest one
+    ESEventNumTypes
+};
+
+enum ESEventBadPacketReason {
+    ESEventBadLength,
+    ESEventBadVersion,
+    ESEventBadMode,
+    ESEventBadStratum,
+    ESEventBadPrecision,
+    ESEventBadRootDelay,
+    ESEventBadRootDispersion,
+    ESEventBadTimeStamps,
+    ESEventBadSend,
+    ESEventNumBadPacketReasons
+};
+
+// Fixed-size record; the dump is an ESEventLogDumpHeader followed by these, oldest first, in the writer's byte order
+struct ESEventRecord {
+    ESTimeInterval          contTime;   // ESTime::currentContinuousTime() when recorded
+    unsigned int            sequence;   // Position in the log plus one; zero while the record is being written
+    unsigned char           type;       // ESEventType
+    unsigned char           arg;
+    unsigned char           family;     // AF_INET or AF_INET6 if host is set, else 0
+    unsigned char           pad;
+    unsigned char           host[16];   // The address in network order:  IPv4 in the first four bytes, or all of an IPv6 one
+    float                   value2;
+    unsigned int            pad2;
+    double                  value;
+};
+
+struct ESEventLogDumpHeader {
+    char                    magic[4];   // "ESEV"
+    unsigned int            version;
+    unsigned int            recordSize;
+    unsigned int            numRecords;
+};
+
+/*! An always-on, fixed-size ring of binary event records for the NTP driver and timer thread, cheap enough to leave
+ *  in production builds (no formatting, no allocation, one atomic increment per record).  Dump it when a slow sync
+ *  is reported, and turn the dump into a timeline with decode(), either in the app or offline by building this file
+ *  on its own with -DES_EVENT_LOG_DECODER. */
+class ESEventLog {
+  public:
+    static void             record(ESEventType    type,
+                                   int            arg = 0,
+                                   ESTimeInterval value = 0,
+                                   float          value2 = 0);
+    static void             recordHost(ESEventType        type,
+                                       const void         *sockaddr,  // A struct sockaddr_storage, or NULL
+                                       int                arg = 0,
+                                       ESTimeInterval     value = 0,
+                                       float              value2 = 0);
+
+    static std::string      dump();  // Binary:  the header and the records still in the ring, oldest first
+    static bool             dumpToFile(const char *path);
+    static std::string      decode(const void *dump,  // Text:  one line per record, with times relative to the first
+                                   size_t     length);
+
+  private:
+    static void             recordGuts(ESEventType    type,
+                                       int            arg,
+                                       unsigned char  family,
+                                       const void     *host,    // family's address size, or NULL
+                                       ESTimeInterval value,
+                                       float          value2);
+
+    static ESEventRecord    _ring[ES_EVENT_LOG_SIZE];
+    static unsigned int     _nextPosition;
+};
+
+#endif  // _ESEVENTLOG_HPP_
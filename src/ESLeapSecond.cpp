@@ -7,7 +7,12 @@
 
 #include "ESTime.hpp"
 #include "ESLeapSecond.hpp"
-#include "assert.h"
+#include "ESErrorReporter.hpp"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
 
 // This table generated automatically from Wikipedia
 // via the script ./getLeapSeconds.pl
@@ -43,104 +48,212 @@ ESLeapSecond::_leapSecondTable[] = {
   {     504921600,   1,   27 },   // 2017 Jan 01 00:00:00
 };
 
-/*static*/ ESLeapSecondEvent *
-ESLeapSecond::_cacheLastEvent = ESLeapSecond::_leapSecondTable;
+// The lookup structure built from a list of events.  Leap seconds happen only at 00:00:00 UTC, so a dense index by
+// day (about 16K entries for 1972-2017) turns every query into a subtraction, a ceil(), and two array references,
+// with no search and no mutable cache.  A table is never modified or freed once published, so readers need no lock.
+struct ESLeapSecondTable {
+    std::vector<ESLeapSecondEvent> events;    // events[0] is a sentinel for "before the first leap second";
+                                              // the last is a sentinel at ESFarFarInTheFuture
+    std::vector<unsigned char> eventForDay;   // Index into events of the last one strictly before the UTC; see dayIndex()
+    ESTimeInterval          firstTransition;
+    int                     maxDayIndex;
+    ESTimeInterval          expirationDate;   // From the list's "#@" line, or 0
+
+    // 0 for utc <= firstTransition; d + 1 for utc in (firstTransition + d * 86400, firstTransition + (d + 1) * 86400];
+    // maxDayIndex for everything after the last transition
+    int                     dayIndex(ESTimeInterval utc) const {
+        double k = ceil((utc - firstTransition) * (1 / 86400.0));
+        k = k > maxDayIndex ? maxDayIndex : k;
+        return k >= 0 ? (int)k : 0;  // (also catches NaN)
+    }
+    const ESLeapSecondEvent *priorEvent(ESTimeInterval utc) const {
+        return &events[eventForDay[dayIndex(utc)]];
+    }
+};
+
+/*static*/ const ESLeapSecondTable *ESLeapSecond::_table = NULL;
+/*static*/ unsigned int            ESLeapSecond::_tableGeneration = 0;
+
+#define ESSecondsPerDay 86400
+#define ESLeapSecondsListNTPOffset (2208988800.0 + ESTIME_EPOCH)  // NTP seconds (since 1900) at the ESTime epoch
+
+// Returns NULL if the events aren't in order or don't fall on day boundaries
+/*static*/ ESLeapSecondTable *
+ESLeapSecond::buildTable(const ESLeapSecondEvent *events,
+                         int                     numEvents) {
+    if (numEvents < 1 || numEvents > 250) {
+        return NULL;
+    }
+    ESTimeInterval firstTransition = events[0].beginningOfChange;
+    for (int i = 0; i < numEvents; i++) {
+        if (fmod(events[i].beginningOfChange - firstTransition, ESSecondsPerDay) != 0 ||
+            (i > 0 && events[i].beginningOfChange <= events[i - 1].beginningOfChange)) {
+            return NULL;
+        }
+    }
+    ESLeapSecondTable *table = new ESLeapSecondTable;
+    table->firstTransition = firstTransition;
+    table->expirationDate = 0;
+    ESLeapSecondEvent sentinel = { -ESFarFarInTheFuture, 0, 0 };
+    table->events.push_back(sentinel);
+    table->events.insert(table->events.end(), events, events + numEvents);
+    ESLeapSecondEvent endSentinel = { ESFarFarInTheFuture, 0, events[numEvents - 1].cumulativeLeapSeconds };
+    table->events.push_back(endSentinel);
+    int numDays = (int)((events[numEvents - 1].beginningOfChange - firstTransition) / ESSecondsPerDay);
+    table->maxDayIndex = numDays + 1;
+    table->eventForDay.resize(numDays + 2);
+    table->eventForDay[0] = 0;
+    int eventIndex = 1;  // events[1] is the first real one, at day 0
+    for (int k = 1; k <= numDays + 1; k++) {
+        ESTimeInterval dayStart = firstTransition + (k - 1) * (ESTimeInterval)ESSecondsPerDay;  // Everything in day index k is after this
+        while (eventIndex + 1 <= numEvents && table->events[eventIndex + 1].beginningOfChange <= dayStart) {
+            eventIndex++;
+        }
+        table->eventForDay[k] = (unsigned char)eventIndex;
+    }
+    return table;
+}
 
-/*static*/ void
-ESLeapSecond::findAndCacheEventPriorTo(ESTimeInterval utc) {
+/*static*/ const ESLeapSecondTable *
+ESLeapSecond::currentTable() {
+    const ESLeapSecondTable *table = __atomic_load_n(&_table, __ATOMIC_ACQUIRE);
+    if (table) {
+        return table;
+    }
     // Sanity checks to make sure we copied the table correctly
-    assert(_leapSecondTable[0].beginningOfChange == ESFirstLeapSecondTransition);
-    assert(_leapSecondTable[ESNumberOfLeapSecondEntries - 1].beginningOfChange == ESLastLeapSecondTransition);
-    assert(_leapSecondTable[ESNumberOfLeapSecondEntries - 1].cumulativeLeapSeconds == ESTotalLeapSeconds);
-    // Ensure we don't try to call if we're before the first event or after the last -- catch outside this routine
-    assert(utc > ESFirstLeapSecondTransition);
-    assert(utc <= ESLastLeapSecondTransition);
-    // Check on the cache...
-    assert(_cacheLastEvent - _leapSecondTable < ESNumberOfLeapSecondEntries - 1 && _cacheLastEvent >= _leapSecondTable);  // Never point at the last entry
-    // Binary search:  We know utc is between idx1 and idx2 transition events
-    int idx1 = 0;
-    int idx2 = ESNumberOfLeapSecondEntries - 1;
-    while (idx2 - idx1 > 1) {
-        int pivot = (idx1 + idx2) / 2;
-        if (utc > _leapSecondTable[pivot].beginningOfChange) {
-            idx1 = pivot;
+    ESAssert(_leapSecondTable[0].beginningOfChange == ESFirstLeapSecondTransition);
+    ESAssert(_leapSecondTable[ESNumberOfLeapSecondEntries - 1].beginningOfChange == ESLastLeapSecondTransition);
+    ESAssert(_leapSecondTable[ESNumberOfLeapSecondEntries - 1].cumulativeLeapSeconds == ESTotalLeapSeconds);
+    ESLeapSecondTable *builtIn = buildTable(_leapSecondTable, ESNumberOfLeapSecondEntries);
+    ESAssert(builtIn);
+    const ESLeapSecondTable *expected = NULL;
+    if (!__atomic_compare_exchange_n(&_table, &expected, builtIn, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        delete builtIn;  // Another thread (or a load) got there first, and nobody else has seen ours
+        return expected;
+    }
+    return builtIn;
+}
+
+/*static*/ unsigned int
+ESLeapSecond::tableGeneration() {
+    return __atomic_load_n(&_tableGeneration, __ATOMIC_ACQUIRE);
+}
+
+/*static*/ ESTimeInterval
+ESLeapSecond::expirationDate() {
+    return currentTable()->expirationDate;
+}
+
+// The format:  '#' lines are comments (including the "#$" update time and "#h" hash lines, which we don't check, and the
+// "#@ <NTP seconds>" expiration, which we record); every other line is "<NTP seconds> <TAI - UTC> [# comment]", the
+// first giving the offset in effect from 1972 Jan 1 and each later one a leap second taking effect at that instant.
+/*static*/ bool
+ESLeapSecond::loadLeapSecondsListFromString(const std::string &contents) {
+    std::vector<ESLeapSecondEvent> events;
+    bool haveBase = false;
+    int baseOffset = 0;
+    int lastOffset = 0;
+    ESTimeInterval expiration = 0;
+    size_t pos = 0;
+    while (pos < contents.size()) {
+        size_t end = contents.find('\n', pos);
+        if (end == std::string::npos) {
+            end = contents.size();
+        }
+        std::string line = contents.substr(pos, end - pos);
+        pos = end + 1;
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos) {
+            continue;
+        }
+        if (line[start] == '#') {
+            unsigned long long expirationNTPSeconds;
+            if (line.compare(start, 2, "#@") == 0 && sscanf(line.c_str() + start + 2, "%llu", &expirationNTPSeconds) == 1) {
+                expiration = expirationNTPSeconds - ESLeapSecondsListNTPOffset;
+            }
+            continue;
+        }
+        unsigned long long ntpSeconds;
+        int taiMinusUTC;
+        if (sscanf(line.c_str() + start, "%llu %d", &ntpSeconds, &taiMinusUTC) != 2) {
+            ESErrorReporter::logError("ESLeapSecond", "Unparseable line in leap-seconds.list: '%s'", line.c_str());
+            return false;
+        }
+        if (!haveBase) {
+            haveBase = true;
+            baseOffset = taiMinusUTC;
         } else {
-            idx2 = pivot;
+            ESLeapSecondEvent event;
+            event.beginningOfChange = ntpSeconds - ESLeapSecondsListNTPOffset;
+            event.leapSeconds = taiMinusUTC - lastOffset;
+            event.cumulativeLeapSeconds = taiMinusUTC - baseOffset;
+            events.push_back(event);
         }
-        //printf("Pivot %d => %d\n", idx1, idx2);
+        lastOffset = taiMinusUTC;
+    }
+    ESLeapSecondTable *table = events.empty() ? NULL : buildTable(&events[0], (int)events.size());
+    if (!table) {
+        ESErrorReporter::logError("ESLeapSecond", "leap-seconds.list has no leap seconds, or they're out of order or not at midnight");
+        return false;
+    }
+    if (expiration == 0) {
+        ESErrorReporter::logInfo("ESLeapSecond", "leap-seconds.list has no expiration (#@) line");
+    } else if (expiration < ESTime::currentTime()) {
+        ESErrorReporter::logError("ESLeapSecond", "leap-seconds.list expired %s; any leap second announced since then may be missing",
+                                  ESTime::timeAsString(expiration).c_str());
+    }
+    table->expirationDate = expiration;
+    // The table we replace is leaked:  a reader on another thread may still be looking at it, and loads are rare
+    __atomic_store_n(&_table, table, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&_tableGeneration, 1, __ATOMIC_RELEASE);
+    ESTime::setupNextLeapSecondData();  // Sees the new generation, so recomputes the next leap second and publishes it
+    return true;
+}
+
+/*static*/ bool
+ESLeapSecond::loadLeapSecondsList(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        ESErrorReporter::checkAndLogSystemError("ESLeapSecond", errno, "Opening leap-seconds.list");
+        return false;
+    }
+    std::string contents;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        contents.append(buf, n);
     }
-    assert(idx2 == idx1 + 1);
-    _cacheLastEvent = _leapSecondTable + idx1;
-    assert(idx1 < ESNumberOfLeapSecondEntries - 1);
-    assert(_cacheLastEvent - _leapSecondTable < ESNumberOfLeapSecondEntries - 1 && _cacheLastEvent >= _leapSecondTable);  // Never point at the last entry
-    assert(utc > _cacheLastEvent->beginningOfChange && utc <= (_cacheLastEvent + 1)->beginningOfChange);
+    fclose(fp);
+    return loadLeapSecondsListFromString(contents);
 }
 
 /*static*/ ESTimeInterval 
 ESLeapSecond::cumulativeLeapSecondsForUTC(ESTimeInterval utc) {
-    // Sanity checks to make sure we copied the table correctly
-    assert(_leapSecondTable[0].beginningOfChange == ESFirstLeapSecondTransition);
-    assert(_leapSecondTable[ESNumberOfLeapSecondEntries - 1].beginningOfChange == ESLastLeapSecondTransition);
-    assert(_leapSecondTable[ESNumberOfLeapSecondEntries - 1].cumulativeLeapSeconds == ESTotalLeapSeconds);
-    // Check on the cache...
-    assert(_cacheLastEvent - _leapSecondTable < ESNumberOfLeapSecondEntries - 1 && _cacheLastEvent >= _leapSecondTable);  // Never point at the last entry
-    if (utc > ESLastLeapSecondTransition) {  // By far the most common case
-        return ESTotalLeapSeconds;   // Don't cache here -- the use of the cache looks ahead one, so it will crash if we supply the last item.  No need anyway because of this check
-    } else if (utc <= ESFirstLeapSecondTransition) {  // Not so common but worth ruling out
-        return 0;
-    } else if (utc > _cacheLastEvent->beginningOfChange &&
-               utc <= (_cacheLastEvent + 1)->beginningOfChange) {
-        //printf("returning cache\n");
-        return _cacheLastEvent->cumulativeLeapSeconds;
-    } else {
-        findAndCacheEventPriorTo(utc);
-        return _cacheLastEvent->cumulativeLeapSeconds;
-    }
+    return currentTable()->priorEvent(utc)->cumulativeLeapSeconds;
 }
 
 /*static*/ ESTimeInterval 
 ESLeapSecond::nextLeapSecondAfter(ESTimeInterval utc,
                                   ESTimeInterval *leapSecondDelta) {
-    // Sanity checks to make sure we copied the table correctly
-    assert(_leapSecondTable[0].beginningOfChange == ESFirstLeapSecondTransition);
-    assert(_leapSecondTable[ESNumberOfLeapSecondEntries - 1].beginningOfChange == ESLastLeapSecondTransition);
-    assert(_leapSecondTable[ESNumberOfLeapSecondEntries - 1].cumulativeLeapSeconds == ESTotalLeapSeconds);
-    // Check on the cache...
-    assert(_cacheLastEvent - _leapSecondTable < ESNumberOfLeapSecondEntries - 1 && _cacheLastEvent >= _leapSecondTable);  // Never point at the last entry
-    assert(leapSecondDelta);
-    ESLeapSecondEvent *nextEvent;
-    if (utc > ESLastLeapSecondTransition) {  // The most common case (?)
-        *leapSecondDelta = 0;
-        return ESFarFarInTheFuture;   // (meaning "never").  Don't cache here -- the use of the cache looks ahead one, so it will crash if we supply the last item.
-    } else if (utc <= ESFirstLeapSecondTransition) {  // Not so common but worth ruling out because binary search is easier without this case
-        *leapSecondDelta = _leapSecondTable[0].leapSeconds;
-        return ESFirstLeapSecondTransition;
-    } else if (utc > _cacheLastEvent->beginningOfChange &&
-               utc <= (nextEvent = _cacheLastEvent + 1)->beginningOfChange) {
-        //printf("returning cache\n");
-        *leapSecondDelta = nextEvent->leapSeconds;
-        return nextEvent->beginningOfChange;
-    } else {
-        findAndCacheEventPriorTo(utc);
-        nextEvent = _cacheLastEvent + 1;
-        *leapSecondDelta = nextEvent->leapSeconds;
-        return nextEvent->beginningOfChange;
-    }
+    ESAssert(leapSecondDelta);
+    const ESLeapSecondEvent *nextEvent = currentTable()->priorEvent(utc) + 1;  // Past the last, the sentinel:  "never", with no delta
+    *leapSecondDelta = nextEvent->leapSeconds;
+    return nextEvent->beginningOfChange;
 }
 
 // Convenience function
 /*static*/ ESTimeInterval 
 ESLeapSecond::intervalBetweenUTCValues(ESTimeInterval utc1,
                                        ESTimeInterval utc2) {
-    // We can certainly do better than this:  Find the table entry for utc1 and move forward until you hit utc2, counting leap seconds encountered.
-    // That saves doing two searches.  But... meh.  We have the cache anyway...
-    return utc2 + cumulativeLeapSecondsForUTC(utc2) - (utc1 + cumulativeLeapSecondsForUTC(utc1));
+    const ESLeapSecondTable *table = currentTable();  // Both ends from the same table, even if a load happens in between
+    return utc2 + table->priorEvent(utc2)->cumulativeLeapSeconds - (utc1 + table->priorEvent(utc1)->cumulativeLeapSeconds);
 }
 
 /*static*/ ESTimeInterval 
 ESLeapSecond::leapSecondsDuringInterval(ESTimeInterval utc1,
                                         ESTimeInterval utc2) {
-    return cumulativeLeapSecondsForUTC(utc2) - cumulativeLeapSecondsForUTC(utc1);
+    const ESLeapSecondTable *table = currentTable();
+    return table->priorEvent(utc2)->cumulativeLeapSeconds - table->priorEvent(utc1)->cumulativeLeapSeconds;
 }
 
 /*static*/ ESTimeInterval
@@ -182,5 +295,57 @@ ESTestLeapSecond() {
     dc.year = 2009;
     t = ESCalendar_timeIntervalFromUTCDateComponents(&dc);
     printf("The answer(4) is %.1f\n", ESLeapSecond::cumulativeLeapSecondsForUTC(t));
+
+    // A leap-seconds.list equivalent to the compiled-in table must give the same answers everywhere, including
+    // exactly at each transition (which still belongs to the earlier period)
+    std::string list = "#$ 3676924800\n#@ 3928521600\n2272060800 10 # 1 Jan 1972\n";
+    char line[64];
+    for (int i = 0; i < ESNumberOfLeapSecondEntries; i++) {
+        snprintf(line, sizeof(line), "%.0f %d\n", ESLeapSecond::_leapSecondTable[i].beginningOfChange + ESLeapSecondsListNTPOffset,
+                 10 + (int)ESLeapSecond::_leapSecondTable[i].cumulativeLeapSeconds);
+        list += line;
+    }
+    ESTimeInterval probes[] = { -1e12, ESFirstLeapSecondTransition - 0.5, 0, 1e12 };
+    ESTimeInterval before[ESNumberOfLeapSecondEntries * 3 + 4];
+    ESTimeInterval nextBefore[ESNumberOfLeapSecondEntries * 3 + 4];
+    int n = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            unsigned int generation = ESLeapSecond::tableGeneration();
+            bool loaded = ESLeapSecond::loadLeapSecondsListFromString(list);
+            ESAssert(loaded && ESLeapSecond::tableGeneration() == generation + 1);
+        }
+        int i = 0;
+        for (int e = 0; e < ESNumberOfLeapSecondEntries; e++) {
+            for (int d = -1; d <= 1; d++) {
+                ESTimeInterval utc = ESLeapSecond::_leapSecondTable[e].beginningOfChange + d * 0.25;
+                ESTimeInterval delta;
+                ESTimeInterval cum = ESLeapSecond::cumulativeLeapSecondsForUTC(utc);
+                ESTimeInterval next = ESLeapSecond::nextLeapSecondAfter(utc, &delta);
+                ESAssert(cum == ESLeapSecond::_leapSecondTable[e].cumulativeLeapSeconds - (d <= 0));
+                if (pass == 0) {
+                    before[i] = cum;
+                    nextBefore[i] = next;
+                } else {
+                    ESAssert(before[i] == cum && nextBefore[i] == next);
+                }
+                i++;
+            }
+        }
+        for (size_t p = 0; p < sizeof(probes) / sizeof(probes[0]); p++) {
+            ESTimeInterval delta;
+            ESTimeInterval cum = ESLeapSecond::cumulativeLeapSecondsForUTC(probes[p]);
+            ESTimeInterval next = ESLeapSecond::nextLeapSecondAfter(probes[p], &delta);
+            if (pass == 0) {
+                before[i] = cum;
+                nextBefore[i] = next;
+            } else {
+                ESAssert(before[i] == cum && nextBefore[i] == next);
+            }
+            i++;
+        }
+        n = i;
+    }
+    printf("Leap-second table load matched the compiled-in table at %d points\n", n);
 }
 #endif // ESLEAPSECOND_TEST
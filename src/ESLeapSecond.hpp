@@ -8,6 +8,8 @@
 #ifndef _ESLEAPSECOND_HPP_
 #define _ESLEAPSECOND_HPP_
 
+#include <string>
+
 /*! Internal data structure and constants */
 struct ESLeapSecondEvent {
     ESTimeInterval          beginningOfChange;
@@ -19,6 +21,8 @@ struct ESLeapSecondEvent {
 #define ESFirstLeapSecondTransition -899510400
 #define ESLastLeapSecondTransition 504921600
 
+struct ESLeapSecondTable;  // Immutable once built; see ESLeapSecond.cpp
+
 /*! Leap-second data needed for interval timing */
 class ESLeapSecond {
   public:
@@ -38,18 +42,27 @@ class ESLeapSecond {
                                                                             ESTimeInterval utc2,
                                                                             ESTimeInterval liveLeapSecondCorrection2);
 
+    // Replace the compiled-in table with the one in an IERS/NIST leap-seconds.list file (e.g., from
+    // https://hpiers.obspm.fr/iers/bul/bulc/ntp/leap-seconds.list).  Returns false, leaving the current table in place,
+    // if the file can't be read or doesn't parse.  May be called from any thread; ESTime's next-leap-second data (and
+    // its snapshot) are updated before this returns.  An expired list is still loaded, but logged.
+    static bool             loadLeapSecondsList(const char *path);
+    static bool             loadLeapSecondsListFromString(const std::string &contents);
+
+    static unsigned int     tableGeneration();  // Bumped by each successful load, so cached answers can be invalidated
+    static ESTimeInterval   expirationDate();   // From the loaded list's "#@" line; 0 if none (as for the compiled-in table)
+
   private:
-    // shh ... this should be private but then we couldn't use it as the static initialization of _cacheLastEvent (or can we...)
-    static ESLeapSecondEvent _leapSecondTable[ESNumberOfLeapSecondEntries];
+    static ESLeapSecondEvent _leapSecondTable[ESNumberOfLeapSecondEntries];  // Compiled in; the default table
 
-    static void             findAndCacheEventPriorTo(ESTimeInterval utc);
+    static const ESLeapSecondTable *currentTable();
+    static ESLeapSecondTable *buildTable(const ESLeapSecondEvent *events,
+                                         int                     numEvents);
 
-    // Caching for nextLeapSecondAfter
-    static ESTimeInterval   _lastCheckNextLeapSecond;
-    static ESTimeInterval   _lastAnswerNextLeapSecond;
+    static const ESLeapSecondTable *_table;  // Built lazily from _leapSecondTable, or replaced by a load
+    static unsigned int     _tableGeneration;
 
-    // General caching
-    static ESLeapSecondEvent *_cacheLastEvent;
+friend void ESTestLeapSecond();
 };
 
 #undef ESLEAPSECOND_TEST
@@ -0,0 +1,320 @@
+//
+//  ESMetrics.cpp
+//
+//  Copyright Emerald Sequoia LLC 2011. All rights reserved.
+//
+
+#include "ESMetrics.hpp"
+#include "ESErrorReporter.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ES_METRICS_BINARY_VERSION 1
+
+/*static*/ ESMetric *ESMetrics::_metrics[ES_METRICS_MAX];
+/*static*/ int       ESMetrics::_numMetrics = 0;
+
+ESMetric::ESMetric(const char   *name,
+                   const char   *unit,
+                   ESMetricType type)
+:   _name(name),
+    _unit(unit),
+    _type(type)
+{
+    ESMetrics::registerMetric(this);
+}
+
+ESMetricCounter::ESMetricCounter(const char *name)
+:   ESMetric(name, "", ESMetricTypeCounter),
+    _value(0)
+{
+}
+
+ESMetricHistogram::ESMetricHistogram(const char *name,
+                                     const char *unit,
+                                     double     firstBound,
+                                     double     ratio)
+:   ESMetric(name, unit, ESMetricTypeHistogram),
+    _scaledSum(0)
+{
+    ESAssert(firstBound > 0 && ratio > 1);
+    double bound = firstBound;
+    for (int i = 0; i < ES_METRIC_HISTOGRAM_BUCKETS - 1; i++) {
+        _bounds[i] = bound;
+        _counts[i] = 0;
+        bound *= ratio;
+    }
+    _bounds[ES_METRIC_HISTOGRAM_BUCKETS - 1] = INFINITY;
+    _counts[ES_METRIC_HISTOGRAM_BUCKETS - 1] = 0;
+}
+
+void
+ESMetricHistogram::record(double value) {
+    int bucket = 0;
+    while (bucket < ES_METRIC_HISTOGRAM_BUCKETS - 1 && value > _bounds[bucket]) {
+        bucket++;
+    }
+    __sync_fetch_and_add(&_counts[bucket], 1);
+    __sync_fetch_and_add(&_scaledSum, (long long)llround(value * ES_METRIC_SUM_SCALE));
+}
+
+unsigned long long
+ESMetricHistogram::count() const {
+    unsigned long long total = 0;
+    for (int i = 0; i < ES_METRIC_HISTOGRAM_BUCKETS; i++) {
+        total += bucketCount(i);
+    }
+    return total;
+}
+
+double
+ESMetricHistogram::sum() const {
+    return __atomic_load_n(&_scaledSum, __ATOMIC_RELAXED) / ES_METRIC_SUM_SCALE;
+}
+
+double
+ESMetricHistogram::mean() const {
+    unsigned long long n = count();
+    return n ? sum() / n : 0;
+}
+
+/*static*/ void
+ESMetrics::registerMetric(ESMetric *metric) {
+    int slot = __sync_fetch_and_add(&_numMetrics, 1);
+    ESAssert(slot < ES_METRICS_MAX);  // Raise ES_METRICS_MAX
+    if (slot < ES_METRICS_MAX) {
+        _metrics[slot] = metric;
+    }
+}
+
+// Each value is read atomically, but the metrics (and a histogram's buckets and sum) aren't read at one instant
+/*static*/ void
+ESMetrics::snapshot(ESMetricsSnapshot *snapshot) {
+    snapshot->clear();
+    int numMetrics = _numMetrics < ES_METRICS_MAX ? _numMetrics : ES_METRICS_MAX;
+    snapshot->resize(numMetrics);
+    for (int i = 0; i < numMetrics; i++) {
+        const ESMetric *metric = _metrics[i];
+        ESMetricValue &value = (*snapshot)[i];
+        value.name = metric->name();
+        value.unit = metric->unit();
+        value.type = metric->type();
+        if (value.type == ESMetricTypeCounter) {
+            value.count = ((const ESMetricCounter *)metric)->value();
+            value.sum = 0;
+        } else {
+            const ESMetricHistogram *histogram = (const ESMetricHistogram *)metric;
+            value.bounds.resize(ES_METRIC_HISTOGRAM_BUCKETS);
+            value.bucketCounts.resize(ES_METRIC_HISTOGRAM_BUCKETS);
+            value.count = 0;
+            for (int b = 0; b < ES_METRIC_HISTOGRAM_BUCKETS; b++) {
+                value.bounds[b] = histogram->bound(b);
+                value.bucketCounts[b] = histogram->bucketCount(b);
+                value.count += value.bucketCounts[b];
+            }
+            value.sum = histogram->sum();
+        }
+    }
+}
+
+/*static*/ std::string
+ESMetrics::exportText(const ESMetricsSnapshot &snapshot) {
+    std::string result;
+    char buf[128];
+    size_t numMetrics = snapshot.size();
+    for (size_t i = 0; i < numMetrics; i++) {
+        const ESMetricValue &value = snapshot[i];
+        result += value.name;
+        if (value.type == ESMetricTypeCounter) {
+            snprintf(buf, sizeof(buf), " %llu", value.count);
+            result += buf;
+        } else {
+            snprintf(buf, sizeof(buf), " count %llu mean %.6g %s", value.count, value.count ? value.sum / value.count : 0.0, value.unit.c_str());
+            result += buf;
+            size_t numBuckets = value.bucketCounts.size();
+            for (size_t b = 0; b < numBuckets; b++) {
+                if (value.bucketCounts[b]) {
+                    if (b == numBuckets - 1) {
+                        snprintf(buf, sizeof(buf), " >%.3g:%llu", value.bounds[b - 1], value.bucketCounts[b]);
+                    } else {
+                        snprintf(buf, sizeof(buf), " <=%.3g:%llu", value.bounds[b], value.bucketCounts[b]);
+                    }
+                    result += buf;
+                }
+            }
+        }
+        result += "\n";
+    }
+    return result;
+}
+
+static void
+appendVarint(std::string        &out,
+             unsigned long long value) {
+    while (value >= 0x80) {
+        out += (char)((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+static void
+appendDouble(std::string &out,
+             double      value) {  // Little-endian IEEE, whatever the host
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof(bits));
+    for (int i = 0; i < 8; i++) {
+        out += (char)((bits >> (8 * i)) & 0xff);
+    }
+}
+
+static void
+appendString(std::string       &out,
+             const std::string &value) {
+    appendVarint(out, value.size());
+    out += value;
+}
+
+// Format:  "ESMT", then varints and little-endian doubles:
+//   version, number of metrics, then for each:  name, unit (varint length + bytes), type (varint), count;
+//   and for a histogram:  sum, first bound, ratio, number of buckets, number of nonempty buckets,
+//   and (bucket index, count) for each nonempty bucket
+/*static*/ std::string
+ESMetrics::exportBinary(const ESMetricsSnapshot &snapshot) {
+    std::string out("ESMT");
+    appendVarint(out, ES_METRICS_BINARY_VERSION);
+    appendVarint(out, snapshot.size());
+    size_t numMetrics = snapshot.size();
+    for (size_t i = 0; i < numMetrics; i++) {
+        const ESMetricValue &value = snapshot[i];
+        appendString(out, value.name);
+        appendString(out, value.unit);
+        appendVarint(out, value.type);
+        appendVarint(out, value.count);
+        if (value.type == ESMetricTypeHistogram) {
+            ESAssert(value.bounds.size() >= 2);
+            appendDouble(out, value.sum);
+            appendDouble(out, value.bounds[0]);
+            appendDouble(out, value.bounds[1] / value.bounds[0]);
+            size_t numBuckets = value.bucketCounts.size();
+            appendVarint(out, numBuckets);
+            size_t numNonEmpty = 0;
+            for (size_t b = 0; b < numBuckets; b++) {
+                if (value.bucketCounts[b]) {
+                    numNonEmpty++;
+                }
+            }
+            appendVarint(out, numNonEmpty);
+            for (size_t b = 0; b < numBuckets; b++) {
+                if (value.bucketCounts[b]) {
+                    appendVarint(out, b);
+                    appendVarint(out, value.bucketCounts[b]);
+                }
+            }
+        }
+    }
+    return out;
+}
+
+// Bounds-checked reader for importBinary()
+struct ESMetricsReader {
+    const std::string       &in;
+    size_t                  pos;
+    bool                    ok;
+
+                            ESMetricsReader(const std::string &input) : in(input), pos(0), ok(true) {}
+
+    unsigned long long      varint() {
+        unsigned long long value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos >= in.size()) {
+                ok = false;
+                return 0;
+            }
+            unsigned char c = (unsigned char)in[pos++];
+            value |= (unsigned long long)(c & 0x7f) << shift;
+            if (!(c & 0x80)) {
+                return value;
+            }
+        }
+        ok = false;
+        return 0;
+    }
+    double                  dbl() {
+        if (pos + 8 > in.size()) {
+            ok = false;
+            return 0;
+        }
+        unsigned long long bits = 0;
+        for (int i = 0; i < 8; i++) {
+            bits |= (unsigned long long)(unsigned char)in[pos++] << (8 * i);
+        }
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    std::string             str() {
+        unsigned long long len = varint();
+        if (!ok || len > in.size() - pos) {
+            ok = false;
+            return "";
+        }
+        std::string value = in.substr(pos, (size_t)len);
+        pos += (size_t)len;
+        return value;
+    }
+};
+
+/*static*/ bool
+ESMetrics::importBinary(const std::string &binary,
+                        ESMetricsSnapshot *snapshot) {
+    snapshot->clear();
+    if (binary.size() < 4 || binary.compare(0, 4, "ESMT") != 0) {
+        return false;
+    }
+    ESMetricsReader reader(binary);
+    reader.pos = 4;
+    if (reader.varint() != ES_METRICS_BINARY_VERSION) {
+        return false;
+    }
+    unsigned long long numMetrics = reader.varint();
+    for (unsigned long long i = 0; reader.ok && i < numMetrics; i++) {
+        ESMetricValue value;
+        value.name = reader.str();
+        value.unit = reader.str();
+        value.type = (ESMetricType)reader.varint();
+        value.count = reader.varint();
+        value.sum = 0;
+        if (value.type == ESMetricTypeHistogram) {
+            value.sum = reader.dbl();
+            double bound = reader.dbl();
+            double ratio = reader.dbl();
+            unsigned long long numBuckets = reader.varint();
+            if (!reader.ok || numBuckets < 2 || numBuckets > 1024) {
+                return false;
+            }
+            value.bounds.resize((size_t)numBuckets);
+            value.bucketCounts.assign((size_t)numBuckets, 0);
+            for (size_t b = 0; b < numBuckets - 1; b++) {
+                value.bounds[b] = bound;
+                bound *= ratio;
+            }
+            value.bounds[numBuckets - 1] = INFINITY;
+            unsigned long long numNonEmpty = reader.varint();
+            for (unsigned long long n = 0; reader.ok && n < numNonEmpty; n++) {
+                unsigned long long b = reader.varint();
+                unsigned long long count = reader.varint();
+                if (b >= numBuckets) {
+                    return false;
+                }
+                value.bucketCounts[(size_t)b] = count;
+            }
+        } else if (value.type != ESMetricTypeCounter) {
+            return false;
+        }
+        snapshot->push_back(value);
+    }
+    return reader.ok;
+}
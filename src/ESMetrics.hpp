@@ -0,0 +1,105 @@
+//
+//  ESMetrics.hpp
+//
+//  Copyright Emerald Sequoia LLC 2011. All rights reserved.
+//
+
+#ifndef _ESMETRICS_HPP_
+#define _ESMETRICS_HPP_
+
+#include <string>
+#include <vector>
+
+#define ES_METRICS_MAX               32  /* Registered metrics, total */
+#define ES_METRIC_HISTOGRAM_BUCKETS  24  /* Including the overflow bucket */
+#define ES_METRIC_SUM_SCALE         1e6  /* Histogram sums are kept in millionths of the unit, so they can be added atomically */
+
+enum ESMetricType {
+    ESMetricTypeCounter,
+    ESMetricTypeHistogram
+};
+
+/*! Base class for the metrics below.  Metrics are meant to be file-static objects in the module that records them;
+ *  each one registers itself (during static initialization) with ESMetrics so they can be exported together. */
+class ESMetric {
+  public:
+    const char              *name() const { return _name; }
+    const char              *unit() const { return _unit; }
+    ESMetricType            type() const { return _type; }
+
+  protected:
+                            ESMetric(const char   *name,
+                                     const char   *unit,
+                                     ESMetricType type);
+
+  private:
+    const char              *_name;
+    const char              *_unit;
+    ESMetricType            _type;
+};
+
+/*! A lock-free count of something that happened */
+class ESMetricCounter : public ESMetric {
+  public:
+                            ESMetricCounter(const char *name);
+    void                    add(unsigned long long n = 1) { __sync_fetch_and_add(&_value, n); }
+    unsigned long long      value() const { return __atomic_load_n(&_value, __ATOMIC_RELAXED); }
+
+  private:
+    unsigned long long      _value;
+};
+
+/*! A lock-free distribution over fixed buckets:  the first bucket holds values up to firstBound, each later one
+ *  values up to ratio times the previous bound, and the last everything bigger */
+class ESMetricHistogram : public ESMetric {
+  public:
+                            ESMetricHistogram(const char *name,
+                                              const char *unit,
+                                              double     firstBound,
+                                              double     ratio);
+    void                    record(double value);
+
+    unsigned long long      count() const;
+    double                  sum() const;
+    double                  mean() const;
+    double                  bound(int bucket) const { return _bounds[bucket]; }  // Upper bound; the last is infinite
+    unsigned long long      bucketCount(int bucket) const { return __atomic_load_n(&_counts[bucket], __ATOMIC_RELAXED); }
+
+  private:
+    double                  _bounds[ES_METRIC_HISTOGRAM_BUCKETS];
+    unsigned long long      _counts[ES_METRIC_HISTOGRAM_BUCKETS];
+    long long               _scaledSum;
+};
+
+// A point-in-time copy of one metric
+struct ESMetricValue {
+    std::string             name;
+    std::string             unit;
+    ESMetricType            type;
+    unsigned long long      count;  // The counter's value, or the number of values recorded in the histogram
+    double                  sum;    // Histogram only
+    std::vector<double>     bounds; // Histogram only
+    std::vector<unsigned long long> bucketCounts;  // Histogram only
+};
+
+typedef std::vector<ESMetricValue> ESMetricsSnapshot;
+
+/*! The registry of every metric in the process */
+class ESMetrics {
+  public:
+    static void             snapshot(ESMetricsSnapshot *snapshot);
+    static std::string      exportText(const ESMetricsSnapshot &snapshot);    // One line per metric; histograms list only the nonempty buckets
+    static std::string      exportBinary(const ESMetricsSnapshot &snapshot);  // Compact:  varint counts, empty buckets run-length skipped
+    static bool             importBinary(const std::string &binary,           // For the collecting end of exportBinary()
+                                         ESMetricsSnapshot *snapshot);
+
+  private:
+    static void             registerMetric(ESMetric *metric);
+
+    static ESMetric         *_metrics[ES_METRICS_MAX];  // Zero-initialized before any constructor runs, so registration order doesn't matter
+    static int              _numMetrics;
+
+friend class ESMetric;
+};
+
+#endif  // _ESMETRICS_HPP_
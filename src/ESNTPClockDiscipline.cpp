@@ -0,0 +1,178 @@
+//
+//  ESNTPClockDiscipline.cpp
+//
+//  Copyright Emerald Sequoia LLC 2011. All rights reserved.
+//
+
+#include "ESNTPClockDiscipline.hpp"
+#include "ESTrace.hpp"
+
+#include <math.h>
+
+// All times below are in seconds
+#define ES_DISCIPLINE_MIN_POLL_LOG2          12       /* 4096 seconds: the shortest interval between syncs, no shorter than ES_FIX_TIMEOUT without the discipline */
+#define ES_DISCIPLINE_MAX_POLL_LOG2          17       /* ~36 hours: the longest */
+#define ES_DISCIPLINE_STEPOUT             900.0       /* Don't measure the frequency directly over an interval shorter than this (ntpd's clock_minstep) */
+#define ES_DISCIPLINE_STEP_THRESHOLD        1.0       /* A residual bigger than this means the time base jumped (e.g., sleep); start the frequency measurement over */
+#define ES_DISCIPLINE_MAX_FREQUENCY       500e-6      /* ntpd's NTP_MAXFREQ */
+#define ES_DISCIPLINE_UNLOCKED_FREQ_ERROR 100e-6      /* Presumed frequency error before we've measured it (a poor crystal) */
+#define ES_DISCIPLINE_WANDER                1e-6      /* Presumed random walk of the frequency, per square-root day */
+#define ES_DISCIPLINE_MIN_JITTER          0.001       /* Floor on the jitter estimate, so a lucky run of samples doesn't close the poll gate */
+#define ES_DISCIPLINE_AVG                   8.0       /* ntpd's CLOCK_AVG: the averaging constant for jitter */
+#define ES_DISCIPLINE_PGATE                 4.0       /* ntpd's CLOCK_PGATE: residuals under this many jitters count toward a longer poll */
+#define ES_DISCIPLINE_LIMIT                  30       /* ntpd's CLOCK_LIMIT: the poll-adjust threshold */
+#define ES_DISCIPLINE_MAX_PREDICTED_ERROR   0.5       /* Sync again before the predicted error grows past this */
+
+ESNTPClockDiscipline::ESNTPClockDiscipline() {
+    reset();
+}
+
+void
+ESNTPClockDiscipline::reset() {
+    _state = ESNTPDisciplineNoSample;
+    _sampleTime = 0;
+    _sampleSkew = 0;
+    _sampleError = 0;
+    _baseTime = 0;
+    _baseSkew = 0;
+    _baseError = 0;
+    _frequency = 0;
+    _stability = ES_DISCIPLINE_UNLOCKED_FREQ_ERROR;
+    _jitter = ES_DISCIPLINE_MIN_JITTER;
+    _pollLog2 = ES_DISCIPLINE_MIN_POLL_LOG2;
+    _pollCounter = 0;
+}
+
+static double
+clampFrequency(double frequency) {
+    if (frequency > ES_DISCIPLINE_MAX_FREQUENCY) {
+        return ES_DISCIPLINE_MAX_FREQUENCY;
+    } else if (frequency < -ES_DISCIPLINE_MAX_FREQUENCY) {
+        return -ES_DISCIPLINE_MAX_FREQUENCY;
+    }
+    return frequency;
+}
+
+void
+ESNTPClockDiscipline::addSample(ESTimeInterval contTime,
+                                ESTimeInterval skew,
+                                ESTimeInterval error) {
+    ESTimeInterval residual = skew - predictedSkew(contTime);
+    if (_state != ESNTPDisciplineNoSample && fabs(residual) > ES_DISCIPLINE_STEP_THRESHOLD) {
+        // Keep the frequency (the crystal didn't change), but measure it again from here
+        tracePrintf2("discipline: residual %.3f after %.0f seconds is a step; remeasuring frequency", residual, contTime - _sampleTime);
+        _state = ESNTPDisciplineNoSample;
+        _pollLog2 = ES_DISCIPLINE_MIN_POLL_LOG2;
+        _pollCounter = 0;
+    }
+    switch (_state) {
+      case ESNTPDisciplineNoSample:
+        _baseTime = contTime;
+        _baseSkew = skew;
+        _baseError = error;
+        _jitter = error > ES_DISCIPLINE_MIN_JITTER ? error : ES_DISCIPLINE_MIN_JITTER;  // The best guess at the noise we'll see
+        _state = ESNTPDisciplineFrequencyPending;
+        break;
+
+      case ESNTPDisciplineFrequencyPending:
+        {
+            // Like ntpd's EVNT_FREQ state: wait for the stepout, then compute the frequency directly
+            ESTimeInterval mu = contTime - _baseTime;
+            if (mu < ES_DISCIPLINE_STEPOUT) {
+                break;
+            }
+            ESTimeInterval baseResidual = skew - (_baseSkew + _frequency * mu);
+            _frequency = clampFrequency(_frequency + baseResidual / mu);
+            _stability = (error + _baseError) / mu;
+            _state = ESNTPDisciplineLocked;
+            tracePrintf3("discipline: frequency %.3f ppm +- %.3f ppm measured over %.0f seconds", _frequency * 1e6, _stability * 1e6, mu);
+        }
+        break;
+
+      case ESNTPDisciplineLocked:
+        {
+            ESTimeInterval mu = contTime - _sampleTime;
+            if (mu <= 0) {
+                break;
+            }
+            double residualSquared = residual * residual;
+            double minJitterSquared = ES_DISCIPLINE_MIN_JITTER * ES_DISCIPLINE_MIN_JITTER;
+            double jitterSquared = _jitter * _jitter;
+            _jitter = sqrt(jitterSquared + ((residualSquared > minJitterSquared ? residualSquared : minJitterSquared) - jitterSquared) / ES_DISCIPLINE_AVG);
+
+            // Weight the frequency correction by how much we trust the old frequency (grown by the wander since then)
+            // against how much this sample can tell us:  the two phase errors spread over the interval.
+            double variance = _stability * _stability + ES_DISCIPLINE_WANDER * ES_DISCIPLINE_WANDER * mu / (3600 * 24);
+            double sampleSigma = (error + _sampleError) / mu;
+            double gain = variance / (variance + sampleSigma * sampleSigma);
+            _frequency = clampFrequency(_frequency + gain * residual / mu);
+            _stability = sqrt((1 - gain) * variance);
+
+            // ntpd's poll adjustment, with a bit of hysteresis
+            if (fabs(residual) < ES_DISCIPLINE_PGATE * _jitter) {
+                _pollCounter += _pollLog2;
+                if (_pollCounter > ES_DISCIPLINE_LIMIT) {
+                    _pollCounter = ES_DISCIPLINE_LIMIT;
+                    if (_pollLog2 < ES_DISCIPLINE_MAX_POLL_LOG2) {
+                        _pollCounter = 0;
+                        _pollLog2++;
+                    }
+                }
+            } else {
+                _pollCounter -= _pollLog2 * 2;
+                if (_pollCounter < -ES_DISCIPLINE_LIMIT) {
+                    _pollCounter = -ES_DISCIPLINE_LIMIT;
+                    if (_pollLog2 > ES_DISCIPLINE_MIN_POLL_LOG2) {
+                        _pollCounter = 0;
+                        _pollLog2--;
+                    }
+                }
+            }
+            tracePrintf6("discipline: residual %.4f after %.0f seconds, frequency %.3f ppm +- %.3f ppm, jitter %.4f, poll 2^%d",
+                         residual, mu, _frequency * 1e6, _stability * 1e6, _jitter, _pollLog2);
+        }
+        break;
+    }
+    _sampleTime = contTime;
+    _sampleSkew = skew;
+    _sampleError = error;
+}
+
+ESTimeInterval
+ESNTPClockDiscipline::predictedSkew(ESTimeInterval contTime) const {
+    if (_state == ESNTPDisciplineNoSample) {
+        return 0;
+    }
+    return _sampleSkew + _frequency * (contTime - _sampleTime);
+}
+
+ESTimeInterval
+ESNTPClockDiscipline::predictedError(ESTimeInterval contTime) const {
+    if (_state == ESNTPDisciplineNoSample) {
+        return 1e9;
+    }
+    ESTimeInterval dt = contTime - _sampleTime;
+    if (dt < 0) {
+        dt = 0;
+    }
+    double frequencyError = (_state == ESNTPDisciplineLocked) ? _stability : ES_DISCIPLINE_UNLOCKED_FREQ_ERROR;
+    frequencyError = sqrt(frequencyError * frequencyError + ES_DISCIPLINE_WANDER * ES_DISCIPLINE_WANDER * dt / (3600 * 24));
+    return _sampleError + frequencyError * dt;
+}
+
+ESTimeInterval
+ESNTPClockDiscipline::pollInterval() const {
+    ESTimeInterval minInterval = (ESTimeInterval)(1 << ES_DISCIPLINE_MIN_POLL_LOG2);
+    if (_state != ESNTPDisciplineLocked) {
+        return minInterval;
+    }
+    ESTimeInterval interval = (ESTimeInterval)(1 << _pollLog2);
+    // Don't let the prediction get worse than we're willing to report before we check it again
+    if (_stability > 0) {
+        ESTimeInterval errorLimitedInterval = (ES_DISCIPLINE_MAX_PREDICTED_ERROR - _sampleError) / _stability;
+        if (errorLimitedInterval < interval) {
+            interval = errorLimitedInterval;
+        }
+    }
+    return interval < minInterval ? minInterval : interval;
+}
@@ -0,0 +1,62 @@
+//
+//  ESNTPClockDiscipline.hpp
+//
+//  Copyright Emerald Sequoia LLC 2011. All rights reserved.
+//
+
+#ifndef _ESNTPCLOCKDISCIPLINE_HPP_
+#define _ESNTPCLOCKDISCIPLINE_HPP_
+
+#include "ESTime.hpp"  // For ESTimeInterval
+
+/*! Tracks the offset (contSkew) and frequency error of the continuous time base from a series of completed syncs,
+ *  after the fashion of local_clock() in ntpdist/ntpd/ntp_loopfilter.c, so that the driver can predict the skew
+ *  between syncs and sync less often as the prediction proves itself.
+ *
+ *  Unlike ntpd we don't slew anything:  each sample replaces the phase outright, and the residual against the
+ *  prediction is used only to correct the frequency.  Because our samples are much noisier than ntpd's (a sync
+ *  stops at ES_FIX_GOOD), each frequency correction is weighted by how much the sample's error allows it to
+ *  tell us over the time since the last one, rather than by ntpd's fixed PLL/FLL gains.  The poll-interval
+ *  adjustment (the jiggle counter) is ntpd's.
+ *
+ *  Not thread-safe; the driver uses it only from its own thread. */
+class ESNTPClockDiscipline {
+  public:
+                            ESNTPClockDiscipline();
+
+    void                    reset();  // Forget everything, including the frequency
+    void                    addSample(ESTimeInterval contTime,   // When the sync finished, as ESTime::currentContinuousTime()
+                                      ESTimeInterval skew,       // ... and what it found
+                                      ESTimeInterval error);
+
+    bool                    haveSample() const { return _state != ESNTPDisciplineNoSample; }
+    bool                    frequencyLocked() const { return _state == ESNTPDisciplineLocked; }
+    ESTimeInterval          predictedSkew(ESTimeInterval contTime) const;
+    ESTimeInterval          predictedError(ESTimeInterval contTime) const;
+    ESTimeInterval          pollInterval() const;  // How long after the last sample the next sync should start
+    double                  frequency() const { return _frequency; }   // Rate of change of contSkew (s/s)
+    double                  stability() const { return _stability; }   // Estimated (1-sigma) error in frequency()
+    ESTimeInterval          jitter() const { return _jitter; }
+
+  private:
+    enum ESNTPDisciplineState {
+        ESNTPDisciplineNoSample,
+        ESNTPDisciplineFrequencyPending,  // Have a phase, waiting for a long enough interval to measure the frequency directly
+        ESNTPDisciplineLocked
+    };
+
+    ESNTPDisciplineState    _state;
+    ESTimeInterval          _sampleTime;      // Continuous time of the last sample
+    ESTimeInterval          _sampleSkew;
+    ESTimeInterval          _sampleError;
+    ESTimeInterval          _baseTime;        // In ESNTPDisciplineFrequencyPending, the sample we'll measure the frequency from
+    ESTimeInterval          _baseSkew;
+    ESTimeInterval          _baseError;
+    double                  _frequency;
+    double                  _stability;
+    ESTimeInterval          _jitter;
+    int                     _pollLog2;
+    int                     _pollCounter;     // ntpd's tc_counter
+};
+
+#endif  // _ESNTPCLOCKDISCIPLINE_HPP_
@@ -22,6 +22,9 @@
 #include "ESNTPHostReport.hpp"
 #include "ESNetwork.hpp"
 #include "ESSystemTimeBase.hpp"
+#include "ESFile.hpp"
+#include "ESEventLog.hpp"
+#include "ESMetrics.hpp"
 #if ES_TRIPLEBASE
 #include "ESTimeCalibrator.hpp"
 #endif
@@ -66,6 +69,30 @@
 #define ES_BASE_PENALTY_STRATUM    8            /* The first stratum which incurs a penalty for presumed unreported error */
 #define ES_BASE_STRATUM_PENALTY    0.5          /* The amount of error presumed to be added to a host at stratum ES_BASE_PENALTY_STRATUM */
 #define ES_PENALTY_PER_STRATUM     0.25         /* The amount of additional penalty added to ES_BASE_STRATUM_PENALTY per stratum that we are above ES_BASE_PENALTY_STRATUM */
+#define ES_NTP_XMIT_RING_SIZE      8            /* The number of outstanding sends remembered per socket; the oldest is forgotten (and counted as lost) to make room */
+#define ES_NTP_RECV_BATCH          8            /* The maximum number of datagrams pulled off one socket by a single recvmmsg() call */
+#define ES_NTP_EPOLL_MAX_EVENTS    64           /* The maximum number of ready fds returned by a single epoll_wait() call */
+#define ES_KERNEL_TIMESTAMP_MAX_AGE 1.0         /* A kernel packet time stamp older than this (or in the future) presumably straddles a system clock change, so we use our own time stamp instead */
+#define ES_NTP_CONTROL_BUFFER_SIZE 256          /* Bytes of ancillary data space for each received message (holds the kernel time stamps) */
+#define ES_HOST_CACHE_MAX_AGE   (3600.0 * 24 * 7) /* Remembered host-quality entries older than this are dropped rather than used to seed a sync */
+#define ES_HOST_CACHE_MAX_ENTRIES  64           /* ... and we keep at most this many, most recently seen first */
+#define ES_DNS_CACHE_LIFETIME    120.0          /* Reuse a host name's resolved addresses for this long across syncs (getaddrinfo doesn't give us the record's TTL) */
+#define ES_DNS_PREFETCH_COUNT      3            /* The number of pool host names we resolve ahead of need, in parallel */
+#define ES_HOST_CACHE_SEED_SPARE   8            /* Room left after a host name's cached addresses for new ones its background resolution turns up */
+#define ES_PREDICTION_SKEW_STEP  0.001          /* In discipline mode, move contSkew to the predicted value whenever it has drifted this far from it */
+#define ES_PREDICTION_ERROR_STEP 0.01           /*  ... or the predicted error has grown this much */
+#define ES_PREDICTION_MIN_INTERVAL 10.0         /*  ... checking no more often than this */
+#define ES_PREDICTION_MAX_INTERVAL 600.0        /*  ... and no less often than this */
+#define ES_PREDICTION_LEEWAY     0.1            /* Fraction of the prediction interval the timer thread may delay its firing to share a wakeup */
+#define ES_RESYNC_LEEWAY         60.0           /* How late the periodic resync may start, for the same reason */
+#define ES_SOCKET_TIMEOUT_LEEWAY 0.1            /* Fraction of a per-packet timeout the timer thread may add, so timeouts for lost packets share wakeups with other timers */
+
+// Define this to log user-space and kernel packet time stamps side by side
+#undef ES_NTP_COMPARE_KERNEL_TIMESTAMPS
+
+// Define this to print, when the driver thread starts, what one wakeup of the driver loop costs with 10, 100 and 1000
+// loopback server sockets, for the epoll engine and for the select() loop it replaced
+#undef ES_NTP_WAKEUP_BENCHMARK
 
 #undef min
 #undef max
@@ -77,11 +104,30 @@ extern int numPoolHosts;
 
 #include <string>
 #include <iostream>
+#include <algorithm>
+#include <list>
+#include <map>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#if ES_NTP_USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+// Where available, ask the kernel to time stamp packets as they pass through the network stack, so that
+// scheduler latency and the time we spend waking up don't count towards the offset and RTT
+#if defined(__linux__) && defined(SO_TIMESTAMPNS) && defined(SO_TIMESTAMPING)
+#define ES_NTP_USE_KERNEL_TIMESTAMPS 1
+#include <linux/net_tstamp.h>
+#include <time.h>
+#include <math.h>
+#else
+#define ES_NTP_USE_KERNEL_TIMESTAMPS 0
+#endif
 
 class ESNTPSocketDescriptor;
 class ESNTPHostNameDescriptor;
@@ -102,13 +148,31 @@ static int _numPacketsReceived = 0;
 static int _numLongTimeoutsTriggered = 0;
 static ESTimeInterval _lastSyncStart = 0;
 static ESTimeInterval _lastSyncElapsedTime = 0;
-static int _sumNumPacketsSent = 0;
-static ESTimeInterval _sumLastSyncElapsedTime = 0;
-static int _numSyncs = 0;
 static ESTimeInterval _timeOfLastSuccessfulSync = 0;
 static ESTimeInterval _timeOfLastSyncAttempt = 0;
+static ESTimeInterval _lastSyncDNSWaitTime = 0;  // From the start of the sync until the first address was available, or -1 if none yet
+static int _numDNSLookups = 0;
+static int _numDNSCacheHits = 0;
+static ESTimeInterval _sumDNSLookupTime = 0;  // Over the lookups which went to the resolver
+static ESLock syncReportLock;
+static unsigned int hostNameDescriptorsGeneration = 0;  // Bumped whenever ESNTPDriver::_hostNameDescriptors are destroyed
+
+// Lifetime statistics, for export with ESMetrics
+static ESMetricCounter   packetsSentMetric("ntp.packets.sent");
+static ESMetricCounter   packetsReceivedMetric("ntp.packets.received");
+static ESMetricCounter   badPacketsMetric("ntp.packets.bad");  // Including send failures
+static ESMetricCounter   syncsMetric("ntp.syncs");
+static ESMetricHistogram rttMetric("ntp.rtt", "s", 0.001, 2);
+static ESMetricHistogram packetErrorMetric("ntp.packet_error", "s", 0.001, 2);  // Half the RTT plus the host's own error
+static ESMetricHistogram timeToSyncMetric("ntp.time_to_sync", "s", 0.05, 2);
+static ESMetricHistogram packetsPerSyncMetric("ntp.packets_per_sync", "packets", 1, 2);
+static ESMetricHistogram dnsLatencyMetric("ntp.dns_latency", "s", 0.001, 2);
 
 static bool inPollingMode = false;
+static bool inDisciplineMode = false;
+#ifdef ES_NTP_LOOPBACK_SIMULATOR
+static bool restartOnDisagreement = false;  // The pre-majority behavior, for the simulator to compare against
+#endif
 static int nextSendHostIndex = 0;
 static bool _pollingCycleRunning = false;
 static bool _pollingRunning = false;
@@ -127,6 +191,49 @@ static ESTimeInterval timeStampMake(l_fp *ts) {
     return esti;
 }
 
+#if ES_NTP_USE_KERNEL_TIMESTAMPS
+// Like timeStampMake() but for a time we already have on the continuous time base
+static void timeStampFromContinuousTime(l_fp           *ts,
+                                        ESTimeInterval esti) {
+    double timeSince1970 = esti + ESTIME_EPOCH;
+    double intSeconds = floor(timeSince1970);
+    ts->l_i = (int32)intSeconds + JAN_1970;
+    ts->l_uf = (u_int32)((timeSince1970 - intSeconds) * FRAC);
+}
+
+// The kernel time stamps packets with CLOCK_REALTIME, which isn't our continuous time base.  Rather than
+// try to relate the two bases directly, find out how long ago the kernel time stamp was on the system
+// clock and back off the same amount from the current continuous time.  Returns 0 if the kernel time
+// stamp can't be trusted.
+static ESTimeInterval continuousTimeForKernelTimeStamp(const struct timespec *kernelTS) {
+    ESTimeInterval kernelSysTime = kernelTS->tv_sec - ESTIME_EPOCH + kernelTS->tv_nsec / 1e9;
+    ESTimeInterval age = ESSystemTimeBase::currentSystemTime() - kernelSysTime;
+    ESTimeInterval now = ESTime::currentContinuousTime();
+    if (age < 0 || age > ES_KERNEL_TIMESTAMP_MAX_AGE) {
+        return 0;
+    }
+    return now - age;
+}
+
+// Find the software time stamp in the ancillary data of a received message.  SO_TIMESTAMPNS delivers it as
+// SCM_TIMESTAMPNS; messages read from the error queue carry it as the first of the three SCM_TIMESTAMPING values.
+static bool kernelTimeStampFromMessage(struct msghdr   *msg,
+                                       struct timespec *kernelTS) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET) {
+            continue;
+        }
+        if (cmsg->cmsg_type == SCM_TIMESTAMPNS || cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            memcpy(kernelTS, CMSG_DATA(cmsg), sizeof(*kernelTS));
+            if (kernelTS->tv_sec != 0 || kernelTS->tv_nsec != 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+#endif
+
 // Class to get notified when the network goes away or comes back.
 class ESNTPDriverNetworkObserver : public ESNetworkInternetObserver {
   public:
@@ -147,27 +254,41 @@ class ESNTPDriverNetworkObserver : public ESNetworkInternetObserver {
     ESNTPDriver             *_driver;
 };
 
-/** Representation of transmit time, in host time and network time formats */
+/** Representation of transmit time, in host time and network time formats.
+ *  These live in a fixed-size ring in each socket descriptor, so sending and matching don't allocate. */
 class ESNTPxmitTimeStamp {
   public:
-                            ESNTPxmitTimeStamp(ESNTPxmitTimeStamp *oldHead)
-    :   next(oldHead),
-        longTimeoutTimer(NULL)
+                            ESNTPxmitTimeStamp()
+    :   inUse(false),
+        kernelXmitTimeES(0),
+        longTimeoutDeadline(0),
+        longTimeoutExpired(false)
     {
-        xmitTimeES = timeStampMake(&xmitTimeFP);
     }
-                            ~ESNTPxmitTimeStamp()
-    {
-        if (longTimeoutTimer) {
-            longTimeoutTimer->release();
-        }
+    void                    init() {
+        inUse = true;
+        xmitTimeES = timeStampMake(&xmitTimeFP);
+        kernelXmitTimeES = 0;
+        longTimeoutDeadline = 0;
+        longTimeoutExpired = false;
     }
+    bool                    inUse;      /* false if never used, or if the reply has arrived */
     l_fp	            xmitTimeFP;	/* my transmit time stamp */
     ESTimeInterval          xmitTimeES;	/* my transmit time stamp */
-    ESTimer                 *longTimeoutTimer;
-    ESNTPxmitTimeStamp      *next;
+    l_fp                    kernelXmitTimeFP;  /* when the kernel says the packet actually went out, if it told us */
+    ESTimeInterval          kernelXmitTimeES;  /*  ... or 0 if it didn't */
+    ESTimeInterval          longTimeoutDeadline;  /* continuous time at which we presume the packet lost, or 0 if the short timeout hasn't happened yet */
+    bool                    longTimeoutExpired;   /* we've already counted this packet as lost (but will still take the reply if it comes) */
 };
 
+/*! One address returned by name resolution, in the form we keep it in the resolver cache */
+struct ESNTPResolvedAddress {
+    int                     family;
+    int                     socktype;
+    int                     protocol;
+    struct sockaddr_storage addr;
+    int                     addrlen;
+};
 
 /*! A host name and its associated IP addresses and sockets, if any */
 class ESNTPHostNameDescriptor : public ESNameResolverObserver {
@@ -179,6 +300,7 @@ class ESNTPHostNameDescriptor : public ESNameResolverObserver {
                                  bool              isUserHost,
                                  ESNTPDriver       *driver);
     void                    startResolving();  // Start a background name resolution
+    void                    startPrefetching();  // Start a background name resolution whose result is held until the driver asks for this host
 
     std::string             nameAsRequested() const { return _name; }
 
@@ -196,20 +318,35 @@ class ESNTPHostNameDescriptor : public ESNameResolverObserver {
 
     void                    setupPostResolutionFailureTimer();
 
+    int                     seedFromHostCache(const std::string &countryCode);  // Returns the number of addresses seeded; DNS still runs behind them
+    void                    queueHeldSockets();  // Hand prefetched addresses to the driver's RTT queue
+
     ESNTPDriver             *driver() const { return _driver; }
 
   private:
     void                    postResolutionFailureTimerFire();
+    void                    gotAddresses(const ESNTPResolvedAddress *addresses,
+                                         int                        numAddresses);
+    static void             resolverCacheHitGlue(void *obj,
+                                                 void *param);
+    void                    mergeResolvedAddresses(const ESNTPResolvedAddress *addresses,
+                                                   int                        numAddresses);
 
     std::string             _name;
+    std::string             _port;   // From _name if the user gave one, else the NTP port; outlives the resolver
     bool                    _isUserHost;
     int                     _proximity;
     ESNameResolver          *_nameResolver;
     int                     _numSocketDescriptors;
+    int                     _socketDescriptorCapacity;  // Beyond _numSocketDescriptors only when seeded from the host cache
     ESNTPSocketDescriptor   *_socketDescriptors;
     ESNTPDriver             *_driver;
     bool                    _resolving;
     bool                    _doneResolving;
+    bool                    _prefetching;     // The resolution in progress (or done) was speculative; the driver hasn't asked for this host yet
+    bool                    _socketsQueued;   // Our sockets are in the driver's RTT queue (pool hosts only)
+    bool                    _seededFromCache; // Our sockets came from the host cache, and the resolution in progress (if any) will refresh them
+    ESTimeInterval          _resolveStartTime;  // Continuous time
     int                     _numResolutionFailures;
     ESTimer                 *_postResolutionFailureTimer;
 friend class ESNTPSocketDescriptor;
@@ -225,16 +362,35 @@ class ESNTPSocketDescriptor {
                             ~ESNTPSocketDescriptor();
     void                    connectAndSendFirstPacket(ESNTPDriver *driver);
     std::string             humanReadableIPAddress() const;
-    void                    badHost(ESNTPDriver *driver);
-    void                    badPacket(ESNTPDriver *driver);
+    void                    badHost(ESNTPDriver            *driver,
+                                    ESEventBadPacketReason reason);
+    void                    badPacket(ESNTPDriver            *driver,
+                                      ESEventBadPacketReason reason);
     void                    sendPacket(ESNTPDriver *driver,
                                        bool        haveTicket);
     bool                    recvPacket(ESNTPDriver *driver);
+    bool                    processPacket(ESNTPDriver    *driver,
+                                          struct pkt     *responsePtr,
+                                          ssize_t        len,
+                                          l_fp           *recvTimeFPPtr,
+                                          ESTimeInterval recvTimeES);
+#if ES_NTP_USE_EPOLL
+    void                    drainSocket(ESNTPDriver *driver);
+#endif
+#if ES_NTP_USE_KERNEL_TIMESTAMPS
+    void                    enableKernelTimeStamps();
+    void                    collectKernelXmitTimeStamps();
+    ESTimeInterval          applyKernelRecvTimeStamp(struct msghdr  *msg,
+                                                     ESTimeInterval userRecvTimeES,
+                                                     l_fp           *recvTimeFP);
+#endif
     int                     fd() const { return _fd; }
+    const struct sockaddr_storage *addr() const { return &_addr; }
     void                    closeSocket();
     int                     packetsReceived() const { return _packetsReceived; }
     int                     packetsUsed() const { return _packetsUsed; }
     int                     packetsSent() const { return _packetsSent; }
+    int                     packetsSentAfterDropped() const { return _packetsSentAfterDropped; }
     ESNTPHostNameDescriptor *hostNameDescriptor() const { return _hostNameDescriptor; }
     ESTimeInterval          averageRTT() const { return _averageRTT; }
     ESTimeInterval          skewLB() const { return _skewLB; }
@@ -242,11 +398,17 @@ class ESNTPSocketDescriptor {
     ESTimeInterval          nonRTTErrorFromLastPacket() const { return _nonRTTErrorFromLastPacket; }
     int                     leapBitsFromLastPacket() const { return _leapBitsFromLastPacket; }
     int                     stratumFromLastPacket() const { return _stratumFromLastPacket; }
+    bool                    isFalseticker() const { return _falseticker; }
+    bool                    isRetiredFromPool() const { return _falseticker || _stale; }  // Never (again) in the driver's RTT queue
   private:
     void                    sendTimeoutShort();
     void                    sendTimeoutLong();
+    ESNTPxmitTimeStamp      *newXmitTimeStamp();
+    ESNTPxmitTimeStamp      *findXmitTimeStamp(const l_fp *xmitTimeFP);
+    void                    armLongTimeoutTimer();
 
     ESTimer                 *_timer;  // timer used for packet resend
+    ESTimer                 *_longTimeoutTimer;  // one timer for the earliest long-timeout deadline among all of _xmitTimes
 
     int                     _family;  // AF_INET or AF_INET6
     struct sockaddr_storage _addr;
@@ -254,7 +416,8 @@ class ESNTPSocketDescriptor {
     int                     _fd;
     int                     _socktype;
     int                     _protocol;
-    ESNTPxmitTimeStamp      *_xmitTimes;
+    ESNTPxmitTimeStamp      _xmitTimes[ES_NTP_XMIT_RING_SIZE];
+    int                     _lastXmitSlot;  // The most recent send, which is the one the short timeout is for
     ESTimeInterval          _lastSendFailureTime;   /* The last time we failed trying to connect and/or send a packet */
     ESTimeInterval          _lastSendTime;
     ESTimeInterval          _averageRTT;
@@ -262,11 +425,16 @@ class ESNTPSocketDescriptor {
     int                     _packetsSent;
     int                     _packetsReceived;
     int                     _packetsUsed;
+    int                     _packetsSentAfterDropped;  // Sent while _falseticker was set; should stay zero
     int                     _leapBitsFromLastPacket;
     int                     _stratumFromLastPacket;
     ESTimeInterval          _skewLB;
     ESTimeInterval          _skewUB;
     ESTimeInterval          _nonRTTErrorFromLastPacket;
+    bool                    _falseticker;  // Outvoted by the other hosts; we no longer use its packets or send to it
+    bool                    _stale;        // Seeded from the host cache, missing from the name's fresh DNS answer, and then failed or outlived
+                                           // _unresolvedExpiration; we no longer send to it
+    ESTimeInterval          _unresolvedExpiration;  // Nonzero for a cached address the fresh DNS answer didn't include:  when we stop trusting it
     ESNTPHostNameDescriptor *_hostNameDescriptor;
 friend class ESNTPHostNameDescriptor;
 friend class ESNTPSocketShortTimeoutObserver;
@@ -316,21 +484,26 @@ bool ESNTPSocketRTTGreaterThan(ESNTPSocketDescriptor *s1,
 
 ESNTPSocketDescriptor::ESNTPSocketDescriptor()
 :   _timer(NULL),
+    _longTimeoutTimer(NULL),
     _family(0),
     _addrlen(0),
     _fd(-1),
+    _lastXmitSlot(-1),
     _lastSendFailureTime(0),
     _lastSendTime(0),
     _averageRTT(0),
     _sumRTT(0),
-    _nonRTTErrorFromLastPacket(0),
+    _packetsSent(0),
+    _packetsReceived(0),
+    _packetsUsed(0),
+    _packetsSentAfterDropped(0),
     _leapBitsFromLastPacket(0),
     _skewLB(-1e6),
     _skewUB(1e6),
-    _xmitTimes(NULL),
-    _packetsReceived(0),
-    _packetsUsed(0),
-    _packetsSent(0),
+    _nonRTTErrorFromLastPacket(0),
+    _falseticker(false),
+    _stale(false),
+    _unresolvedExpiration(0),
     _hostNameDescriptor(NULL)
 {
     ESAssert(ESNTPDriver::_theDriver);
@@ -354,11 +527,36 @@ ESNTPSocketDescriptor::~ESNTPSocketDescriptor() {
     if (_timer) {
         _timer->release();
     }
-    while (_xmitTimes) {
-        ESNTPxmitTimeStamp *nxt = _xmitTimes->next;
-        delete _xmitTimes;
-        _xmitTimes = nxt;
+    if (_longTimeoutTimer) {
+        _longTimeoutTimer->release();
+    }
+}
+
+// Take the next slot in the ring.  If it still holds a send that never got a reply, that send is
+// forgotten; count it as lost now if the long timeout hasn't already done so.
+ESNTPxmitTimeStamp *
+ESNTPSocketDescriptor::newXmitTimeStamp() {
+    _lastXmitSlot = (_lastXmitSlot + 1) % ES_NTP_XMIT_RING_SIZE;
+    ESNTPxmitTimeStamp *xmit = &_xmitTimes[_lastXmitSlot];
+    if (xmit->inUse && !xmit->longTimeoutExpired && !inPollingMode) {
+        tracePrintf2("%s (%s) dropping oldest unanswered send to make room",
+                     humanReadableIPAddress().c_str(),
+                     hostNameDescriptor()->nameAsRequested().c_str());
+        _hostNameDescriptor->_driver->stateGotLongSocketTimeout(this);
+    }
+    xmit->init();
+    return xmit;
+}
+
+ESNTPxmitTimeStamp *
+ESNTPSocketDescriptor::findXmitTimeStamp(const l_fp *xmitTimeFP) {
+    for (int i = 0; i < ES_NTP_XMIT_RING_SIZE; i++) {
+        ESNTPxmitTimeStamp *xmit = &_xmitTimes[i];
+        if (xmit->inUse && L_ISEQU(xmitTimeFP, &xmit->xmitTimeFP)) {
+            return xmit;
+        }
     }
+    return NULL;
 }
 
 class ESNTPSocketLongTimeoutObserver : public ESTimerObserver {
@@ -370,28 +568,73 @@ class ESNTPSocketLongTimeoutObserver : public ESTimerObserver {
 };
 static ESNTPSocketLongTimeoutObserver *socketLongTimeoutObserver = NULL;
 
-void 
-ESNTPSocketDescriptor::sendTimeoutShort() {
+// Set the long-timeout timer for the earliest pending deadline, if there is one
+void
+ESNTPSocketDescriptor::armLongTimeoutTimer() {
+    ESAssert(!_longTimeoutTimer);
+    ESTimeInterval earliestDeadline = 0;
+    for (int i = 0; i < ES_NTP_XMIT_RING_SIZE; i++) {
+        const ESNTPxmitTimeStamp *xmit = &_xmitTimes[i];
+        if (xmit->inUse && xmit->longTimeoutDeadline && !xmit->longTimeoutExpired) {
+            if (!earliestDeadline || xmit->longTimeoutDeadline < earliestDeadline) {
+                earliestDeadline = xmit->longTimeoutDeadline;
+            }
+        }
+    }
+    if (!earliestDeadline) {
+        return;
+    }
     if (!socketLongTimeoutObserver) {
         socketLongTimeoutObserver = new ESNTPSocketLongTimeoutObserver;
     }
+    ESTimeInterval now = ESTime::currentContinuousTime();
+    _longTimeoutTimer = new ESIntervalTimer(socketLongTimeoutObserver, earliestDeadline > now ? earliestDeadline - now : 0, now);
+    _longTimeoutTimer->setInfo(this);
+    _longTimeoutTimer->setLeeway(ES_LONG_SOCKET_TIMEOUT * ES_SOCKET_TIMEOUT_LEEWAY);
+    _longTimeoutTimer->activate();
+}
+
+void 
+ESNTPSocketDescriptor::sendTimeoutShort() {
     _timer = NULL;
     if (inPollingMode) {
         return;
     }
-    ESAssert(_xmitTimes);
-    _xmitTimes->longTimeoutTimer = new ESIntervalTimer(socketLongTimeoutObserver, ES_LONG_SOCKET_TIMEOUT);
-    _xmitTimes->longTimeoutTimer->setInfo(this);
-    _xmitTimes->longTimeoutTimer->activate();
+    ESAssert(_lastXmitSlot >= 0);
+    ESNTPxmitTimeStamp *xmit = &_xmitTimes[_lastXmitSlot];
+    ESAssert(xmit->inUse);  // Otherwise the reply came in and _timer would have been released
+    ESEventLog::recordHost(ESEventShortTimeout, &_addr);
+    xmit->longTimeoutDeadline = ESTime::currentContinuousTime() + ES_LONG_SOCKET_TIMEOUT;
+    // Deadlines are set in send order, so an existing timer is already set for an earlier one
+    if (!_longTimeoutTimer) {
+        armLongTimeoutTimer();
+    }
     _hostNameDescriptor->_driver->stateGotShortSocketTimeout(this);
 }
 
 void 
 ESNTPSocketDescriptor::sendTimeoutLong() {
+    _longTimeoutTimer->release();
+    _longTimeoutTimer = NULL;
     if (inPollingMode) {
         return;
     }
-    _hostNameDescriptor->_driver->stateGotLongSocketTimeout(this);
+    ESTimeInterval now = ESTime::currentContinuousTime();
+    int numExpired = 0;
+    for (int i = 0; i < ES_NTP_XMIT_RING_SIZE; i++) {
+        ESNTPxmitTimeStamp *xmit = &_xmitTimes[i];
+        if (xmit->inUse && xmit->longTimeoutDeadline && !xmit->longTimeoutExpired && xmit->longTimeoutDeadline <= now) {
+            xmit->longTimeoutExpired = true;
+            numExpired++;
+        }
+    }
+    armLongTimeoutTimer();
+    if (numExpired) {
+        ESEventLog::recordHost(ESEventLongTimeout, &_addr, numExpired);
+    }
+    for (int i = 0; i < numExpired; i++) {
+        _hostNameDescriptor->_driver->stateGotLongSocketTimeout(this);
+    }
 }
 
 class ESNTPSocketShortTimeoutObserver : public ESTimerObserver {
@@ -404,7 +647,9 @@ class ESNTPSocketShortTimeoutObserver : public ESTimerObserver {
 static ESNTPSocketShortTimeoutObserver *socketShortTimeoutObserver = NULL;
 
 void 
-ESNTPSocketDescriptor::badHost(ESNTPDriver *driver) {
+ESNTPSocketDescriptor::badHost(ESNTPDriver            *driver,
+                               ESEventBadPacketReason reason) {
+    ESEventLog::recordHost(ESEventBadPacket, &_addr, reason);
 #ifndef ES_SURVEY_POOL_HOSTS
     _averageRTT = ES_FORCE_RTT_FOR_BAD_HOST;
     driver->stateGotBadPacket(this);
@@ -412,7 +657,9 @@ ESNTPSocketDescriptor::badHost(ESNTPDriver *driver) {
 }
 
 void 
-ESNTPSocketDescriptor::badPacket(ESNTPDriver *driver) {
+ESNTPSocketDescriptor::badPacket(ESNTPDriver            *driver,
+                                 ESEventBadPacketReason reason) {
+    ESEventLog::recordHost(ESEventBadPacket, &_addr, reason);
 #ifndef ES_SURVEY_POOL_HOSTS
     _averageRTT = ES_FORCE_RTT_FOR_BAD_PACKET;
     driver->stateGotBadPacket(this);
@@ -473,9 +720,9 @@ ESNTPSocketDescriptor::sendPacket(ESNTPDriver *driver,
     L_CLR(&xpkt.reftime);
     L_CLR(&xpkt.org);
     L_CLR(&xpkt.rec);
-    // record the time in our format, put it on the front of the list
-    _xmitTimes = new ESNTPxmitTimeStamp(_xmitTimes);
-    HTONL_FP(&_xmitTimes->xmitTimeFP, &xpkt.xmt);
+    // record the time in our format, in the next slot of the ring
+    ESNTPxmitTimeStamp *xmit = newXmitTimeStamp();
+    HTONL_FP(&xmit->xmitTimeFP, &xpkt.xmt);
     // printf("Sending packet: ");
     // for (int i = 0; i < LEN_PKT_NOMAC; i++) {
     //     char c = ((const UInt8 *)&xpkt)[i];
@@ -507,6 +754,7 @@ ESNTPSocketDescriptor::sendPacket(ESNTPDriver *driver,
         if (!socketShortTimeoutObserver) {
             socketShortTimeoutObserver = new ESNTPSocketShortTimeoutObserver;
         }
+        ESEventLog::recordHost(ESEventSend, &_addr);
         tracePrintf2("%s (%s) sent packet",
                      humanReadableIPAddress().c_str(),
                      hostNameDescriptor()->nameAsRequested().c_str());
@@ -514,9 +762,14 @@ ESNTPSocketDescriptor::sendPacket(ESNTPDriver *driver,
         ESAssert(!_timer);
         _timer = new ESIntervalTimer(socketShortTimeoutObserver, ES_SHORT_SOCKET_TIMEOUT);
         _timer->setInfo(this);
+        _timer->setLeeway(ES_SHORT_SOCKET_TIMEOUT * ES_SOCKET_TIMEOUT_LEEWAY);
         _timer->activate();
 #endif
         _packetsSent++;
+        if (_falseticker) {
+            _packetsSentAfterDropped++;
+        }
+        packetsSentMetric.add();
         driver->incrementNumPacketsSent();
         tracePrintf4("sendPacket incrementing number of packets sent to %d (sent) %d (received) %d (outstanding) %d (longtimeout)",
                      _numPacketsSent,
@@ -531,41 +784,209 @@ ESNTPSocketDescriptor::sendPacket(ESNTPDriver *driver,
     }
 }
 
+#if ES_NTP_USE_KERNEL_TIMESTAMPS
+void
+ESNTPSocketDescriptor::enableKernelTimeStamps() {
+    int on = 1;
+    if (setsockopt(_fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) != 0) {
+        ESErrorReporter::checkAndLogSystemError("ESNTPDriver", errno, "Enabling kernel receive time stamps");
+    }
+    int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (setsockopt(_fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0) {
+        // Not fatal; we just use the time stamp in the packet as the send time
+        ESErrorReporter::checkAndLogSystemError("ESNTPDriver", errno, "Enabling kernel transmit time stamps");
+    }
+}
+
+// Transmit time stamps come back on the socket's error queue, attached to a copy of the outgoing packet
+// (with all of the headers prepended, so the NTP packet is the trailing LEN_PKT_NOMAC bytes).  Match each
+// one up with the send it belongs to via the xmt field, which is what the server echoes back to us as org.
+void
+ESNTPSocketDescriptor::collectKernelXmitTimeStamps() {
+    while (_fd >= 0) {
+        char buf[256];
+        unsigned long long control[ES_NTP_CONTROL_BUFFER_SIZE / sizeof(unsigned long long)];
+        struct iovec iov;
+        iov.iov_base = buf;
+        iov.iov_len = sizeof(buf);
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t len = recvmsg(_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (len < 0) {
+            return;  // Normally EAGAIN: nothing (more) there
+        }
+        struct timespec kernelTS;
+        if ((size_t)len < LEN_PKT_NOMAC || (msg.msg_flags & MSG_TRUNC) || !kernelTimeStampFromMessage(&msg, &kernelTS)) {
+            continue;
+        }
+        const struct pkt *sent = (const struct pkt *)(buf + len - LEN_PKT_NOMAC);
+        l_fp xmt;
+        NTOHL_FP(&sent->xmt, &xmt);
+        ESNTPxmitTimeStamp *xmit = findXmitTimeStamp(&xmt);
+        if (xmit) {
+            ESTimeInterval kernelXmitTimeES = continuousTimeForKernelTimeStamp(&kernelTS);
+            if (kernelXmitTimeES) {
+                xmit->kernelXmitTimeES = kernelXmitTimeES;
+                timeStampFromContinuousTime(&xmit->kernelXmitTimeFP, kernelXmitTimeES);
+            }
+#ifdef ES_NTP_COMPARE_KERNEL_TIMESTAMPS
+            ESErrorReporter::logInfo("ESNTPDriver", ESUtil::stringWithFormat("%s xmit user %.6f kernel %.6f (delta %.6f)",
+                                                                             humanReadableIPAddress().c_str(),
+                                                                             xmit->xmitTimeES, kernelXmitTimeES,
+                                                                             kernelXmitTimeES ? kernelXmitTimeES - xmit->xmitTimeES : 0).c_str());
+#endif
+        }
+    }
+}
+
+// Replace our own receive time stamp with the kernel's, if it gave us one we can use
+ESTimeInterval
+ESNTPSocketDescriptor::applyKernelRecvTimeStamp(struct msghdr  *msg,
+                                                ESTimeInterval userRecvTimeES,
+                                                l_fp           *recvTimeFP) {
+    struct timespec kernelTS;
+    if (!kernelTimeStampFromMessage(msg, &kernelTS)) {
+        return userRecvTimeES;
+    }
+    ESTimeInterval kernelRecvTimeES = continuousTimeForKernelTimeStamp(&kernelTS);
+#ifdef ES_NTP_COMPARE_KERNEL_TIMESTAMPS
+    ESErrorReporter::logInfo("ESNTPDriver", ESUtil::stringWithFormat("%s recv user %.6f kernel %.6f (delta %.6f)",
+                                                                     humanReadableIPAddress().c_str(),
+                                                                     userRecvTimeES, kernelRecvTimeES,
+                                                                     kernelRecvTimeES ? userRecvTimeES - kernelRecvTimeES : 0).c_str());
+#endif
+    if (!kernelRecvTimeES) {
+        return userRecvTimeES;
+    }
+    timeStampFromContinuousTime(recvTimeFP, kernelRecvTimeES);
+    return kernelRecvTimeES;
+}
+#endif
+
 bool
 ESNTPSocketDescriptor::recvPacket(ESNTPDriver *driver) {
     struct pkt response;
+#if ES_NTP_USE_KERNEL_TIMESTAMPS
+    collectKernelXmitTimeStamps();
+    unsigned long long control[ES_NTP_CONTROL_BUFFER_SIZE / sizeof(unsigned long long)];
+    struct iovec iov;
+    iov.iov_base = &response;
+    iov.iov_len = sizeof(response);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    // Don't block: select() reports the socket as readable when all that's there is a transmit time stamp on the error queue
+    ssize_t len = recvmsg(_fd, &msg, MSG_DONTWAIT);
+    l_fp recvTimeFP;
+    ESTimeInterval recvTimeES = timeStampMake(&recvTimeFP);
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return false;
+    }
+    recvTimeES = applyKernelRecvTimeStamp(&msg, recvTimeES, &recvTimeFP);
+#else
     // int len = recvfrom(_fd, (char *)&response, sizeof(response), 0, (struct sockaddr *)&serverAddr, &slen);
     ssize_t len = recv(_fd, (char *)&response, sizeof(response), 0);
     l_fp recvTimeFP;
-#ifdef ES_SURVEY_POOL_HOSTS
-    ESTimeInterval recvTimeES =
+    ESTimeInterval recvTimeES = timeStampMake(&recvTimeFP);
+#endif
+    return processPacket(driver, &response, len, &recvTimeFP, recvTimeES);
+}
+
+#if ES_NTP_USE_EPOLL
+// Pull everything that's queued on this socket, in batches, and hand each datagram to processPacket().
+// Our own receive time stamp is taken once per batch, immediately after the batch is returned; where the
+// kernel time stamps each datagram, that's used instead.
+void
+ESNTPSocketDescriptor::drainSocket(ESNTPDriver *driver) {
+    ESAssert(driver->thread()->inThisThread());
+    struct pkt responses[ES_NTP_RECV_BATCH];
+    struct iovec iovecs[ES_NTP_RECV_BATCH];
+    struct mmsghdr msgs[ES_NTP_RECV_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < ES_NTP_RECV_BATCH; i++) {
+        iovecs[i].iov_base = &responses[i];
+        iovecs[i].iov_len = sizeof(struct pkt);
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+#if ES_NTP_USE_KERNEL_TIMESTAMPS
+    unsigned long long controls[ES_NTP_RECV_BATCH][ES_NTP_CONTROL_BUFFER_SIZE / sizeof(unsigned long long)];
+    collectKernelXmitTimeStamps();  // An EPOLLERR wakeup means there's a transmit time stamp waiting
+#endif
+    int numReceived;
+    do {
+        if (_fd < 0) {
+            return;
+        }
+#if ES_NTP_USE_KERNEL_TIMESTAMPS
+        for (int i = 0; i < ES_NTP_RECV_BATCH; i++) {
+            msgs[i].msg_hdr.msg_control = controls[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);  // recvmmsg() overwrites this, so reset it every time
+        }
+#endif
+        numReceived = recvmmsg(_fd, msgs, ES_NTP_RECV_BATCH, MSG_DONTWAIT, NULL);
+        l_fp recvTimeFP;
+        ESTimeInterval recvTimeES = timeStampMake(&recvTimeFP);
+        if (numReceived < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                // Typically ECONNREFUSED reported from an ICMP response; recvmmsg() clears it so we won't see it again
+                tracePrintf2("%s (%s) recvmmsg failed",
+                             humanReadableIPAddress().c_str(),
+                             hostNameDescriptor()->nameAsRequested().c_str());
+            }
+            return;
+        }
+        for (int i = 0; i < numReceived; i++) {
+#if ES_NTP_USE_KERNEL_TIMESTAMPS
+            l_fp packetRecvTimeFP = recvTimeFP;
+            ESTimeInterval packetRecvTimeES = applyKernelRecvTimeStamp(&msgs[i].msg_hdr, recvTimeES, &packetRecvTimeFP);
+            processPacket(driver, &responses[i], msgs[i].msg_len, &packetRecvTimeFP, packetRecvTimeES);
+#else
+            processPacket(driver, &responses[i], msgs[i].msg_len, &recvTimeFP, recvTimeES);
+#endif
+            if (driver->_stopReading) {
+                return;
+            }
+        }
+    } while (numReceived == ES_NTP_RECV_BATCH);
+}
 #endif
-        timeStampMake(&recvTimeFP);
+
+bool
+ESNTPSocketDescriptor::processPacket(ESNTPDriver    *driver,
+                                     struct pkt     *responsePtr,
+                                     ssize_t        len,
+                                     l_fp           *recvTimeFPPtr,
+                                     ESTimeInterval recvTimeES) {
+    struct pkt &response = *responsePtr;
+    l_fp recvTimeFP = *recvTimeFPPtr;
 
     l_fp	org;		/* originate time stamp (server's copy of xmitTime)*/
     NTOHL_FP(&response.org, &org);
-    ESNTPxmitTimeStamp *prev = NULL;
-    ESNTPxmitTimeStamp *xmit = _xmitTimes;
-    while (xmit && !L_ISEQU(&org, &xmit->xmitTimeFP)) {
-        prev = xmit;
-        xmit = xmit->next;
-    }
+    ESNTPxmitTimeStamp *xmit = findXmitTimeStamp(&org);
     if (!xmit) {  // We didn't find one -- must have been from a previous sync, which might have been on a different time base
         tracePrintf("response xmit time didn't match any of ours");
 	return false;
     }
-    // If we're here, xmit matches; remove it from the list
+    // If we're here, xmit matches; free up its slot
     ESAssert(L_ISEQU(&org, &xmit->xmitTimeFP));
-    if (prev) {
-        prev->next = xmit->next;
-    } else {
-        ESAssert(xmit == _xmitTimes);
-        _xmitTimes = xmit->next;
-    }
 #ifdef ES_SURVEY_POOL_HOSTS
     ESTimeInterval xmitTimeES = xmit->xmitTimeES;
 #endif
-    delete xmit;
+    l_fp xmitTimeFP = org;  // t3: by default, the time we wrote into the packet before sending it
+#if ES_NTP_USE_KERNEL_TIMESTAMPS
+    if (xmit->kernelXmitTimeES) {
+        xmitTimeFP = xmit->kernelXmitTimeFP;  // ... but the kernel knows when it actually went out
+    }
+#endif
+    xmit->inUse = false;  // A pending long-timeout deadline goes with it; the timer will just find nothing due
 
     _packetsReceived++;
     driver->incrementNumPacketsReceived();
@@ -620,24 +1041,24 @@ ESNTPSocketDescriptor::recvPacket(ESNTPDriver *driver) {
 	//[self failed:[NSString stringWithFormat:@"got %d bytes", len]];
         tracePrintf1("recv call failed, length was %d", len);
         ESErrorReporter::checkAndLogSystemError("ESNTPDriver", errno, "recv() failure");
-        badPacket(driver);  // Not the host's fault
+        badPacket(driver, ESEventBadLength);  // Not the host's fault
 	return false;
     }
     if (PKT_VERSION(response.li_vn_mode) < NTP_OLDVERSION || PKT_VERSION(response.li_vn_mode) > NTP_VERSION) {
 	//[self failed:@"bad version"];
         tracePrintf1("response version funny %u", PKT_VERSION(response.li_vn_mode));
-        badHost(driver);
+        badHost(driver, ESEventBadVersion);
 	return false;
     }
     if ((PKT_MODE(response.li_vn_mode) != MODE_SERVER && PKT_MODE(response.li_vn_mode) != MODE_PASSIVE)) {
 	//[self failed:[NSString stringWithFormat:@"received mode %d stratum %d", PKT_MODE(response.li_vn_mode), response.stratum]];
         tracePrintf1("response mode funny %d", PKT_MODE(response.li_vn_mode));
-        badHost(driver);
+        badHost(driver, ESEventBadMode);
 	return false;
     }
     if (response.stratum == STRATUM_PKT_UNSPEC) {
         tracePrintf1("response stratum unspecified", response.stratum);
-        badHost(driver);
+        badHost(driver, ESEventBadStratum);
 	return false;
     }
     
@@ -648,7 +1069,7 @@ ESNTPSocketDescriptor::recvPacket(ESNTPDriver *driver) {
     _stratumFromLastPacket = stratum;
     if (stratum == 0) {  // No such thing as a stratum-0 host, and in fact PKT_TO_STRATUM should never generate this
         tracePrintf1("response stratum funny %d", stratum);
-        badHost(driver);
+        badHost(driver, ESEventBadStratum);
         return false;
     }
 
@@ -659,7 +1080,7 @@ ESNTPSocketDescriptor::recvPacket(ESNTPDriver *driver) {
     }
     if (precision > 0.25) {
         tracePrintf2("response precision too high %.8f (stratum is %d)", precision, stratum);
-        badHost(driver);  // It's not bad per se, but it's not going to be much help
+        badHost(driver, ESEventBadPrecision);  // It's not bad per se, but it's not going to be much help
         return false;
     }
     // Note: below we reject delays and dispersions that are 0.  That would mean either we're looking
@@ -667,7 +1088,7 @@ ESNTPSocketDescriptor::recvPacket(ESNTPDriver *driver) {
     rootdelay = FPTOD(ntohl(response.rootdelay));
     if (rootdelay > ES_ROOT_DELAY_REJECT) {
         tracePrintf2("response rootdelay is too large at %.3f (stratum is %d)", rootdelay, stratum);
-        badHost(driver);
+        badHost(driver, ESEventBadRootDelay);
         return false;
     }
     if (rootdelay == 0) {
@@ -675,14 +1096,14 @@ ESNTPSocketDescriptor::recvPacket(ESNTPDriver *driver) {
             //tracePrintf("response rootdelay is 0 for stratum 1 host, accepting packet");
         } else {
             tracePrintf1("response rootdelay is 0 for non-stratum-1 host (stratum is %d)", stratum);
-            badHost(driver);
+            badHost(driver, ESEventBadRootDelay);
             return false;
         }
     }
     rootdispersion = FPTOD(ntohl(response.rootdispersion));
     if (rootdispersion > ES_DISPERSION_REJECT || rootdispersion <= 0) {
         tracePrintf2("response rootdispersion is too large (or nonpositive) at %.3f (stratum is %d)", rootdispersion, stratum);
-        badHost(driver);
+        badHost(driver, ESEventBadRootDispersion);
         return false;
     }
 
@@ -704,6 +1125,7 @@ ESNTPSocketDescriptor::recvPacket(ESNTPDriver *driver) {
     if (L_ISZERO(&rec)) {
 	//[self failed:@"rec is zero"];
         tracePrintf("response rec time zero");
+        ESEventLog::recordHost(ESEventBadPacket, &_addr, ESEventBadTimeStamps);
         driver->stateGotBadPacket(this);
 	return false;
     }
@@ -711,6 +1133,7 @@ ESNTPSocketDescriptor::recvPacket(ESNTPDriver *driver) {
     if (!L_ISHIS(&xmt, &rec) && !L_ISEQU(&xmt, &rec)) {
 	//[self failed:@"rec before xmt"];
         tracePrintf("response rec time after xmt");
+        ESEventLog::recordHost(ESEventBadPacket, &_addr, ESEventBadTimeStamps);
         driver->stateGotBadPacket(this);
 	return false;
     }
@@ -732,7 +1155,7 @@ ESNTPSocketDescriptor::recvPacket(ESNTPDriver *driver) {
     L_SUB(&t10, &recvTimeFP);	/* recv_time == t0*/
     
     t23 = rec;			/* pkt.rec == t2 */
-    L_SUB(&t23, &org);		/* pkt->org == t3 */
+    L_SUB(&t23, &xmitTimeFP);	/* pkt->org (or kernel xmit time) == t3 */
     
     double d10, d23;
     LFPTOD(&t10, d10);
@@ -760,6 +1183,7 @@ ESNTPSocketDescriptor::recvPacket(ESNTPDriver *driver) {
     double offsetThisTime;
     LFPTOD(&ci,offsetThisTime);
     double rttThisTime = FPTOD(di);
+    ESEventLog::recordHost(ESEventRecv, &_addr, stratum, offsetThisTime, (float)rttThisTime);
 
 #ifndef ES_SURVEY_POOL_HOSTS
     tracePrintf7("Got packet %s (%s)[%d]: prcsn %.8f, rootdelay %.4f, rootdisp %.4f, RTT %.4f",
@@ -776,6 +1200,9 @@ ESNTPSocketDescriptor::recvPacket(ESNTPDriver *driver) {
         hostError += ES_BASE_STRATUM_PENALTY + (stratum - ES_BASE_PENALTY_STRATUM) * ES_PENALTY_PER_STRATUM;
     }
     double error = (rttThisTime/2) + hostError;
+    packetsReceivedMetric.add();
+    rttMetric.record(rttThisTime);
+    packetErrorMetric.record(error);
     double minOffset = offsetThisTime - error;
     double maxOffset = offsetThisTime + error;
     if (inPollingMode) {   // In polling mode, the host report shows just the last packet, so that post-leap-second skews aren't influenced by pre-event skews
@@ -795,7 +1222,9 @@ ESNTPSocketDescriptor::recvPacket(ESNTPDriver *driver) {
 
     _packetsUsed++;  // Be optimistic
     _sumRTT += error * 2.0;
-    _averageRTT = _sumRTT / _packetsReceived;
+    if (!_falseticker) {  // A falseticker keeps its forced-high RTT (see ESNTPDriver::dropFalsetickers())
+        _averageRTT = _sumRTT / _packetsReceived;
+    }
 #ifdef ES_SURVEY_POOL_HOSTS
     printf("SURVEY: offset: %7.6f => %7.6f (ctr %7.6f), rtt %7.6f (%7.6f), dispersion %7.6f, rootdelay %.6f, precision %.8f, stratum %d, error %7.6f from %s\n",
            minOffset, maxOffset, offsetThisTime, rttThisTime, recvTimeES - xmitTimeES, rootdispersion, rootdelay, precision, stratum, error, humanReadableIPAddress().c_str());
@@ -861,6 +1290,12 @@ ESNTPSocketDescriptor::connectAndSendFirstPacket(ESNTPDriver *driver) {
         return;
     }
     _hostNameDescriptor->_driver->checkMaxSocketFD(_fd);
+#if ES_NTP_USE_KERNEL_TIMESTAMPS
+    enableKernelTimeStamps();
+#endif
+#if ES_NTP_USE_EPOLL
+    _hostNameDescriptor->_driver->registerSocketFD(this);
+#endif
     sendPacket(driver, false/* !haveTicket*/);
 }
 
@@ -872,6 +1307,9 @@ ESNTPSocketDescriptor::closeSocket() {
         _timer = NULL;
     }
     if (_fd >= 0) {
+#if ES_NTP_USE_EPOLL
+        _hostNameDescriptor->_driver->unregisterSocketFD(_fd);
+#endif
         int st = close(_fd);
         if (st != 0) {
             ESErrorReporter::checkAndLogSystemError("ESNTPDriver", errno, "Closing NTP socket");
@@ -915,27 +1353,31 @@ class ESNTPDriverSleepWakeObserver : public ESUtilSleepWakeObserver {
 
 ESNTPDriver::ESNTPDriver()
 :   _maxSocketFD(-1),
+#if ES_NTP_USE_EPOLL
+    _epollFD(-1),
+#endif
     _maxMinOffset(0),
     _minMaxOffset(0),
     _stopThread(false),
     _stopReading(false),
     _reading(false),
     _released(false),
+    _networkReachable(true),
     _lastSuccessfulSyncTime(0),
     _poolHostLookupFailures(0),
+    _currentProximity(0),
     _throttleLastTicketTime(0),
     _throttleSendInterval(0),
-    _currentProximity(0),
-    _disabled(false),
     _noProgressTimeout(NULL),
     _restartSyncTimeout(NULL),
     _giveUpTimer(NULL),
     _proximityBumpTimer(NULL),
-    _networkReachable(true),
+    _predictionTimer(NULL),
+    _disabled(false),
+    _networkObserver(NULL),
     _deviceCountryCode(getAppropriateCountryCode()),  // Depends on .hpp ordering of fields
     _hostNameIterator(_deviceCountryCode.c_str()),
-    _availablePoolSocketsByRTT(ESNTPSocketRTTGreaterThan),
-    _networkObserver(NULL)
+    _availablePoolSocketsByRTT(ESNTPSocketRTTGreaterThan)
 {
     ESAssert(ESThread::inMainThread());
     ESAssert(!_theDriver);   // Only make one of these
@@ -980,6 +1422,10 @@ ESNTPDriver::releaseInThread() {
         _giveUpTimer->release();
         _giveUpTimer = NULL;
     }
+    if (_predictionTimer) {
+        _predictionTimer->release();
+        _predictionTimer = NULL;
+    }
     if (_networkObserver) {
         _networkObserver->release();
         _networkObserver = NULL;
@@ -1014,6 +1460,24 @@ ESNTPDriver::getPollingInterval() {
     return _pollingInterval;
 }
 
+/*static*/ void
+ESNTPDriver::setDisciplineMode(bool on) {
+    ESAssert(!inPollingMode || !on);  // Polling mode never finishes a sync, so there'd be nothing to discipline with
+    inDisciplineMode = on;
+}
+
+/*static*/ bool
+ESNTPDriver::disciplineMode() {
+    return inDisciplineMode;
+}
+
+#ifdef ES_NTP_LOOPBACK_SIMULATOR
+/*static*/ void
+ESNTPDriver::setRestartOnDisagreement(bool on) {
+    restartOnDisagreement = on;
+}
+#endif
+
 /*static*/ std::string
 ESNTPDriver::getAppropriateCountryCode() {
     ESAssert(ESThread::inMainThread());
@@ -1249,6 +1713,7 @@ ESNTPDriver::bumpProximity() {
             _proximityBumpTimer->setInfo(this);
             _proximityBumpTimer->activate();
         }
+        prefetchPoolHostDNS();  // Get a head start on the level after this one
     }
 }
 
@@ -1344,6 +1809,7 @@ ESNTPDriver::startSyncing(bool userRequested) {  // The name of this parameter i
     }
 
     _lastSyncStart = ESTime::currentContinuousTime();
+    ESEventLog::record(ESEventSyncStart, 0, userRequested ? 1 : 0);
 
     // Here, everything is stopped
     _stopReading = false;
@@ -1395,6 +1861,12 @@ ESNTPDriver::startSyncing(bool userRequested) {  // The name of this parameter i
     _numPacketsSent = 0;
     _numPacketsReceived = 0;
     _numLongTimeoutsTriggered = 0;
+    syncReportLock.lock();
+    _lastSyncDNSWaitTime = -1;
+    _numDNSLookups = 0;
+    _numDNSCacheHits = 0;
+    _sumDNSLookupTime = 0;
+    syncReportLock.unlock();
     _throttleLastTicketTime = 0;
     _throttleSendInterval = 0;
 
@@ -1435,6 +1907,7 @@ ESNTPDriver::startSyncing(bool userRequested) {  // The name of this parameter i
 
     int i = 0;
     bool firstNonUserResolved = false;
+    int numSeededFromCache = 0;
     while (_hostNameIterator.next()) {
         bool isUserHost = _hostNameIterator.isUserHost();
         ESNTPHostNameDescriptor *hostNameDescriptor = &_hostNameDescriptors[i];
@@ -1444,6 +1917,9 @@ ESNTPDriver::startSyncing(bool userRequested) {  // The name of this parameter i
                                  this);
         if (isUserHost || inPollingMode) {
             hostNameDescriptor->startResolving();
+        } else if (int numSeeded = hostNameDescriptor->seedFromHostCache(_deviceCountryCode)) {
+            numSeededFromCache += numSeeded;  // Already in the RTT queue
+            hostNameDescriptor->startResolving();  // In the background, to pick up any change in the name's addresses
         } else {
             if (!firstNonUserResolved) {
                 hostNameDescriptor->startResolving();
@@ -1454,6 +1930,15 @@ ESNTPDriver::startSyncing(bool userRequested) {  // The name of this parameter i
     }
     ESAssert(i == _hostNameIterator.totalNumberOfHostNames());
     ESAssert(i == _hostNameDescriptors.size());
+    if (numSeededFromCache) {
+        // Start with the historically best host rather than waiting for a resolution to complete
+        tracePrintf1("seeded %d pool address(es) from the host cache", numSeededFromCache);
+        sendPacketToFastestPoolHost();
+        if (!_noProgressTimeout) {
+            installNoProgressTimeout();
+        }
+    }
+    prefetchPoolHostDNS();
     makeHostReportIfRequired();
 }
 
@@ -1485,6 +1970,228 @@ ESNTPDriver::processRemoteSockets(fd_set *fdset) {
     }
 }
 
+#if ES_NTP_USE_EPOLL
+// Sockets are added to the epoll set when they're connected and removed when they're closed, so a
+// wakeup costs time proportional to the number of sockets that actually have data, not the number we own.
+// The ESThread inter-thread message fds are not in the set:  ESThread can add to them whenever a thread is
+// created, and it has no way to tell us, so we ask for them afresh on every pass, as the select() loop does,
+// and wait on them and the epoll fd together (see processEpollEvents()).
+
+bool
+ESNTPDriver::setupEpoll() {
+    ESAssert(_thread->inThisThread());
+    ESAssert(_epollFD < 0);
+    _epollFD = epoll_create1(EPOLL_CLOEXEC);
+    if (_epollFD < 0) {
+        ESErrorReporter::checkAndLogSystemError("ESNTPDriver", errno, "Creating epoll fd, falling back to select()");
+        return false;
+    }
+    return true;
+}
+
+void
+ESNTPDriver::registerSocketFD(ESNTPSocketDescriptor *socketDescriptor) {
+    ESAssert(_thread->inThisThread());
+    if (_epollFD < 0) {
+        return;  // Using select()
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = socketDescriptor;
+    if (epoll_ctl(_epollFD, EPOLL_CTL_ADD, socketDescriptor->fd(), &event) != 0) {
+        ESErrorReporter::checkAndLogSystemError("ESNTPDriver", errno, "Adding NTP socket to epoll set");
+    }
+}
+
+void
+ESNTPDriver::unregisterSocketFD(int fd) {
+    ESAssert(_thread->inThisThread());
+    if (_epollFD < 0) {
+        return;  // Using select()
+    }
+    // close() would remove it anyway, but only if there are no other references to the open file
+    if (epoll_ctl(_epollFD, EPOLL_CTL_DEL, fd, NULL) != 0) {
+        ESErrorReporter::checkAndLogSystemError("ESNTPDriver", errno, "Removing NTP socket from epoll set");
+    }
+}
+
+// One pass of the driver thread's loop:  wait for the epoll fd (which is readable when any socket is) or an
+// inter-thread message, then drain the ready sockets without blocking and run the messages
+void
+ESNTPDriver::processEpollEvents() {
+    ESAssert(_thread->inThisThread());
+    fd_set readers;
+    FD_ZERO(&readers);
+    int highestThreadFD = ESThread::setBitsForSelect(&readers);
+    FD_SET(_epollFD, &readers);
+    int nfds = ESUtil::max(highestThreadFD, _epollFD) + 1;
+    if (select(nfds, &readers, NULL/*writers*/, NULL, NULL) < 0) {
+        if (errno != EINTR) {
+            ESErrorReporter::checkAndLogSystemError("ESNTPDriver", errno, "select() on epoll fd failure");
+        }
+        return;
+    }
+    if (FD_ISSET(_epollFD, &readers)) {
+        FD_CLR(_epollFD, &readers);  // ESThread expects only its own bits
+        struct epoll_event events[ES_NTP_EPOLL_MAX_EVENTS];
+        int numEvents = epoll_wait(_epollFD, events, ES_NTP_EPOLL_MAX_EVENTS, 0/*don't block*/);
+        if (numEvents < 0 && errno != EINTR) {
+            ESErrorReporter::checkAndLogSystemError("ESNTPDriver", errno, "epoll_wait() failure");
+        }
+        _reading = true;
+        for (int i = 0; i < numEvents && !_stopReading; i++) {
+            // Socket descriptors aren't deleted while _reading is set, so the pointer is still good
+            ((ESNTPSocketDescriptor *)events[i].data.ptr)->drainSocket(this);
+        }
+        _reading = false;
+        if (_stopReading) {
+            _stopReading = false;
+            stopSyncingInThisThread();
+        }
+    }
+    ESThread::processInterThreadMessages(&readers);
+}
+#endif
+
+#if defined(ES_NTP_WAKEUP_BENCHMARK) && ES_NTP_USE_EPOLL
+#define ES_NTP_WAKEUP_BENCHMARK_WAKEUPS 5000  /* Wakeups timed for each socket count and engine */
+
+static int
+compareWakeupCosts(const void *a,
+                   const void *b) {
+    ESTimeInterval x = *(const ESTimeInterval *)a;
+    ESTimeInterval y = *(const ESTimeInterval *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// Each wakeup starts with one packet sent to the next socket round-robin, so every socket carries traffic and exactly
+// one is ready.  A wakeup is timed from building the wait set (for select(), the fd_set of every socket; for epoll,
+// just the epoll fd) through the wait, which returns at once, to having read the packet:  one recv() per ready socket
+// for the select() loop, and epoll_wait() plus a recvmmsg() drain for the epoll engine, as in the driver.  Both wait
+// sets include the thread's inter-thread message fds, as the driver's do.
+static void
+runWakeupBenchmark(int  numSockets,
+                   bool useEpoll) {
+    int *fds = new int[numSockets];
+    struct sockaddr_in *addrs = new struct sockaddr_in[numSockets];
+    int maxFD = -1;
+    int epollFD = useEpoll ? epoll_create1(EPOLL_CLOEXEC) : -1;
+    int numOpened;
+    for (numOpened = 0; numOpened < numSockets; numOpened++) {
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0) {
+            break;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        memset(&addrs[numOpened], 0, sizeof(addrs[numOpened]));
+        addrs[numOpened].sin_family = AF_INET;
+        addrs[numOpened].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t addrLen = sizeof(addrs[numOpened]);
+        bind(fd, (struct sockaddr *)&addrs[numOpened], addrLen);
+        getsockname(fd, (struct sockaddr *)&addrs[numOpened], &addrLen);
+        if (useEpoll) {
+            struct epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            epoll_ctl(epollFD, EPOLL_CTL_ADD, fd, &event);
+        }
+        fds[numOpened] = fd;
+        if (fd > maxFD) {
+            maxFD = fd;
+        }
+    }
+    int senderFD = socket(AF_INET, SOCK_DGRAM, 0);
+    if (numOpened < numSockets || (!useEpoll && maxFD >= FD_SETSIZE)) {
+        printf("NTP WAKEUP: %4d sockets, %s:  can't run (%s)\n", numSockets, useEpoll ? "epoll " : "select",
+               numOpened < numSockets ? "out of fds" : "fds past FD_SETSIZE");
+    } else {
+        ESTimeInterval *costs = new ESTimeInterval[ES_NTP_WAKEUP_BENCHMARK_WAKEUPS];
+        struct pkt packet;
+        memset(&packet, 0, sizeof(packet));
+        struct pkt responses[ES_NTP_RECV_BATCH];
+        struct iovec iovecs[ES_NTP_RECV_BATCH];
+        struct mmsghdr msgs[ES_NTP_RECV_BATCH];
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < ES_NTP_RECV_BATCH; i++) {
+            iovecs[i].iov_base = &responses[i];
+            iovecs[i].iov_len = sizeof(struct pkt);
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int numRead = 0;
+        for (int w = 0; w < ES_NTP_WAKEUP_BENCHMARK_WAKEUPS; w++) {
+            int target = w % numSockets;
+            sendto(senderFD, &packet, LEN_PKT_NOMAC, 0, (struct sockaddr *)&addrs[target], sizeof(addrs[target]));
+            ESTimeInterval start = ESTime::currentContinuousTime();
+            fd_set readers;
+            FD_ZERO(&readers);
+            int highestThreadFD = ESThread::setBitsForSelect(&readers);
+            int nfds;
+            if (useEpoll) {
+                FD_SET(epollFD, &readers);
+                nfds = ESUtil::max(highestThreadFD, epollFD) + 1;
+            } else {
+                for (int i = 0; i < numSockets; i++) {
+                    FD_SET(fds[i], &readers);
+                }
+                nfds = ESUtil::max(highestThreadFD, maxFD) + 1;
+            }
+            select(nfds, &readers, NULL/*writers*/, NULL, NULL);
+            if (useEpoll) {
+                struct epoll_event events[ES_NTP_EPOLL_MAX_EVENTS];
+                int numEvents = epoll_wait(epollFD, events, ES_NTP_EPOLL_MAX_EVENTS, 0/*don't block*/);
+                for (int e = 0; e < numEvents; e++) {
+                    int numReceived;
+                    do {
+                        numReceived = recvmmsg(events[e].data.fd, msgs, ES_NTP_RECV_BATCH, MSG_DONTWAIT, NULL);
+                        numRead += numReceived > 0 ? numReceived : 0;
+                    } while (numReceived == ES_NTP_RECV_BATCH);
+                }
+            } else {
+                for (int i = 0; i < numSockets; i++) {
+                    if (FD_ISSET(fds[i], &readers) && recv(fds[i], &responses[0], sizeof(struct pkt), 0) > 0) {
+                        numRead++;
+                    }
+                }
+            }
+            costs[w] = ESTime::currentContinuousTime() - start;
+        }
+        qsort(costs, ES_NTP_WAKEUP_BENCHMARK_WAKEUPS, sizeof(costs[0]), compareWakeupCosts);
+        ESTimeInterval total = 0;
+        for (int w = 0; w < ES_NTP_WAKEUP_BENCHMARK_WAKEUPS; w++) {
+            total += costs[w];
+        }
+        printf("NTP WAKEUP: %4d sockets, %s:  per wakeup mean %7.2f us, median %7.2f us, 99%% %7.2f us (%d of %d packets read)\n",
+               numSockets, useEpoll ? "epoll " : "select",
+               total / ES_NTP_WAKEUP_BENCHMARK_WAKEUPS * 1e6,
+               costs[ES_NTP_WAKEUP_BENCHMARK_WAKEUPS / 2] * 1e6,
+               costs[ES_NTP_WAKEUP_BENCHMARK_WAKEUPS * 99 / 100] * 1e6,
+               numRead, ES_NTP_WAKEUP_BENCHMARK_WAKEUPS);
+        delete [] costs;
+    }
+    close(senderFD);
+    for (int i = 0; i < numOpened; i++) {
+        close(fds[i]);
+    }
+    if (epollFD >= 0) {
+        close(epollFD);
+    }
+    delete [] addrs;
+    delete [] fds;
+}
+
+static void
+runWakeupBenchmarks() {
+    static const int socketCounts[] = { 10, 100, 1000 };
+    for (size_t i = 0; i < sizeof(socketCounts) / sizeof(socketCounts[0]); i++) {
+        runWakeupBenchmark(socketCounts[i], false/*useEpoll*/);
+        runWakeupBenchmark(socketCounts[i], true/*useEpoll*/);
+    }
+}
+#endif  // ES_NTP_WAKEUP_BENCHMARK && ES_NTP_USE_EPOLL
+
 void *
 ESNTPDriver::threadMain() {
     ESAssert(_thread->inThisThread());
@@ -1497,6 +2204,19 @@ ESNTPDriver::threadMain() {
     //ESErrorReporter::logInfo("ESNTPDriver", "NTPDriver done starting all hosts");
 
     _stopThread = false;
+#if defined(ES_NTP_WAKEUP_BENCHMARK) && ES_NTP_USE_EPOLL
+    runWakeupBenchmarks();  // Before any of our own sockets exist; messages arriving meanwhile wait for the loop
+#endif
+#if ES_NTP_USE_EPOLL
+    if (setupEpoll()) {
+        while (!_stopThread) {
+            processEpollEvents();
+        }
+        close(_epollFD);
+        _epollFD = -1;
+        return NULL;
+    }
+#endif
     while (!_stopThread) {
         fd_set readers;
         FD_ZERO(&readers);
@@ -1674,8 +2394,6 @@ ESNTPDriver::closeAllSockets() {
     }
 }
 
-static ESLock syncReportLock;
-
 /*static*/ int 
 ESNTPDriver::numPacketsSent() {
     return _numPacketsSent;
@@ -1699,20 +2417,43 @@ ESNTPDriver::lastSyncElapsedTime() {
     return returnValue;
 }
 
-/*static*/ double
-ESNTPDriver::avgPacketsSent() {
+/*static*/ ESTimeInterval
+ESNTPDriver::lastSyncDNSWaitTime() {
     syncReportLock.lock();
-    double returnValue;
-    // Don't include the current run in the average -- it will artificially lower the result
-    if (_numSyncs == 0) {
-        returnValue = 0;
+    ESTimeInterval returnValue;
+    if (_lastSyncDNSWaitTime >= 0) {
+        returnValue = _lastSyncDNSWaitTime;
+    } else if (_lastSyncStart) {
+        returnValue = ESTime::currentContinuousTime() - _lastSyncStart;  // Still waiting
     } else {
-        returnValue = (double)_sumNumPacketsSent / _numSyncs;
+        returnValue = 0;
     }
     syncReportLock.unlock();
     return returnValue;
 }
 
+/*static*/ ESTimeInterval
+ESNTPDriver::avgDNSLookupTime() {
+    syncReportLock.lock();
+    ESTimeInterval returnValue = _numDNSLookups ? _sumDNSLookupTime / _numDNSLookups : 0;
+    syncReportLock.unlock();
+    return returnValue;
+}
+
+/*static*/ int
+ESNTPDriver::numDNSCacheHits() {
+    syncReportLock.lock();
+    int returnValue = _numDNSCacheHits;
+    syncReportLock.unlock();
+    return returnValue;
+}
+
+/*static*/ double
+ESNTPDriver::avgPacketsSent() {
+    // Doesn't include the current run -- it would artificially lower the result
+    return packetsPerSyncMetric.mean();
+}
+
 /*static*/ ESTimeInterval
 ESNTPDriver::timeOfLastSuccessfulSync() {
     return _timeOfLastSuccessfulSync;
@@ -1729,16 +2470,8 @@ ESNTPDriver::timeOfLastSyncAttempt() {
 
 /*static*/ ESTimeInterval
 ESNTPDriver::avgSyncElapsedTime() {
-    syncReportLock.lock();
-    ESTimeInterval returnValue;
-    // Don't include the current run in the average -- it will artificially lower the result
-    if (_numSyncs == 0) {
-        returnValue = 0;
-    } else {
-        returnValue = _sumLastSyncElapsedTime / _numSyncs;
-    }
-    syncReportLock.unlock();
-    return returnValue;
+    // Doesn't include the current run -- it would artificially lower the result
+    return timeToSyncMetric.mean();
 }
 
 void
@@ -1751,14 +2484,20 @@ ESNTPDriver::stopSyncingInThisThread() {
         if (_lastSyncStart) {
             syncReportLock.lock();
             _lastSyncElapsedTime = ESTime::currentContinuousTime() - _lastSyncStart;
+            ESEventLog::record(ESEventSyncStop, 0, _lastSyncElapsedTime, (float)_numPacketsSent);
             _timeOfLastSyncAttempt = ESTime::currentTime();
             tracePrintf3("stopSyncing after sending %d packet%s, synchronization took %.2f seconds",
                          _numPacketsSent, _numPacketsSent == 1 ? "" : "s", _lastSyncElapsedTime);
+            if (_lastSyncDNSWaitTime < 0) {
+                _lastSyncDNSWaitTime = _lastSyncElapsedTime;  // Never got an address at all
+            }
+            tracePrintf4("...of which %.2f seconds was waiting for DNS; %d lookup(s) averaging %.3f seconds, %d resolver cache hit(s)",
+                         _lastSyncDNSWaitTime, _numDNSLookups, _numDNSLookups ? _sumDNSLookupTime / _numDNSLookups : 0.0, _numDNSCacheHits);
             _lastSyncStart = 0;
-            _numSyncs++;
-            _sumLastSyncElapsedTime += _lastSyncElapsedTime;
-            _sumNumPacketsSent += _numPacketsSent;
             syncReportLock.unlock();
+            syncsMetric.add();
+            timeToSyncMetric.record(_lastSyncElapsedTime);
+            packetsPerSyncMetric.record(_numPacketsSent);
         } else {
             ESAssert(false);  // This happens but I don't know why so I'm putting this in to find out...
             tracePrintf2("stopSyncing after sending %d packet%s, sync stop without corresponding start?",
@@ -1783,10 +2522,12 @@ ESNTPDriver::stopSyncingInThisThread() {
         stopPollingCycle();
     }
     ESTime::workingSyncValue(-1, -1);
+    updateHostCache();
     // Most of this is redundant with what happens in startSyncing():
     _throttleSendInterval = 0;
     _hostNameIterator.reset();
     _hostNameDescriptors.clear();
+    hostNameDescriptorsGeneration++;
     // Gack.  STL priority_queues have no clear() method?  Why would anyone want that? </sarcasm>
     // ... so we assign an empty queue to it.  Yeah, much better. </sarcasm>
     _availablePoolSocketsByRTT = std::priority_queue<ESNTPSocketDescriptor*, std::vector<ESNTPSocketDescriptor *>, bool (*)(ESNTPSocketDescriptor *, ESNTPSocketDescriptor *)>(ESNTPSocketRTTGreaterThan);
@@ -1883,6 +2624,13 @@ ESNTPDriver::nameResolutionComplete(ESNTPHostNameDescriptor *hostNameDescriptor)
     stateGotNameResolutionComplete(hostNameDescriptor);
 }
 
+void 
+ESNTPDriver::prefetchComplete(ESNTPHostNameDescriptor *hostNameDescriptor) {
+    _poolHostLookupFailures = 0;  // Must not be a network problem (any more)
+    makeHostReportIfRequired();
+    // Don't send; the addresses are held until resolveOnePoolHostDNS() asks for them
+}
+
 void
 ESNTPDriver::logAllHostAddresses(bool       includeNoPacketHosts,
                                  const char *introMessage) {
@@ -1928,41 +2676,212 @@ ESNTPDriver::incrementNumPacketsReceived() {
     _numPacketsReceived++;
 }
 
-// Return true iff we're using the packet
-bool 
-ESNTPDriver::gotPacket(ESTimeInterval        minOffset,
-                       ESTimeInterval        maxOffset,
-                       ESNTPSocketDescriptor *socketDescriptor) {
+// *****************************************************************************
+// Combining the offset intervals from all hosts
+// *****************************************************************************
+
+// Each host's packets are intersected into that host's own [skewLB, skewUB] interval (see
+// ESNTPSocketDescriptor::processPacket).  Here we look for the interval agreed on by the largest
+// possible majority of hosts, in the manner of clock_select() in ntpd (ntpdist/ntpd/ntp_proto.c):
+// presume f of the n hosts are falsetickers, starting with f = 0, and find the lowest point
+// covered by at least n - f of the intervals and the highest point covered by at least n - f of them.
+// If those points cross, try again with one more falseticker, giving up when the falsetickers would
+// no longer be a minority.  When all hosts agree this is just the intersection of all of the intervals.
+
+struct ESNTPIntervalEndpoint {
+    ESTimeInterval          offset;
+    int                     type;   // -1 for the low end of an interval, +1 for the high end
+};
+
+static bool ESNTPIntervalEndpointLessThan(const ESNTPIntervalEndpoint &e1,
+                                          const ESNTPIntervalEndpoint &e2) {
+    if (e1.offset != e2.offset) {
+        return e1.offset < e2.offset;
+    }
+    return e1.type < e2.type;  // Low ends first, so intervals which just touch are considered to overlap
+}
+
+// Return true iff a majority interval was found, in which case it is left in _maxMinOffset and _minMaxOffset
+bool
+ESNTPDriver::findMajorityInterval(int *numSources,
+                                  int *numFalsetickers) {
     ESAssert(_thread->inThisThread());
-    if (minOffset > _maxMinOffset) {
-        _maxMinOffset = minOffset;
+    std::vector<ESNTPIntervalEndpoint> endpoints;
+    for (size_t n = 0; n < _hostNameDescriptors.size(); n++) {
+        const ESNTPHostNameDescriptor *hostNameDescriptor = &_hostNameDescriptors[n];
+        for (int i = 0; i < hostNameDescriptor->_numSocketDescriptors; i++) {
+            const ESNTPSocketDescriptor *socketDescriptor = &hostNameDescriptor->_socketDescriptors[i];
+            if (socketDescriptor->packetsUsed() == 0 || socketDescriptor->isFalseticker()) {
+                continue;
+            }
+            ESAssert(socketDescriptor->skewLB() <= socketDescriptor->skewUB());  // dropFalsetickers() takes care of hosts which disagree with themselves
+            ESNTPIntervalEndpoint endpoint;
+            endpoint.offset = socketDescriptor->skewLB();
+            endpoint.type = -1;
+            endpoints.push_back(endpoint);
+            endpoint.offset = socketDescriptor->skewUB();
+            endpoint.type = 1;
+            endpoints.push_back(endpoint);
+        }
     }
-    if (maxOffset < _minMaxOffset) {
-        _minMaxOffset = maxOffset;
+    int n = (int)endpoints.size() / 2;
+    *numSources = n;
+    if (n == 0) {
+        return false;
+    }
+    std::sort(endpoints.begin(), endpoints.end(), ESNTPIntervalEndpointLessThan);
+    for (int f = 0; 2 * f < n; f++) {
+        int needed = n - f;
+        bool foundLow = false;
+        ESTimeInterval low = 0;
+        int count = 0;
+        for (int i = 0; i < 2 * n; i++) {
+            count -= endpoints[i].type;
+            if (count >= needed) {
+                low = endpoints[i].offset;
+                foundLow = true;
+                break;
+            }
+        }
+        bool foundHigh = false;
+        ESTimeInterval high = 0;
+        count = 0;
+        for (int i = 2 * n - 1; i >= 0; i--) {
+            count += endpoints[i].type;
+            if (count >= needed) {
+                high = endpoints[i].offset;
+                foundHigh = true;
+                break;
+            }
+        }
+        if (foundLow && foundHigh && low <= high) {
+            _maxMinOffset = low;
+            _minMaxOffset = high;
+            *numFalsetickers = f;
+            return true;
+        }
     }
+    return false;
+}
+
+// Mark the hosts which disagree with themselves and, if includeOutvoted, those whose intervals don't reach
+// the majority interval, so that we stop using them.  They're taken out of the pool queue and never put back.
+void
+ESNTPDriver::dropFalsetickers(bool includeOutvoted) {
+    ESAssert(_thread->inThisThread());
+    bool droppedAny = false;
+    for (size_t n = 0; n < _hostNameDescriptors.size(); n++) {
+        ESNTPHostNameDescriptor *hostNameDescriptor = &_hostNameDescriptors[n];
+        for (int i = 0; i < hostNameDescriptor->_numSocketDescriptors; i++) {
+            ESNTPSocketDescriptor *socketDescriptor = &hostNameDescriptor->_socketDescriptors[i];
+            if (socketDescriptor->packetsUsed() == 0 || socketDescriptor->_falseticker) {
+                continue;
+            }
+            if (socketDescriptor->_skewLB > socketDescriptor->_skewUB) {
+                ESErrorReporter::logError("ESNTPDriver", ESUtil::stringWithFormat("Dropping host %s (%s): its own packets don't overlap",
+                                                                                  socketDescriptor->humanReadableIPAddress().c_str(),
+                                                                                  hostNameDescriptor->nameAsRequested().c_str()).c_str());
+            } else if (includeOutvoted && (socketDescriptor->_skewUB < _maxMinOffset || socketDescriptor->_skewLB > _minMaxOffset)) {
+                ESErrorReporter::logError("ESNTPDriver", ESUtil::stringWithFormat("Dropping falseticker host %s (%s): %.3f %.3f is outside majority interval %.3f %.3f",
+                                                                                  socketDescriptor->humanReadableIPAddress().c_str(),
+                                                                                  hostNameDescriptor->nameAsRequested().c_str(),
+                                                                                  socketDescriptor->_skewLB, socketDescriptor->_skewUB,
+                                                                                  _maxMinOffset, _minMaxOffset).c_str());
+            } else {
+                continue;
+            }
+            socketDescriptor->_falseticker = true;
+            socketDescriptor->_averageRTT = ES_FORCE_RTT_FOR_BAD_HOST;  // For the host cache
+            droppedAny = true;
+        }
+    }
+    if (droppedAny) {
+        removeRetiredSocketsFromPoolQueue();
+    }
+}
+
+// Changing the RTT of a socket already in the queue breaks the heap ordering, so rather than leave new
+// falsetickers (or stale cached addresses) in place we rebuild the queue without them.  Popping a misordered
+// heap still yields every element.
+void
+ESNTPDriver::removeRetiredSocketsFromPoolQueue() {
+    ESAssert(_thread->inThisThread());
+    std::vector<ESNTPSocketDescriptor *> keep;
+    keep.reserve(_availablePoolSocketsByRTT.size());
+    while (!_availablePoolSocketsByRTT.empty()) {
+        ESNTPSocketDescriptor *socketDescriptor = _availablePoolSocketsByRTT.top();
+        _availablePoolSocketsByRTT.pop();
+        if (!socketDescriptor->isRetiredFromPool()) {
+            keep.push_back(socketDescriptor);
+        }
+    }
+    for (size_t i = 0; i < keep.size(); i++) {
+        _availablePoolSocketsByRTT.push(keep[i]);
+    }
+}
+
+// Return true iff we're using the packet
+bool 
+ESNTPDriver::gotPacket(ESTimeInterval        minOffset,
+                       ESTimeInterval        maxOffset,
+                       ESNTPSocketDescriptor *socketDescriptor) {
+    ESAssert(_thread->inThisThread());
     tracePrintf6("%s (%s) got packet min/max %.3f %.3f (rtt %.3f, avg rtt %.3f)",
                  socketDescriptor->humanReadableIPAddress().c_str(),
                  socketDescriptor->hostNameDescriptor()->nameAsRequested().c_str(),
                  minOffset, maxOffset, (maxOffset - minOffset), socketDescriptor->averageRTT());
-    tracePrintf6("%s (%s) ... cumulativeMinMax %.3f %.3f (bound %.3f, err %.3f)",
-                 socketDescriptor->humanReadableIPAddress().c_str(),
-                 socketDescriptor->hostNameDescriptor()->nameAsRequested().c_str(),
-                 _maxMinOffset, _minMaxOffset, _minMaxOffset - _maxMinOffset, (_minMaxOffset - _maxMinOffset)/2.0);
+    // In polling mode each host's interval is just its last packet, so a host can't disagree with itself, and
+    // one which is outvoted now might not be next time:  we don't drop anybody, we just count the votes each time.
+    if (!inPollingMode) {
+        dropFalsetickers(false/* !includeOutvoted*/);  // This packet might have made its host disagree with itself
+    }
+    if (socketDescriptor->isFalseticker()) {
+        tracePrintf2("%s (%s) ... ignoring packet from falseticker",
+                     socketDescriptor->humanReadableIPAddress().c_str(),
+                     socketDescriptor->hostNameDescriptor()->nameAsRequested().c_str());
+        if (!inPollingMode && !socketDescriptor->_hostNameDescriptor->_isUserHost) {
+            sendPacketToFastestPoolHost();
+        }
+        return false;
+    }
 
-    if (_minMaxOffset < _maxMinOffset) {
-        std::string str = ESUtil::stringWithFormat("Got non-overlapping packet data from host %s (%s) (the error might be from another host though):",
-                                                   socketDescriptor->humanReadableIPAddress().c_str(),
-                                                   socketDescriptor->hostNameDescriptor()->nameAsRequested().c_str());
+    int numSources = 0;
+    int numFalsetickers = 0;
+    bool haveMajority = findMajorityInterval(&numSources, &numFalsetickers);
+#ifdef ES_NTP_LOOPBACK_SIMULATOR
+    // The old cumulative intersection went empty whenever any two hosts disagreed, and the driver then threw
+    // away every sample and started over
+    if (restartOnDisagreement && !inPollingMode && (haveMajority ? numFalsetickers > 0 : numSources > 1)) {
+        ESErrorReporter::logInfo("ESNTPDriver", "Restarting because of non-overlapping packet data");
+        resyncInThisThread(false/* !userRequested*/);
+        return true;  // we're not "using" this packet but this will prevent a deleted socket from referencing itself
+    }
+#endif
+    if (!haveMajority) {
+        // No majority yet (e.g., two hosts which disagree); we need to hear from more hosts before we can tell who's right
+        tracePrintf1("... no majority among %d hosts, looking for more", numSources);
+        makeHostReportIfRequired();
         if (inPollingMode) {
-            makeHostReportIfRequired();  // Do this here, after we bump down the count, not in driver::gotPacket
             return true;
         }
-        ESErrorReporter::logError("ESNTPDriver", str.c_str());
+        stateGotPacketWithUnreportableSync(socketDescriptor, maxOffset - minOffset);
+        return true;
+    }
+    tracePrintf6("%s (%s) ... majority interval %.3f %.3f (bound %.3f, err %.3f)",
+                 socketDescriptor->humanReadableIPAddress().c_str(),
+                 socketDescriptor->hostNameDescriptor()->nameAsRequested().c_str(),
+                 _maxMinOffset, _minMaxOffset, _minMaxOffset - _maxMinOffset, (_minMaxOffset - _maxMinOffset)/2.0);
+    if (numFalsetickers > 0 && !inPollingMode) {
+        dropFalsetickers(true/*includeOutvoted*/);
         logAllHostAddresses(false/* !includeNoPacketHosts*/,
                             "Hosts which have contributed to the cumulative result follow:");
-        ESErrorReporter::logInfo("ESNTPDriver", "Restarting because of non-overlapping packet data");
-        resyncInThisThread(false/* !userRequested*/);
-        return true;  // we're not "using" this packet but this will prevent a deleted socket from referencing itself
+        if (socketDescriptor->isFalseticker()) {
+            makeHostReportIfRequired();
+            if (!inPollingMode && !socketDescriptor->_hostNameDescriptor->_isUserHost) {
+                sendPacketToFastestPoolHost();
+            }
+            return true;  // The packet went into the vote, so it was "used", even though it lost
+        }
     }
     double currentError =  (_minMaxOffset - _maxMinOffset) / 2;
     double tentativeSkew = (_minMaxOffset + _maxMinOffset) / 2;
@@ -1976,6 +2895,9 @@ ESNTPDriver::gotPacket(ESTimeInterval        minOffset,
 #endif
         tracePrintf("...so we're done!!");
         makeHostReportIfRequired();  // Do this before stopping the sync otherwise the array of descriptors will be already gone
+        if (inDisciplineMode) {
+            _discipline.addSample(ESTime::currentContinuousTime(), tentativeSkew, currentError);
+        }
         setContSkew(tentativeSkew, currentError);
         setStatus(ESTimeSourceStatusSynchronized);
         _timeOfLastSuccessfulSync = ESTime::currentTime();
@@ -2028,12 +2950,40 @@ ESNTPDriver::pushPoolSocket(ESNTPSocketDescriptor *socketDescriptor) {
                  socketDescriptor->humanReadableIPAddress().c_str(),
                  socketDescriptor->hostNameDescriptor()->nameAsRequested().c_str(),
                  socketDescriptor->averageRTT());
+    if (socketDescriptor->isRetiredFromPool()) {
+        return;  // We don't send to these any more
+    }
     _availablePoolSocketsByRTT.push(socketDescriptor);
 }
 
+// Cached addresses which the fresh DNS answer didn't include go stale once ES_DNS_CACHE_LIFETIME has passed
+void
+ESNTPDriver::retireExpiredCachedAddresses() {
+    ESAssert(_thread->inThisThread());
+    ESTimeInterval now = ESTime::currentContinuousTime();
+    bool retiredAny = false;
+    for (size_t n = 0; n < _hostNameDescriptors.size(); n++) {
+        ESNTPHostNameDescriptor *hostNameDescriptor = &_hostNameDescriptors[n];
+        for (int i = 0; i < hostNameDescriptor->_numSocketDescriptors; i++) {
+            ESNTPSocketDescriptor *socketDescriptor = &hostNameDescriptor->_socketDescriptors[i];
+            if (socketDescriptor->_unresolvedExpiration && !socketDescriptor->_stale && now >= socketDescriptor->_unresolvedExpiration) {
+                tracePrintf2("cached address %s for '%s' has expired",
+                             socketDescriptor->humanReadableIPAddress().c_str(), hostNameDescriptor->nameAsRequested().c_str());
+                socketDescriptor->_stale = true;
+                retiredAny = true;
+            }
+        }
+    }
+    if (retiredAny) {
+        removeRetiredSocketsFromPoolQueue();
+    }
+}
+
 void
 ESNTPDriver::sendPacketToFastestPoolHost() {
     ESAssert(_thread->inThisThread());
+    retireExpiredCachedAddresses();
+    ESAssert(_availablePoolSocketsByRTT.empty() || !_availablePoolSocketsByRTT.top()->isRetiredFromPool());  // pushPoolSocket() and removeRetiredSocketsFromPoolQueue() see to that
     if (_availablePoolSocketsByRTT.size() == 0) {
         resolveOnePoolHostDNS();
         return;
@@ -2056,6 +3006,12 @@ ESNTPDriver::sendPacketToFastestPoolHost() {
 void
 ESNTPDriver::sendPacketToFastestPoolHostIncludingThisOne(ESNTPSocketDescriptor *socketDescriptor) {
     ESAssert(_thread->inThisThread());
+    retireExpiredCachedAddresses();
+    if (socketDescriptor->isRetiredFromPool()) {
+        sendPacketToFastestPoolHost();  // But not this one
+        return;
+    }
+    ESAssert(_availablePoolSocketsByRTT.empty() || !_availablePoolSocketsByRTT.top()->isRetiredFromPool());
     if (_availablePoolSocketsByRTT.size() == 0) {
         socketDescriptor->sendPacket(this, false/* !haveTicket*/);
         return;
@@ -2106,15 +3062,61 @@ ESNTPDriver::resolveOnePoolHostDNS() {
         if (hostNameDescriptor->_proximity > _currentProximity) {
             return false;
         }
+        if (hostNameDescriptor->_isUserHost) {
+            continue;
+        }
+        if (hostNameDescriptor->_prefetching) {
+            if (hostNameDescriptor->_resolving) {
+                // Already on its way; have it report in as if we'd asked for it just now
+                hostNameDescriptor->_prefetching = false;
+                return true;
+            }
+            if (hostNameDescriptor->numSocketDescriptors() > 0) {
+                tracePrintf1("using prefetched addresses for '%s'", hostNameDescriptor->nameAsRequested().c_str());
+                hostNameDescriptor->queueHeldSockets();
+                prefetchPoolHostDNS();
+                stateGotNameResolutionComplete(hostNameDescriptor);
+                return true;
+            }
+            // Otherwise the prefetch failed, and its retry timer is running
+        }
         if (!hostNameDescriptor->_resolving && !hostNameDescriptor->_doneResolving) { // _doneResolving is set even on failure for just this reason
             // virgin host -- never resolved: resolve it!
             hostNameDescriptor->startResolving();
+            prefetchPoolHostDNS();
             return true;
         }
     }
     return false;
 }
 
+// Start resolving the next few pool host names, up to one proximity level beyond the current one, in parallel,
+// so their addresses are on hand by the time resolveOnePoolHostDNS() wants them
+void
+ESNTPDriver::prefetchPoolHostDNS() {
+    ESAssert(_thread->inThisThread());
+    if (inPollingMode) {
+        return;  // Everything was resolved up front
+    }
+    int numOutstanding = 0;
+    for (size_t n = 0; n < _hostNameDescriptors.size(); n++) {
+        ESNTPHostNameDescriptor *hostNameDescriptor = &_hostNameDescriptors[n];
+        if (hostNameDescriptor->_prefetching && (hostNameDescriptor->_resolving || hostNameDescriptor->numSocketDescriptors() > 0)) {
+            numOutstanding++;
+        }
+    }
+    for (size_t n = 0; n < _hostNameDescriptors.size() && numOutstanding < ES_DNS_PREFETCH_COUNT; n++) {
+        ESNTPHostNameDescriptor *hostNameDescriptor = &_hostNameDescriptors[n];
+        if (hostNameDescriptor->_proximity > _currentProximity + 1) {
+            break;
+        }
+        if (!hostNameDescriptor->_isUserHost && !hostNameDescriptor->_resolving && !hostNameDescriptor->_doneResolving) {
+            hostNameDescriptor->startPrefetching();
+            numOutstanding++;
+        }
+    }
+}
+
 class ESNTPNoProgressTimeoutObserver : public ESTimerObserver {
   public:
     /*virtual*/ void        notify(ESTimer *timer) {
@@ -2159,15 +3161,78 @@ ESNTPDriver::stateGotFinishingPacket() {
     }
     _lastSuccessfulSyncTime = ESTime::currentContinuousTime();
     _lastFailTimeout = 0;
-    _restartSyncTimeout = new ESIntervalTimer(restartSyncTimeoutObserver, ES_FIX_TIMEOUT);
+    ESTimeInterval resyncInterval = inDisciplineMode ? _discipline.pollInterval() : ES_FIX_TIMEOUT;
+    tracePrintf1("next sync in %.0f seconds", resyncInterval);
+    _restartSyncTimeout = new ESIntervalTimer(restartSyncTimeoutObserver, resyncInterval);
     _restartSyncTimeout->setInfo(this);
+    _restartSyncTimeout->setLeeway(ES_RESYNC_LEEWAY);
     _restartSyncTimeout->activate();
     stopSyncingInThisThread();
+    if (inDisciplineMode) {
+        installPredictionTimer();
+    }
+}
+
+class ESNTPPredictionTimerObserver : public ESTimerObserver {
+  public:
+    /*virtual*/ void        notify(ESTimer *timer) {
+        ESNTPDriver *driver = (ESNTPDriver *)timer->info();
+        driver->predictionTimerFire();
+    }
+};
+static ESNTPPredictionTimerObserver *predictionTimerObserver = NULL;
+
+// Check again when the predicted skew will have moved by about ES_PREDICTION_SKEW_STEP
+void
+ESNTPDriver::installPredictionTimer() {
+    ESAssert(_thread->inThisThread());
+    ESAssert(inDisciplineMode);
+    if (!predictionTimerObserver) {
+        predictionTimerObserver = new ESNTPPredictionTimerObserver;
+    }
+    if (_predictionTimer) {
+        _predictionTimer->release();
+    }
+    double rate = fabs(_discipline.frequency()) + _discipline.stability();
+    ESTimeInterval interval = rate > 0 ? ES_PREDICTION_SKEW_STEP / rate : ES_PREDICTION_MAX_INTERVAL;
+    if (interval < ES_PREDICTION_MIN_INTERVAL) {
+        interval = ES_PREDICTION_MIN_INTERVAL;
+    } else if (interval > ES_PREDICTION_MAX_INTERVAL) {
+        interval = ES_PREDICTION_MAX_INTERVAL;
+    }
+    _predictionTimer = new ESIntervalTimer(predictionTimerObserver, interval);
+    _predictionTimer->setInfo(this);
+    _predictionTimer->setLeeway(interval * ES_PREDICTION_LEEWAY);
+    _predictionTimer->activate();
+}
+
+void
+ESNTPDriver::predictionTimerFire() {
+    ESAssert(_thread->inThisThread());
+    if (_predictionTimer) {
+        _predictionTimer->release();  // One-shot; installPredictionTimer() makes the next one
+        _predictionTimer = NULL;
+    }
+    if (!_discipline.haveSample()) {
+        return;
+    }
+    if (!_lastSyncStart) {  // A sync in progress reports its own skew
+        ESTimeInterval now = ESTime::currentContinuousTime();
+        ESTimeInterval predictedSkew = _discipline.predictedSkew(now);
+        ESTimeInterval predictedError = _discipline.predictedError(now);
+        if (fabs(predictedSkew - _contSkew) >= ES_PREDICTION_SKEW_STEP ||
+            predictedError - _currentTimeError >= ES_PREDICTION_ERROR_STEP) {
+            tracePrintf2("discipline: predicted contSkew %.4f +- %.4f", predictedSkew, predictedError);
+            setContSkew(predictedSkew, predictedError);
+        }
+    }
+    installPredictionTimer();
 }
 
 void
 ESNTPDriver::stateGotPacketSendError(ESNTPSocketDescriptor *socketDescriptor) {
     ESAssert(_thread->inThisThread());
+    ESEventLog::recordHost(ESEventBadPacket, socketDescriptor->addr(), ESEventBadSend);
     tracePrintf2("%s (%s) got packet send error, delegating to stateGotBadPacket",
                  socketDescriptor->humanReadableIPAddress().c_str(),
                  socketDescriptor->hostNameDescriptor()->nameAsRequested().c_str());
@@ -2222,6 +3287,7 @@ ESNTPDriver::stateGotPacketWithUnreportableSync(ESNTPSocketDescriptor *socketDes
 void 
 ESNTPDriver::stateGotBadPacket(ESNTPSocketDescriptor *socketDescriptor) {
     ESAssert(_thread->inThisThread());
+    badPacketsMetric.add();
     static bool recursing = false;
     if (recursing) {
         tracePrintf2("%s (%s) got bad user-host packet, recursion detected, returning without push...",
@@ -2240,7 +3306,10 @@ ESNTPDriver::stateGotBadPacket(ESNTPSocketDescriptor *socketDescriptor) {
         tracePrintf2("%s (%s) got bad pool-host packet, pushing and selecting another host...",
                      socketDescriptor->humanReadableIPAddress().c_str(),
                      socketDescriptor->hostNameDescriptor()->nameAsRequested().c_str());
-        _availablePoolSocketsByRTT.push(socketDescriptor);  // It will sort to the end with the forced-high RTT
+        if (socketDescriptor->_unresolvedExpiration) {
+            socketDescriptor->_stale = true;  // DNS no longer vouches for it and now it has failed, so pushPoolSocket() drops it
+        }
+        pushPoolSocket(socketDescriptor);  // It will sort to the end with the forced-high RTT
         if (inPollingMode) {
             return;
         }
@@ -2426,10 +3495,15 @@ ESNTPHostNameDescriptor::ESNTPHostNameDescriptor()
 :   _isUserHost(false),
     _nameResolver(NULL),
     _numSocketDescriptors(0),
+    _socketDescriptorCapacity(0),
     _socketDescriptors(NULL),
     _driver(NULL),
     _resolving(false),
     _doneResolving(false),
+    _prefetching(false),
+    _socketsQueued(false),
+    _seededFromCache(false),
+    _resolveStartTime(0),
     _numResolutionFailures(0),
     _postResolutionFailureTimer(NULL)
 {
@@ -2517,19 +3591,144 @@ ESNTPHostNameDescriptor::sendPacketsToAllHosts() {
     }
 }
 
+// User host specifications may carry a port, as "host:port" or "[v6address]:port"; a bare IPv6 address
+// (more than one colon, no brackets) is taken as having no port
+static void splitHostSpecification(const std::string &specification,
+                                   std::string       *host,
+                                   std::string       *port) {
+    *host = specification;
+    *port = ES_NTP_PORT_AS_STRING;
+    if (specification.length() > 0 && specification[0] == '[') {
+        size_t close = specification.find(']');
+        if (close != std::string::npos) {
+            *host = specification.substr(1, close - 1);
+            if (close + 1 < specification.length() && specification[close + 1] == ':') {
+                *port = specification.substr(close + 2);
+            }
+        }
+    } else {
+        size_t colon = specification.find(':');
+        if (colon != std::string::npos && specification.find(':', colon + 1) == std::string::npos) {
+            *host = specification.substr(0, colon);
+            *port = specification.substr(colon + 1);
+        }
+    }
+}
+
+// *****************************************************************************
+// Resolver cache.  Addresses are kept by host name (as requested, including any
+// port) for ES_DNS_CACHE_LIFETIME, across syncs, so a resync shortly after the
+// last one doesn't wait on DNS at all.  getaddrinfo() doesn't tell us the TTL
+// of the records it found, so we use a fixed lifetime a little under the
+// 130-150 seconds the pool's records have been seen to carry.
+// *****************************************************************************
+
+struct ESNTPResolverCacheEntry {
+    std::vector<ESNTPResolvedAddress> addresses;
+    ESTimeInterval                    expiration;  // Continuous time
+};
+
+static std::map<std::string, ESNTPResolverCacheEntry> *resolverCache = NULL;
+
+// A cache hit on its way to the host name descriptor through the driver thread's queue.  The descriptors are
+// destroyed when a sync stops, so the hit is dropped if that has happened since it was posted.
+struct ESNTPResolverCacheHit {
+    unsigned int                      generation;
+    std::vector<ESNTPResolvedAddress> addresses;
+};
+
+/*static*/ void
+ESNTPHostNameDescriptor::resolverCacheHitGlue(void *obj,
+                                              void *param) {
+    ESNTPResolverCacheHit *hit = (ESNTPResolverCacheHit *)param;
+    if (hit->generation == hostNameDescriptorsGeneration) {
+        ESNTPHostNameDescriptor *hostNameDescriptor = (ESNTPHostNameDescriptor *)obj;
+        hostNameDescriptor->gotAddresses(&hit->addresses[0], hit->addresses.size());
+    }
+    delete hit;
+}
+
+static void
+noteDNSLookup(ESTimeInterval lookupTime) {
+    syncReportLock.lock();
+    _numDNSLookups++;
+    _sumDNSLookupTime += lookupTime;
+    syncReportLock.unlock();
+    dnsLatencyMetric.record(lookupTime);
+}
+
+static void
+noteDNSCacheHit() {
+    syncReportLock.lock();
+    _numDNSCacheHits++;
+    syncReportLock.unlock();
+}
+
+// Record (once per sync) how long the sync waited before it had an address to send to
+static void
+noteFirstAddressAvailable() {
+    syncReportLock.lock();
+    if (_lastSyncStart && _lastSyncDNSWaitTime < 0) {
+        _lastSyncDNSWaitTime = ESTime::currentContinuousTime() - _lastSyncStart;
+        tracePrintf1("first address available after %.3f seconds", _lastSyncDNSWaitTime);
+    }
+    syncReportLock.unlock();
+}
+
 void 
 ESNTPHostNameDescriptor::startResolving() {  // Start a background name resolution
     ESAssert(_driver->thread()->inThisThread());
     _resolving = true;
-    tracePrintf1("startResolving '%s'", _name.c_str());
+    _resolveStartTime = ESTime::currentContinuousTime();
+    tracePrintf2("startResolving '%s'%s", _name.c_str(), _prefetching ? " (prefetch)" : "");
+    if (!resolverCache) {
+        resolverCache = new std::map<std::string, ESNTPResolverCacheEntry>;
+    }
+    std::map<std::string, ESNTPResolverCacheEntry>::iterator iter = resolverCache->find(_name);
+    if (iter != resolverCache->end()) {
+        if (iter->second.expiration > _resolveStartTime) {
+            noteDNSCacheHit();
+            tracePrintf2("resolver cache hit for '%s', expires in %.0f seconds", _name.c_str(), iter->second.expiration - _resolveStartTime);
+            // Deliver it the way the resolver would, from the thread's queue, so no caller sees the
+            // resolution complete (and the driver's state change) inside its own call to us
+            ESNTPResolverCacheHit *hit = new ESNTPResolverCacheHit;
+            hit->generation = hostNameDescriptorsGeneration;
+            hit->addresses = iter->second.addresses;
+            _driver->thread()->callInThread(resolverCacheHitGlue, this, hit);
+            return;
+        }
+        resolverCache->erase(iter);
+    }
+    std::string host;
+    splitHostSpecification(_name, &host, &_port);
     _nameResolver = new ESNameResolver(this,   // observer
-                                       _name,  // host name
-                                       ES_NTP_PORT_AS_STRING, // portAsString
+                                       host,   // host name
+                                       _port.c_str(), // portAsString
                                        AI_NUMERICSERV      // Service name ("123") is numeric
                                          | AI_ADDRCONFIG,  // IPv6 addresses only returned if IPv6 configured locally
                                        IPPROTO_UDP);
 }
 
+void
+ESNTPHostNameDescriptor::startPrefetching() {
+    ESAssert(!_isUserHost);
+    _prefetching = true;
+    startResolving();
+}
+
+void
+ESNTPHostNameDescriptor::queueHeldSockets() {
+    ESAssert(_driver->thread()->inThisThread());
+    ESAssert(!_isUserHost);
+    ESAssert(!_socketsQueued);
+    for (int i = 0; i < _numSocketDescriptors; i++) {
+        _driver->pushPoolSocket(&_socketDescriptors[i]);
+    }
+    _socketsQueued = true;
+    _prefetching = false;
+    noteFirstAddressAvailable();
+}
+
 void
 ESNTPHostNameDescriptor::postResolutionFailureTimerFire() {
     _postResolutionFailureTimer = NULL;
@@ -2561,45 +3760,160 @@ ESNTPHostNameDescriptor::setupPostResolutionFailureTimer() {
                  _name.c_str(), delay);
 }
 
-// ESNameResolverObserver redefines
-/*virtual*/ void 
-ESNTPHostNameDescriptor::notifyNameResolutionComplete(ESNameResolver *resolver) {
+// Build our socket descriptors from the addresses found by the resolver (or the resolver cache)
+void
+ESNTPHostNameDescriptor::gotAddresses(const ESNTPResolvedAddress *addresses,
+                                      int                        numAddresses) {
     ESAssert(_driver->thread()->inThisThread());
+    if (_seededFromCache) {
+        mergeResolvedAddresses(addresses, numAddresses);
+        return;
+    }
     ESAssert(_numSocketDescriptors == 0);
     ESAssert(_socketDescriptors == NULL);
-    _numSocketDescriptors = 0;
     _resolving = false;
     _doneResolving = true;
-    tracePrintf1("name resolution complete for '%s'", _name.c_str());
-    const struct addrinfo *result0 = resolver->result0();
-    for (const struct addrinfo *res = result0; res; res = res->ai_next) {
-        _numSocketDescriptors++;
-    }    
-    if (_numSocketDescriptors == 0) {
-        ESAssert(result0 == NULL);
+    if (numAddresses == 0) {
         ESErrorReporter::logError("ESNTPDriver",
                                   "Name resolution succeeded but host list was empty for host '%s'",
                                   _name.c_str());
         _driver->nameResolutionFailed(this, _name, 0);
         return;
     }
-    _socketDescriptors = new ESNTPSocketDescriptor[_numSocketDescriptors];
-    int i = 0;
-    for (const struct addrinfo *addrinfo = result0; addrinfo; addrinfo = addrinfo->ai_next, i++) {
+    _socketDescriptors = new ESNTPSocketDescriptor[numAddresses];
+    _socketDescriptorCapacity = numAddresses;
+    for (int i = 0; i < numAddresses; i++) {
+        const ESNTPResolvedAddress *address = &addresses[i];
         ESNTPSocketDescriptor *desc = &_socketDescriptors[i];
         desc->_hostNameDescriptor = this;
-        desc->_family = addrinfo->ai_family;
-        ESAssert(addrinfo->ai_addrlen < sizeof(desc->_addr));
-        memcpy(&desc->_addr, addrinfo->ai_addr, addrinfo->ai_addrlen);
-        desc->_addrlen = addrinfo->ai_addrlen;
-        desc->_socktype = addrinfo->ai_socktype;
-        desc->_protocol = addrinfo->ai_protocol;
-        if (!_isUserHost) {
-            _driver->pushPoolSocket(desc);
+        desc->_family = address->family;
+        memcpy(&desc->_addr, &address->addr, address->addrlen);
+        desc->_addrlen = address->addrlen;
+        desc->_socktype = address->socktype;
+        desc->_protocol = address->protocol;
+    }
+    _numSocketDescriptors = numAddresses;
+    if (_isUserHost) {
+        noteFirstAddressAvailable();
+        _driver->nameResolutionComplete(this);
+    } else if (_prefetching) {
+        tracePrintf2("holding %d prefetched address(es) for '%s'", numAddresses, _name.c_str());
+        _driver->prefetchComplete(this);
+    } else {
+        queueHeldSockets();
+        _driver->nameResolutionComplete(this);
+    }
+}
+
+static bool
+sameAddress(const struct sockaddr_storage *addr,
+            const ESNTPResolvedAddress    *address) {
+    if (addr->ss_family != address->family) {
+        return false;
+    }
+    if (address->family == AF_INET) {
+        const struct sockaddr_in *in1 = (const struct sockaddr_in *)addr;
+        const struct sockaddr_in *in2 = (const struct sockaddr_in *)&address->addr;
+        return in1->sin_port == in2->sin_port && in1->sin_addr.s_addr == in2->sin_addr.s_addr;
+    }
+    if (address->family == AF_INET6) {
+        const struct sockaddr_in6 *in1 = (const struct sockaddr_in6 *)addr;
+        const struct sockaddr_in6 *in2 = (const struct sockaddr_in6 *)&address->addr;
+        return in1->sin6_port == in2->sin6_port && memcmp(&in1->sin6_addr, &in2->sin6_addr, sizeof(in1->sin6_addr)) == 0;
+    }
+    return false;
+}
+
+// The background resolution of a name seeded from the host cache has finished.  A pool name resolves to a few
+// addresses out of many, rotated on every query, so a cached address missing from this answer is most likely still
+// a pool server:  it stays in use for ES_DNS_CACHE_LIFETIME (as long as we'd trust the answer itself), or until it
+// fails, and only then goes stale.  New addresses are added to the RTT queue in the room seedFromHostCache() left
+// for them.  The seeded sockets can't be moved or freed, since the queue, their timers and the epoll registration
+// all point at them.
+void
+ESNTPHostNameDescriptor::mergeResolvedAddresses(const ESNTPResolvedAddress *addresses,
+                                                int                        numAddresses) {
+    ESAssert(_driver->thread()->inThisThread());
+    ESAssert(_seededFromCache);
+    ESAssert(!_isUserHost);
+    _resolving = false;
+    _doneResolving = true;
+    _seededFromCache = false;
+    if (numAddresses == 0) {
+        tracePrintf1("keeping cached addresses for '%s' (empty resolution)", _name.c_str());
+        return;
+    }
+    ESTimeInterval unresolvedExpiration = ESTime::currentContinuousTime() + ES_DNS_CACHE_LIFETIME;
+    int numSeeded = _numSocketDescriptors;
+    for (int i = 0; i < numSeeded; i++) {
+        ESNTPSocketDescriptor *desc = &_socketDescriptors[i];
+        bool stillResolves = false;
+        for (int j = 0; j < numAddresses; j++) {
+            if (sameAddress(&desc->_addr, &addresses[j])) {
+                stillResolves = true;
+                break;
+            }
+        }
+        if (!stillResolves) {
+            tracePrintf3("cached address %s for '%s' isn't in the fresh answer; keeping it for %.0f seconds",
+                         desc->humanReadableIPAddress().c_str(), _name.c_str(), ES_DNS_CACHE_LIFETIME);
+            desc->_unresolvedExpiration = unresolvedExpiration;
         }
     }
-    _driver->nameResolutionComplete(this);
+    for (int j = 0; j < numAddresses; j++) {
+        const ESNTPResolvedAddress *address = &addresses[j];
+        bool alreadySeeded = false;
+        for (int i = 0; i < numSeeded; i++) {
+            if (sameAddress(&_socketDescriptors[i]._addr, address)) {
+                alreadySeeded = true;
+                break;
+            }
+        }
+        if (alreadySeeded) {
+            continue;
+        }
+        if (_numSocketDescriptors == _socketDescriptorCapacity) {
+            tracePrintf1("no room for more resolved addresses for '%s'", _name.c_str());
+            break;
+        }
+        ESNTPSocketDescriptor *desc = &_socketDescriptors[_numSocketDescriptors++];
+        desc->_hostNameDescriptor = this;
+        desc->_family = address->family;
+        memcpy(&desc->_addr, &address->addr, address->addrlen);
+        desc->_addrlen = address->addrlen;
+        desc->_socktype = address->socktype;
+        desc->_protocol = address->protocol;
+        _driver->pushPoolSocket(desc);
+    }
+    _driver->prefetchComplete(this);  // The same bookkeeping; nothing is sent now, the new sockets wait their turn in the queue
+}
+
+// ESNameResolverObserver redefines
+/*virtual*/ void 
+ESNTPHostNameDescriptor::notifyNameResolutionComplete(ESNameResolver *resolver) {
+    ESAssert(_driver->thread()->inThisThread());
+    ESTimeInterval lookupTime = ESTime::currentContinuousTime() - _resolveStartTime;
+    noteDNSLookup(lookupTime);
+    tracePrintf2("name resolution complete for '%s' after %.3f seconds", _name.c_str(), lookupTime);
+    const struct addrinfo *result0 = resolver->result0();
+    std::vector<ESNTPResolvedAddress> addresses;
+    for (const struct addrinfo *addrinfo = result0; addrinfo; addrinfo = addrinfo->ai_next) {
+        ESNTPResolvedAddress address;
+        address.family = addrinfo->ai_family;
+        ESAssert(addrinfo->ai_addrlen < sizeof(address.addr));
+        memcpy(&address.addr, addrinfo->ai_addr, addrinfo->ai_addrlen);
+        address.addrlen = addrinfo->ai_addrlen;
+        address.socktype = addrinfo->ai_socktype;
+        address.protocol = addrinfo->ai_protocol;
+        addresses.push_back(address);
+    }
     freeaddrinfo(resolver->result0());
+    if (!addresses.empty()) {
+        ESNTPResolverCacheEntry &entry = (*resolverCache)[_name];
+        entry.addresses = addresses;
+        entry.expiration = ESTime::currentContinuousTime() + ES_DNS_CACHE_LIFETIME;
+    }
+    gotAddresses(addresses.empty() ? NULL : &addresses[0], addresses.size());
 }
 
 /*virtual*/ void 
@@ -2608,10 +3922,228 @@ ESNTPHostNameDescriptor::notifyNameResolutionFailed(ESNameResolver *resolver,
     _resolving = false;
     _doneResolving = true;
     _numResolutionFailures++;
+    ESTimeInterval lookupTime = ESTime::currentContinuousTime() - _resolveStartTime;
+    noteDNSLookup(lookupTime);
     tracePrintf1("name resolution FAILED for '%s'", _name.c_str());
+    if (_seededFromCache) {
+        _seededFromCache = false;  // Carry on with the cached addresses; the driver isn't waiting on this one
+        return;
+    }
     _driver->nameResolutionFailed(this, _name, failureStatus);
 }
 
+// *****************************************************************************
+// Host quality cache.  What we learned about each pool address (its average RTT
+// and error, stratum, and whether it gave us bad data) is kept across syncs and
+// launches in a small text file, so the next sync can start with the addresses
+// that did best last time instead of waiting for DNS and relearning them.
+// Entries are keyed by country code (which selects the pool zone, and which
+// determines what the global pool names resolve to) plus host name and address.
+// *****************************************************************************
+
+struct ESNTPHostCacheEntry {
+    std::string             countryCode;
+    std::string             hostName;
+    std::string             address;      // Numeric, as from humanReadableIPAddress()
+    ESTimeInterval          averageRTT;
+    ESTimeInterval          error;        // Non-RTT error from the last packet
+    int                     stratum;
+    ESTimeInterval          lastSeen;     // ESTime::currentTime() at the end of the sync in which we last heard from it
+    bool                    bad;          // Sent bad data, or was outvoted as a falseticker
+};
+
+static std::list<ESNTPHostCacheEntry> *hostCache = NULL;  // Most recently seen first
+
+static std::string hostCacheName() {
+    return "ntp_host_cache.txt";
+}
+
+static void
+readHostCache() {
+    ESAssert(!hostCache);
+    hostCache = new std::list<ESNTPHostCacheEntry>;
+    size_t contentLength;
+    char *fileContents = ESFile::getFileContentsInMallocdArray(hostCacheName().c_str(), ESFilePathTypeRelativeToDocumentDir,
+                                                               true /* missingOK */, &contentLength);
+    if (!fileContents) {
+        return;
+    }
+    ESTimeInterval now = ESTime::currentTime();
+    int pos = 0;
+    while (true) {
+        char countryCode[16];
+        char hostName[64];
+        char address[INET6_ADDRSTRLEN];
+        char badChar;
+        int bytesRead;
+        ESNTPHostCacheEntry entry;
+        int st = sscanf(fileContents + pos, "%15s %63s %45s %lf %lf %d %lf %c\n%n",
+                        countryCode, hostName, address, &entry.averageRTT, &entry.error, &entry.stratum, &entry.lastSeen, &badChar, &bytesRead);
+        if (st != 8) {  // The %n doesn't count
+            if (st != EOF) {
+                ESErrorReporter::logError("ESNTPDriver", "Found an incomplete host cache line with %d element(s)", st);
+            }
+            break;
+        }
+        pos += bytesRead;
+        if (now - entry.lastSeen > ES_HOST_CACHE_MAX_AGE) {
+            continue;
+        }
+        entry.countryCode = strcmp(countryCode, "-") == 0 ? "" : countryCode;
+        entry.hostName = hostName;
+        entry.address = address;
+        entry.bad = (badChar == 'B');
+        hostCache->push_back(entry);
+    }
+    free(fileContents);
+}
+
+static void
+writeHostCache() {
+    ESAssert(hostCache);
+    std::string s;
+    for (std::list<ESNTPHostCacheEntry>::iterator iter = hostCache->begin(); iter != hostCache->end(); iter++) {
+        const ESNTPHostCacheEntry &entry = *iter;
+        s += ESUtil::stringWithFormat("%s %s %s %.6f %.6f %d %.0f %c\n",
+                                      entry.countryCode.length() ? entry.countryCode.c_str() : "-",
+                                      entry.hostName.c_str(), entry.address.c_str(), entry.averageRTT, entry.error,
+                                      entry.stratum, entry.lastSeen, entry.bad ? 'B' : 'G');
+    }
+    int fd = open((ESFile::documentDirectory() + "/" + hostCacheName()).c_str(),
+                  O_CREAT|O_TRUNC|O_WRONLY, 0666);
+    if (fd < 0) {
+        ESErrorReporter::logErrorWithCode("ESNTPDriver", errno, strerror_r, "Couldn't open host cache file for writing");
+        return;
+    }
+    size_t writtenBytes = write(fd, s.c_str(), s.length());
+    if (writtenBytes != s.length()) {
+        ESErrorReporter::logErrorWithCode("ESNTPDriver", errno, strerror_r,
+                                          ESUtil::stringWithFormat("Only wrote %d of %d bytes to host cache file", writtenBytes, s.length()).c_str());
+    }
+    close(fd);
+}
+
+// Fill in the socket descriptors for this (pool) host name from the cache, with the RTTs we saw last time, and
+// put them in the RTT queue just as notifyNameResolutionComplete() would.  The caller still resolves the name,
+// and mergeResolvedAddresses() then brings the sockets up to date with its answer.
+int
+ESNTPHostNameDescriptor::seedFromHostCache(const std::string &countryCode) {
+    ESAssert(_driver->thread()->inThisThread());
+    ESAssert(!_isUserHost);
+    ESAssert(_numSocketDescriptors == 0);
+    if (!hostCache) {
+        readHostCache();
+    }
+    std::vector<const ESNTPHostCacheEntry *> entries;
+    for (std::list<ESNTPHostCacheEntry>::iterator iter = hostCache->begin(); iter != hostCache->end(); iter++) {
+        if (iter->hostName == _name && iter->countryCode == countryCode) {
+            entries.push_back(&*iter);
+        }
+    }
+    if (entries.empty()) {
+        return 0;
+    }
+    _socketDescriptorCapacity = entries.size() + ES_HOST_CACHE_SEED_SPARE;
+    _socketDescriptors = new ESNTPSocketDescriptor[_socketDescriptorCapacity];
+    for (size_t i = 0; i < entries.size(); i++) {
+        const ESNTPHostCacheEntry *entry = entries[i];
+        ESNTPSocketDescriptor *desc = &_socketDescriptors[_numSocketDescriptors];
+        memset(&desc->_addr, 0, sizeof(desc->_addr));
+        struct sockaddr_in *inp = (struct sockaddr_in *)&desc->_addr;
+        struct sockaddr_in6 *in6p = (struct sockaddr_in6 *)&desc->_addr;
+        if (inet_pton(AF_INET, entry->address.c_str(), &inp->sin_addr) == 1) {
+            inp->sin_family = AF_INET;
+            inp->sin_port = ES_NTP_PORT_AS_NETWORK_NUMBER;
+            desc->_addrlen = sizeof(*inp);
+        } else if (inet_pton(AF_INET6, entry->address.c_str(), &in6p->sin6_addr) == 1) {
+            in6p->sin6_family = AF_INET6;
+            in6p->sin6_port = ES_NTP_PORT_AS_NETWORK_NUMBER;
+            desc->_addrlen = sizeof(*in6p);
+        } else {
+            continue;
+        }
+        desc->_hostNameDescriptor = this;
+        desc->_family = desc->_addr.ss_family;
+        desc->_socktype = SOCK_DGRAM;
+        desc->_protocol = IPPROTO_UDP;
+        desc->_averageRTT = entry->bad ? ES_FORCE_RTT_FOR_BAD_HOST : entry->averageRTT;  // Replaced by the measured value on the first packet
+        _numSocketDescriptors++;
+        _driver->pushPoolSocket(desc);
+    }
+    if (_numSocketDescriptors) {
+        _seededFromCache = true;
+        _socketsQueued = true;
+        noteFirstAddressAvailable();
+    } else {
+        delete [] _socketDescriptors;  // Nothing usable; resolve as if there were no cache entries
+        _socketDescriptors = NULL;
+        _socketDescriptorCapacity = 0;
+    }
+    return _numSocketDescriptors;
+}
+
+// Record what this sync learned about each pool address and rewrite the cache
+void
+ESNTPDriver::updateHostCache() {
+    ESAssert(_thread->inThisThread());
+    if (!hostCache) {
+        readHostCache();
+    }
+    ESTimeInterval now = ESTime::currentTime();
+    bool changed = false;
+    for (size_t n = 0; n < _hostNameDescriptors.size(); n++) {
+        ESNTPHostNameDescriptor *hostNameDescriptor = &_hostNameDescriptors[n];
+        if (hostNameDescriptor->_isUserHost) {
+            continue;
+        }
+        for (int i = 0; i < hostNameDescriptor->_numSocketDescriptors; i++) {
+            ESNTPSocketDescriptor *socketDescriptor = &hostNameDescriptor->_socketDescriptors[i];
+            bool bad = socketDescriptor->averageRTT() >= ES_FORCE_RTT_FOR_BAD_HOST;
+            if (socketDescriptor->packetsReceived() == 0 && !bad) {
+                continue;  // Nothing new to say about it; an older entry, if any, stays as it was
+            }
+            std::string address = socketDescriptor->humanReadableIPAddress();
+            std::list<ESNTPHostCacheEntry>::iterator iter = hostCache->begin();
+            while (iter != hostCache->end() &&
+                   !(iter->address == address && iter->hostName == hostNameDescriptor->_name && iter->countryCode == _deviceCountryCode)) {
+                iter++;
+            }
+            ESNTPHostCacheEntry entry;
+            if (iter != hostCache->end()) {
+                if (iter->bad && socketDescriptor->packetsReceived() == 0) {
+                    continue;  // Seeded as bad and (rightly) never used; let the old verdict age out
+                }
+                entry = *iter;
+                hostCache->erase(iter);
+            } else {
+                entry.countryCode = _deviceCountryCode;
+                entry.hostName = hostNameDescriptor->_name;
+                entry.address = address;
+                entry.averageRTT = 0;
+                entry.error = 0;
+                entry.stratum = 0;
+            }
+            if (socketDescriptor->packetsReceived() > 0 && !bad) {
+                entry.averageRTT = socketDescriptor->averageRTT();
+                entry.error = socketDescriptor->nonRTTErrorFromLastPacket();
+                entry.stratum = socketDescriptor->stratumFromLastPacket();
+            }
+            entry.bad = bad;
+            entry.lastSeen = now;
+            hostCache->push_front(entry);
+            changed = true;
+        }
+    }
+    if (!changed) {
+        return;
+    }
+    while (hostCache->size() > ES_HOST_CACHE_MAX_ENTRIES ||
+           (!hostCache->empty() && now - hostCache->back().lastSeen > ES_HOST_CACHE_MAX_AGE)) {
+        hostCache->pop_back();
+    }
+    writeHostCache();
+}
+
 // *****************************************************************************
 // Host reporting...  The implementation is split among ESNTPDriver and the
 // two ESNTPHostReport classes so we place it here to put it all in one place
@@ -2689,7 +4221,8 @@ ESNTPHostReport::ESNTPHostReport(const ESNTPDriver *driver) {
             hostInfoPtr->packetsReceived = socketDescriptor->packetsReceived();
             hostInfoPtr->packetsUsed = socketDescriptor->packetsUsed();
             hostInfoPtr->packetsSent = socketDescriptor->packetsSent();
-            hostInfoPtr->disabled = false; // FIX FIX
+            hostInfoPtr->packetsSentAfterDisabled = socketDescriptor->packetsSentAfterDropped();
+            hostInfoPtr->disabled = socketDescriptor->isFalseticker();
             hostInfoPtr->skewLB = socketDescriptor->skewLB();
             hostInfoPtr->skewUB = socketDescriptor->skewUB();
             hostInfoPtr->leapBits = socketDescriptor->leapBitsFromLastPacket();
@@ -2700,6 +4233,7 @@ ESNTPHostReport::ESNTPHostReport(const ESNTPDriver *driver) {
         ESAssert(hostInfoPtr == hostNameInfoPtr->_hostInfos + hostNameInfoPtr->_numberOfHostInfos);
     }
     ESAssert(hostNameInfoPtr == _hostNameInfos + _numberOfHostNameInfos);
+    ESMetrics::snapshot(&_metrics);
 }
 
 ESNTPHostReport::~ESNTPHostReport() {
@@ -12,6 +12,7 @@
 #include "ESTime.hpp"
 #include "ESTimeSourceDriver.hpp"
 #include "ESNTPHostNames.hpp"
+#include "ESNTPClockDiscipline.hpp"
 #include "ESTimer.hpp"
 
 #include "ntp_fp.h"
@@ -20,6 +21,7 @@
 
 // System includes
 #include <sys/socket.h>
+#include <sys/select.h>
 #include <unistd.h>
 
 // Standard Template Library (STL)
@@ -27,6 +29,17 @@
 #include <string>
 #include <queue>
 
+// On Linux the driver thread keeps its sockets in a persistent epoll interest set and drains
+// each socket with recvmmsg(), rather than rebuilding an fd_set of every socket for select() on every pass
+#if defined(__linux__)
+#define ES_NTP_USE_EPOLL 1
+#else
+#define ES_NTP_USE_EPOLL 0
+#endif
+
+// Define this to run the driver against local simulated servers instead of the pool (see ESNTPLoopbackSimulator.hpp)
+#undef ES_NTP_LOOPBACK_SIMULATOR
+
 // Forward refs
 class ESNTPDriver;
 
@@ -58,6 +71,14 @@ class ESNTPDriver : public ESTimeSourceDriver {
     static int		    getPollingInterval();
     static void             setPollingInterval(int secs);   // Poll each host once every N seconds, don't stop when synchronized.
                                                             // Call this once per session *before* creating any ESNTPDriver instances.
+    static void             setDisciplineMode(bool on);     // Track the frequency of the continuous time base across syncs, predict the skew between
+                                                            // them, and sync less often as the prediction holds up.  Not with polling.
+                                                            // Call this once per session *before* creating any ESNTPDriver instances.
+    static bool             disciplineMode();
+#ifdef ES_NTP_LOOPBACK_SIMULATOR
+    static void             setRestartOnDisagreement(bool on);  // Throw away the sync whenever hosts disagree, as before the majority combiner.
+                                                                // Only while the driver is idle; the simulator uses it to compare time-to-sync.
+#endif
     void                    restartPollingCycle();
     void                    stopPollingCycle();
     bool                    pollingRunning();
@@ -79,6 +100,9 @@ class ESNTPDriver : public ESTimeSourceDriver {
     static int              numPacketsSent();
     static int              numPacketsReceived();
     static ESTimeInterval   lastSyncElapsedTime();
+    static ESTimeInterval   lastSyncDNSWaitTime();  // The part of lastSyncElapsedTime() spent before we had any address to send to
+    static ESTimeInterval   avgDNSLookupTime();     // Over the name resolutions (not counting resolver cache hits) in the last sync
+    static int              numDNSCacheHits();      // In the last sync
     static double           avgPacketsSent();
     static ESTimeInterval   avgSyncElapsedTime();
     static ESTimeInterval   timeOfLastSuccessfulSync();
@@ -115,6 +139,7 @@ class ESNTPDriver : public ESTimeSourceDriver {
                                                  const std::string       &hostName,
                                                  int                     failureStatus);
     void                    nameResolutionComplete(ESNTPHostNameDescriptor *hostNameDescriptor);
+    void                    prefetchComplete(ESNTPHostNameDescriptor *hostNameDescriptor);
 
     void                    startSyncingAfterDelay();
 
@@ -129,12 +154,24 @@ class ESNTPDriver : public ESTimeSourceDriver {
     void                    processRemoteSockets(fd_set *);
     void                    closeAllSockets();
     void                    checkMaxSocketFD(int fd);
+#if ES_NTP_USE_EPOLL
+    void                    registerSocketFD(ESNTPSocketDescriptor *socketDescriptor);
+    void                    unregisterSocketFD(int fd);
+    bool                    setupEpoll();
+    void                    processEpollEvents();
+#endif
 
     bool                    resolveOnePoolHostDNS();
+    void                    prefetchPoolHostDNS();
 
     bool                    gotPacket(ESTimeInterval        minOffset,
                                       ESTimeInterval        maxOffset,
                                       ESNTPSocketDescriptor *socketDescriptor);
+    bool                    findMajorityInterval(int *numSources,
+                                                 int *numFalsetickers);
+    void                    dropFalsetickers(bool includeOutvoted);
+    void                    removeRetiredSocketsFromPoolQueue();
+    void                    retireExpiredCachedAddresses();
 
     void                    pushPoolSocket(ESNTPSocketDescriptor *socketDescriptor);
 
@@ -152,6 +189,8 @@ class ESNTPDriver : public ESTimeSourceDriver {
 
     void                    giveUpTimerFire();
     void                    bumpProximity();
+    void                    installPredictionTimer();
+    void                    predictionTimerFire();
 
     ESTimeInterval          getThrottleTicket(ESTimeInterval sendTime);
 
@@ -175,6 +214,7 @@ class ESNTPDriver : public ESTimeSourceDriver {
     void                    stateGotPacketSendError(ESNTPSocketDescriptor *socketDescriptor);
 
     void                    makeHostReportIfRequired();
+    void                    updateHostCache();
 
 #undef ES_SURVEY_POOL_HOSTS
 #ifdef ES_SURVEY_POOL_HOSTS
@@ -184,8 +224,11 @@ class ESNTPDriver : public ESTimeSourceDriver {
     // private data
     ESNTPThread             *_thread;
     int                     _maxSocketFD;
-    double                  _maxMinOffset;
-    double                  _minMaxOffset;
+#if ES_NTP_USE_EPOLL
+    int                     _epollFD;
+#endif
+    double                  _maxMinOffset;    // Low end of the interval the majority of hosts agree on
+    double                  _minMaxOffset;    // High end of the same
     bool                    _stopThread;
     bool                    _stopReading;
     bool                    _reading;
@@ -202,6 +245,8 @@ class ESNTPDriver : public ESTimeSourceDriver {
     ESTimer                 *_restartSyncTimeout;
     ESTimer                 *_giveUpTimer;
     ESTimer                 *_proximityBumpTimer;
+    ESTimer                 *_predictionTimer;  // Discipline mode only: moves contSkew along the predicted line between syncs
+    ESNTPClockDiscipline    _discipline;
     bool                    _disabled;
     static ESUINT32         _appSignature;
 
@@ -224,6 +269,7 @@ friend class ESNTPNoProgressTimeoutObserver;
 friend class ESNTPRestartSyncTimeoutObserver;
 friend class ESNTPGiveUpTimerObserver;
 friend class ESNTPProximityBumpTimerObserver;
+friend class ESNTPPredictionTimerObserver;
 friend class ESNTPDriverSleepWakeObserver;
 friend class ESNTPPollingHostTimerObserver;
 };
@@ -8,6 +8,8 @@
 #ifndef _ESNTPHOSTREPORT_HPP_
 #define _ESNTPHOSTREPORT_HPP_
 
+#include "ESMetrics.hpp"
+
 class ESNTPDriver;
 
 /////////////////////////////
@@ -32,6 +34,7 @@ class ESNTPHostReport {
             int                     packetsSent;
             int                     packetsReceived;
             int                     packetsUsed;
+            int                     packetsSentAfterDisabled;
             ESTimeInterval          skewLB;  // Continuous-time skew
             ESTimeInterval          skewUB;  // Continuous-time skew
             ESTimeInterval          nonRTTError;
@@ -56,9 +59,12 @@ class ESNTPHostReport {
     int                     numberOfHostNameInfos() const { return _numberOfHostNameInfos; }
     const HostNameInfo      *hostNameInfos() const { return _hostNameInfos; }
 
+    const ESMetricsSnapshot &metrics() const { return _metrics; }  // Every registered metric, as of when the report was made
+
   private:
     int                     _numberOfHostNameInfos;
     HostNameInfo            *_hostNameInfos;
+    ESMetricsSnapshot       _metrics;
 };
 
 /////////////////////////////
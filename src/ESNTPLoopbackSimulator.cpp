@@ -0,0 +1,481 @@
+//
+//  ESNTPLoopbackSimulator.cpp
+//
+//  Copyright Emerald Sequoia LLC 2011. All rights reserved.
+//
+
+#include "ESNTPLoopbackSimulator.hpp"
+
+#ifdef ES_NTP_LOOPBACK_SIMULATOR
+
+#include "ESTime.hpp"
+#include "ESTimer.hpp"
+#include "ESThread.hpp"
+#include "ESUtil.hpp"
+#include "ESErrorReporter.hpp"
+#include "ESNTPHostNames.hpp"
+#include "ESNTPHostReport.hpp"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "ntp_fp.h"
+#include "ntp.h"
+#include "ntp_unixtime.h"
+#undef min
+#undef max
+
+#define ES_SIMULATOR_SCENARIO_TIMEOUT 120.0  /* Give up on a scenario that hasn't reached a good sync by now */
+#define ES_SIMULATOR_SETTLE_TIME        5.0  /* After a good sync, let the driver finish before measuring the final error */
+#define ES_SIMULATOR_PRECISION          -20  /* ~1us, like a modern server */
+#define ES_SIMULATOR_ROOT_DELAY        0.01
+
+// *****************************************************************************
+// Scenarios
+// *****************************************************************************
+
+#define ES_SIMULATOR_TRUE_OFFSET 1.5  // Every truthful host in every scenario agrees on this
+
+//                                        offset                          rtt    jitter  loss  stratum  rootdisp  KoD    bad
+static const ESNTPSimulatedHost idealHosts[] = {
+                                        { ES_SIMULATOR_TRUE_OFFSET,       0.020, 0.001,  0.0,  2,       0.010,    false, false },
+                                        { ES_SIMULATOR_TRUE_OFFSET,       0.030, 0.001,  0.0,  2,       0.010,    false, false },
+                                        { ES_SIMULATOR_TRUE_OFFSET,       0.040, 0.002,  0.0,  3,       0.020,    false, false },
+                                        { ES_SIMULATOR_TRUE_OFFSET,       0.050, 0.002,  0.0,  2,       0.010,    false, false },
+};
+
+static const ESNTPSimulatedHost jitteryHosts[] = {
+                                        { ES_SIMULATOR_TRUE_OFFSET,       0.200, 0.050,  0.0,  2,       0.010,    false, false },
+                                        { ES_SIMULATOR_TRUE_OFFSET,       0.250, 0.080,  0.0,  2,       0.010,    false, false },
+                                        { ES_SIMULATOR_TRUE_OFFSET,       0.300, 0.100,  0.0,  3,       0.020,    false, false },
+                                        { ES_SIMULATOR_TRUE_OFFSET,       0.150, 0.050,  0.0,  2,       0.010,    false, false },
+};
+
+static const ESNTPSimulatedHost falsetickerHosts[] = {
+                                        { ES_SIMULATOR_TRUE_OFFSET,       0.030, 0.002,  0.0,  2,       0.010,    false, false },
+                                        { ES_SIMULATOR_TRUE_OFFSET + 3.0, 0.010, 0.001,  0.0,  2,       0.010,    false, false },
+                                        { ES_SIMULATOR_TRUE_OFFSET,       0.040, 0.002,  0.0,  2,       0.010,    false, false },
+                                        { ES_SIMULATOR_TRUE_OFFSET,       0.050, 0.002,  0.0,  3,       0.020,    false, false },
+                                        { ES_SIMULATOR_TRUE_OFFSET,       0.060, 0.003,  0.0,  2,       0.010,    false, false },
+};
+
+static const ESNTPSimulatedHost misbehavingHosts[] = {
+                                        { ES_SIMULATOR_TRUE_OFFSET,       0.010, 0.001,  0.0,  2,       0.010,    true,  false },
+                                        { ES_SIMULATOR_TRUE_OFFSET,       0.015, 0.001,  0.0,  2,       0.010,    false, true  },
+                                        { ES_SIMULATOR_TRUE_OFFSET,       0.040, 0.002,  0.0,  2,       0.010,    false, false },
+                                        { ES_SIMULATOR_TRUE_OFFSET,       0.050, 0.002,  0.0,  3,       0.020,    false, false },
+};
+
+// The non-3G-in-England report in specs/hostTimeouts.txt:  long RTTs and packets that never come back
+static const ESNTPSimulatedHost lossyLowBandwidthHosts[] = {
+                                        { ES_SIMULATOR_TRUE_OFFSET,       1.200, 0.400,  0.3,  2,       0.010,    false, false },
+                                        { ES_SIMULATOR_TRUE_OFFSET,       1.500, 0.500,  0.4,  2,       0.010,    false, false },
+                                        { ES_SIMULATOR_TRUE_OFFSET,       0.900, 0.300,  0.3,  3,       0.020,    false, false },
+                                        { ES_SIMULATOR_TRUE_OFFSET,       2.000, 0.600,  0.5,  2,       0.010,    false, false },
+};
+
+#define ES_SIMULATOR_SCENARIO(name, hosts) { name, hosts, sizeof(hosts) / sizeof(hosts[0]), false }
+#define ES_SIMULATOR_RESTART_SCENARIO(name, hosts) { name, hosts, sizeof(hosts) / sizeof(hosts[0]), true }
+static const ESNTPSimulatorScenario scenarios[] = {
+    ES_SIMULATOR_SCENARIO("ideal",               idealHosts),
+    ES_SIMULATOR_SCENARIO("jittery",             jitteryHosts),
+    ES_SIMULATOR_SCENARIO("falseticker",         falsetickerHosts),
+    ES_SIMULATOR_SCENARIO("kod-and-bad-packet",  misbehavingHosts),
+    ES_SIMULATOR_SCENARIO("lossy-low-bandwidth", lossyLowBandwidthHosts),
+    // Last, since the driver might still be restarting when it times out
+    ES_SIMULATOR_RESTART_SCENARIO("falseticker-restart", falsetickerHosts),
+};
+static const int numScenarios = sizeof(scenarios) / sizeof(scenarios[0]);
+
+// *****************************************************************************
+// Responder thread
+// *****************************************************************************
+
+static void simulatorTimeStamp(l_fp           *ts,
+                               ESTimeInterval esti) {
+    double timeSince1970 = esti + ESTIME_EPOCH;
+    double intSeconds = floor(timeSince1970);
+    ts->l_i = (int32)intSeconds + JAN_1970;
+    ts->l_uf = (u_int32)((timeSince1970 - intSeconds) * FRAC);
+}
+
+static ESTimeInterval oneWayDelay(const ESNTPSimulatedHost *host) {
+    ESTimeInterval delay = host->rtt / 2 + host->jitter * (2 * drand48() - 1);
+    return delay > 0 ? delay : 0;
+}
+
+/*! Handed to the responder thread to replace whatever it was serving before */
+struct ESNTPSimulatorSetup {
+    const ESNTPSimulatorScenario *scenario;
+    std::vector<int>             fds;  // One bound socket per host, in scenario order
+};
+
+struct ESNTPSimulatorPendingReply {
+    ESTimeInterval          sendTime;   // Continuous time at which the reply "arrives" back at the client
+    int                     hostIndex;
+    struct sockaddr_in      to;
+    struct pkt              reply;
+};
+
+class ESNTPSimulatorThread : public ESChildThread {
+  public:
+                            ESNTPSimulatorThread();
+    void                    *main();
+    void                    setupInThread(ESNTPSimulatorSetup *setup);
+
+  private:
+    void                    receiveRequest(int hostIndex);
+    void                    sendDueReplies();
+
+    ESNTPSimulatorSetup     *_setup;
+    std::vector<ESNTPSimulatorPendingReply> _pending;
+};
+
+ESNTPSimulatorThread::ESNTPSimulatorThread()
+:   ESChildThread("NTPSimulator", ESChildThreadExitsOnlyByParentRequest),
+    _setup(NULL)
+{
+}
+
+void
+ESNTPSimulatorThread::setupInThread(ESNTPSimulatorSetup *setup) {
+    ESAssert(inThisThread());
+    if (_setup) {
+        for (int i = 0; i < _setup->scenario->numHosts; i++) {
+            close(_setup->fds[i]);
+        }
+        delete _setup;
+    }
+    _setup = setup;
+    _pending.clear();
+    srand48(1);  // Each scenario sees the same sequence of delays and losses from run to run
+}
+
+static void setupGlue(void *obj,
+                      void *param) {
+    ((ESNTPSimulatorThread *)obj)->setupInThread((ESNTPSimulatorSetup *)param);
+}
+
+void
+ESNTPSimulatorThread::receiveRequest(int hostIndex) {
+    const ESNTPSimulatedHost *host = &_setup->scenario->hosts[hostIndex];
+    struct pkt request;
+    struct sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    ssize_t len = recvfrom(_setup->fds[hostIndex], &request, sizeof(request), 0, (struct sockaddr *)&from, &fromLen);
+    if (len < (ssize_t)(LEN_PKT_NOMAC)) {  // ntp.h leaves the macro unparenthesized
+        return;
+    }
+    if (drand48() < host->lossProbability) {
+        return;  // Request lost on the way out
+    }
+    ESTimeInterval now = ESTime::currentContinuousTime();
+    ESTimeInterval serverRecvTime = now + oneWayDelay(host);
+
+    ESNTPSimulatorPendingReply pending;
+    pending.sendTime = serverRecvTime + oneWayDelay(host);
+    pending.hostIndex = hostIndex;
+    pending.to = from;
+
+    struct pkt &reply = pending.reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.li_vn_mode = PKT_LI_VN_MODE(LEAP_NOWARNING, NTP_VERSION, MODE_SERVER);
+    reply.ppoll = request.ppoll;
+    reply.precision = ES_SIMULATOR_PRECISION;
+    reply.rootdelay = htonl(DTOFP(ES_SIMULATOR_ROOT_DELAY));
+    reply.rootdispersion = htonl(DTOFP(host->rootDispersion));
+    if (host->kissOfDeath) {
+        reply.stratum = STRATUM_PKT_UNSPEC;
+        memcpy(&reply.refid, "RATE", 4);
+    } else {
+        reply.stratum = STRATUM_TO_PKT(host->stratum);
+        memcpy(&reply.refid, "SIM", 4);
+    }
+    reply.org = request.xmt;  // Already in network order
+    l_fp ts;
+    simulatorTimeStamp(&ts, serverRecvTime + host->offset - 16);
+    HTONL_FP(&ts, &reply.reftime);
+    simulatorTimeStamp(&ts, serverRecvTime + host->offset);
+    HTONL_FP(&ts, &reply.rec);
+    simulatorTimeStamp(&ts, serverRecvTime + host->offset + 0.00001);
+    HTONL_FP(&ts, &reply.xmt);
+
+    _pending.push_back(pending);
+}
+
+void
+ESNTPSimulatorThread::sendDueReplies() {
+    ESTimeInterval now = ESTime::currentContinuousTime();
+    std::vector<ESNTPSimulatorPendingReply>::iterator iter = _pending.begin();
+    while (iter != _pending.end()) {
+        if (iter->sendTime > now) {
+            iter++;
+            continue;
+        }
+        const ESNTPSimulatedHost *host = &_setup->scenario->hosts[iter->hostIndex];
+        if (drand48() >= host->lossProbability) {  // Otherwise the reply is lost on the way back
+            size_t len = host->badPacket ? LEN_PKT_NOMAC - 8 : LEN_PKT_NOMAC;
+            sendto(_setup->fds[iter->hostIndex], &iter->reply, len, 0, (struct sockaddr *)&iter->to, sizeof(iter->to));
+        }
+        iter = _pending.erase(iter);
+    }
+}
+
+void *
+ESNTPSimulatorThread::main() {
+    ESAssert(inThisThread());
+    while (1) {
+        fd_set readers;
+        FD_ZERO(&readers);
+        int nfds = ESThread::setBitsForSelect(&readers) + 1;
+        int numHosts = _setup ? _setup->scenario->numHosts : 0;
+        for (int i = 0; i < numHosts; i++) {
+            FD_SET(_setup->fds[i], &readers);
+            nfds = ESUtil::max(nfds, _setup->fds[i] + 1);
+        }
+        struct timeval *timeout = NULL;
+        struct timeval tv;
+        if (!_pending.empty()) {
+            ESTimeInterval nextSendTime = _pending[0].sendTime;
+            for (size_t i = 1; i < _pending.size(); i++) {
+                nextSendTime = ESUtil::min(nextSendTime, _pending[i].sendTime);
+            }
+            ESTimeInterval delta = nextSendTime - ESTime::currentContinuousTime();
+            if (delta < 0) {
+                delta = 0;
+            }
+            double seconds = floor(delta);
+            tv.tv_sec = seconds;
+            tv.tv_usec = (delta - seconds) * 1000000;
+            timeout = &tv;
+        }
+        select(nfds, &readers, NULL/*writers*/, NULL, timeout);
+        for (int i = 0; i < numHosts; i++) {
+            if (FD_ISSET(_setup->fds[i], &readers)) {
+                receiveRequest(i);
+            }
+        }
+        sendDueReplies();
+        ESThread::processInterThreadMessages(&readers);
+    }
+    return NULL;
+}
+
+// *****************************************************************************
+// Benchmark (main thread)
+// *****************************************************************************
+
+static ESNTPSimulatorThread *simulatorThread = NULL;
+static int scenarioIndex = -1;
+static ESTimeInterval scenarioStartTime;
+static ESTimeInterval fixElapsedTime;  // Zero until the driver reports a good sync
+static int fixPacketsSent;
+static ESTimer *scenarioTimer = NULL;  // Either the timeout or, after a fix, the settle timer
+static std::vector<std::string> scenarioServerNames;  // As given to the driver, in scenario order
+static ESNTPHostReport *lastHostReport = NULL;  // The most recent report with this scenario's hosts in it
+static int numCheckFailures = 0;
+static ESTimeInterval scenarioSyncTimes[numScenarios];  // Time to good sync, or the timeout if there wasn't one
+
+static void startScenario();
+
+// Keeps the latest report that still has the hosts in it (the driver's last report after a sync has none)
+class ESNTPSimulatorHostReportObserver : public ESNTPHostReportObserver {
+  public:
+                            ESNTPSimulatorHostReportObserver()
+    :   ESNTPHostReportObserver(ESThread::mainThread())
+    {}
+    /*virtual*/ void        hostReportAvailable(ESNTPHostReport *hostReport) {
+        if (hostReport->numberOfHostNameInfos() == 0) {
+            delete hostReport;
+            return;
+        }
+        delete lastHostReport;
+        lastHostReport = hostReport;
+    }
+};
+
+static const ESNTPHostReport::HostNameInfo::HostInfo *
+hostInfoForServer(const std::string &serverName) {
+    if (!lastHostReport) {
+        return NULL;
+    }
+    for (int n = 0; n < lastHostReport->numberOfHostNameInfos(); n++) {
+        const ESNTPHostReport::HostNameInfo *hostNameInfo = &lastHostReport->hostNameInfos()[n];
+        if (hostNameInfo->hostNameAsRequested == serverName && hostNameInfo->numberOfHostInfos() > 0) {
+            return &hostNameInfo->hostInfos()[0];
+        }
+    }
+    return NULL;
+}
+
+// Replays each scenario's expectations against the driver's final report:  the truth must lie within the reported
+// error, every lying host the driver heard from must have been dropped (and sent nothing after it was), and no
+// truthful host may have been dropped.  A driver restarting on disagreement drops nobody, so only the error is checked.
+static void checkScenario(const ESNTPSimulatorScenario *scenario,
+                          ESTimeInterval               finalError) {
+    if (!fixElapsedTime) {
+        return;  // Already reported
+    }
+    if (finalError > ESTime::skewAccuracy()) {
+        printf("SIMULATOR: %-20s CHECK FAILED: true offset is outside the reported error\n", scenario->name);
+        numCheckFailures++;
+    }
+    if (scenario->restartOnDisagreement) {
+        return;
+    }
+    for (int i = 0; i < scenario->numHosts; i++) {
+        const ESNTPSimulatedHost *host = &scenario->hosts[i];
+        const ESNTPHostReport::HostNameInfo::HostInfo *hostInfo = hostInfoForServer(scenarioServerNames[i]);
+        if (!hostInfo || hostInfo->packetsReceived == 0) {
+            continue;  // The driver never heard from it, so it can't have been misled by it
+        }
+        bool lying = fabs(host->offset - ES_SIMULATOR_TRUE_OFFSET) > host->rtt + host->rootDispersion;
+        if (lying && !hostInfo->disabled) {
+            printf("SIMULATOR: %-20s CHECK FAILED: host %d (offset %+.3f) was not dropped\n", scenario->name, i, host->offset);
+            numCheckFailures++;
+        } else if (lying && hostInfo->packetsSentAfterDisabled > 0) {
+            printf("SIMULATOR: %-20s CHECK FAILED: host %d was sent %d more packets after it was dropped\n",
+                   scenario->name, i, hostInfo->packetsSentAfterDisabled);
+            numCheckFailures++;
+        } else if (!lying && hostInfo->disabled) {
+            printf("SIMULATOR: %-20s CHECK FAILED: truthful host %d was dropped\n", scenario->name, i);
+            numCheckFailures++;
+        }
+    }
+}
+
+// Each restart scenario is compared against the majority-combiner run of the same hosts, which must sync sooner
+static void compareRestartScenarios() {
+    for (int r = 0; r < numScenarios; r++) {
+        if (!scenarios[r].restartOnDisagreement) {
+            continue;
+        }
+        for (int m = 0; m < numScenarios; m++) {
+            if (scenarios[m].restartOnDisagreement || scenarios[m].hosts != scenarios[r].hosts) {
+                continue;
+            }
+            printf("SIMULATOR: %-20s time to good sync %7.3f by majority vs %7.3f restarting on disagreement\n",
+                   scenarios[m].name, scenarioSyncTimes[m], scenarioSyncTimes[r]);
+            if (scenarioSyncTimes[m] >= scenarioSyncTimes[r]) {
+                printf("SIMULATOR: %-20s CHECK FAILED: the majority combiner was no faster\n", scenarios[m].name);
+                numCheckFailures++;
+            }
+        }
+    }
+}
+
+static void finishScenario() {
+    const ESNTPSimulatorScenario *scenario = &scenarios[scenarioIndex];
+    ESTimeInterval finalError = fabs(ESTime::continuousSkewForReportingPurposesOnly() - ES_SIMULATOR_TRUE_OFFSET);
+    checkScenario(scenario, finalError);
+    if (fixElapsedTime) {
+        printf("SIMULATOR: %-20s time to good sync %7.3f, packets sent %3d, final error %.6f (reported ±%.6f)\n",
+               scenario->name, fixElapsedTime, fixPacketsSent, finalError, ESTime::skewAccuracy());
+    } else {
+        printf("SIMULATOR: %-20s NO GOOD SYNC after %.0f seconds, packets sent %3d, final error %.6f (reported ±%.6f)\n",
+               scenario->name, ES_SIMULATOR_SCENARIO_TIMEOUT, ESNTPDriver::numPacketsSent(), finalError, ESTime::skewAccuracy());
+    }
+    scenarioSyncTimes[scenarioIndex] = fixElapsedTime ? fixElapsedTime : ES_SIMULATOR_SCENARIO_TIMEOUT;
+    if (scenarioIndex + 1 < numScenarios) {
+        startScenario();
+    } else {
+        compareRestartScenarios();
+        printf("SIMULATOR: done, %d check failures\n", numCheckFailures);
+    }
+}
+
+class ESNTPSimulatorTimerObserver : public ESTimerObserver {
+  public:
+    /*virtual*/ void        notify(ESTimer *timer) {
+        ESAssert(timer == scenarioTimer);
+        scenarioTimer->release();
+        scenarioTimer = NULL;
+        finishScenario();
+    }
+};
+static ESNTPSimulatorTimerObserver *simulatorTimerObserver = NULL;
+
+class ESNTPSimulatorSyncObserver : public ESTimeSyncObserver {
+  public:
+                            ESNTPSimulatorSyncObserver()
+    :   ESTimeSyncObserver(ESThread::mainThread())
+    {}
+    /*virtual*/ void        syncStatusChanged() {
+        if (fixElapsedTime == 0 && ESTime::currentStatus() == ESTimeSourceStatusSynchronized) {
+            fixElapsedTime = ESTime::currentContinuousTime() - scenarioStartTime;
+            fixPacketsSent = ESNTPDriver::numPacketsSent();
+            ESAssert(scenarioTimer);
+            scenarioTimer->release();
+            scenarioTimer = new ESIntervalTimer(simulatorTimerObserver, ES_SIMULATOR_SETTLE_TIME);
+            scenarioTimer->activate();
+        }
+    }
+};
+
+static void startScenario() {
+    ESAssert(ESThread::inMainThread());
+    scenarioIndex++;
+    const ESNTPSimulatorScenario *scenario = &scenarios[scenarioIndex];
+
+    // Bind the responders here rather than in the responder thread so their ports are known before
+    // the driver starts resolving.  The driver is idle between scenarios (it stops once it has a good
+    // sync, and the settle time is well past that), so it's safe to swap the user-server list here.
+    ESNTPSimulatorSetup *setup = new ESNTPSimulatorSetup;
+    setup->scenario = scenario;
+    ESNTPHostNames::clearUserServerList();
+    ESNTPHostNames::disablePoolHosts();
+    scenarioServerNames.clear();
+    delete lastHostReport;
+    lastHostReport = NULL;
+    for (int i = 0; i < scenario->numHosts; i++) {
+        int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        ESAssert(fd >= 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;  // Let the system pick
+        socklen_t addrLen = sizeof(addr);
+        if (bind(fd, (struct sockaddr *)&addr, addrLen) != 0 ||
+            getsockname(fd, (struct sockaddr *)&addr, &addrLen) != 0) {
+            ESErrorReporter::checkAndLogSystemError("ESNTPLoopbackSimulator", errno, "bind() failure");
+        }
+        setup->fds.push_back(fd);
+        scenarioServerNames.push_back(ESUtil::stringWithFormat("127.0.0.1:%d", ntohs(addr.sin_port)));
+        ESNTPHostNames::addUserServer(scenarioServerNames.back());
+    }
+    simulatorThread->callInThread(setupGlue, simulatorThread, setup);
+    ESNTPDriver::setRestartOnDisagreement(scenario->restartOnDisagreement);
+
+    fixElapsedTime = 0;
+    fixPacketsSent = 0;
+    scenarioStartTime = ESTime::currentContinuousTime();
+    scenarioTimer = new ESIntervalTimer(simulatorTimerObserver, ES_SIMULATOR_SCENARIO_TIMEOUT);
+    scenarioTimer->activate();
+
+    if (ESNTPDriver::isRunning()) {  // Else this is the first scenario, and the driver's own startup sync will pick it up
+        ESTime::resync(false/* !userRequested*/);
+    }
+}
+
+/*static*/ void
+ESNTPLoopbackSimulator::startBenchmark() {
+    ESAssert(ESThread::inMainThread());
+    ESAssert(!simulatorThread);
+    printf("ES_NTP_LOOPBACK_SIMULATOR active: %d scenarios, true offset %.3f\n", numScenarios, ES_SIMULATOR_TRUE_OFFSET);
+    simulatorTimerObserver = new ESNTPSimulatorTimerObserver;
+    ESTime::registerTimeSyncObserver(new ESNTPSimulatorSyncObserver);
+    ESNTPDriver::registerHostReportObserver(new ESNTPSimulatorHostReportObserver);
+    simulatorThread = new ESNTPSimulatorThread;
+    simulatorThread->start();
+    startScenario();
+}
+
+#endif  // ES_NTP_LOOPBACK_SIMULATOR
@@ -0,0 +1,50 @@
+//
+//  ESNTPLoopbackSimulator.hpp
+//
+//  Copyright Emerald Sequoia LLC 2011. All rights reserved.
+//
+
+#ifndef _ESNTPLOOPBACKSIMULATOR_HPP_
+#define _ESNTPLOOPBACKSIMULATOR_HPP_
+
+#include "ESNTPDriver.hpp"  // For macro definition
+
+#ifdef ES_NTP_LOOPBACK_SIMULATOR
+
+/*! The behavior of one simulated NTP server.  All times are in seconds. */
+struct ESNTPSimulatedHost {
+    ESTimeInterval          offset;           // Server clock minus our continuous time; this is what the driver should converge to
+    ESTimeInterval          rtt;              // Nominal network round trip, split evenly between the two directions
+    ESTimeInterval          jitter;           // Each direction's delay varies uniformly by +/- this much
+    double                  lossProbability;  // Chance of dropping a request (and, independently, its reply)
+    int                     stratum;
+    ESTimeInterval          rootDispersion;
+    bool                    kissOfDeath;      // Reply with stratum 0 and a "RATE" refid
+    bool                    badPacket;        // Reply with a truncated packet
+};
+
+/*! A named set of simulated servers to run one sync against */
+struct ESNTPSimulatorScenario {
+    const char               *name;
+    const ESNTPSimulatedHost *hosts;
+    int                      numHosts;
+    bool                     restartOnDisagreement;  // Run the driver the old way, to compare time-to-sync against
+};
+
+/*! A stand-in for the NTP pool: a set of UDP responders on 127.0.0.1 which the driver reaches through the
+ *  user-server list (as "127.0.0.1:<port>", with pool hosts disabled).  The benchmark runs one sync per
+ *  scenario and prints, for each, the time until the driver reported a good sync, the number of packets
+ *  it sent, and the error of the final sync against the scenario's true offset.  The falseticker scenario
+ *  is run a second time with the driver restarting on disagreement, as it did before it combined hosts
+ *  by majority, and the check fails unless the majority combiner got to a good sync sooner.
+ *
+ *  Enable by defining ES_NTP_LOOPBACK_SIMULATOR in ESNTPDriver.hpp; ESTime::init() then calls
+ *  startBenchmark() just before it creates the NTP driver. */
+class ESNTPLoopbackSimulator {
+  public:
+    static void             startBenchmark();  // Main thread only
+};
+
+#endif  // ES_NTP_LOOPBACK_SIMULATOR
+
+#endif  // _ESNTPLOOPBACKSIMULATOR_HPP_
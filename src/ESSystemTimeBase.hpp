@@ -28,6 +28,12 @@ class ESSystemTimeBase {
                                                             // This is the basis to which NTP adjustments are applied.
     static ESTimeInterval   continuousOffset() { return _continuousOffset; }  // (continuousTime - systemTime) aka EC dateROffset
 
+    // currentContinuousSystemTime() == currentBaseTime(usingAltTime()) + continuousBaseOffset().  ESTime captures the
+    // two values in its snapshot so readers on other threads never combine one base with the other base's offset.
+    static bool             usingAltTime() { return _usingAltTime; }
+    static ESTimeInterval   continuousBaseOffset() { return _usingAltTime ? _continuousAltOffset : _continuousOffset; }
+    static ESTimeInterval   currentBaseTime(bool usingAltTime) { return usingAltTime ? currentSystemAltTime() : currentSystemTime(); }
+
     // Methods called by private observer classes
     static void             systemBaseChange();
     static void             goingToSleep();
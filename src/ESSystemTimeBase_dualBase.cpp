@@ -46,6 +46,7 @@ ESSystemTimeBase::goingToSleep() {  // iOS going to sleep: Go back to using NSDa
     ESTimeInterval altTime = currentSystemAltTime();
     _altOffset = sysTime - altTime;
     _continuousOffset = _continuousAltOffset - _altOffset;
+    ESTime::publishSnapshot();
     // no ESTime::continuousTimeReset() here because (we assert) the continuous time remains continuous when going into sleep
 }
 
@@ -59,6 +60,7 @@ ESSystemTimeBase::wakingUp() {  // iOS waking up
     ESTimeInterval altTime = currentSystemAltTime();
     _altOffset = sysTime - altTime;
     _continuousAltOffset = _continuousOffset + _altOffset;  // Note: This is different from the EC/EO/ETS TSTime implementation, which was wrong
+    ESTime::publishSnapshot();  // Readers switch to the alt base only now that its offset is set
     if (firstTime) {
         firstTime = false;
     } else {
@@ -15,30 +15,96 @@
 #include "ESThread.hpp"
 #include "ESLeapSecond.hpp" // For test
 #include "ESTimer.hpp"
+#include "ESMetrics.hpp"
 
 #include "ESNTPDriver.hpp"
+#include "ESNTPLoopbackSimulator.hpp"
 #include "ESFakeTimeDriver.hpp"
 #include "ESXGPS150TimeDriver.hpp"
 
 #include <math.h>
 #include <assert.h>
+#include <string.h>
+#include <pthread.h>
 
 #include <list>
+#include <vector>
+#include <algorithm>
 
 // Class static member variables
 /*static*/ ESTimeSourceDriver *ESTime::_bestDriver;
 /*static*/ std::list<ESTimeSourceDriver *> *ESTime::_drivers;
 /*static*/ ESTimeInterval      ESTime::_nextLeapSecondDate = ESFarFarInTheFuture;  // Meaning "never"
 /*static*/ ESTimeInterval      ESTime::_nextLeapSecondDelta = 0;
+/*static*/ ESTimeSnapshot      ESTime::_snapshot = { 0, 1e9, ESTimeSourceStatusOff, ESFarFarInTheFuture, 0, 0, false, 0 };
+/*static*/ unsigned int        ESTime::_snapshotSequence = 0;
+
+// The kinds of event an observer can have pending
+#define ES_SYNC_EVENT_VALUE       0x1  /* syncValueChanged() */
+#define ES_SYNC_EVENT_STATUS      0x2  /* syncStatusChanged() */
+#define ES_SYNC_EVENT_CONT_TIME   0x4  /* continuousTimeReset() */
+#define ES_SYNC_EVENT_WORKING     0x8  /* workingSyncValueChanged() */
+
+// One registered observer, and what it hasn't been told yet
+struct ESTimeSyncRegistration {
+    ESTimeSyncObserver      *observer;
+    ESThread                *thread;  // The observer's notificationThread, or NULL to call it from whatever thread posts the event
+    unsigned int            pendingEvents;
+    ESTimeInterval          workingSyncValue;  // Latest, if ES_SYNC_EVENT_WORKING is pending
+    ESTimeInterval          workingSyncAccuracy;
+    ESTimeInterval          workingSyncMinInterval;
+    ESTimeInterval          lastWorkingSyncPostTime;  // Continuous time
+    bool                    workingSyncDeferred;  // A working value arrived within workingSyncMinInterval and waits for the trailing timer
+    ESTimeInterval          deferredWorkingSyncValue;  // Latest, if workingSyncDeferred
+    ESTimeInterval          deferredWorkingSyncAccuracy;
+};
+
+// There's at most one message in flight to each notification thread, carrying every observer's pending events there
+struct ESTimeSyncDispatch {
+    ESThread                *thread;
+    bool                    messagePending;
+};
+
+// An observer being called right now, so unregistering it from another thread knows to wait
+struct ESTimeSyncDelivery {
+    ESTimeSyncObserver      *observer;
+    pthread_t               thread;
+};
+
+// Fires when the earliest deferred working value is due, in the thread that posted the value that armed it
+class ESTimeSyncTrailingTimerObserver : public ESTimerObserver {
+  public:
+    void                    notify(ESTimer *timer);
+};
 
 // File static variables
-static std::list<ESTimeSyncObserver *> *timeSyncObservers;
+static std::vector<ESTimeSyncRegistration> *timeSyncObservers;  // Protected by observerLock
+static std::vector<ESTimeSyncDispatch *> *timeSyncDispatches;  // Protected by observerLock; never freed, there's one per thread
+static std::vector<ESTimeSyncDelivery> *timeSyncDeliveries;  // Protected by observerLock
+static pthread_mutex_t observerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t observerDeliveryDone = PTHREAD_COND_INITIALIZER;  // Signaled with observerLock whenever a delivery ends
+static ESTimer *workingSyncTrailingTimer = NULL;  // Protected by observerLock; set while there's one on the way
+static ESTimeSyncTrailingTimerObserver workingSyncTrailingTimerObserver;
+static ESMetricHistogram observerQueueDepthMetric("time.observer_queue_depth", "observers", 1, 2);  // Observers with events pending when a thread's dispatch runs
+static ESTimeInterval leapDataComputedAt = -1;  // The UTC for which _nextLeapSecondDate was last looked up; it's good until then
+static unsigned int leapDataTableGeneration = 0;  // ... unless a new leap-second table has been loaded since
+static ESLock leapDataLock;  // Protects the two above and the leap data; a leap-second list may be loaded on any thread
+
+#undef ES_TIME_BULK_BENCHMARK  // Define this to check the bulk conversions against the single ones, and time both, in ESTime::init()
+// Define this to run, in ESTime::init() before any driver exists, a writer thread publishing synthetic snapshots as fast
+// as it can against reader threads checking they never see a torn one, and then (once the real snapshot is up) to time
+// the lock-free read path
+#undef ES_TIME_SNAPSHOT_TEST
+#ifdef ES_TIME_SNAPSHOT_TEST
+#include <unistd.h>
+#endif
 static ESLock *printfLock;
 static double startOfMainTime;
 static double startOfMainCTime;
 static double lastTimeNoted = -1;
 static double lastCTimeNoted = -1;
 static bool initialized = false;
+static ESLock snapshotLock;  // Serializes writers only; readers use the sequence number
 
 
 /*static*/ std::string 
@@ -242,36 +308,481 @@ ESTime::reportAllSkewsAndOffset(const char  *description) {
 
 // Public registration method to be informed when the sync changes
 /*static*/ void 
-ESTime::registerTimeSyncObserver(ESTimeSyncObserver *observer) {
-    timeSyncObservers->push_back(observer);
+ESTime::registerTimeSyncObserver(ESTimeSyncObserver *observer,
+                                 ESTimeInterval     workingSyncMinInterval) {
+    ESTimeSyncRegistration registration;
+    registration.observer = observer;
+    registration.thread = observer->_notificationThread;
+    registration.pendingEvents = 0;
+    registration.workingSyncValue = 0;
+    registration.workingSyncAccuracy = 0;
+    registration.workingSyncMinInterval = workingSyncMinInterval;
+    registration.lastWorkingSyncPostTime = -1e9;
+    registration.workingSyncDeferred = false;
+    registration.deferredWorkingSyncValue = 0;
+    registration.deferredWorkingSyncAccuracy = 0;
+    pthread_mutex_lock(&observerLock);
+    timeSyncObservers->push_back(registration);
+    if (registration.thread) {
+        size_t numDispatches = timeSyncDispatches->size();
+        size_t i;
+        for (i = 0; i < numDispatches; i++) {
+            if ((*timeSyncDispatches)[i]->thread == registration.thread) {
+                break;
+            }
+        }
+        if (i == numDispatches) {
+            ESTimeSyncDispatch *dispatch = new ESTimeSyncDispatch;
+            dispatch->thread = registration.thread;
+            dispatch->messagePending = false;
+            timeSyncDispatches->push_back(dispatch);
+        }
+    }
+    pthread_mutex_unlock(&observerLock);
 }
 
+// Any pending events for the observer are dropped with it.  If another thread is calling the observer right now,
+// wait for that call to return, so the caller can delete the observer as soon as we do.  A call in progress in
+// this thread (the observer unregistering itself from its callback, say) can't be waited for, and isn't.
 /*static*/ void 
 ESTime::unregisterTimeSyncObserver(ESTimeSyncObserver *observer) {
-    timeSyncObservers->remove(observer);
+    pthread_mutex_lock(&observerLock);
+    std::vector<ESTimeSyncRegistration>::iterator end = timeSyncObservers->end();
+    std::vector<ESTimeSyncRegistration>::iterator iter = timeSyncObservers->begin();
+    while (iter != end) {
+        if (iter->observer == observer) {
+            timeSyncObservers->erase(iter);
+            break;
+        }
+        iter++;
+    }
+    pthread_t thisThread = pthread_self();
+    bool deliveryInOtherThread;
+    do {
+        deliveryInOtherThread = false;
+        size_t numDeliveries = timeSyncDeliveries->size();
+        for (size_t i = 0; i < numDeliveries; i++) {
+            const ESTimeSyncDelivery &delivery = (*timeSyncDeliveries)[i];
+            if (delivery.observer == observer && !pthread_equal(delivery.thread, thisThread)) {
+                deliveryInOtherThread = true;
+                pthread_cond_wait(&observerDeliveryDone, &observerLock);
+                break;
+            }
+        }
+    } while (deliveryInOtherThread);
+    pthread_mutex_unlock(&observerLock);
+}
+
+// Call each observer for the events given in its entry, in an order that makes sense if several were coalesced.
+// Each entry is checked against the registry under observerLock just before its call, since an earlier callback
+// or another thread may have unregistered it since the entry was taken, and the call is recorded in
+// timeSyncDeliveries while it runs so unregisterTimeSyncObserver() can wait for it.
+static void
+deliverTimeSyncEvents(const std::vector<ESTimeSyncRegistration> &deliveries) {
+    pthread_t thisThread = pthread_self();
+    size_t numDeliveries = deliveries.size();
+    for (size_t d = 0; d < numDeliveries; d++) {
+        const ESTimeSyncRegistration &registration = deliveries[d];
+        ESTimeSyncObserver *observer = registration.observer;
+        pthread_mutex_lock(&observerLock);
+        bool registered = false;
+        size_t numObservers = timeSyncObservers->size();
+        for (size_t i = 0; i < numObservers; i++) {
+            if ((*timeSyncObservers)[i].observer == observer) {
+                registered = true;
+                break;
+            }
+        }
+        if (registered) {
+            ESTimeSyncDelivery delivery;
+            delivery.observer = observer;
+            delivery.thread = thisThread;
+            timeSyncDeliveries->push_back(delivery);
+        }
+        pthread_mutex_unlock(&observerLock);
+        if (!registered) {
+            continue;
+        }
+        unsigned int events = registration.pendingEvents;
+        if (events & ES_SYNC_EVENT_CONT_TIME) {
+            observer->continuousTimeReset();
+        }
+        if (events & ES_SYNC_EVENT_VALUE) {
+            observer->syncValueChanged();
+        }
+        if (events & ES_SYNC_EVENT_STATUS) {
+            observer->syncStatusChanged();
+        }
+        if (events & ES_SYNC_EVENT_WORKING) {
+            observer->workingSyncValueChanged(registration.workingSyncValue, registration.workingSyncAccuracy);
+        }
+        pthread_mutex_lock(&observerLock);
+        std::vector<ESTimeSyncDelivery>::iterator end = timeSyncDeliveries->end();
+        std::vector<ESTimeSyncDelivery>::iterator iter = timeSyncDeliveries->begin();
+        while (iter != end) {  // One of ours; a callback may have posted (and so nested a delivery) to the same observer
+            if (iter->observer == observer && pthread_equal(iter->thread, thisThread)) {
+                timeSyncDeliveries->erase(iter);
+                break;
+            }
+            iter++;
+        }
+        pthread_cond_broadcast(&observerDeliveryDone);
+        pthread_mutex_unlock(&observerLock);
+    }
+}
+
+// In the dispatch's thread:  take every pending event for the observers here and deliver them
+static void
+timeSyncDispatchGlue(void *obj,
+                     void *param) {
+    ESTimeSyncDispatch *dispatch = (ESTimeSyncDispatch *)obj;
+    ESAssert(dispatch->thread->inThisThread());
+    std::vector<ESTimeSyncRegistration> pending;
+    pthread_mutex_lock(&observerLock);
+    dispatch->messagePending = false;  // Events posted from here on need another message
+    size_t numObservers = timeSyncObservers->size();
+    for (size_t i = 0; i < numObservers; i++) {
+        ESTimeSyncRegistration &registration = (*timeSyncObservers)[i];
+        if (registration.thread == dispatch->thread && registration.pendingEvents) {
+            pending.push_back(registration);
+            registration.pendingEvents = 0;
+        }
+    }
+    pthread_mutex_unlock(&observerLock);
+    observerQueueDepthMetric.record(pending.size());
+    deliverTimeSyncEvents(pending);
+}
+
+// With observerLock held:  queue the event for one observer, either for a direct call (no notification thread, or
+// it's this one) or as pending on its registration, noting its thread's dispatch if that needs a message sent
+static void
+queueTimeSyncEvent(ESTimeSyncRegistration              &registration,
+                   unsigned int                        event,
+                   ESTimeInterval                      workingSyncValue,
+                   ESTimeInterval                      workingSyncAccuracy,
+                   std::vector<ESTimeSyncRegistration> &directDeliveries,
+                   std::vector<ESTimeSyncDispatch *>   &dispatchesToSend) {
+    if (!registration.thread || registration.thread->inThisThread()) {
+        ESTimeSyncRegistration delivery = registration;
+        delivery.pendingEvents = event;
+        delivery.workingSyncValue = workingSyncValue;
+        delivery.workingSyncAccuracy = workingSyncAccuracy;
+        directDeliveries.push_back(delivery);
+        return;
+    }
+    registration.pendingEvents |= event;
+    if (event == ES_SYNC_EVENT_WORKING) {
+        registration.workingSyncValue = workingSyncValue;  // Latest wins
+        registration.workingSyncAccuracy = workingSyncAccuracy;
+    }
+    size_t numDispatches = timeSyncDispatches->size();
+    for (size_t d = 0; d < numDispatches; d++) {
+        ESTimeSyncDispatch *dispatch = (*timeSyncDispatches)[d];
+        if (dispatch->thread == registration.thread) {
+            if (!dispatch->messagePending) {
+                dispatch->messagePending = true;
+                dispatchesToSend.push_back(dispatch);
+            }
+            break;
+        }
+    }
+}
+
+// With observerLock held:  if any observer has a deferred working value and no trailing timer is on the way, create
+// one for the earliest due.  Returns it, to be activated once the lock is released.
+static ESTimer *
+armWorkingSyncTrailingTimer() {
+    if (workingSyncTrailingTimer) {
+        return NULL;  // It'll rearm for whatever it finds not yet due
+    }
+    ESTimeInterval earliestDue = ESFarFarInTheFuture;
+    size_t numObservers = timeSyncObservers->size();
+    for (size_t i = 0; i < numObservers; i++) {
+        const ESTimeSyncRegistration &registration = (*timeSyncObservers)[i];
+        if (registration.workingSyncDeferred) {
+            ESTimeInterval due = registration.lastWorkingSyncPostTime + registration.workingSyncMinInterval;
+            if (due < earliestDue) {
+                earliestDue = due;
+            }
+        }
+    }
+    if (earliestDue == ESFarFarInTheFuture) {
+        return NULL;
+    }
+    workingSyncTrailingTimer = new ESContinuousTimeTimer(&workingSyncTrailingTimerObserver, earliestDue);
+    return workingSyncTrailingTimer;
+}
+
+static void
+sendTimeSyncEvents(const std::vector<ESTimeSyncRegistration> &directDeliveries,
+                   const std::vector<ESTimeSyncDispatch *>   &dispatchesToSend,
+                   ESTimer                                   *trailingTimer) {
+    if (trailingTimer) {
+        trailingTimer->activate();
+    }
+    size_t numDispatchesToSend = dispatchesToSend.size();
+    for (size_t d = 0; d < numDispatchesToSend; d++) {
+        dispatchesToSend[d]->thread->callInThread(timeSyncDispatchGlue, dispatchesToSend[d], NULL);
+    }
+    deliverTimeSyncEvents(directDeliveries);
+}
+
+// Mark the event pending for every observer in another thread, sending a message to each such thread that doesn't
+// already have one on the way, and call the rest directly.  Observers are called without observerLock held, so
+// they may register and unregister (themselves or others) from their callbacks.  A working value arriving within
+// an observer's workingSyncMinInterval of the last one it was sent is held, and the latest such value is sent by
+// a trailing timer once the interval has passed, so the observer always ends up with the final value.
+/*static*/ void
+ESTime::postTimeSyncEvent(unsigned int   event,
+                          ESTimeInterval workingSyncValue,
+                          ESTimeInterval workingSyncAccuracy) {
+    ESTimeInterval now = (event == ES_SYNC_EVENT_WORKING) ? currentContinuousTime() : 0;
+    std::vector<ESTimeSyncRegistration> directDeliveries;
+    std::vector<ESTimeSyncDispatch *> dispatchesToSend;
+    ESTimer *trailingTimer = NULL;
+    pthread_mutex_lock(&observerLock);
+    size_t numObservers = timeSyncObservers->size();
+    for (size_t i = 0; i < numObservers; i++) {
+        ESTimeSyncRegistration &registration = (*timeSyncObservers)[i];
+        if (event == ES_SYNC_EVENT_WORKING) {
+            if (now - registration.lastWorkingSyncPostTime < registration.workingSyncMinInterval) {
+                registration.workingSyncDeferred = true;  // Latest wins
+                registration.deferredWorkingSyncValue = workingSyncValue;
+                registration.deferredWorkingSyncAccuracy = workingSyncAccuracy;
+                continue;
+            }
+            registration.lastWorkingSyncPostTime = now;
+            registration.workingSyncDeferred = false;  // Superseded by this one
+        }
+        queueTimeSyncEvent(registration, event, workingSyncValue, workingSyncAccuracy, directDeliveries, dispatchesToSend);
+    }
+    if (event == ES_SYNC_EVENT_WORKING) {
+        trailingTimer = armWorkingSyncTrailingTimer();
+    }
+    pthread_mutex_unlock(&observerLock);
+    sendTimeSyncEvents(directDeliveries, dispatchesToSend, trailingTimer);
+}
+
+// In the thread that armed the timer:  send every deferred working value that's now due, and rearm for the rest
+void
+ESTimeSyncTrailingTimerObserver::notify(ESTimer *timer) {
+    ESTimeInterval now = ESTime::currentContinuousTime();
+    std::vector<ESTimeSyncRegistration> directDeliveries;
+    std::vector<ESTimeSyncDispatch *> dispatchesToSend;
+    pthread_mutex_lock(&observerLock);
+    ESAssert(timer == workingSyncTrailingTimer);
+    workingSyncTrailingTimer = NULL;
+    size_t numObservers = timeSyncObservers->size();
+    for (size_t i = 0; i < numObservers; i++) {
+        ESTimeSyncRegistration &registration = (*timeSyncObservers)[i];
+        if (registration.workingSyncDeferred &&
+            now - registration.lastWorkingSyncPostTime >= registration.workingSyncMinInterval) {
+            registration.workingSyncDeferred = false;
+            registration.lastWorkingSyncPostTime = now;
+            queueTimeSyncEvent(registration, ES_SYNC_EVENT_WORKING,
+                               registration.deferredWorkingSyncValue, registration.deferredWorkingSyncAccuracy,
+                               directDeliveries, dispatchesToSend);
+        }
+    }
+    ESTimer *trailingTimer = armWorkingSyncTrailingTimer();
+    pthread_mutex_unlock(&observerLock);
+    timer->release();
+    sendTimeSyncEvents(directDeliveries, dispatchesToSend, trailingTimer);
 }
 
 // Methods to be called by app delegate
 /*static*/ void 
 ESTime::startOfMain(const char *fourByteAppSig) {
     startOfMainTime = ESSystemTimeBase::init();
+    publishSnapshot();  // Picks up the continuous offset established by init()
     startOfMainCTime = cTimeForSysTime(startOfMainTime);
     ESUtil::registerNoteTimeAtPhaseCapability(&ESTime::noteTimeAtPhase);
     ESNTPDriver::setAppSignature(fourByteAppSig);
 }
 
+#ifdef ES_TIME_BULK_BENCHMARK
+// Convert a million continuous times spanning the next leap second (so the slow path is exercised) both ways, check
+// the results match bit for bit, and report the time per element
+static void
+runBulkConversionBenchmark() {
+    const size_t count = 1000000;
+    std::vector<ESTimeInterval> cTimes(count);
+    std::vector<ESTimeInterval> bulk(count);
+    std::vector<ESTimeInterval> single(count);
+    std::vector<ESTimeInterval> bulkLive(count);
+    std::vector<ESTimeInterval> singleLive(count);
+    ESTimeSnapshot snapshot;
+    ESTime::currentSnapshot(&snapshot);
+    ESTimeInterval center = (snapshot.nextLeapSecondDate < ESFarFarInTheFuture ? snapshot.nextLeapSecondDate : ESTime::currentTime()) - snapshot.contSkew;
+    for (size_t i = 0; i < count; i++) {
+        cTimes[i] = center + (i - count / 2.0) * 1e-5;  // 10 seconds either side, so about 1 in 10 elements is near the leap
+    }
+    struct {
+        const char *name;
+        ESTimeInterval bulkTime;
+        ESTimeInterval singleTime;
+        bool matched;
+    } results[4];
+    for (int which = 0; which < 4; which++) {
+        ESTimeInterval t0 = ESTime::currentContinuousTime();
+        switch (which) {
+          case 0: ESTime::ntpTimesForCTimes(&cTimes[0], &bulk[0], count); break;
+          case 1: ESTime::ntpTimesForCTimesWithLiveCorrection(&cTimes[0], &bulk[0], &bulkLive[0], count); break;
+          case 2: ESTime::cTimesForNTPTimes(&cTimes[0], &bulk[0], count); break;
+          case 3: ESTime::sysTimesForCTimes(&cTimes[0], &bulk[0], count); break;
+        }
+        ESTimeInterval t1 = ESTime::currentContinuousTime();
+        for (size_t i = 0; i < count; i++) {
+            switch (which) {
+              case 0: single[i] = ESTime::ntpTimeForCTime(cTimes[i]); break;
+              case 1: single[i] = ESTime::ntpTimeForCTimeWithLiveCorrection(cTimes[i], &singleLive[i]); break;
+              case 2: single[i] = ESTime::cTimeForNTPTime(cTimes[i]); break;
+              case 3: single[i] = ESTime::sysTimeForCTime(cTimes[i]); break;
+            }
+        }
+        ESTimeInterval t2 = ESTime::currentContinuousTime();
+        static const char *names[] = { "ntpTimesForCTimes", "ntpTimesForCTimesWithLiveCorrection", "cTimesForNTPTimes", "sysTimesForCTimes" };
+        results[which].name = names[which];
+        results[which].bulkTime = t1 - t0;
+        results[which].singleTime = t2 - t1;
+        results[which].matched = memcmp(&bulk[0], &single[0], count * sizeof(ESTimeInterval)) == 0 &&
+            (which != 1 || memcmp(&bulkLive[0], &singleLive[0], count * sizeof(ESTimeInterval)) == 0);
+    }
+    for (int which = 0; which < 4; which++) {
+        printf("BULK CONVERSION: %-36s %6.2f ns/element bulk, %6.2f ns/element single, %s\n",
+               results[which].name, results[which].bulkTime * 1e9 / count, results[which].singleTime * 1e9 / count,
+               results[which].matched ? "identical" : "MISMATCH");
+        ESAssert(results[which].matched);
+    }
+}
+#endif  // ES_TIME_BULK_BENCHMARK
+
+#ifdef ES_TIME_SNAPSHOT_TEST
+class ESTimeSnapshotTest {
+  public:
+    static void             runStressTest();
+    static void             runReadBenchmark();
+  private:
+    static void             *writer(void *arg);
+    static void             *reader(void *arg);
+    static volatile bool    _done;
+};
+
+/*static*/ volatile bool ESTimeSnapshotTest::_done;
+
+/*static*/ void *
+ESTimeSnapshotTest::writer(void *arg) {
+    ESTimeSnapshot snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    for (double k = 1; !_done; k++) {  // Every field derived from k, so a reader can check they match
+        snapshot.contSkew = k;
+        snapshot.currentTimeError = 2 * k;
+        snapshot.status = (ESTimeSourceStatus)((int)k & 3);
+        snapshot.nextLeapSecondDate = 1e9 + k;
+        snapshot.nextLeapSecondDelta = -k;
+        snapshot.continuousOffset = -k;
+        snapshot.usingAltTime = ((long)k & 1) != 0;
+        snapshot.continuousBaseOffset = 3 * k;
+        snapshotLock.lock();
+        ESTime::storeSnapshot(&snapshot);
+        snapshotLock.unlock();
+    }
+    return NULL;
+}
+
+/*static*/ void *
+ESTimeSnapshotTest::reader(void *arg) {
+    long numReads = 0;
+    long numTorn = 0;
+    long numBackwards = 0;
+    double lastK = 0;
+    while (!_done) {
+        ESTimeSnapshot snapshot;
+        ESTime::currentSnapshot(&snapshot);
+        double k = snapshot.contSkew;
+        if (k == 0) {
+            continue;  // Writer hasn't started
+        }
+        if (snapshot.currentTimeError != 2 * k || snapshot.status != (ESTimeSourceStatus)((int)k & 3) ||
+            snapshot.nextLeapSecondDate != 1e9 + k || snapshot.nextLeapSecondDelta != -k ||
+            snapshot.continuousOffset != -k || snapshot.usingAltTime != (((long)k & 1) != 0) ||
+            snapshot.continuousBaseOffset != 3 * k) {
+            numTorn++;
+        }
+        if (k < lastK) {
+            numBackwards++;
+        }
+        lastK = k;
+        numReads++;
+    }
+    printf("SNAPSHOT TEST: reader %ld reads, %ld torn, %ld backwards\n", numReads, numTorn, numBackwards);
+    ESAssert(numTorn == 0);
+    ESAssert(numBackwards == 0);
+    return NULL;
+}
+
+// Runs before any driver can publish; ESTime::init() publishes the real snapshot afterwards
+/*static*/ void
+ESTimeSnapshotTest::runStressTest() {
+    const int numReaders = 3;
+    pthread_t writerThread;
+    pthread_t readerThreads[numReaders];
+    _done = false;
+    pthread_create(&writerThread, NULL, writer, NULL);
+    for (int i = 0; i < numReaders; i++) {
+        pthread_create(&readerThreads[i], NULL, reader, NULL);
+    }
+    sleep(1);
+    _done = true;
+    pthread_join(writerThread, NULL);
+    for (int i = 0; i < numReaders; i++) {
+        pthread_join(readerThreads[i], NULL);
+    }
+}
+
+// Uncontended cost of the read path, against the raw system clock it's built on
+/*static*/ void
+ESTimeSnapshotTest::runReadBenchmark() {
+    const int numCalls = 10000000;
+    double sum = 0;
+    ESTimeInterval t0 = ESSystemTimeBase::currentContinuousSystemTime();
+    for (int i = 0; i < numCalls; i++) {
+        sum += ESSystemTimeBase::currentContinuousSystemTime();
+    }
+    ESTimeInterval t1 = ESSystemTimeBase::currentContinuousSystemTime();
+    for (int i = 0; i < numCalls; i++) {
+        sum += ESTime::currentContinuousTime();
+    }
+    ESTimeInterval t2 = ESSystemTimeBase::currentContinuousSystemTime();
+    for (int i = 0; i < numCalls; i++) {
+        sum += ESTime::currentTime();
+    }
+    ESTimeInterval t3 = ESSystemTimeBase::currentContinuousSystemTime();
+    printf("SNAPSHOT TEST: system clock %.1f ns, ESTime::currentContinuousTime %.1f ns, ESTime::currentTime %.1f ns (%g)\n",
+           (t1 - t0) * 1e9 / numCalls, (t2 - t1) * 1e9 / numCalls, (t3 - t2) * 1e9 / numCalls, sum);
+}
+#endif  // ES_TIME_SNAPSHOT_TEST
+
 /*static*/ void
 ESTime::init(unsigned int   makerFlags,
              ESTimeInterval fakeTimeForSync,
              ESTimeInterval fakeTimeError) {
     ESAssert(!initialized);
-    timeSyncObservers = new std::list<ESTimeSyncObserver *>;
+    timeSyncObservers = new std::vector<ESTimeSyncRegistration>;
+    timeSyncDispatches = new std::vector<ESTimeSyncDispatch *>;
+    timeSyncDeliveries = new std::vector<ESTimeSyncDelivery>;
     ESTimer::init();
     ESCalendar_init();
     _bestDriver = NULL;
+#ifdef ES_TIME_SNAPSHOT_TEST
+    ESTimeSnapshotTest::runStressTest();
+#endif
     ESAssert(!_drivers);
     _drivers = new std::list<ESTimeSourceDriver *>;
     if (makerFlags & ESNTPMakerFlag) {
+#ifdef ES_NTP_LOOPBACK_SIMULATOR
+        ESNTPLoopbackSimulator::startBenchmark();  // Sets up the user-server list before the driver's first sync
+#endif
         ESTimeSourceDriver *d = (*ESNTPDriver::makeOne)();
         _drivers->push_back(d);
         _bestDriver = d;
@@ -300,10 +811,17 @@ ESTime::init(unsigned int   makerFlags,
         ESAssert(!_bestDriver);  // system time driver only makes sense if it's the only source
         _bestDriver = d;
     }
+    publishSnapshot();
     initialized = true;
 #ifdef ESLEAPSECOND_TEST  // Defined (or not) in ESLeapSecond.hpp
     ESTestLeapSecond();
 #endif
+#ifdef ES_TIME_BULK_BENCHMARK
+    runBulkConversionBenchmark();
+#endif
+#ifdef ES_TIME_SNAPSHOT_TEST
+    ESTimeSnapshotTest::runReadBenchmark();
+#endif
 }
 
 // This is called when the system is going down (as in Android, when switching away from a watch
@@ -329,48 +847,171 @@ ESTime::shutdown() {
 }
 
 /*static*/ ESTimeInterval 
-ESTime::adjustForLeapSecondGuts(ESTimeInterval rawUTC) {
-    ESAssert(rawUTC >= _nextLeapSecondDate);  // otherwise should have been caught in calling inline
-    if (_nextLeapSecondDelta > 0) {  // positive leap second, as with all of first 15+
-        if (rawUTC > _nextLeapSecondDate + _nextLeapSecondDelta) {
-            return rawUTC - _nextLeapSecondDelta;
+ESTime::adjustForLeapSecondGuts(ESTimeInterval       rawUTC,
+                                const ESTimeSnapshot *snapshot) {
+    ESTimeInterval nextLeapSecondDate = snapshot->nextLeapSecondDate;
+    ESTimeInterval nextLeapSecondDelta = snapshot->nextLeapSecondDelta;
+    ESAssert(rawUTC >= nextLeapSecondDate);  // otherwise should have been caught in calling inline
+    if (nextLeapSecondDelta > 0) {  // positive leap second, as with all of first 15+
+        if (rawUTC > nextLeapSecondDate + nextLeapSecondDelta) {
+            return rawUTC - nextLeapSecondDelta;
         } else {
-            return _nextLeapSecondDate - ESLeapSecondHoldShortInterval;  // We hold in place during the transition
+            return nextLeapSecondDate - ESLeapSecondHoldShortInterval;  // We hold in place during the transition
         }
     } else {
-        ESAssert(_nextLeapSecondDelta < 0);  // If we get here, we should have a zero delta
-        return rawUTC - _nextLeapSecondDelta;  // Jump back; no transition period to worry about
+        ESAssert(nextLeapSecondDelta < 0);  // If we get here, we should have a zero delta
+        return rawUTC - nextLeapSecondDelta;  // Jump back; no transition period to worry about
     }
 }
 
 /*static*/ ESTimeInterval 
-ESTime::adjustForLeapSecondGutsWithLiveCorrection(ESTimeInterval rawUTC,
-                                                  ESTimeInterval *liveCorrection) {
-    ESAssert(rawUTC >= _nextLeapSecondDate - 1.0);  // otherwise should have been caught in calling inline
-    if (_nextLeapSecondDelta > 0) {  // positive leap second, as with all of first 15+
-        ESTimeInterval timeSinceStart = rawUTC - _nextLeapSecondDate;  // Might be negative up to -1
-        if (timeSinceStart > _nextLeapSecondDelta) {
+ESTime::adjustForLeapSecondGutsWithLiveCorrection(ESTimeInterval       rawUTC,
+                                                  ESTimeInterval       *liveCorrection,
+                                                  const ESTimeSnapshot *snapshot) {
+    ESTimeInterval nextLeapSecondDate = snapshot->nextLeapSecondDate;
+    ESTimeInterval nextLeapSecondDelta = snapshot->nextLeapSecondDelta;
+    ESAssert(rawUTC >= nextLeapSecondDate - 1.0);  // otherwise should have been caught in calling inline
+    if (nextLeapSecondDelta > 0) {  // positive leap second, as with all of first 15+
+        ESTimeInterval timeSinceStart = rawUTC - nextLeapSecondDate;  // Might be negative up to -1
+        if (timeSinceStart > nextLeapSecondDelta) {
             *liveCorrection = 0;
-            return rawUTC - _nextLeapSecondDelta;
+            return rawUTC - nextLeapSecondDelta;
         } else {
             *liveCorrection = timeSinceStart + ESLeapSecondHoldShortInterval + 1;  // Live correction goes from ~0 (the second before, for rounding purposes) to 2 (after the leap)
             if (timeSinceStart > 0) {
-                return _nextLeapSecondDate - ESLeapSecondHoldShortInterval;  // We hold in place during the transition
+                return nextLeapSecondDate - ESLeapSecondHoldShortInterval;  // We hold in place during the transition
             } else {
                 return rawUTC;  // During the lead-up second we proceed normally with UTC; only the live correction is active
             }
         }
     } else {
-        ESAssert(_nextLeapSecondDelta < 0);  // If we get here, we should have a zero delta
+        ESAssert(nextLeapSecondDelta < 0);  // If we get here, we should have a zero delta
         *liveCorrection = 0;  // No live correction for negative leap seconds
-        return rawUTC - _nextLeapSecondDelta;  // Jump back; no transition period to worry about
+        return rawUTC - nextLeapSecondDelta;  // Jump back; no transition period to worry about
+    }
+}
+
+// *****************************************************************************
+// Bulk conversions.  Each does the common case for every element in a first
+// loop with no branches and no calls (so the compiler can vectorize it), then
+// redoes, exactly as the single version would, the few elements at or past the
+// point where the next leap second matters.
+// *****************************************************************************
+
+/*static*/ void
+ESTime::ntpTimesForCTimes(const ESTimeInterval *cTimes,
+                          ESTimeInterval       *ntpTimes,
+                          size_t               count) {
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    ESTimeInterval contSkew = snapshot.contSkew;
+    for (size_t i = 0; i < count; i++) {
+        ntpTimes[i] = cTimes[i] + contSkew;
+    }
+    ESTimeInterval nextLeapSecondDate = snapshot.nextLeapSecondDate;
+    for (size_t i = 0; i < count; i++) {
+        if (ntpTimes[i] >= nextLeapSecondDate) {
+            ntpTimes[i] = adjustForLeapSecondGuts(ntpTimes[i], &snapshot);
+        }
+    }
+}
+
+/*static*/ void
+ESTime::ntpTimesForCTimesWithLiveCorrection(const ESTimeInterval *cTimes,
+                                            ESTimeInterval       *ntpTimes,
+                                            ESTimeInterval       *liveCorrections,
+                                            size_t               count) {
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    ESTimeInterval contSkew = snapshot.contSkew;
+    for (size_t i = 0; i < count; i++) {
+        ntpTimes[i] = cTimes[i] + contSkew;
+        liveCorrections[i] = 0;
+    }
+    ESTimeInterval liveCorrectionStart = snapshot.nextLeapSecondDate - 1.0;
+    for (size_t i = 0; i < count; i++) {
+        if (ntpTimes[i] >= liveCorrectionStart) {
+            ntpTimes[i] = adjustForLeapSecondGutsWithLiveCorrection(ntpTimes[i], &liveCorrections[i], &snapshot);
+        }
+    }
+}
+
+/*static*/ void
+ESTime::cTimesForNTPTimes(const ESTimeInterval *ntpTimes,
+                          ESTimeInterval       *cTimes,
+                          size_t               count) {
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    ESTimeInterval contSkew = snapshot.contSkew;
+    ESTimeInterval nextLeapSecondDate = snapshot.nextLeapSecondDate;
+    ESTimeInterval nextLeapSecondDelta = snapshot.nextLeapSecondDelta;
+    // One loop here:  the select doesn't stop vectorization, and the input is gone by a second pass if it's in place
+    for (size_t i = 0; i < count; i++) {
+        ESTimeInterval ntpTime = ntpTimes[i];
+        ESTimeInterval adjusted = ntpTime + nextLeapSecondDelta;  // Computed as the single version does, not folded into the skew
+        cTimes[i] = (ntpTime > nextLeapSecondDate ? adjusted : ntpTime) - contSkew;
+    }
+}
+
+/*static*/ void
+ESTime::sysTimesForCTimes(const ESTimeInterval *cTimes,
+                          ESTimeInterval       *sysTimes,
+                          size_t               count) {
+    ESTimeInterval continuousOffset = ESTime::continuousOffset();
+    for (size_t i = 0; i < count; i++) {
+        sysTimes[i] = cTimes[i] - continuousOffset;
     }
 }
 
 /*static*/ void 
 ESTime::setupNextLeapSecondData() {
-    ESTimeInterval utcNow = currentTime();
+    ESTimeInterval utcNow = currentTime();  // Caller must already have published the new skew
+    unsigned int tableGeneration = ESLeapSecond::tableGeneration();
+    leapDataLock.lock();
+    if (leapDataComputedAt >= 0 && utcNow >= leapDataComputedAt && utcNow < _nextLeapSecondDate &&
+        tableGeneration == leapDataTableGeneration) {
+        leapDataLock.unlock();
+        return;  // The same leap second is still next (the usual case for the small corrections of a sync)
+    }
     _nextLeapSecondDate = ESLeapSecond::nextLeapSecondAfter(utcNow, &_nextLeapSecondDelta);
+    leapDataComputedAt = utcNow;
+    leapDataTableGeneration = tableGeneration;
+    publishSnapshot();  // Still under leapDataLock, so two threads can't publish their leap data out of order
+    leapDataLock.unlock();
+}
+
+// Sequence-lock writer (see ESTime::currentSnapshot() in ESTimeInl.hpp for the reader).  The values are gathered
+// under the lock so that two writers on different threads can't publish out of order.
+/*static*/ void
+ESTime::publishSnapshot() {
+    snapshotLock.lock();
+    ESTimeSnapshot snapshot;
+    if (_bestDriver) {
+        snapshot.contSkew = _bestDriver->contSkew();
+        snapshot.currentTimeError = _bestDriver->currentTimeError();
+        snapshot.status = _bestDriver->currentStatus();
+    } else {
+        snapshot.contSkew = 0;
+        snapshot.currentTimeError = 1e9;
+        snapshot.status = ESTimeSourceStatusOff;
+    }
+    snapshot.nextLeapSecondDate = _nextLeapSecondDate;
+    snapshot.nextLeapSecondDelta = _nextLeapSecondDelta;
+    snapshot.continuousOffset = ESSystemTimeBase::continuousOffset();
+    snapshot.usingAltTime = ESSystemTimeBase::usingAltTime();
+    snapshot.continuousBaseOffset = ESSystemTimeBase::continuousBaseOffset();
+    storeSnapshot(&snapshot);
+    publishSharedMemorySnapshot(&snapshot);  // Under snapshotLock, so the shared page sees snapshots in the same order
+    snapshotLock.unlock();
+}
+
+/*static*/ void
+ESTime::storeSnapshot(const ESTimeSnapshot *snapshot) {
+    unsigned int sequence = _snapshotSequence;
+    __atomic_store_n(&_snapshotSequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    _snapshot = *snapshot;
+    __atomic_store_n(&_snapshotSequence, sequence + 2, __ATOMIC_RELEASE);
 }
 
 /*static*/ ESTimeInterval 
@@ -410,43 +1051,15 @@ ESTime::notificationTimeForDST(ESTimeInterval secondsSinceMidnight,
 
 /*static*/ void 
 ESTime::syncValueReallyChanged() {
+    publishSnapshot();
     setupNextLeapSecondData();
-    // Call observers "safely" with respect to removing the observer we're on
-    {
-        ESTimeSyncObserver *observer;
-        std::list<ESTimeSyncObserver *>::iterator end = timeSyncObservers->end();
-        std::list<ESTimeSyncObserver *>::iterator iter = timeSyncObservers->begin();
-        if (iter != end) {
-            observer = *iter;
-            iter++;
-            while (iter != end) {
-                observer->callSyncValueChanged();  // Last one
-                observer = *iter;
-                iter++;
-            }
-            observer->callSyncValueChanged();  // Last one
-        }
-    }
+    postTimeSyncEvent(ES_SYNC_EVENT_VALUE);
 }
 
 /*static*/ void 
 ESTime::syncStatusReallyChanged() {
-    // Call observers "safely" with respect to removing the observer we're on
-    {
-        ESTimeSyncObserver *observer;
-        std::list<ESTimeSyncObserver *>::iterator end = timeSyncObservers->end();
-        std::list<ESTimeSyncObserver *>::iterator iter = timeSyncObservers->begin();
-        if (iter != end) {
-            observer = *iter;
-            iter++;
-            while (iter != end) {
-                observer->callSyncStatusChanged();  // Last one
-                observer = *iter;
-                iter++;
-            }
-            observer->callSyncStatusChanged();  // Last one
-        }
-    }
+    publishSnapshot();
+    postTimeSyncEvent(ES_SYNC_EVENT_STATUS);
 }
 
 /*static*/ void 
@@ -483,43 +1096,13 @@ ESTime::continuousTimeReset() {
             driver->resync(false/* !userRequested*/);
         }
     }
-    // Call observers "safely" with respect to removing the observer we're on
-    {
-        ESTimeSyncObserver *observer;
-        std::list<ESTimeSyncObserver *>::iterator end = timeSyncObservers->end();
-        std::list<ESTimeSyncObserver *>::iterator iter = timeSyncObservers->begin();
-        if (iter != end) {
-            observer = *iter;
-            iter++;
-            while (iter != end) {
-                observer->callContinuousTimeReset();  // Last one
-                observer = *iter;
-                iter++;
-            }
-            observer->callContinuousTimeReset();  // Last one
-        }
-    }
+    postTimeSyncEvent(ES_SYNC_EVENT_CONT_TIME);
 }
 
 /*static*/ void 
 ESTime::workingSyncValue(ESTimeInterval workingSyncValue,
                          ESTimeInterval workingSyncAccuracy) {
-    // Call observers "safely" with respect to removing the observer we're on
-    {
-        ESTimeSyncObserver *observer;
-        std::list<ESTimeSyncObserver *>::iterator end = timeSyncObservers->end();
-        std::list<ESTimeSyncObserver *>::iterator iter = timeSyncObservers->begin();
-        if (iter != end) {
-            observer = *iter;
-            iter++;
-            while (iter != end) {
-                observer->callWorkingSyncValueChanged(workingSyncValue, workingSyncAccuracy);  // last one
-                observer = *iter;
-                iter++;
-            }
-            observer->callWorkingSyncValueChanged(workingSyncValue, workingSyncAccuracy);  // last one
-        }
-    }
+    postTimeSyncEvent(ES_SYNC_EVENT_WORKING, workingSyncValue, workingSyncAccuracy);
 }
 
 inline static bool
@@ -641,6 +1224,7 @@ ESTime::syncActive() {  // Are we looking for a sync
 
 /*static*/ void 
 ESTime::notifyContinuousOffsetChange() {
+    publishSnapshot();
     if (_drivers) {
         std::list<ESTimeSourceDriver *>::iterator end = _drivers->end();
         std::list<ESTimeSourceDriver *>::iterator iter = _drivers->begin();
@@ -716,82 +1300,8 @@ ESTimeSyncObserver::ESTimeSyncObserver(ESThread *notificationThread)
 {
 }
 
-static void
-syncValueGlue(void *obj,
-              void *param) {
-    ESTimeSyncObserver *observer = (ESTimeSyncObserver *)obj;
-    observer->syncValueChanged();
-}
-
-static void
-syncStatusGlue(void *obj,
-               void *param) {
-    ESTimeSyncObserver *observer = (ESTimeSyncObserver *)obj;
-    observer->syncStatusChanged();
-}
-
-static void
-contTimeGlue(void *obj,
-             void *param) {
-    ESTimeSyncObserver *observer = (ESTimeSyncObserver *)obj;
-    observer->continuousTimeReset();
-}
-
-void 
-ESTimeSyncObserver::callSyncValueChanged() {
-    if (_notificationThread && !_notificationThread->inThisThread()) {
-        _notificationThread->callInThread(syncValueGlue, this, NULL);
-    } else {
-        syncValueChanged();
-    }
-}
-
-void 
-ESTimeSyncObserver::callSyncStatusChanged() {
-    if (_notificationThread && !_notificationThread->inThisThread()) {
-        _notificationThread->callInThread(syncStatusGlue, this, NULL);
-    } else {
-        syncStatusChanged();
-    }
-}
-
-void 
-ESTimeSyncObserver::callContinuousTimeReset() {
-    if (_notificationThread && !_notificationThread->inThisThread()) {
-        _notificationThread->callInThread(contTimeGlue, this, NULL);
-    } else {
-        continuousTimeReset();
-    }
-}
-
-struct ESWorkingSyncMsg {
-                            ESWorkingSyncMsg(ESTimeInterval val,
-                                             ESTimeInterval acc)
-    :   workingSyncValue(val),
-        workingSyncAccuracy(acc)
-    {}
-    ESTimeInterval  workingSyncValue;
-    ESTimeInterval  workingSyncAccuracy;
-};
-
-static void
-workingSyncValueChangedGlue(void *obj,
-                            void *param) {
-    ESTimeSyncObserver *observer = (ESTimeSyncObserver *)obj;
-    ESWorkingSyncMsg *msg = (ESWorkingSyncMsg *)param;
-    observer->workingSyncValueChanged(msg->workingSyncValue,
-                                      msg->workingSyncAccuracy);
-    delete msg;
-}
-
-void
-ESTimeSyncObserver::callWorkingSyncValueChanged(ESTimeInterval workingSyncValue,
-                                                ESTimeInterval workingSyncAccuracy) {
-    if (_notificationThread && !_notificationThread->inThisThread()) {
-        ESWorkingSyncMsg *msg = new ESWorkingSyncMsg(workingSyncValue, workingSyncAccuracy);
-        _notificationThread->callInThread(workingSyncValueChangedGlue, this, msg);
-    } else {
-        workingSyncValueChanged(workingSyncValue, workingSyncAccuracy);
-    }
+ESThread *
+ESTimeSyncObserver::notificationThread() {
+    return _notificationThread;
 }
 
@@ -60,6 +60,21 @@ typedef enum ESTimeBaseKind {
 /*! A pointer to a function (or static method) that creates an ESTimeSourceDriver* */
 typedef ESTimeSourceDriver *(*ESTimeSourceDriverMaker)(void);
 
+/*! A self-consistent copy of everything ESTime needs to answer currentTime() and friends.  The driver thread,
+ *  the timer thread and the sleep/wake handlers publish a new copy through a sequence lock (see ESTime::publishSnapshot());
+ *  readers, which may be render threads running at frame rate, take no lock and never see the skew from one sync
+ *  combined with the leap-second data or continuous offset from another. */
+struct ESTimeSnapshot {
+    ESTimeInterval          contSkew;             // delta of NTP - CTime
+    ESTimeInterval          currentTimeError;     // confidence in contSkew
+    ESTimeSourceStatus      status;
+    ESTimeInterval          nextLeapSecondDate;
+    ESTimeInterval          nextLeapSecondDelta;
+    ESTimeInterval          continuousOffset;     // delta of CTime - SysTime
+    bool                    usingAltTime;         // which system clock CTime is currently based on
+    ESTimeInterval          continuousBaseOffset; // delta of CTime - that clock
+};
+
 /*! Abstract class for observers of the time synchronization */
 class ESTimeSyncObserver {
   public:
@@ -78,13 +93,6 @@ class ESTimeSyncObserver {
   protected:
     ESThread                *_notificationThread;
 
-  private:
-    void                    callSyncValueChanged();
-    void                    callSyncStatusChanged();
-    void                    callContinuousTimeReset();
-    void                    callWorkingSyncValueChanged(ESTimeInterval workingSyncValue,
-                                                        ESTimeInterval workingSyncAccuracy);
-
 friend class ESTime;
 };
 
@@ -94,6 +102,7 @@ class ESTime {
     static ESTimeInterval   currentTimeWithLiveLeapSecondCorrection(ESTimeInterval *liveCorrection);  // like currentTime but also returns correction for seconds digit
     static ESTimeInterval   currentContinuousTime(); // For clients who just want a consistent time base from app startup (e.g., for timing intervals)
     static ESTimeSourceStatus currentStatus();
+    static void             currentSnapshot(ESTimeSnapshot *snapshot);  // Lock-free; use this when combining several of the values below
     static std::string      currentStatusEngrString(); // Just the name of the enum
     static std::string      currentTimeSourceName();  // "NTP", "XGPS150", "Fake", "Device", etc
     static bool             syncActive();  // Are we looking for a sync
@@ -101,6 +110,8 @@ class ESTime {
     static ESTimeInterval   continuousOffset();      // delta of CTime - SysTime
     static ESTimeInterval   continuousSkewForReportingPurposesOnly();  // delta of NTP - CTime  // Reporting purposes only because it doesn't account for live leap
     static ESTimeInterval   skewAccuracy();     // What is our confidence in skew()
+    static bool             startSharedMemoryPublisher(const char *name = "/estime");  // Publish each snapshot to a shared-memory page for other processes (see ESTimeShared.hpp); call from a thread with a run loop, which gets the page's heartbeat
+    static void             stopSharedMemoryPublisher();  // From the thread that started it
     static ESTimeInterval   ntpTimeForCTime(ESTimeInterval  cTime);
     static ESTimeInterval   ntpTimeForCTimeWithLiveCorrection(ESTimeInterval  cTime,
                                                               ESTimeInterval  *liveCorrection);
@@ -108,6 +119,23 @@ class ESTime {
     static ESTimeInterval   sysTimeForCTime(ESTimeInterval cTime);
     static ESTimeInterval   cTimeForSysTime(ESTimeInterval sysTime);
     static ESTimeInterval   sysTimeForNTPTime(ESTimeInterval ntpTime);
+
+    // Bulk versions of the above, for converting arrays of recorded timestamps:  each takes one snapshot for the
+    // whole span and gives results bit-identical to calling the single versions (with that snapshot) on each element.
+    // The output array may be the input array.
+    static void             ntpTimesForCTimes(const ESTimeInterval *cTimes,
+                                              ESTimeInterval       *ntpTimes,
+                                              size_t               count);
+    static void             ntpTimesForCTimesWithLiveCorrection(const ESTimeInterval *cTimes,
+                                                                ESTimeInterval       *ntpTimes,
+                                                                ESTimeInterval       *liveCorrections,
+                                                                size_t               count);
+    static void             cTimesForNTPTimes(const ESTimeInterval *ntpTimes,
+                                              ESTimeInterval       *cTimes,
+                                              size_t               count);
+    static void             sysTimesForCTimes(const ESTimeInterval *cTimes,
+                                              ESTimeInterval       *sysTimes,
+                                              size_t               count);
     static float            currentTimeError();
     static void             noteTimeAtPhase(const char  *phaseName);
     static void             noteTimeAtPhase(const std::string phaseName) { noteTimeAtPhase(phaseName.c_str()); }
@@ -142,9 +170,13 @@ class ESTime {
     static void             reportAllSkewsAndOffset(const char  *description);
 #endif
 
-// Public registration method to be informed when the sync changes
-    static void             registerTimeSyncObserver(ESTimeSyncObserver *observer);
-    static void             unregisterTimeSyncObserver(ESTimeSyncObserver *observer);
+// Public registration method to be informed when the sync changes.  May be called from any thread.
+// Notifications to an observer with a notificationThread other than the caller's are coalesced:  however many
+// events arrive before that thread gets to them, each observer there is called at most once per kind of event,
+// and workingSyncValueChanged() gets only the latest value.
+    static void             registerTimeSyncObserver(ESTimeSyncObserver *observer,
+                                                     ESTimeInterval     workingSyncMinInterval = 0);  // Hold working values arriving sooner than this after the last one sent, then send the latest
+    static void             unregisterTimeSyncObserver(ESTimeSyncObserver *observer);  // Once this returns the observer won't be called again
 
 // Methods to be called by app delegate
     static void             startOfMain(const char *fourByteAppSig);
@@ -181,16 +213,36 @@ class ESTime {
 
     static void             syncValueReallyChanged();
     static void             syncStatusReallyChanged();
+    static void             postTimeSyncEvent(unsigned int   event,
+                                              ESTimeInterval workingSyncValue = 0,
+                                              ESTimeInterval workingSyncAccuracy = 0);
 
     static void             setupNextLeapSecondData();
-    static ESTimeInterval   adjustForLeapSecondGuts(ESTimeInterval rawUTC);
-    static ESTimeInterval   adjustForLeapSecondGutsWithLiveCorrection(ESTimeInterval rawUTC,
-                                                                      ESTimeInterval *liveCorrection);
+    static ESTimeInterval   continuousTimeUsingSnapshot(const ESTimeSnapshot *snapshot);
+    static ESTimeInterval   adjustForLeapSecondUsingSnapshot(ESTimeInterval       rawUTC,
+                                                             const ESTimeSnapshot *snapshot);
+    static ESTimeInterval   adjustForLeapSecondWithLiveCorrectionUsingSnapshot(ESTimeInterval       rawUTC,
+                                                                               ESTimeInterval       *liveCorrection,
+                                                                               const ESTimeSnapshot *snapshot);
+    static ESTimeInterval   adjustForLeapSecondGuts(ESTimeInterval       rawUTC,
+                                                    const ESTimeSnapshot *snapshot);
+    static ESTimeInterval   adjustForLeapSecondGutsWithLiveCorrection(ESTimeInterval       rawUTC,
+                                                                      ESTimeInterval       *liveCorrection,
+                                                                      const ESTimeSnapshot *snapshot);
+
+    static void             publishSnapshot();  // Called by writers whenever the best driver, its skew or status, the leap data, or the continuous offset changes
+    static void             storeSnapshot(const ESTimeSnapshot *snapshot);  // The seqlock write; caller holds snapshotLock
+    static void             publishSharedMemorySnapshot(const ESTimeSnapshot *snapshot);  // In ESTimeSharedPublisher.cpp
 
     static ESTimeSourceDriver *_bestDriver;
     static std::list<ESTimeSourceDriver *> *_drivers;
 
+    static ESTimeSnapshot   _snapshot;
+    static unsigned int     _snapshotSequence;  // Odd while a publish is in progress
+
 friend class ESSystemTimeBase;
+friend class ESLeapSecond;
+friend class ESTimeSnapshotTest;
 };
 
 #define ESTIME_EPOCH (978307200.0)  // Conversion between ESTimeInterval and Unix time.  It's the Unix time at the ESTimeInterval epoch (1/1/2001 UTC)
@@ -11,103 +11,166 @@
 #include "ESTimeSourceDriver.hpp"
 #include "ESSystemTimeBase.hpp"
 
+// Sequence-lock reader:  Retry if a publish was in progress when we started or completed while we were copying.
+// The GCC/clang __atomic builtins are used so this header doesn't require C++11.
+/*static*/ inline void
+ESTime::currentSnapshot(ESTimeSnapshot *snapshot) {
+    unsigned int sequence;
+    do {
+        sequence = __atomic_load_n(&_snapshotSequence, __ATOMIC_ACQUIRE);
+        *snapshot = _snapshot;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((sequence & 1) || sequence != __atomic_load_n(&_snapshotSequence, __ATOMIC_RELAXED));
+}
+
 inline /*static*/ ESTimeInterval 
-ESTime::adjustForLeapSecond(ESTimeInterval rawUTC) {
-    if (rawUTC >= _nextLeapSecondDate) {
-        rawUTC = adjustForLeapSecondGuts(rawUTC);
+ESTime::adjustForLeapSecondUsingSnapshot(ESTimeInterval       rawUTC,
+                                         const ESTimeSnapshot *snapshot) {
+    if (rawUTC >= snapshot->nextLeapSecondDate) {
+        rawUTC = adjustForLeapSecondGuts(rawUTC, snapshot);
     }
     return rawUTC;
 }
 
 inline /*static*/ ESTimeInterval 
-ESTime::adjustForLeapSecondWithLiveCorrection(ESTimeInterval rawUTC,
-                                              ESTimeInterval *liveCorrection) {
-    if (rawUTC >= _nextLeapSecondDate - 1.0) {
-        return adjustForLeapSecondGutsWithLiveCorrection(rawUTC, liveCorrection);
+ESTime::adjustForLeapSecondWithLiveCorrectionUsingSnapshot(ESTimeInterval       rawUTC,
+                                                           ESTimeInterval       *liveCorrection,
+                                                           const ESTimeSnapshot *snapshot) {
+    if (rawUTC >= snapshot->nextLeapSecondDate - 1.0) {
+        return adjustForLeapSecondGutsWithLiveCorrection(rawUTC, liveCorrection, snapshot);
     } else {
         *liveCorrection = 0;
         return rawUTC;
     }
 }
 
+inline /*static*/ ESTimeInterval 
+ESTime::adjustForLeapSecond(ESTimeInterval rawUTC) {
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    return adjustForLeapSecondUsingSnapshot(rawUTC, &snapshot);
+}
+
+inline /*static*/ ESTimeInterval 
+ESTime::adjustForLeapSecondWithLiveCorrection(ESTimeInterval rawUTC,
+                                              ESTimeInterval *liveCorrection) {
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    return adjustForLeapSecondWithLiveCorrectionUsingSnapshot(rawUTC, liveCorrection, &snapshot);
+}
+
+/*static*/ inline ESTimeInterval
+ESTime::continuousTimeUsingSnapshot(const ESTimeSnapshot *snapshot) {
+    return ESSystemTimeBase::currentBaseTime(snapshot->usingAltTime) + snapshot->continuousBaseOffset;
+}
+
 /*static*/ inline ESTimeInterval
 ESTime::currentTime() {
-    return adjustForLeapSecond(_bestDriver->contSkew() + ESSystemTimeBase::currentContinuousSystemTime());
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    return adjustForLeapSecondUsingSnapshot(snapshot.contSkew + continuousTimeUsingSnapshot(&snapshot), &snapshot);
 }
 
 /*static*/ inline ESTimeInterval
 ESTime::currentTimeWithLiveLeapSecondCorrection(ESTimeInterval *liveCorrection) {
-    return adjustForLeapSecondWithLiveCorrection(_bestDriver->contSkew() + ESSystemTimeBase::currentContinuousSystemTime(), liveCorrection);
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    return adjustForLeapSecondWithLiveCorrectionUsingSnapshot(snapshot.contSkew + continuousTimeUsingSnapshot(&snapshot), liveCorrection, &snapshot);
 }
 
 /*static*/ inline ESTimeInterval
 ESTime::currentContinuousTime() {
-    return ESSystemTimeBase::currentContinuousSystemTime();
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    return continuousTimeUsingSnapshot(&snapshot);
 }
 
 /*static*/ inline ESTimeInterval
 ESTime::skewForReportingPurposesOnly() {  // delta of NTP - SysTime = (contSkew + contSysTime()) - sysTime() = contSkew -+ contOffset
-    return _bestDriver->contSkew() + ESSystemTimeBase::continuousOffset();
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    return snapshot.contSkew + snapshot.continuousOffset;
 }
 
 inline /*static*/ ESTimeSourceStatus 
 ESTime::currentStatus() {
-    return _bestDriver->currentStatus();
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    return snapshot.status;
 }
 
 inline /*static*/ ESTimeInterval 
 ESTime::skewAccuracy() {     // What is our confidence in skew()
-    return _bestDriver->currentTimeError();
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    return snapshot.currentTimeError;
 }
 
 /*static*/ inline ESTimeInterval
 ESTime::continuousOffset() {
-    return ESSystemTimeBase::continuousOffset();
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    return snapshot.continuousOffset;
 }
 
 
 /*static*/ inline ESTimeInterval
 ESTime::continuousSkewForReportingPurposesOnly() {
-    return _bestDriver->contSkew();
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    return snapshot.contSkew;
 }
 
 /*static*/ inline ESTimeInterval
 ESTime::ntpTimeForCTime(ESTimeInterval  cTime) {
-    return adjustForLeapSecond(cTime + _bestDriver->contSkew());
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    return adjustForLeapSecondUsingSnapshot(cTime + snapshot.contSkew, &snapshot);
 }
 
 /*static*/ inline ESTimeInterval
 ESTime::ntpTimeForCTimeWithLiveCorrection(ESTimeInterval  cTime,
                                           ESTimeInterval  *liveCorrection) {
-    return adjustForLeapSecondWithLiveCorrection(cTime + _bestDriver->contSkew(), liveCorrection);
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    return adjustForLeapSecondWithLiveCorrectionUsingSnapshot(cTime + snapshot.contSkew, liveCorrection, &snapshot);
 }
 
 /*static*/ inline ESTimeInterval
 ESTime::cTimeForNTPTime(ESTimeInterval  ntpTime) {
-    if (ntpTime > _nextLeapSecondDate) {
-        return (ntpTime + _nextLeapSecondDelta) - _bestDriver->contSkew();
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    if (ntpTime > snapshot.nextLeapSecondDate) {
+        return (ntpTime + snapshot.nextLeapSecondDelta) - snapshot.contSkew;
     }
-    return ntpTime - _bestDriver->contSkew();
+    return ntpTime - snapshot.contSkew;
 }
 
 /*static*/ inline float
 ESTime::currentTimeError() {
-    return _bestDriver->currentTimeError();
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    return snapshot.currentTimeError;
 }
 
 /*static*/ inline ESTimeInterval
 ESTime::sysTimeForCTime(ESTimeInterval cTime) {
-    return cTime - ESSystemTimeBase::continuousOffset();
+    return cTime - continuousOffset();
 }
 
 /*static*/ inline ESTimeInterval
 ESTime::cTimeForSysTime(ESTimeInterval tim) {
-    return tim + ESSystemTimeBase::continuousOffset();
+    return tim + continuousOffset();
 }
 
 inline /*static*/ ESTimeInterval 
 ESTime::sysTimeForNTPTime(ESTimeInterval ntpTime) {
-    return ESTime::cTimeForNTPTime(ntpTime) - ESSystemTimeBase::continuousOffset();
+    ESTimeSnapshot snapshot;
+    currentSnapshot(&snapshot);
+    if (ntpTime > snapshot.nextLeapSecondDate) {
+        ntpTime += snapshot.nextLeapSecondDelta;
+    }
+    return ntpTime - snapshot.contSkew - snapshot.continuousOffset;
 }
 
 #else  // _ESTIMEINL_HPP_
@@ -0,0 +1,157 @@
+//
+//  ESTimeShared.hpp
+//
+//  Copyright Emerald Sequoia LLC 2011. All rights reserved.
+//
+
+#ifndef _ESTIMESHARED_HPP_
+#define _ESTIMESHARED_HPP_
+
+// The layout of the shared-memory page written by ESTime::startSharedMemoryPublisher(), and a header-only reader for
+// it, so that other processes on the host can tell the corrected time without linking estime or running their own
+// NTP driver.  In the spirit of ntpd's SHM refclock driver (ntpdist/ntpd/refclock_shm.c), but carrying everything
+// ESTime::currentTime() needs, including the next leap second.
+//
+// This header deliberately depends on nothing else in estime.  Link with -lrt for shm_open on older glibc.
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define ES_TIME_SHARED_MAGIC         0x45535453  /* "ESTS" */
+#define ES_TIME_SHARED_VERSION       2           /* Bump when the meaning of a field changes; new fields go at the end (2: base clock instead of CLOCK_REALTIME) */
+#define ES_TIME_SHARED_DEFAULT_NAME  "/estime"   /* shm_open() name */
+#define ES_TIME_SHARED_EPOCH         978307200.0 /* Unix time of the ESTime epoch (2001), as ESTIME_EPOCH */
+#define ES_TIME_SHARED_HOLD_SHORT    0.000001    /* As ESLeapSecondHoldShortInterval */
+#define ES_TIME_SHARED_HEARTBEAT     60.0        /* The publisher rewrites publishTime at least this often */
+#define ES_TIME_SHARED_STALE_AGE     180.0       /* Readers ignore a page whose publishTime is older than this:  the publisher has gone away */
+
+// Times are ESTimeIntervals (seconds since the ESTime epoch); skews are seconds.  A reader reproduces
+// ESTime::currentTime() as clock_gettime(baseClock) + continuousBaseOffset + contSkew, then the leap-second adjustment.
+struct ESTimeSharedValues {
+    double                  contSkew;             // As ESTime's snapshot:  NTP - CTime
+    double                  continuousBaseOffset; // As ESTime's snapshot:  CTime - baseClock
+    double                  continuousOffset;     // CTime - SysTime, for reporting
+    double                  currentTimeError;
+    double                  nextLeapSecondDate;
+    double                  nextLeapSecondDelta;
+    double                  publishTime;          // baseClock when this was written, so a reader can tell if the publisher has gone away
+    int32_t                 baseClock;            // The clockid_t ESSystemTimeBase reads for the base CTime is currently on
+    int32_t                 usingAltTime;         // As ESTime's snapshot:  whether that's the alt time base rather than the system time
+    int32_t                 status;               // ESTimeSourceStatus
+    int32_t                 publisherPID;
+};
+
+struct ESTimeSharedPage {
+    uint32_t                magic;
+    uint32_t                version;
+    uint32_t                size;                 // sizeof(ESTimeSharedPage) as the publisher was built
+    uint32_t                sequence;             // Odd while the publisher is writing; zero if it has never published
+    ESTimeSharedValues      values;
+};
+
+/*! Maps the page read-only and reads it with the publisher's sequence lock.  Reading takes no lock and makes no system
+ *  call; currentTime() makes one clock_gettime(), on the publisher's base clock, like ESTime::currentTime() itself. */
+class ESTimeSharedReader {
+  public:
+                            ESTimeSharedReader() : _page(NULL) {}
+                            ~ESTimeSharedReader() { close(); }
+
+    bool                    open(const char *name = ES_TIME_SHARED_DEFAULT_NAME) {
+        close();
+#ifdef __ANDROID__
+        return false;  // No shm_open() in bionic
+#else
+        int fd = shm_open(name, O_RDONLY, 0);
+        if (fd < 0) {
+            return false;
+        }
+        void *addr = mmap(NULL, sizeof(ESTimeSharedPage), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+        _page = (const ESTimeSharedPage *)addr;
+        if (_page->magic != ES_TIME_SHARED_MAGIC || _page->version != ES_TIME_SHARED_VERSION || _page->size < sizeof(ESTimeSharedPage)) {
+            close();
+            return false;
+        }
+        return true;
+#endif
+    }
+
+    void                    close() {
+        if (_page) {
+            munmap((void *)_page, sizeof(ESTimeSharedPage));
+            _page = NULL;
+        }
+    }
+
+    // Returns false if the page isn't open or nothing has been published yet
+    bool                    read(ESTimeSharedValues *values) const {
+        if (!_page) {
+            return false;
+        }
+        uint32_t sequence;
+        do {
+            sequence = __atomic_load_n(&_page->sequence, __ATOMIC_ACQUIRE);
+            memcpy(values, (const void *)&_page->values, sizeof(*values));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while ((sequence & 1) || sequence != __atomic_load_n(&_page->sequence, __ATOMIC_RELAXED));
+        return sequence != 0;
+    }
+
+    // As ESSystemTimeBase:  the given clock, in seconds since the ESTime epoch
+    static double           clockNow(clockid_t clock) {
+        struct timespec ts;
+        clock_gettime(clock, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1E9 - ES_TIME_SHARED_EPOCH;
+    }
+
+    static bool             isStale(const ESTimeSharedValues &values,
+                                    double                   baseNow) {  // clockNow(values.baseClock)
+        return baseNow - values.publishTime > ES_TIME_SHARED_STALE_AGE;
+    }
+
+    // As ESTime::adjustForLeapSecond()
+    static double           adjustForLeapSecond(double                    rawUTC,
+                                                const ESTimeSharedValues  &values) {
+        if (rawUTC < values.nextLeapSecondDate) {
+            return rawUTC;
+        }
+        if (values.nextLeapSecondDelta > 0) {
+            if (rawUTC > values.nextLeapSecondDate + values.nextLeapSecondDelta) {
+                return rawUTC - values.nextLeapSecondDelta;
+            }
+            return values.nextLeapSecondDate - ES_TIME_SHARED_HOLD_SHORT;  // Hold in place during the transition
+        }
+        return rawUTC - values.nextLeapSecondDelta;
+    }
+
+    // The corrected time (ESTime epoch), or, if nothing has been published or the publisher has stopped updating the
+    // page, the system time with an error of 1e9
+    double                  currentTime(double *error = NULL) const {
+        ESTimeSharedValues values;
+        if (read(&values)) {
+            double baseNow = clockNow(values.baseClock);
+            if (!isStale(values, baseNow)) {
+                if (error) {
+                    *error = values.currentTimeError;
+                }
+                return adjustForLeapSecond(baseNow + values.continuousBaseOffset + values.contSkew, values);
+            }
+        }
+        if (error) {
+            *error = 1e9;
+        }
+        return clockNow(CLOCK_REALTIME);
+    }
+
+  private:
+    const ESTimeSharedPage  *_page;
+};
+
+#endif  // _ESTIMESHARED_HPP_
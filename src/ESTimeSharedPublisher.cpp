@@ -0,0 +1,262 @@
+//
+//  ESTimeSharedPublisher.cpp
+//
+//  Copyright Emerald Sequoia LLC 2011. All rights reserved.
+//
+
+#include "ESTime.hpp"
+#include "ESTimeShared.hpp"
+#include "ESSystemTimeBase.hpp"
+#include "ESTimer.hpp"
+#include "ESLock.hpp"
+#include "ESErrorReporter.hpp"
+
+#include <errno.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+// Define this to run, when the publisher starts, a writer thread publishing synthetic values as fast as it can against
+// reader threads (through ESTimeSharedReader) checking that they never see a torn page, and then to time the reader.
+// The test uses its own page, removed afterwards, so readers of the real page never see its values.
+#undef ES_TIME_SHARED_MEMORY_TEST
+#ifdef ES_TIME_SHARED_MEMORY_TEST
+#include <pthread.h>
+#endif
+
+// The clocks ESSystemTimeBase::currentBaseTime() reads, so a reader can read the same one
+#if ES_TRIPLEBASE
+#define ES_TIME_SHARED_ALT_CLOCK     CLOCK_BOOTTIME   /* As ESSystemTimeBase::currentSystemAltTime() */
+#else
+#define ES_TIME_SHARED_ALT_CLOCK     CLOCK_REALTIME   /* The alt time is the system time, or NSDate, which is the same clock */
+#endif
+#define ES_TIME_SHARED_SYSTEM_CLOCK  CLOCK_REALTIME   /* As ESSystemTimeBase::currentSystemTime() */
+
+#define ES_TIME_SHARED_HEARTBEAT_LEEWAY 10.0          /* Readers allow ES_TIME_SHARED_STALE_AGE, so the heartbeat needn't be punctual */
+
+static ESTimeSharedPage *sharedPage = NULL;  // Protected by sharedPageLock
+static ESLock sharedPageLock;
+static ESTimer *heartbeatTimer = NULL;       // Only touched in the thread that started the publisher
+
+static void
+writeSharedPage(ESTimeSharedPage         *page,
+                const ESTimeSharedValues &values) {
+    uint32_t sequence = page->sequence;
+    __atomic_store_n(&page->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    page->values = values;
+    __atomic_store_n(&page->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+// Snapshots can be hours apart once the discipline has settled, so between them rewrite the last values with a fresh
+// publishTime, letting readers tell a quiet publisher from one that has gone away
+class ESTimeSharedHeartbeatObserver : public ESTimerObserver {
+  public:
+    void                    notify(ESTimer *) {
+        sharedPageLock.lock();
+        if (sharedPage) {
+            ESTimeSharedValues values = sharedPage->values;  // Only this process writes the page, under the lock
+            values.publishTime = ESTimeSharedReader::clockNow(values.baseClock);
+            writeSharedPage(sharedPage, values);
+        }
+        sharedPageLock.unlock();
+    }
+};
+
+static ESTimeSharedHeartbeatObserver heartbeatObserver;
+
+static ESTimeSharedPage *
+mapSharedPage(const char *name) {
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        ESErrorReporter::checkAndLogSystemError("ESTime", errno, "shm_open for the shared time page");
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(ESTimeSharedPage)) != 0) {
+        ESErrorReporter::checkAndLogSystemError("ESTime", errno, "ftruncate for the shared time page");
+        close(fd);
+        return NULL;
+    }
+    void *addr = mmap(NULL, sizeof(ESTimeSharedPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        ESErrorReporter::checkAndLogSystemError("ESTime", errno, "mmap for the shared time page");
+        return NULL;
+    }
+    ESTimeSharedPage *page = (ESTimeSharedPage *)addr;
+    // Readers check the header only when they open the page, so a publisher restarting on an existing page (with
+    // readers attached) keeps its sequence going rather than starting over
+    if (page->magic != ES_TIME_SHARED_MAGIC || page->version != ES_TIME_SHARED_VERSION) {
+        page->sequence = 0;
+    }
+    page->magic = ES_TIME_SHARED_MAGIC;
+    page->version = ES_TIME_SHARED_VERSION;
+    page->size = sizeof(ESTimeSharedPage);
+    return page;
+}
+
+#ifdef ES_TIME_SHARED_MEMORY_TEST
+static volatile bool sharedTestDone;
+
+static void *
+sharedTestWriter(void *arg) {
+    ESTimeSharedPage *page = (ESTimeSharedPage *)arg;
+    ESTimeSharedValues values;
+    memset(&values, 0, sizeof(values));
+    for (double k = 1; !sharedTestDone; k++) {  // Every field derived from k, so a reader can check they match
+        values.continuousBaseOffset = k;
+        values.contSkew = k;
+        values.continuousOffset = -k;
+        values.currentTimeError = 2 * k;
+        values.nextLeapSecondDate = 1e9 + k;
+        values.nextLeapSecondDelta = 1;
+        values.publishTime = k;
+        values.status = (int32_t)k;
+        writeSharedPage(page, values);
+    }
+    return NULL;
+}
+
+static void *
+sharedTestReader(void *arg) {
+    ESTimeSharedReader reader;
+    bool opened = reader.open((const char *)arg);
+    ESAssert(opened);
+    long numReads = 0;
+    long numTorn = 0;
+    while (!sharedTestDone) {
+        ESTimeSharedValues values;
+        if (reader.read(&values)) {
+            double k = values.contSkew;
+            if (values.continuousBaseOffset != k || values.continuousOffset != -k || values.currentTimeError != 2 * k ||
+                values.nextLeapSecondDate != 1e9 + k || values.publishTime != k || values.status != (int32_t)k) {
+                numTorn++;
+            }
+            numReads++;
+        }
+    }
+    printf("SHARED TIME TEST: reader %ld reads, %ld torn\n", numReads, numTorn);
+    ESAssert(numTorn == 0);
+    return NULL;
+}
+
+// Runs against a private page named after the real one
+static void
+runSharedMemoryTest(const char *realName) {
+    char name[256];
+    snprintf(name, sizeof(name), "%s-test-%d", realName, (int)getpid());
+    ESTimeSharedPage *page = mapSharedPage(name);
+    ESAssert(page);
+    if (!page) {
+        return;
+    }
+    const int numReaders = 3;
+    pthread_t writer;
+    pthread_t readers[numReaders];
+    sharedTestDone = false;
+    pthread_create(&writer, NULL, sharedTestWriter, page);
+    for (int i = 0; i < numReaders; i++) {
+        pthread_create(&readers[i], NULL, sharedTestReader, (void *)name);
+    }
+    sleep(1);
+    sharedTestDone = true;
+    pthread_join(writer, NULL);
+    for (int i = 0; i < numReaders; i++) {
+        pthread_join(readers[i], NULL);
+    }
+
+    // Reader cost, uncontended, against ESTime::currentTime() in this process, with values the reader will use
+    ESTimeSharedValues values;
+    memset(&values, 0, sizeof(values));
+    values.baseClock = ES_TIME_SHARED_SYSTEM_CLOCK;
+    values.publishTime = ESTimeSharedReader::clockNow(values.baseClock);
+    values.contSkew = ESTime::currentTime() - values.publishTime;
+    values.nextLeapSecondDate = ESFarFarInTheFuture;
+    writeSharedPage(page, values);
+    ESTimeSharedReader reader;
+    reader.open(name);
+    const int numCalls = 10000000;
+    double sum = 0;
+    ESTimeInterval t0 = ESTime::currentContinuousTime();
+    for (int i = 0; i < numCalls; i++) {
+        sum += reader.currentTime();
+    }
+    ESTimeInterval t1 = ESTime::currentContinuousTime();
+    for (int i = 0; i < numCalls; i++) {
+        sum += ESTime::currentTime();
+    }
+    ESTimeInterval t2 = ESTime::currentContinuousTime();
+    printf("SHARED TIME TEST: ESTimeSharedReader::currentTime %.1f ns, ESTime::currentTime %.1f ns (%g)\n",
+           (t1 - t0) * 1e9 / numCalls, (t2 - t1) * 1e9 / numCalls, sum);
+    reader.close();
+    munmap(page, sizeof(ESTimeSharedPage));
+    shm_unlink(name);
+}
+#endif  // ES_TIME_SHARED_MEMORY_TEST
+
+/*static*/ bool
+ESTime::startSharedMemoryPublisher(const char *name) {
+#if ES_ANDROID
+    ESErrorReporter::logError("ESTime", "shared-memory publishing isn't supported on Android");
+    return false;
+#else
+    sharedPageLock.lock();
+    bool alreadyStarted = sharedPage != NULL;
+    sharedPageLock.unlock();
+    if (alreadyStarted) {
+        return true;
+    }
+#ifdef ES_TIME_SHARED_MEMORY_TEST
+    runSharedMemoryTest(name);
+#endif
+    ESTimeSharedPage *page = mapSharedPage(name);
+    if (!page) {
+        return false;
+    }
+    sharedPageLock.lock();
+    sharedPage = page;
+    sharedPageLock.unlock();
+    publishSnapshot();  // Which calls publishSharedMemorySnapshot() to fill in the page
+    ESIntervalTimer *timer = new ESIntervalTimer(&heartbeatObserver, ES_TIME_SHARED_HEARTBEAT, -1, ES_TIME_SHARED_HEARTBEAT);
+    timer->setLeeway(ES_TIME_SHARED_HEARTBEAT_LEEWAY);
+    timer->activate();  // The heartbeat arrives in this thread
+    heartbeatTimer = timer;
+    return true;
+#endif
+}
+
+/*static*/ void
+ESTime::stopSharedMemoryPublisher() {
+    if (heartbeatTimer) {
+        heartbeatTimer->release();
+        heartbeatTimer = NULL;
+    }
+    sharedPageLock.lock();
+    ESTimeSharedPage *page = sharedPage;
+    sharedPage = NULL;
+    sharedPageLock.unlock();
+    if (page) {
+        munmap(page, sizeof(ESTimeSharedPage));  // The page stays, and readers ignore it once its publishTime is stale
+    }
+}
+
+// Called from publishSnapshot() with each new snapshot
+/*static*/ void
+ESTime::publishSharedMemorySnapshot(const ESTimeSnapshot *snapshot) {
+    sharedPageLock.lock();
+    if (sharedPage) {
+        ESTimeSharedValues values;
+        values.contSkew = snapshot->contSkew;
+        values.continuousBaseOffset = snapshot->continuousBaseOffset;
+        values.continuousOffset = snapshot->continuousOffset;
+        values.currentTimeError = snapshot->currentTimeError;
+        values.nextLeapSecondDate = snapshot->nextLeapSecondDate;
+        values.nextLeapSecondDelta = snapshot->nextLeapSecondDelta;
+        values.baseClock = snapshot->usingAltTime ? ES_TIME_SHARED_ALT_CLOCK : ES_TIME_SHARED_SYSTEM_CLOCK;
+        values.usingAltTime = snapshot->usingAltTime;
+        values.publishTime = ESTimeSharedReader::clockNow(values.baseClock);
+        values.status = snapshot->status;
+        values.publisherPID = getpid();
+        writeSharedPage(sharedPage, values);
+    }
+    sharedPageLock.unlock();
+}
@@ -9,6 +9,7 @@
 #include "ESUtil.hpp"
 #include "ESUserPrefs.hpp"
 #include "ESErrorReporter.hpp"
+#include "ESEventLog.hpp"
 
 static void
 initDefaultPrefs() {
@@ -58,6 +59,7 @@ ESTimeSourceDriver::setContSkew(ESTimeInterval newContSkew,
         currentTimeError != _currentTimeError) {
         _contSkew = newContSkew;
         _currentTimeError = currentTimeError;
+        ESEventLog::record(ESEventSetContSkew, 0, newContSkew, (float)currentTimeError);
         ESUserPrefs::setPref("timeSkew", _contSkew + ESSystemTimeBase::continuousOffset());
         ESUserPrefs::setPref("timeSkewAccuracy", _currentTimeError);
         ESUserPrefs::setPref("contSkew", _contSkew);
@@ -71,6 +73,7 @@ void
 ESTimeSourceDriver::setStatus(ESTimeSourceStatus status) {
     if (status != _status) {
         _status = status;
+        ESEventLog::record(ESEventStatusChange, status);
         ESTime::syncStatusChangedByDriver(this);
     }
 }
@@ -10,20 +10,130 @@
 #include "ESErrorReporter.hpp"
 #undef ESTRACE
 #include "ESTrace.hpp"
+#include "ESEventLog.hpp"
+#include "ESMetrics.hpp"
 
 #include "math.h"
 
-#include <set>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <pthread.h>
 
 // Does select() operate on the continuous time base (i.e., CACurrentMediaTime) as opposed to the "true" (NSDate-style) one?
 // #define ES_SELECT_USES_CONTINUOUS_TIME 0
 #define ES_SELECT_USES_CONTINUOUS_TIME 1
 
-// Timer delivery strategy:  Keep track of the next timer in a sorted list.
-// Have the timer thread select() to time out when the next timer comes in,
-// deliver the notification, and then select() to time out for the following
+// On Linux the timer thread sleeps on a timerfd armed with an absolute CLOCK_BOOTTIME deadline (in nanoseconds),
+// which select() watches alongside the ESThread message fds, rather than on a relative select() timeout
+#if defined(__linux__)
+#define ES_TIMER_USE_TIMERFD 1
+#else
+#define ES_TIMER_USE_TIMERFD 0
+#endif
+
+#if ES_TIMER_USE_TIMERFD
+#include <sys/timerfd.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+// Define this to print firing-latency percentiles (how long after its fire time each timer was found lapsed) every
+// ES_TIMER_LATENCY_BATCH firings.  Where there's a timerfd the timer thread alternates between it and select() timeouts
+// from batch to batch, so a single run compares the two backends under the same load.
+#undef ES_TIMER_MEASURE_LATENCY
+#define ES_TIMER_LATENCY_BATCH 1000
+
+// Define this to print, every ES_TIMER_MESSAGE_COUNT_BATCH expirations, how many inter-thread messages (each one a
+// pipe write in the sender and a wakeup in the receiver) the timer system sent to deliver and release them
+#undef ES_TIMER_COUNT_MESSAGES
+#define ES_TIMER_MESSAGE_COUNT_BATCH 1000
+
+// Define this to print, every minute, how many times the timer thread woke up (for any reason) and how many of
+// those wakeups delivered timers; compare with and without leeway/alignment on the timers in use
+#undef ES_TIMER_COUNT_WAKEUPS
+
+#undef ES_TIMER_CATCH_UP_TEST  // Define this to check the catch-up policies against a 1 Hz timer after a four-hour suspend, when the timer thread starts
+#ifdef ES_TIMER_CATCH_UP_TEST
+#include <unistd.h>
+#endif
+
+// All the notifications for one thread from one fireLapsedTimers() pass travel in a single message, in fire-time order
+struct ESTimerNotification {
+    ESTimer                 *timer;
+    ESTimerObserver         *observer;
+    int                     missedPeriods;
+};
+
+struct ESTimerNotificationBatch {
+    std::vector<ESTimerNotification> notifications;
+};
+
+// Release requests made while a batch of notifications is being delivered are held and sent together at the end
+struct ESTimerReleaseBatch {
+    std::vector<std::pair<ESTimer *, int> > requests;  // Timer, notifications received at time of request
+};
+
+static pthread_key_t releaseBatchKey;  // The thread's ESTimerReleaseBatch while it's delivering a notification batch, else NULL
+static pthread_once_t releaseBatchKeyOnce = PTHREAD_ONCE_INIT;
+
+static void makeReleaseBatchKey() {
+    pthread_key_create(&releaseBatchKey, NULL);
+}
+
+#ifdef ES_TIMER_COUNT_MESSAGES
+static int numExpirationsCounted = 0;  // Timer thread only
+static int numNotificationMessages = 0;  // Timer thread only
+static int numReleaseMessages = 0;  // Any thread; atomic
+
+static void
+countExpirations(int numExpirations,
+                 int numMessages) {
+    numExpirationsCounted += numExpirations;
+    numNotificationMessages += numMessages;
+    if (numExpirationsCounted >= ES_TIMER_MESSAGE_COUNT_BATCH) {
+        int releaseMessages = __sync_fetch_and_and(&numReleaseMessages, 0);
+        printf("TIMER MESSAGES: %d expirations, %d notification messages, %d release messages (%.1f messages per 1000 expirations)\n",
+               numExpirationsCounted, numNotificationMessages, releaseMessages,
+               (numNotificationMessages + releaseMessages) * 1000.0 / numExpirationsCounted);
+        numExpirationsCounted = 0;
+        numNotificationMessages = 0;
+    }
+}
+#endif
+
+#ifdef ES_TIMER_COUNT_WAKEUPS
+static int numWakeups = 0;  // Timer thread only
+static int numTimerWakeups = 0;  // Timer thread only:  wakeups which found at least one lapsed timer
+static ESTimeInterval wakeupCountStart = 0;
+
+static void
+countWakeup() {
+    numWakeups++;
+    ESTimeInterval now = ESTime::currentContinuousTime();
+    if (wakeupCountStart == 0) {
+        wakeupCountStart = now;
+    } else if (now - wakeupCountStart >= 60) {
+        double perMinute = 60 / (now - wakeupCountStart);
+        printf("TIMER WAKEUPS: %.1f per minute, %.1f of them firing timers\n",
+               numWakeups * perMinute, numTimerWakeups * perMinute);
+        numWakeups = 0;
+        numTimerWakeups = 0;
+        wakeupCountStart = now;
+    }
+}
+#endif
+
+// Timer delivery strategy:  Keep track of the next timer in a priority queue.
+// Have the timer thread select() to time out when the next timer comes in
+// (or, if it has leeway, as late as it and the timers due before then allow),
+// deliver the notification(s), and then select() to time out for the following
 // timer. Send a message to that thread via the normal ESThread call mechanism
-// which will also trigger a return from the same select();
+// which will also trigger a return from the same select();  (With
+// ES_TIMER_USE_TIMERFD, the select() has no timeout; instead a timerfd set for
+// the next timer is one of the fds it waits on.)
 
 // This thread handles delivery for all threads, and maintains the list of
 // timers in its own thread to avoid thread synchronization and race condition
@@ -41,6 +151,24 @@ class ESTimerThread : public ESChildThread {
 
     void                    recalculateAllFireTimes();
     void                    fireLapsedTimers();
+
+  private:
+#if ES_TIMER_USE_TIMERFD
+    bool                    setupTimerFD();
+    void                    armTimerFD();
+
+    int                     _timerFD;
+    clockid_t               _timerClock;
+    ESTimeInterval          _armedFireTime;  // The fire time the timerfd is set for, or -1 if it's not set
+#endif
+
+#undef ES_TIMER_CHURN_BENCHMARK  // Define this to time the timer heap with 100,000 timers when the timer thread starts
+#ifdef ES_TIMER_CHURN_BENCHMARK
+    void                    runChurnBenchmark();
+#endif
+#ifdef ES_TIMER_CATCH_UP_TEST
+    void                    runCatchUpTest();
+#endif
 };
 
 class ESTimerThreadTimeObserver : public ESTimeSyncObserver {
@@ -82,48 +210,321 @@ ESTimerThreadTimeObserver::continuousTimeReset() { // There was a (potential) ju
 
 static ESTimerThread *timerThread;
 
-// Comparison operator for sorting timers
-struct ESltTimer {
-    bool                    operator()(ESTimer *t1,
-                                       ESTimer *t2) const
-    {
-        return t1->fireTime() < t2->fireTime();
+// A 4-ary min-heap of timers ordered by fire time.  Each timer records its own slot (_heapIndex), so removing
+// an arbitrary timer needs no search, and the storage is a single vector, so once it has grown to the working
+// set, activating, repeating, and releasing timers don't allocate.  Four children per node make the heap half
+// as deep as a binary one, and siblings are adjacent in memory.  Timer thread only.
+class ESTimerHeap {
+  public:
+                            ESTimerHeap() : _nextSequence(0) {}
+
+    bool                    empty() const { return _timers.empty(); }
+    size_t                  size() const { return _timers.size(); }
+    ESTimer                 *top() const { return _timers[0]; }
+    ESTimer                 *timerAtIndex(size_t i) const { return _timers[i]; }
+
+    void                    insert(ESTimer *timer);
+    void                    remove(ESTimer *timer);
+    ESTimer                 *pop();
+    void                    rebuild();  // After (potentially) every timer's fire time has changed
+    ESTimeInterval          wakeTime();  // The latest time we can wake up without making any timer later than its leeway allows
+
+  private:
+    static bool             before(const ESTimer *t1,
+                                   const ESTimer *t2) {
+        return t1->_fireTime < t2->_fireTime || (t1->_fireTime == t2->_fireTime && t1->_heapSequence < t2->_heapSequence);
+    }
+    void                    place(ESTimer *timer,
+                                  size_t  i) {
+        _timers[i] = timer;
+        timer->_heapIndex = (int)i;
     }
+    void                    siftUp(size_t i);
+    void                    siftDown(size_t i);
+
+    std::vector<ESTimer *>  _timers;
+    unsigned long long      _nextSequence;
 };
 
-typedef std::multiset<class ESTimer *, struct ESltTimer> TimerPriorityQueue;
+void
+ESTimerHeap::siftUp(size_t i) {
+    ESTimer *timer = _timers[i];
+    while (i > 0) {
+        size_t parent = (i - 1) / 4;
+        if (!before(timer, _timers[parent])) {
+            break;
+        }
+        place(_timers[parent], i);
+        i = parent;
+    }
+    place(timer, i);
+}
 
-TimerPriorityQueue *timerPriorityQueue;
+void
+ESTimerHeap::siftDown(size_t i) {
+    ESTimer *timer = _timers[i];
+    size_t n = _timers.size();
+    while (true) {
+        size_t firstChild = 4 * i + 1;
+        if (firstChild >= n) {
+            break;
+        }
+        size_t lastChild = firstChild + 4 < n ? firstChild + 4 : n;
+        size_t best = firstChild;
+        for (size_t child = firstChild + 1; child < lastChild; child++) {
+            if (before(_timers[child], _timers[best])) {
+                best = child;
+            }
+        }
+        if (!before(_timers[best], timer)) {
+            break;
+        }
+        place(_timers[best], i);
+        i = best;
+    }
+    place(timer, i);
+}
+
+void
+ESTimerHeap::insert(ESTimer *timer) {
+    ESAssert(timer->_heapIndex < 0);
+    timer->_heapSequence = _nextSequence++;
+    _timers.push_back(timer);
+    siftUp(_timers.size() - 1);
+}
+
+void
+ESTimerHeap::remove(ESTimer *timer) {
+    int i = timer->_heapIndex;
+    ESAssert(i >= 0 && (size_t)i < _timers.size() && _timers[i] == timer);
+    timer->_heapIndex = -1;
+    ESTimer *last = _timers.back();
+    _timers.pop_back();
+    if (last != timer) {
+        place(last, i);
+        if (i > 0 && before(last, _timers[(i - 1) / 4])) {
+            siftUp(i);
+        } else {
+            siftDown(i);
+        }
+    }
+}
+
+ESTimer *
+ESTimerHeap::pop() {
+    ESTimer *timer = _timers[0];
+    remove(timer);
+    return timer;
+}
+
+void
+ESTimerHeap::rebuild() {
+    size_t n = _timers.size();
+    if (n < 2) {
+        return;
+    }
+    for (size_t i = (n - 2) / 4 + 1; i > 0; i--) {
+        siftDown(i - 1);
+    }
+}
+
+// Starting with the first timer's deadline (fire time plus leeway), pull the wake time earlier for every timer that
+// would be lapsed by then and whose own deadline is sooner.  Since a node's fire time is never earlier than its
+// parent's, only the subtrees with fire times before the (shrinking) wake time need to be visited:  with no leeway
+// anywhere that's just the root.
+ESTimeInterval
+ESTimerHeap::wakeTime() {
+    ESAssert(!_timers.empty());
+    ESTimeInterval wake = _timers[0]->_fireTime + _timers[0]->_leeway;
+    if (_timers[0]->_leeway <= 0) {
+        return wake;
+    }
+    size_t n = _timers.size();
+    size_t stack[64 * 3 + 4];  // Depth-first:  at most 3 pending siblings per level, and a 4-ary heap of 2^64 is 32 deep
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        size_t i = stack[--top];
+        const ESTimer *timer = _timers[i];
+        if (timer->_fireTime > wake) {
+            continue;
+        }
+        ESTimeInterval deadline = timer->_fireTime + timer->_leeway;
+        if (deadline < wake) {
+            wake = deadline;
+        }
+        size_t firstChild = 4 * i + 1;
+        for (size_t child = firstChild; child < firstChild + 4 && child < n; child++) {
+            stack[top++] = child;
+        }
+    }
+    return wake;
+}
+
+static ESTimerHeap *timerHeap;
+
+static ESMetricHistogram latenessMetric("timer.lateness", "s", 1e-5, 2);  // From fire time to the timer thread noticing
+static std::vector<ESTimer *> *lapsedTimers;  // Scratch space for fireLapsedTimers(), kept to avoid reallocating
 
 ESTimerThread::ESTimerThread()
 :   ESChildThread("Timer", ESChildThreadExitsOnlyByParentRequest)
+#if ES_TIMER_USE_TIMERFD
+    , _timerFD(-1),
+    _timerClock(CLOCK_BOOTTIME),
+    _armedFireTime(-1)
+#endif
 {
 }
 
+#if ES_TIMER_USE_TIMERFD
+// BOOTTIME keeps counting through suspend, so a deadline armed before a suspend still comes due at the right moment
+// after it; older kernels without BOOTTIME timerfds get MONOTONIC.  Returns false (and we use select() timeouts) if
+// neither works.
+bool
+ESTimerThread::setupTimerFD() {
+    ESAssert(inThisThread());
+    _timerClock = CLOCK_BOOTTIME;
+    _timerFD = timerfd_create(_timerClock, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (_timerFD < 0 && errno == EINVAL) {
+        _timerClock = CLOCK_MONOTONIC;
+        _timerFD = timerfd_create(_timerClock, TFD_NONBLOCK | TFD_CLOEXEC);
+    }
+    if (_timerFD < 0) {
+        ESErrorReporter::logErrorWithCode("ESTimer", errno, strerror_r, "timerfd_create failed, falling back to select() timeouts");
+        return false;
+    }
+    _armedFireTime = -1;
+    return true;
+}
+
+// Set the timerfd for the first timer in the heap, if it isn't already.  The deadline is translated from our time
+// base to the kernel clock once, here, as an absolute integer nanosecond count; the kernel then holds it exactly.
+void
+ESTimerThread::armTimerFD() {
+    ESAssert(inThisThread());
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (timerHeap->empty()) {
+        if (_armedFireTime >= 0) {
+            timerfd_settime(_timerFD, 0, &its, NULL);  // All-zero it_value disarms
+            _armedFireTime = -1;
+        }
+        return;
+    }
+    ESTimeInterval fireTime = timerHeap->wakeTime();
+    if (fireTime == _armedFireTime) {
+        return;
+    }
+    struct timespec kernelNow;
+    clock_gettime(_timerClock, &kernelNow);
+#if ES_SELECT_USES_CONTINUOUS_TIME
+    ESTimeInterval now = ESTime::currentContinuousTime();
+#else
+    ESTimeInterval now = ESTime::currentTime();
+#endif
+    long long deltaNanoseconds = llround((fireTime - now) * 1E9);
+    if (deltaNanoseconds < 1) {
+        deltaNanoseconds = 1;  // Already due; zero would disarm
+    }
+    long long deadline = kernelNow.tv_sec * 1000000000LL + kernelNow.tv_nsec + deltaNanoseconds;
+    its.it_value.tv_sec = deadline / 1000000000LL;
+    its.it_value.tv_nsec = deadline % 1000000000LL;
+    if (timerfd_settime(_timerFD, TFD_TIMER_ABSTIME, &its, NULL) != 0) {
+        ESErrorReporter::logErrorWithCode("ESTimer", errno, strerror_r, "timerfd_settime failed");
+        return;
+    }
+    _armedFireTime = fireTime;
+}
+#endif  // ES_TIMER_USE_TIMERFD
+
+#ifdef ES_TIMER_MEASURE_LATENCY
+static int latencyBatchNumber = 0;  // Timer thread only
+static bool latencyBatchUsesTimerFD = false;  // Timer thread only
+
+static void
+recordFiringLatency(ESTimeInterval latency) {
+    static std::vector<ESTimeInterval> latencies;
+    latencies.push_back(latency);
+    if (latencies.size() < ES_TIMER_LATENCY_BATCH) {
+        return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    size_t n = latencies.size();
+    printf("TIMER LATENCY (%s): %d firings, p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+           latencyBatchUsesTimerFD ? "timerfd" : "select", (int)n,
+           latencies[n / 2] * 1E6, latencies[n * 9 / 10] * 1E6, latencies[n * 99 / 100] * 1E6, latencies[n - 1] * 1E6);
+    latencies.clear();
+    latencyBatchNumber++;
+}
+#endif
+
 void *
 ESTimerThread::main() {
     ESAssert(inThisThread());
-    ESAssert(!timerPriorityQueue);
-    timerPriorityQueue = new TimerPriorityQueue;
+    ESAssert(!timerHeap);
+    timerHeap = new ESTimerHeap;
+    lapsedTimers = new std::vector<ESTimer *>;
     ESTime::registerTimeSyncObserver(new ESTimerThreadTimeObserver(this));
+#ifdef ES_TIMER_CHURN_BENCHMARK
+    runChurnBenchmark();
+#endif
+#ifdef ES_TIMER_CATCH_UP_TEST
+    runCatchUpTest();
+#endif
+#if ES_TIMER_USE_TIMERFD
+    bool useTimerFD = setupTimerFD();
+#ifdef ES_TIMER_MEASURE_LATENCY
+    bool haveTimerFD = useTimerFD;
+#endif
+#endif
     while (1) {
+#ifdef ES_TIMER_MEASURE_LATENCY
+#if ES_TIMER_USE_TIMERFD
+        if (haveTimerFD && useTimerFD != (latencyBatchNumber % 2 == 0)) {
+            useTimerFD = !useTimerFD;
+            _armedFireTime = -1;  // It may have fired (or been passed) while select() timeouts were in use
+        }
+        latencyBatchUsesTimerFD = useTimerFD;
+#endif
+#endif
         fd_set readers;
         FD_ZERO(&readers);
         int highestThreadFD = ESThread::setBitsForSelect(&readers);
         int nfds = highestThreadFD + 1;
         struct timeval *timeout;
         struct timeval tv;
+#if ES_TIMER_USE_TIMERFD
+        if (useTimerFD) {
+            armTimerFD();
+            FD_SET(_timerFD, &readers);
+            if (_timerFD >= nfds) {
+                nfds = _timerFD + 1;
+            }
+            select(nfds, &readers, NULL/*writers*/, NULL, NULL/*timeout:  the timerfd wakes us*/);
+#ifdef ES_TIMER_COUNT_WAKEUPS
+            countWakeup();
+#endif
+            if (FD_ISSET(_timerFD, &readers)) {
+                unsigned long long expirations;
+                if (read(_timerFD, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                    _armedFireTime = -1;  // Fired, so no longer set
+                }
+            }
+            ESThread::processInterThreadMessages(&readers);
+            fireLapsedTimers();
+            continue;
+        }
+#endif
 #undef ES_INSTRUMENT_SELECT_TIMEBASE  // Define this and note what happens during an aSTC event -- one of the two elapsed times will match the requested interval, and one won't
 #ifdef ES_INSTRUMENT_SELECT_TIMEBASE  //  On the iPhone, the elapsed time matches the continuous time and not the system time
         ESTimeInterval startSysTime;
         ESTimeInterval startContTime;
         ESTimeInterval startDelta;
 #endif
-        if (timerPriorityQueue->empty()) {
+        if (timerHeap->empty()) {
             timeout = NULL;  // No timers, so block in select waiting for a call
         } else {
-            ESTimer *timer = *(timerPriorityQueue->begin());
-            ESTimeInterval fireTime = timer->fireTime();
+            ESTimeInterval fireTime = timerHeap->wakeTime();
 #if ES_SELECT_USES_CONTINUOUS_TIME
             ESTimeInterval now = ESTime::currentContinuousTime();
 #else
@@ -146,6 +547,9 @@ ESTimerThread::main() {
 #endif
         }
         select(nfds, &readers, NULL/*writers*/, NULL, timeout);
+#ifdef ES_TIMER_COUNT_WAKEUPS
+        countWakeup();
+#endif
 #ifdef ES_INSTRUMENT_SELECT_TIMEBASE
         if (timeout) {
            printf("...returning from select with timeout.  %.6f system seconds have elapsed (%.6f more than delta); %.6f continuous seconds have elapsed (%.6f more than delta)\n",
@@ -159,36 +563,67 @@ ESTimerThread::main() {
     return NULL;
 }
 
+// Take every lapsed timer off the heap first, then notify them in fire-time order, and only then put the
+// repeating ones back, so a repeat can't be delivered twice in one pass
 void
 ESTimerThread::fireLapsedTimers() {
     ESAssert(inThisThread());
-    TimerPriorityQueue::iterator end = timerPriorityQueue->end();
-    TimerPriorityQueue::iterator iter = timerPriorityQueue->begin();
 #if ES_SELECT_USES_CONTINUOUS_TIME
     ESTimeInterval now = ESTime::currentContinuousTime();
 #else
     ESTimeInterval now = ESTime::currentTime();
 #endif
-    while (iter != end) {
-        ESTimer *timer = *iter;
-        TimerPriorityQueue::iterator next = iter;
-        next++;
-        if (timer->fireTime() < now) {
-            timer->deliverNotification();
-            timerPriorityQueue->erase(iter);
-            if (timer->possiblyRepeat()) {
-                timer->calculateFireTime();
-                //printf("fired timer 0x%08x, repeating, calculating new time and inserting\n", (unsigned int)timer);
-                timerPriorityQueue->insert(timer);                
-            } else {
-                //printf("fired timer 0x%08x, not repeating, deactivating\n", (unsigned int)timer);
-                timer->_activated = false;
+    while (!timerHeap->empty() && timerHeap->top()->fireTime() <= now) {
+        lapsedTimers->push_back(timerHeap->pop());
+    }
+    size_t numLapsed = lapsedTimers->size();
+    if (numLapsed == 0) {
+        return;
+    }
+#ifdef ES_TIMER_COUNT_WAKEUPS
+    numTimerWakeups++;
+#endif
+    ESEventLog::record(ESEventTimerFire, (int)numLapsed, now - (*lapsedTimers)[0]->fireTime());
+    // One batch per notification thread; there are seldom more than a few, so a linear search will do
+    std::vector<std::pair<ESThread *, ESTimerNotificationBatch *> > batches;
+    for (size_t i = 0; i < numLapsed; i++) {
+        ESTimer *timer = (*lapsedTimers)[i];
+        latenessMetric.record(now - timer->fireTime());
+#ifdef ES_TIMER_MEASURE_LATENCY
+        recordFiringLatency(now - timer->fireTime());
+#endif
+        bool sendNotification;
+        bool repeat = timer->repeatAfterLapse(&sendNotification);
+        if (sendNotification) {
+            ESTimerNotificationBatch *batch = NULL;
+            for (size_t b = 0; b < batches.size(); b++) {
+                if (batches[b].first == timer->_notificationThread) {
+                    batch = batches[b].second;
+                    break;
+                }
             }
+            if (!batch) {
+                batch = new ESTimerNotificationBatch;
+                batches.push_back(std::make_pair(timer->_notificationThread, batch));
+            }
+            timer->deliverNotification(batch);
+        }
+        if (repeat) {
+            timer->calculateFireTime();
+            //printf("fired timer 0x%08x, repeating, calculating new time and inserting\n", (unsigned int)timer);
+            timerHeap->insert(timer);
         } else {
-            break;  // Nothing after this could be ready if this one isn't
+            //printf("fired timer 0x%08x, not repeating, deactivating\n", (unsigned int)timer);
+            timer->_activated = false;
         }
-        iter = next;
     }
+    lapsedTimers->clear();
+    for (size_t b = 0; b < batches.size(); b++) {
+        batches[b].first->callInThread(ESTimer::notificationBatchGlue, batches[b].second, NULL);
+    }
+#ifdef ES_TIMER_COUNT_MESSAGES
+    countExpirations((int)numLapsed, (int)batches.size());
+#endif
 }
 
 void 
@@ -198,8 +633,8 @@ ESTimerThread::activate(ESTimer *timer) {
     // Calculate fire time
     timer->calculateFireTime();
 
-    // Add to sorted list
-    timerPriorityQueue->insert(timer);
+    // Add to heap
+    timerHeap->insert(timer);
 
     timer->_activated = true;
     //printf("timer 0x%08x activated\n", (unsigned int)timer);
@@ -208,8 +643,8 @@ ESTimerThread::activate(ESTimer *timer) {
 void 
 ESTimerThread::deactivate(ESTimer *timer) {
     ESAssert(inThisThread());
-    // Remove from list
-    timerPriorityQueue->erase(timer);
+    // Remove from heap
+    timerHeap->remove(timer);
     
     timer->_activated = false;
 }
@@ -258,35 +693,174 @@ ESTimerThread::release(ESTimer *timer,
 void
 ESTimerThread::recalculateAllFireTimes() {
     ESAssert(inThisThread());
-    ESAssert(timerPriorityQueue);
-    TimerPriorityQueue *newQueue = new TimerPriorityQueue;
-    TimerPriorityQueue::iterator end = timerPriorityQueue->end();
-    TimerPriorityQueue::iterator iter = timerPriorityQueue->begin();
-    TimerPriorityQueue::iterator newIter = newQueue->begin();
-    while (iter != end) {
-        ESTimer *timer = *iter;
-        timer->calculateFireTime();
-        newIter = newQueue->insert(newIter, timer);
-        iter++;
-    }
-    delete timerPriorityQueue;
-    timerPriorityQueue = newQueue;
+    ESAssert(timerHeap);
+    size_t numTimers = timerHeap->size();
+    for (size_t i = 0; i < numTimers; i++) {
+        timerHeap->timerAtIndex(i)->calculateFireTime();
+    }
+    timerHeap->rebuild();
+#if ES_TIMER_USE_TIMERFD
+    _armedFireTime = -1;  // The translation to the kernel clock has moved
+#endif
     fireLapsedTimers();
 }
 
+#ifdef ES_TIMER_CHURN_BENCHMARK
+class ESTimerChurnObserver : public ESTimerObserver {
+  public:
+    /*virtual*/ void        notify(ESTimer *timer) {}
+};
+
+// Time the heap operations behind activate, release and repeat for 100,000 interval timers, the way the
+// NTP driver's short and long socket timeouts churn:  most are cancelled before they fire.  The timers
+// are never delivered, so this measures only the timer thread's bookkeeping.
+void
+ESTimerThread::runChurnBenchmark() {
+    ESAssert(inThisThread());
+    const int numTimers = 100000;
+    ESTimerChurnObserver observer;
+    std::vector<ESTimer *> timers;
+    timers.reserve(numTimers);
+    ESTimeInterval now = ESTime::currentContinuousTime();
+    for (int i = 0; i < numTimers; i++) {
+        timers.push_back(new ESIntervalTimer(&observer, 1000 + (i * 7919 % numTimers) / 1000.0, now));
+    }
+    ESTimeInterval startTime = ESTime::currentContinuousTime();
+    for (int i = 0; i < numTimers; i++) {
+        timers[i]->calculateFireTime();
+        timerHeap->insert(timers[i]);
+    }
+    ESTimeInterval insertTime = ESTime::currentContinuousTime();
+    for (int i = 0; i < numTimers; i += 2) {  // Cancel half, from the middle of the heap
+        timerHeap->remove(timers[i]);
+    }
+    ESTimeInterval removeTime = ESTime::currentContinuousTime();
+    while (!timerHeap->empty()) {  // Expire the rest in order
+        timerHeap->pop();
+    }
+    ESTimeInterval popTime = ESTime::currentContinuousTime();
+    printf("TIMER CHURN: %d timers: insert %.1f ns, cancel %.1f ns, expire %.1f ns each\n",
+           numTimers,
+           (insertTime - startTime) * 1e9 / numTimers,
+           (removeTime - insertTime) * 1e9 / (numTimers / 2),
+           (popTime - removeTime) * 1e9 / (numTimers / 2));
+#ifndef NDEBUG
+    inReleaseDelete = true;
+#endif
+    for (int i = 0; i < numTimers; i++) {
+        delete timers[i];
+    }
+#ifndef NDEBUG
+    inReleaseDelete = false;
+#endif
+}
+#endif  // ES_TIMER_CHURN_BENCHMARK
+
+#ifdef ES_TIMER_CATCH_UP_TEST
+class ESTimerCatchUpObserver : public ESTimerObserver {
+  public:
+    /*virtual*/ void        notify(ESTimer *timer) {}
+};
+
+// Put a 1 Hz interval timer four hours behind, as if the device had just woken, and run it through the lapse
+// logic fireLapsedTimers() uses until it's caught up, for each policy.  Nothing is actually delivered.
+void
+ESTimerThread::runCatchUpTest() {
+    ESAssert(inThisThread());
+    const ESTimeInterval suspendTime = 4 * 3600;
+    ESTimerCatchUpObserver observer;
+    ESTimerCatchUpPolicy policies[] = { ESTimerCatchUpCoalesce, ESTimerCatchUpSkip, ESTimerCatchUpBurst };
+    const char *policyNames[] = { "coalesce", "skip", "burst" };
+    for (int p = 0; p < 3; p++) {
+        ESTimeInterval now = ESTime::currentContinuousTime();
+        ESTimer *timer = new ESIntervalTimer(&observer, 1.0, now - suspendTime, 1.0/*repeatEverySeconds*/);
+        timer->setCatchUpPolicy(policies[p]);
+        int numNotifications = 0;
+        int numMissed = 0;
+        int numPasses = 0;
+        while (timer->_atTime <= now) {
+            bool sendNotification;
+            bool repeat = timer->repeatAfterLapse(&sendNotification);
+            ESAssert(repeat);
+            if (sendNotification) {
+                numNotifications++;
+                numMissed += timer->_missedPeriods;
+            }
+            numPasses++;
+        }
+        printf("TIMER CATCH-UP (%s): %d passes, %d notifications, %d periods reported missed, next fire %.3f s from now\n",
+               policyNames[p], numPasses, numNotifications, numMissed, timer->_atTime - now);
+        ESAssert(policies[p] == ESTimerCatchUpBurst || numPasses == 1);
+        ESAssert(policies[p] != ESTimerCatchUpCoalesce || (numNotifications == 1 && numMissed >= suspendTime - 2));
+        ESAssert(policies[p] != ESTimerCatchUpSkip || numNotifications == 0);
+        ESAssert(timer->_atTime > now && timer->_atTime <= now + 1.0);
+#ifndef NDEBUG
+        inReleaseDelete = true;
+#endif
+        delete timer;
+#ifndef NDEBUG
+        inReleaseDelete = false;
+#endif
+    }
+
+    // A 10 Hz timer aligned to half seconds fires only every fifth period.  Handled just after its aligned fire time
+    // it has missed nothing, and must not be reported (or, under the skip policy, dropped) as having missed the four
+    // periods alignment folded into it; handled a quarter second after that, it has missed two.
+    const ESTimeInterval period = 0.1;
+    const ESTimeInterval alignment = 0.5;
+    ESTimeInterval latenesses[] = { 0.001, 0.25 };
+    int expectedMissed[] = { 0, 2 };
+    for (int l = 0; l < 2; l++) {
+        for (int p = 0; p < 2; p++) {  // Coalesce and skip; burst doesn't look at lateness
+            ESTimeInterval now = ESTime::currentContinuousTime();
+            ESTimeInterval alignedFireTime = ceil(now / alignment) * alignment;
+            usleep((useconds_t)((alignedFireTime + latenesses[l] - now) * 1e6));
+            now = ESTime::currentContinuousTime();
+            ESTimer *timer = new ESIntervalTimer(&observer, 0, alignedFireTime - alignment + period / 2, period);
+            timer->setAlignment(alignment);
+            timer->setCatchUpPolicy(policies[p]);
+            ESAssert(fabs(timer->alignedAtTime(timer->_atTime) - alignedFireTime) < 1e-6);
+            bool sendNotification;
+            bool repeat = timer->repeatAfterLapse(&sendNotification);
+            ESAssert(repeat);
+            printf("TIMER CATCH-UP (%s, alignment %.1f > period %.1f, %.3f s late): %d periods reported missed, %s, next fire %.3f s from now\n",
+                   policyNames[p], alignment, period, now - alignedFireTime, timer->_missedPeriods,
+                   sendNotification ? "delivered" : "dropped", timer->_atTime - now);
+            ESAssert(timer->_missedPeriods == expectedMissed[l]);
+            ESAssert(sendNotification == (expectedMissed[l] == 0 || policies[p] != ESTimerCatchUpSkip));
+            ESAssert(timer->_atTime > now && timer->_atTime <= now + period);
+#ifndef NDEBUG
+            inReleaseDelete = true;
+#endif
+            delete timer;
+#ifndef NDEBUG
+            inReleaseDelete = false;
+#endif
+        }
+    }
+}
+#endif  // ES_TIMER_CATCH_UP_TEST
+
 //////////// ESTimer
 
 ESTimer::ESTimer(ESTimerObserver *observer,
                  ESTimeInterval  atTime,
                  bool            useContinuousTime)
-:   _observer(observer),
-    _atTime(atTime),
+:   _atTime(atTime),
     _useContinuousTime(useContinuousTime),
+    _observer(observer),
     _notificationThread(NULL),
-    _releasePending(false),
     _activated(false),
+    _releasePending(false),
+    _leeway(0),
+    _alignment(0),
+    _catchUpPolicy(ESTimerCatchUpCoalesce),
+    _missedPeriods(0),
+    _missedPeriodsDelivered(0),
     _notificationsSent(0),
-    _notificationsReceived(0)
+    _notificationsReceived(0),
+    _heapIndex(-1),
+    _heapSequence(0)
 {
     tracePrintf1("Ctor of ESTimer 0x%08x:\n", (unsigned long int)this);
     //printf("%s\n",ESUtil::stackTrace().c_str());
@@ -320,12 +894,19 @@ ESTimer::calculateFireTime() {
         _fireTime = ESTime::cTimeForNTPTime(_atTime);
         //printf("atTime %.4f _fireTime %.4f\n", _atTime, _fireTime);
     }
+    if (_alignment > 0) {
+        _fireTime = ceil(_fireTime / _alignment) * _alignment;
+    }
 #else
     if (_useContinuousTime) {
         _fireTime = ESTime::ntpTimeForCTime(_atTime);
     } else {
         _fireTime = _atTime;
     }
+    if (_alignment > 0) {  // Alignment is in continuous time, so go there and back
+        ESTimeInterval cTime = ESTime::cTimeForNTPTime(_fireTime);
+        _fireTime += ceil(cTime / _alignment) * _alignment - cTime;
+    }
 #endif    
 }
 
@@ -348,10 +929,9 @@ ESTimer::shutdown() {  // Called by ESTime::shutdown
     timerThread->requestExitAndWaitForJoin();
     timerThread = NULL;
 
-    TimerPriorityQueue::iterator end = timerPriorityQueue->end();
-    TimerPriorityQueue::iterator iter = timerPriorityQueue->begin();
-    while (iter != end) {
-        ESTimer *timer = *iter;
+    while (!timerHeap->empty()) {
+        ESTimer *timer = timerHeap->pop();
+        timer->_activated = false;
 #ifndef NDEBUG
         inReleaseDelete = true;
 #endif
@@ -361,8 +941,10 @@ ESTimer::shutdown() {  // Called by ESTime::shutdown
 #endif
     }
 
-    delete timerPriorityQueue;
-    timerPriorityQueue = NULL;
+    delete timerHeap;
+    timerHeap = NULL;
+    delete lapsedTimers;
+    lapsedTimers = NULL;
 }
 
 void 
@@ -384,6 +966,30 @@ static void releaseGlue(void *obj,
     timerThread->release((ESTimer *)obj, (int)notificationsReceivedAtTimeOfRequest);
 }
 
+static void releaseBatchGlue(void *obj,
+                             void *param) {
+    ESTimerReleaseBatch *batch = (ESTimerReleaseBatch *)obj;
+    size_t numRequests = batch->requests.size();
+    for (size_t i = 0; i < numRequests; i++) {  // In order, so a stale request for a timer is refused before a current one deletes it
+        timerThread->release(batch->requests[i].first, batch->requests[i].second);
+    }
+    delete batch;
+}
+
+void
+ESTimer::requestRelease() {
+    pthread_once(&releaseBatchKeyOnce, makeReleaseBatchKey);
+    ESTimerReleaseBatch *releaseBatch = (ESTimerReleaseBatch *)pthread_getspecific(releaseBatchKey);
+    if (releaseBatch) {
+        releaseBatch->requests.push_back(std::make_pair(this, _notificationsReceived));
+    } else {
+#ifdef ES_TIMER_COUNT_MESSAGES
+        __sync_fetch_and_add(&numReleaseMessages, 1);
+#endif
+        timerThread->callInThread(releaseGlue, this, (void*)(long)_notificationsReceived);
+    }
+}
+
 void 
 ESTimer::release() {  // Call this in place of 'delete timer' when you want to destroy it
     ESAssert(!_releasePending);  // Don't call release() more than once
@@ -394,9 +1000,9 @@ ESTimer::release() {  // Call this in place of 'delete timer' when you want to d
         // Never activated: Just delete it
     }
     ESAssert(timerThread);  // Don't release any timers before activating the first one to create the thread (this could be rewritten to just call 'delete this' if we really need it)
-    timerThread->callInThread(releaseGlue, this, (void*)(long)_notificationsReceived);
+    requestRelease();
 
-    // Nothing should happen after the callInThread above, because
+    // Nothing should happen after the requestRelease above, because
     // after that call there is no guarantee that the object exists
     // any more
 }
@@ -410,30 +1016,98 @@ ESTimer::releasePending() {  // Only guaranteed in notification thread after act
 }
 
 void
-ESTimer::receiveNotificationMessage(ESTimerObserver *observer) {
+ESTimer::receiveNotificationMessage(ESTimerObserver *observer,
+                                    int             missedPeriods) {
     ESAssert(_notificationThread);  // Because it should have been set when we activated this timer
     ESAssert(_notificationThread->inThisThread());
     _notificationsReceived++;
     if (releasePending()) {  // We need to resend the release request because the first one will have been sent with too small a _notificationsReceived
-        timerThread->callInThread(releaseGlue, this, (void*)(long)_notificationsReceived);
+        requestRelease();
     } else {
+        _missedPeriodsDelivered = missedPeriods;
         observer->notify(this);
+        _missedPeriodsDelivered = 0;
     }
 }
 
+// Deliver each notification in the batch, holding any release requests the observers make until the
+// end so they go back to the timer thread together
 /*static*/ void
-ESTimer::notificationGlue(void *obj,
-                          void *param) {
-    ((ESTimer *)obj)->receiveNotificationMessage((ESTimerObserver *)param);
+ESTimer::notificationBatchGlue(void *obj,
+                               void *param) {
+    ESTimerNotificationBatch *batch = (ESTimerNotificationBatch *)obj;
+    pthread_once(&releaseBatchKeyOnce, makeReleaseBatchKey);
+    ESTimerReleaseBatch *outerReleaseBatch = (ESTimerReleaseBatch *)pthread_getspecific(releaseBatchKey);  // In case an observer runs a nested message loop
+    ESTimerReleaseBatch *releaseBatch = new ESTimerReleaseBatch;
+    pthread_setspecific(releaseBatchKey, releaseBatch);
+    size_t numNotifications = batch->notifications.size();
+    for (size_t i = 0; i < numNotifications; i++) {
+        const ESTimerNotification &notification = batch->notifications[i];
+        notification.timer->receiveNotificationMessage(notification.observer, notification.missedPeriods);
+    }
+    pthread_setspecific(releaseBatchKey, outerReleaseBatch);
+    delete batch;
+    if (releaseBatch->requests.empty()) {
+        delete releaseBatch;
+    } else {
+#ifdef ES_TIMER_COUNT_MESSAGES
+        __sync_fetch_and_add(&numReleaseMessages, 1);
+#endif
+        timerThread->callInThread(releaseBatchGlue, releaseBatch, NULL);
+    }
 }
 
+// Count the notification and add it to the batch for the timer's thread; fireLapsedTimers() sends the batch
 void 
-ESTimer::deliverNotification() {
+ESTimer::deliverNotification(ESTimerNotificationBatch *batch) {
     ESAssert(timerThread);  // Because it should have been created when we activated the first timer
     ESAssert(timerThread->inThisThread());
     ESAssert(_notificationThread);  // Because it should have been set when we activated this timer
     _notificationsSent++;
-    _notificationThread->callInThread(notificationGlue, this, _observer);
+    ESTimerNotification notification;
+    notification.timer = this;
+    notification.observer = _observer;
+    notification.missedPeriods = _missedPeriods;
+    batch->notifications.push_back(notification);
+}
+
+// The timer has lapsed:  set it up for its next firing, if any, and say whether this one should be delivered at
+// all (a timer skipping its missed periods doesn't deliver the stale one either)
+bool
+ESTimer::repeatAfterLapse(bool *sendNotification) {
+    ESAssert(timerThread);
+    ESAssert(timerThread->inThisThread());
+    _missedPeriods = 0;
+    bool repeat = possiblyRepeat();
+    *sendNotification = _missedPeriods == 0 || _catchUpPolicy != ESTimerCatchUpSkip;
+    return repeat;
+}
+
+ESTimeInterval
+ESTimer::alignedAtTime(ESTimeInterval atTime) {
+    if (_alignment <= 0) {
+        return atTime;
+    }
+    ESTimeInterval cTime = _useContinuousTime ? atTime : ESTime::cTimeForNTPTime(atTime);
+    return atTime + ceil(cTime / _alignment) * _alignment - cTime;
+}
+
+void
+ESTimer::advanceByPeriod(ESTimeInterval period) {
+    ESTimeInterval lapsedAt = alignedAtTime(_atTime);  // When the firing we're handling was actually due
+    _atTime += period;
+    if (_catchUpPolicy == ESTimerCatchUpBurst) {
+        return;
+    }
+    ESTimeInterval now = _useContinuousTime ? ESTime::currentContinuousTime() : ESTime::currentTime();
+    if (_atTime <= now) {
+        int periodsBehind = (int)floor((now - _atTime) / period) + 1;
+        _atTime += periodsBehind * period;
+        // Only lateness past the aligned due time counts:  with an alignment longer than the period, the periods
+        // alignment folds into an on-time firing weren't missed
+        ESTimeInterval lateness = now - lapsedAt;
+        _missedPeriods = lateness > 0 ? (int)floor(lateness / period) : 0;
+    }
 }
 
 ESTimeInterval
@@ -459,7 +1133,7 @@ ESIntervalTimer::~ESIntervalTimer()
 /*virtual*/ bool
 ESIntervalTimer::possiblyRepeat() {
     if (_repeatEverySeconds) {
-        _atTime += _repeatEverySeconds;  // FIX: Find the next such time that's after this instant
+        advanceByPeriod(_repeatEverySeconds);
         return true;
     }
     return false;
@@ -482,7 +1156,7 @@ ESAbsoluteTimer::~ESAbsoluteTimer()
 /*virtual*/ bool
 ESAbsoluteTimer::possiblyRepeat() {
     if (_repeatEverySeconds) {
-        _atTime += _repeatEverySeconds;  // FIX: Find the next such time that's after this instant
+        advanceByPeriod(_repeatEverySeconds);
         return true;
     }
     return false;
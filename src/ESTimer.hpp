@@ -47,6 +47,15 @@
 // even save a few lines by deriving from ESAbsoluteTimer directly.
 
 class ESTimer;
+struct ESTimerNotificationBatch;
+
+// What a repeating timer does when it finds, on firing, that it has fallen more than a whole period behind
+// (because the device slept, or the synchronized time jumped ahead)
+enum ESTimerCatchUpPolicy {
+    ESTimerCatchUpCoalesce,  // Send one notification and resume at the next period in the future; missedPeriods() says how many were skipped
+    ESTimerCatchUpSkip,      // Resume at the next period in the future without sending a notification for the stale one
+    ESTimerCatchUpBurst      // Send a notification for every period missed, one per pass of the timer thread
+};
 
 /* Abstract observer base class -- derive from this to be notified of a timer firing. */
 class ESTimerObserver {
@@ -67,6 +76,13 @@ class ESTimer {
     void                    setInfo(void *info) { _info = info; }
     void                    *info() const { return _info; }
 
+    // Call these (if at all) before activate().  Both let the timer thread wake once for several timers.
+    void                    setLeeway(ESTimeInterval leeway) { _leeway = leeway; }  // The notification may be sent up to this much after the fire time
+    void                    setAlignment(ESTimeInterval period) { _alignment = period; }  // Fire (and repeat) only at multiples of this much continuous time, rounding later
+    void                    setCatchUpPolicy(ESTimerCatchUpPolicy policy) { _catchUpPolicy = policy; }  // Default is ESTimerCatchUpCoalesce
+
+    int                     missedPeriods() const { return _missedPeriodsDelivered; }  // Only valid during notify(): periods skipped just before this notification
+
     static void             init();  // Called by ESTime::init -- make sure it happens before any timers are activated in non-main thread
     static void             shutdown();  // Called, in Android, when switching away from watch face
 
@@ -81,30 +97,45 @@ class ESTimer {
     // It is called in the special ESTimerThread, not in the main thread or the notificationThread.
     virtual bool            possiblyRepeat() = 0;
 
+    // For possiblyRepeat() implementations with a fixed period:  sets _atTime to the next period, or, if that's
+    // already past, to the next one in the future according to the catch-up policy
+    void                    advanceByPeriod(ESTimeInterval period);
+
     ESTimeInterval          _atTime;
     bool                    _useContinuousTime;
 
   private:
-    void                    deliverNotification();
+    void                    deliverNotification(ESTimerNotificationBatch *batch);
+    bool                    repeatAfterLapse(bool *sendNotification);
     void                    calculateFireTime();
+    ESTimeInterval          alignedAtTime(ESTimeInterval atTime);  // When a firing due at atTime happens once alignment defers it, in atTime's time base
     ESTimeInterval          fireTime();
     bool                    releasePending();  // Only guaranteed in notification thread after activation
-    void                    receiveNotificationMessage(ESTimerObserver *observer);
+    void                    receiveNotificationMessage(ESTimerObserver *observer,
+                                                       int             missedPeriods);
+    void                    requestRelease();  // Send (or, while delivering a batch, queue) a release request to the timer thread
 
-    static void             notificationGlue(void *obj,
-                                             void *param);
+    static void             notificationBatchGlue(void *obj,
+                                                  void *param);
 
     ESTimerObserver         *_observer;
     ESThread                *_notificationThread;
     bool                    _activated;  // Don't try to use this outside the timer thread
     bool                    _releasePending;  // Dont' try to use this outside the notification thread
     ESTimeInterval          _fireTime;
+    ESTimeInterval          _leeway;
+    ESTimeInterval          _alignment;
+    ESTimerCatchUpPolicy    _catchUpPolicy;
+    int                     _missedPeriods;  // Set by advanceByPeriod() in the timer thread
+    int                     _missedPeriodsDelivered;  // Notification thread's copy, for missedPeriods()
     void                    *_info;
     int                     _notificationsSent;
     int                     _notificationsReceived;
+    int                     _heapIndex;  // Our slot in the timer thread's heap, or -1 if not there; timer thread only
+    unsigned long long      _heapSequence;  // Orders timers with the same fire time by when they were (re)inserted
 
 friend class ESTimerThread;
-friend class ESltTimer;
+friend class ESTimerHeap;
 };
 
 /* Deliver a message to the observer after the given interval has passed. */
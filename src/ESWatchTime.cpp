@@ -583,6 +583,53 @@ ESWatchTime::isDSTUsingEnv(ESTimeEnvironment *env) {
     return ESCalendar_isDSTAtTimeInterval(env->estz(), t);
 }
 
+// All of the above for one instant, from one time read and one calendar decomposition
+void
+ESWatchTime::snapshotUsingEnv(ESTimeEnvironment   *env,
+                              ESWatchTimeSnapshot *snapshot) {
+    ESTimeInterval now = currentTime();
+    snapshot->time = now;
+
+    // Time of day, as secondsSinceMidnight{Number,Value}UsingEnv, which count elapsed seconds (so a DST day has 23 or 25
+    // hours).  Both cached lookups, but done separately as there, since the returned midnight rounds differently.
+    double floorNow = floor(now);
+    int secondsNumber = (int)(floorNow - env->midnightForTimeInterval(floorNow));
+    double secondsValue = now - env->midnightForTimeInterval(now);
+    snapshot->secondsSinceMidnightNumber = secondsNumber;
+    snapshot->secondsSinceMidnightValue = secondsValue;
+    snapshot->secondNumber = secondsNumber % 60;
+    snapshot->secondValue = ESUtil::fmod(secondsValue, 60);
+    snapshot->minuteNumber = (secondsNumber / 60) % 60;
+    snapshot->minuteValue = ESUtil::fmod(secondsValue / 60, 60);
+    snapshot->hour12Number = (secondsNumber / 3600) % 12;
+    snapshot->hour12Value = ESUtil::fmod(secondsValue / 3600, 12);
+    snapshot->hour24Number = (secondsNumber / 3600) % 24;
+    snapshot->hour24Value = ESUtil::fmod(secondsValue / 3600, 24);
+
+    // Date, from the one decomposition
+    ESDateComponents cs;
+    ESCalendar_localDateComponentsFromTimeInterval(now, env->estz(), &cs);
+    snapshot->dayNumber = cs.day - 1;
+    snapshot->dayValue = cs.day - 1.0 + cs.hour / 24.0 + cs.minute / (60.0 * 24.0) + cs.seconds / (3600.0 * 24.0);
+    snapshot->monthNumber = cs.month - 1;
+    snapshot->monthValue = (cs.month - 1.0) + snapshot->dayValue / calcDaysInMonth(cs.month, cs.year, cs.era, env->estz());
+    snapshot->yearNumber = cs.year;
+    snapshot->eraNumber = cs.era;
+
+    // Weekday and DST, as weekday{Number,Value}UsingEnv and isDSTUsingEnv but at this same instant
+    snapshot->tzOffset = ESCalendar_tzOffsetForTimeInterval(env->estz(), now);
+    double weekday = ESUtil::fmod((now + snapshot->tzOffset) / (24 * 3600) + 1, 7);
+    snapshot->weekdayNumber = (int)floor(weekday);
+    snapshot->weekdayValue = weekday;
+    double dstTime = now;
+    if (_warp > 0) {
+        dstTime += 1.0;  // As isDSTUsingEnv
+    } else if (_warp < 0) {
+        dstTime -= 1.0;
+    }
+    snapshot->isDST = ESCalendar_isDSTAtTimeInterval(env->estz(), dstTime);
+}
+
 //extern void printADate(ESTimeInterval dt);  // Wrong prototype
 
 ESTimeInterval
@@ -1681,31 +1728,92 @@ ESWatchTime::retreatToQuarterHourUsingEnv(ESTimeEnvironment *env) {
 // Note: The following routine adds one to the returned month and day, for readability
 std::string
 ESWatchTime::dumpAllUsingEnv(ESTimeEnvironment *env) {
-    // Temporarily stop the watch so the values are consistent, then restore when we're done
-    double oldWarp = _warp;
-    double oldTimeAtCorrectedZero = _ourTimeAtCorrectedZero;
-    _ourTimeAtCorrectedZero = currentTime();
-    _warp = 0.0;
+    // One snapshot, so the values are consistent
+    ESWatchTimeSnapshot snap;
+    snapshotUsingEnv(env, &snap);
     const char *days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
-    const std::string &returnString = ESUtil::stringWithFormat("Watch time Numbers:\n  %d/%02d/%02d %02d:%02d:%02d %s\nWatch time Values:\n   year: %5d\n  month: %10.4f\n    day: %10.4f\n hour24: %10.4f\n hour12: %10.4f\n minute: %10.4f\n second: %10.4f\nWeekday: %10.4f\n",
-                                                               yearNumberUsingEnv(env),
-                                                               monthNumberUsingEnv(env) + 1,
-                                                               dayNumberUsingEnv(env) + 1,
-                                                               hour24NumberUsingEnv(env),
-                                                               minuteNumberUsingEnv(env),
-                                                               secondNumberUsingEnv(env),
-                                                               days[weekdayNumberUsingEnv(env)],
-                                                               yearNumberUsingEnv(env),
-                                                               monthValueUsingEnv(env) + 1.0,
-                                                               dayValueUsingEnv(env) + 1.0,
-                                                               hour24ValueUsingEnv(env),
-                                                               hour12ValueUsingEnv(env),
-                                                               minuteValueUsingEnv(env),
-                                                               secondValueUsingEnv(env),
-                                                               weekdayValueUsingEnv(env)
+    return ESUtil::stringWithFormat("Watch time Numbers:\n  %d/%02d/%02d %02d:%02d:%02d %s\nWatch time Values:\n   year: %5d\n  month: %10.4f\n    day: %10.4f\n hour24: %10.4f\n hour12: %10.4f\n minute: %10.4f\n second: %10.4f\nWeekday: %10.4f\n",
+                                    snap.yearNumber,
+                                    snap.monthNumber + 1,
+                                    snap.dayNumber + 1,
+                                    snap.hour24Number,
+                                    snap.minuteNumber,
+                                    snap.secondNumber,
+                                    days[snap.weekdayNumber],
+                                    snap.yearNumber,
+                                    snap.monthValue + 1.0,
+                                    snap.dayValue + 1.0,
+                                    snap.hour24Value,
+                                    snap.hour12Value,
+                                    snap.minuteValue,
+                                    snap.secondValue,
+                                    snap.weekdayValue
 			      );
-    _warp = oldWarp;
-    _ourTimeAtCorrectedZero = oldTimeAtCorrectedZero;
-    return returnString;
 }
 
+
+#ifdef ESWATCHTIME_SNAPSHOT_TEST
+#include <stdio.h>
+
+// Compares snapshotUsingEnv() against the getters at many instants over several years (so across DST changes and
+// month and year boundaries), then times one frame's worth of hands (ten values) both ways
+void
+ESTestWatchTimeSnapshot(ESTimeEnvironment *env) {
+    ESWatchTime watchTime;
+    ESWatchTimeSnapshot snap;
+    int numChecked = 0;
+    int numMismatches = 0;
+    for (ESTimeInterval t = 1.7; t < 10 * 366 * 86400.0; t += 3571.3) {  // Not a divisor of anything interesting
+        watchTime.setToFrozenDateInterval(t);
+        watchTime.snapshotUsingEnv(env, &snap);
+        if (snap.time != t ||
+            snap.tzOffset != watchTime.tzOffsetUsingEnv(env) ||
+            snap.secondsSinceMidnightNumber != watchTime.secondsSinceMidnightNumberUsingEnv(env) ||
+            snap.secondsSinceMidnightValue != watchTime.secondsSinceMidnightValueUsingEnv(env) ||
+            snap.secondNumber != watchTime.secondNumberUsingEnv(env) ||
+            snap.secondValue != watchTime.secondValueUsingEnv(env) ||
+            snap.minuteNumber != watchTime.minuteNumberUsingEnv(env) ||
+            snap.minuteValue != watchTime.minuteValueUsingEnv(env) ||
+            snap.hour12Number != watchTime.hour12NumberUsingEnv(env) ||
+            snap.hour12Value != watchTime.hour12ValueUsingEnv(env) ||
+            snap.hour24Number != watchTime.hour24NumberUsingEnv(env) ||
+            snap.hour24Value != watchTime.hour24ValueUsingEnv(env) ||
+            snap.dayNumber != watchTime.dayNumberUsingEnv(env) ||
+            snap.dayValue != watchTime.dayValueUsingEnv(env) ||
+            snap.monthNumber != watchTime.monthNumberUsingEnv(env) ||
+            snap.monthValue != watchTime.monthValueUsingEnv(env) ||
+            snap.yearNumber != watchTime.yearNumberUsingEnv(env) ||
+            snap.eraNumber != watchTime.eraNumberUsingEnv(env) ||
+            snap.weekdayNumber != watchTime.weekdayNumberUsingEnv(env) ||
+            snap.weekdayValue != watchTime.weekdayValueUsingEnv(env) ||
+            snap.isDST != watchTime.isDSTUsingEnv(env)) {
+            if (numMismatches++ < 10) {
+                ESErrorReporter::logError("ESTestWatchTimeSnapshot", "Mismatch at %.1f:\n%s", t, watchTime.dumpAllUsingEnv(env).c_str());
+            }
+        }
+        numChecked++;
+    }
+    printf("WATCHTIME SNAPSHOT TEST: %d instants, %d mismatches\n", numChecked, numMismatches);
+
+    // A running, unlatched watch, as a face that doesn't latch would draw it
+    watchTime.resetToLocal();
+    const int numFrames = 100000;
+    double sum = 0;
+    ESTimeInterval t0 = ESTime::currentContinuousTime();
+    for (int i = 0; i < numFrames; i++) {
+        sum += watchTime.secondValueUsingEnv(env) + watchTime.minuteValueUsingEnv(env) + watchTime.hour12ValueUsingEnv(env) +
+            watchTime.hour24ValueUsingEnv(env) + watchTime.dayValueUsingEnv(env) + watchTime.monthValueUsingEnv(env) +
+            watchTime.yearNumberUsingEnv(env) + watchTime.weekdayValueUsingEnv(env) + watchTime.isDSTUsingEnv(env) +
+            watchTime.eraNumberUsingEnv(env);
+    }
+    ESTimeInterval t1 = ESTime::currentContinuousTime();
+    for (int i = 0; i < numFrames; i++) {
+        watchTime.snapshotUsingEnv(env, &snap);
+        sum += snap.secondValue + snap.minuteValue + snap.hour12Value + snap.hour24Value + snap.dayValue + snap.monthValue +
+            snap.yearNumber + snap.weekdayValue + snap.isDST + snap.eraNumber;
+    }
+    ESTimeInterval t2 = ESTime::currentContinuousTime();
+    printf("WATCHTIME SNAPSHOT TEST: per frame, ten getters %.0f ns, one snapshot %.0f ns (%g)\n",
+           (t1 - t0) * 1e9 / numFrames, (t2 - t1) * 1e9 / numFrames, sum);
+}
+#endif  // ESWATCHTIME_SNAPSHOT_TEST
@@ -41,6 +41,36 @@ typedef enum _ESWatchTimeCycle {
 class ESTimeEnvironment;
 ES_OPAQUE_OBJC(NSDate);
 
+// Define this to check snapshotUsingEnv() against the individual getters, and to time a frame's worth of each, in
+// ESTestWatchTimeSnapshot() (which the app must call, with an environment, since there's no natural place to here)
+#undef ESWATCHTIME_SNAPSHOT_TEST
+
+// Every watch-hand and dial value below for a single instant, as filled in by ESWatchTime::snapshotUsingEnv().
+// Each field is exactly what the corresponding *UsingEnv getter returns at that instant.
+struct ESWatchTimeSnapshot {
+    ESTimeInterval          time;                       // currentTime(), latched if the watch is latched
+    ESTimeInterval          tzOffset;                   // tzOffsetUsingEnv()
+    int                     secondsSinceMidnightNumber;
+    double                  secondsSinceMidnightValue;
+    int                     secondNumber;
+    double                  secondValue;
+    int                     minuteNumber;
+    double                  minuteValue;
+    int                     hour12Number;
+    double                  hour12Value;
+    int                     hour24Number;
+    double                  hour24Value;
+    int                     dayNumber;                  // March 1 => 0
+    double                  dayValue;
+    int                     monthNumber;                // March => 2
+    double                  monthValue;
+    int                     yearNumber;
+    int                     eraNumber;
+    int                     weekdayNumber;              // Sunday => 0
+    double                  weekdayValue;
+    bool                    isDST;
+};
+
 // The primary keeper of time in all apps except Chronometer, which uses its own variant.
 class ESWatchTime {
   public:
@@ -74,6 +104,12 @@ class ESWatchTime {
 // Methods useful for watch hands and moving dials:
 // *****************
 
+// All of the values below (except those about years, weeks and DST changes) at once, from a single read of the
+// time and a single calendar decomposition, so that every hand drawn in a frame agrees.  Much cheaper than calling
+// the getters one by one when drawing more than one or two hands.
+    void                    snapshotUsingEnv(ESTimeEnvironment   *env,
+                                             ESWatchTimeSnapshot *snapshot);
+
 // 12:35:45.9 => 45
     int                     secondNumberUsingEnv(ESTimeEnvironment *env);
 
@@ -392,4 +428,8 @@ class ESWatchTime {
 
 };
 
+#ifdef ESWATCHTIME_SNAPSHOT_TEST
+extern void ESTestWatchTimeSnapshot(ESTimeEnvironment *env);
+#endif
+
 #endif  // _ESWATCHTIME_HPP_